@@ -404,6 +404,10 @@ void StreamConfigDialog::storeProtocolWidgets()
         w->storeWidget(p);
     }
     delete iter;
+
+    // storeWidget() sets the fields directly, so the stream can't know if
+    // any protocol size changed
+    mpStream->invalidateFrameLayout();
 }
 
 void StreamConfigDialog::on_cmbPktLenMode_currentIndexChanged(QString mode)
@@ -19,12 +19,15 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "abstractprotocol.h" 
 
+#include "checksum.h"
+
 #include "protocollistiterator.h"
 #include "streambase.h"
 
 #include "bswap.h"
 
 #include <qendian.h>
+#include <string.h>
 
 #if 0
 #ifdef qDebug
@@ -355,6 +358,9 @@ QVariant AbstractProtocol::fieldData(int index, FieldAttrib attrib,
   The default implementation always returns false. Subclasses should 
   reimplement this method. See SampleProtocol for an example.
 
+  If the change may change the protocol's size, the caller needs to call
+  StreamBase::invalidateFrameLayout() after setting the field(s)
+
 */
 bool AbstractProtocol::setFieldData(int /*index*/, const QVariant& /*value*/,
         FieldAttrib /*attrib*/)
@@ -516,7 +522,6 @@ quint32 AbstractProtocol::payloadProtocolId(ProtocolIdType type) const
     else
         id = 0xFFFFFFFF;
 
-    qDebug("%s: payloadProtocolId = 0x%x", __FUNCTION__, id);
     return id;
 }
 
@@ -544,7 +549,6 @@ int AbstractProtocol::protocolFrameSize(int streamIndex) const
         protoSize = (bitsize+7)/8;
     }
 
-    qDebug("%s: protoSize = %d", __FUNCTION__, protoSize);
     return protoSize;
 }
 
@@ -554,11 +558,19 @@ int AbstractProtocol::protocolFrameSize(int streamIndex) const
   This method is useful only for "padding" protocols i.e. protocols which
   fill up the remaining space for the user defined packet size e.g. the 
   PatternPayload protocol
+
+  The offset of a top-level protocol is looked up from the stream's frame
+  layout cache, if available (see StreamBase::protocolFrameLayout())
 */
 int AbstractProtocol::protocolFrameOffset(int streamIndex) const
 {
-    int size = 0;
+    int size = 0, payloadSize;
     AbstractProtocol *p = prev;
+
+    if (!parent && mpStream && mpStream->protocolFrameLayout(this,
+                streamIndex, size, payloadSize))
+        return size;
+
     while (p)
     {
         size += p->protocolFrameSize(streamIndex);
@@ -568,7 +580,6 @@ int AbstractProtocol::protocolFrameOffset(int streamIndex) const
     if (parent)
         size += parent->protocolFrameOffset(streamIndex);
 
-    qDebug("%s: ofs = %d", __FUNCTION__, size);
     return size;
 }
 
@@ -577,11 +588,19 @@ int AbstractProtocol::protocolFrameOffset(int streamIndex) const
   subsequent to the current
 
   This method is useful for protocols which need to fill in a payload size field
+
+  Like protocolFrameOffset(), uses the stream's frame layout cache for a
+  top-level protocol
 */
 int AbstractProtocol::protocolFramePayloadSize(int streamIndex) const
 {
-    int size = 0;
+    int size = 0, offset;
     AbstractProtocol *p = next;
+
+    if (!parent && mpStream && mpStream->protocolFrameLayout(this,
+                streamIndex, offset, size))
+        return size;
+
     while (p)
     {
         size += p->protocolFrameSize(streamIndex);
@@ -590,7 +609,6 @@ int AbstractProtocol::protocolFramePayloadSize(int streamIndex) const
     if (parent)
         size += parent->protocolFramePayloadSize(streamIndex);
 
-    qDebug("%s: payloadSize = %d", __FUNCTION__, size);
     return size;
 }
 
@@ -708,6 +726,49 @@ QByteArray AbstractProtocol::protocolFrameValue(int streamIndex, bool forCksum,
     return proto;
 }
 
+/*!
+  Writes the protocol's frame value (same as protocolFrameValue()) into
+  'buf' and returns the number of bytes written
+
+  Not more than bufSize bytes are written - if bufSize is less than
+  protocolFrameSize(), the value is truncated
+
+  StreamBase::frameValue() writes the protocols of a frame last to first,
+  so the protocol's payload (all the protocols following it) is already in
+  place in 'buf' after the protocol's own bytes, unless truncated by bufSize.
+  Protocols with a checksum over their payload (e.g. UDP) can checksum it
+  in place using protocolFrameBufferCksum()
+
+  The default implementation copies protocolFrameValue() into 'buf'. Since
+  that builds the value field by field as QByteArrays, protocols that are
+  commonly used reimplement this to write their fields directly into 'buf'
+  without any heap allocation
+*/
+int AbstractProtocol::writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex, FrameValueAttrib *attrib) const
+{
+    QByteArray fv = protocolFrameValue(streamIndex, false, attrib);
+    int size = qMin(fv.size(), bufSize);
+
+    memcpy(buf, fv.constData(), size);
+    return size;
+}
+
+/*!
+  Applies the protocol's variableFields for 'streamIndex' to the protocol
+  frame value in 'buf' of size 'bufSize'
+
+  For use by writeFrameValue() reimplementations - the default
+  protocolFrameValue() implementation does the same
+*/
+void AbstractProtocol::applyProtocolFrameVariableFields(uchar *buf,
+        int bufSize, int streamIndex) const
+{
+    for (int i = 0; i < _data.variable_field_size(); i++)
+        varyProtocolFrameValue(buf, bufSize, streamIndex,
+                               _data.variable_field(i));
+}
+
 /*!
   Returns true if the protocol varies one or more of its fields at run-time,
   false otherwise
@@ -729,6 +790,20 @@ bool AbstractProtocol::isProtocolFrameSizeVariable() const
     return false;
 }
 
+/*!
+  Returns true if the protocol's frame value can be built by any thread,
+  false if only by the thread that owns the protocol's stream (see
+  StreamBase::frameValueConcurrency())
+
+  The default implementation returns true. A subclass should reimplement
+  if building its frame value needs any resources tied to a thread e.g.
+  a lock held by the thread building the packet list
+*/
+bool AbstractProtocol::isProtocolFrameValueThreadSafe() const
+{
+    return true;
+}
+
 /*!
   Returns the minimum number of frames required for the protocol to 
   vary its fields
@@ -757,6 +832,33 @@ int AbstractProtocol::protocolFrameVariableCount() const
     return _frameVariableCount;
 }
 
+/*!
+  Appends to 'varFields' all the fields that the protocol varies at run-time
+  described as VariableFields (with offsets relative to the protocol)
+
+  This allows the frames of a stream to be derived from the first frame
+  by just updating the variable fields (see FrameTemplate) instead of
+  building each frame from scratch.
+
+  The default implementation appends the protocol's variableFields and
+  returns true only if those are all that the protocol varies. A subclass
+  that varies its own fields should reimplement and describe those too;
+  it should return false if any field cannot be described as a
+  VariableField e.g. a field that varies with the frame length.
+
+  \note Checksum fields that vary only because the checksummed content
+  varies need not be described - they are taken care of by FrameTemplate
+*/
+bool AbstractProtocol::protocolFrameVariableFields(
+        QList<OstProto::VariableField> &varFields) const
+{
+    for (int i = 0; i < _data.variable_field_size(); i++)
+        varFields.append(_data.variable_field(i));
+
+    return (protocolFrameVariableCount()
+                == AbstractProtocol::protocolFrameVariableCount());
+}
+
 /*!
   Returns true if the payload content for a protocol varies at run-time,
   false otherwise
@@ -859,7 +961,7 @@ bool AbstractProtocol::protocolHasPayload() const
 quint32 AbstractProtocol::protocolFrameCksum(int streamIndex,
     CksumType cksumType, CksumFlags cksumFlags) const
 {
-    static int recursionCount = 0;
+    static thread_local int recursionCount = 0;
     quint32 cksum = 0xFFFFFFFF;
 
     recursionCount++;
@@ -870,31 +972,12 @@ quint32 AbstractProtocol::protocolFrameCksum(int streamIndex,
         case CksumIp:
         {
             QByteArray fv;
-            quint16 *ip;
-            quint32 len, sum = 0;
             bool forCksum = cksumFlags.testFlag(IncludeCksumField) ?
                                 false : true;
 
             fv = protocolFrameValue(streamIndex, forCksum);
-            ip = (quint16*) fv.constData();
-            len = fv.size();
-
-            while(len > 1)
-            {
-                sum += *ip;
-                if(sum & 0x80000000)
-                    sum = (sum & 0xFFFF) + (sum >> 16);
-                ip++;
-                len -= 2;
-            }
-
-            if (len)
-                sum += (unsigned short) *(unsigned char *)ip;
-
-            while(sum>>16)
-                sum = (sum & 0xFFFF) + (sum >> 16);
-
-            cksum = qFromBigEndian((quint16) ~sum);
+            cksum = qFromBigEndian((quint16)
+                        ~checksumOnesSum(fv.constData(), fv.size()));
             break;
         }
 
@@ -977,7 +1060,6 @@ quint32 AbstractProtocol::protocolFrameHeaderCksum(int streamIndex,
             sum += protocolFrameSize(streamIndex)
                     + protocolFramePayloadSize(streamIndex);
             sum += protocolId(ProtocolIdIp);
-            qDebug("%s: sum = %x, cksum = %x", __FUNCTION__, sum, cksum);
             if (cksumScope == CksumScopeAdjacentProtocol)
                 goto out;
         }
@@ -1055,6 +1137,34 @@ out:
     return cksum;
 }
 
+/*!
+  Returns the checksum of the requested type over 'size' bytes of 'buf'
+  which has the protocol (with its checksum field zeroed) followed by its
+  payload as written in the frame by writeFrameValue()
+
+  This gives the same value as protocolFrameCksum() but without having to
+  build the protocol and its payload all over again
+
+  Currently supports only types CksumTcpUdp and CksumIcmpIgmp
+*/
+quint32 AbstractProtocol::protocolFrameBufferCksum(const uchar *buf,
+    int size, int streamIndex, CksumType cksumType) const
+{
+    quint32 sum;
+
+    Q_ASSERT((cksumType == CksumTcpUdp) || (cksumType == CksumIcmpIgmp));
+
+    sum = qFromBigEndian(checksumOnesSum(buf, size));
+    if (cksumType == CksumTcpUdp)
+        sum += (quint16) ~protocolFrameHeaderCksum(streamIndex,
+                                                   CksumIpPseudo);
+
+    while(sum>>16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return (~sum) & 0xFFFF;
+}
+
 /*!
     Returns true, if the protocol fields are incorrect or may cause
     overall packet to be invalid
@@ -1066,6 +1176,33 @@ bool AbstractProtocol::hasErrors(QStringList* /*errors*/) const
     return false;
 }
 
+/*!
+  Returns the generator for the random values of the protocol's frames
+
+  The generator is keyed by the stream's random seed and the protocol's
+  position in the stream (and in its parent, if any), so that multiple
+  instances of a protocol in a stream don't produce the same values while
+  the values stay the same across runs; use CounterRng::value() with the
+  frame index as the counter. 'subKey' selects an independent sequence for
+  each randomized field - by convention, the field index or
+  kVariableFieldRandomKey + field offset for a field described as a
+  variable field (see protocolFrameVariableFields())
+*/
+CounterRng AbstractProtocol::protocolRandomGenerator(quint64 subKey) const
+{
+    quint64 position = 0;
+
+    for (const AbstractProtocol *p = this; p; p = p->parent) {
+        quint64 index = 1;
+        for (const AbstractProtocol *q = p->prev; q; q = q->prev)
+            index++;
+        position = (position << 8) + index;
+    }
+
+    return CounterRng(CounterRng(mpStream ? mpStream->randomSeed() : 0,
+                                 position).value(subKey));
+}
+
 // Stein's binary GCD algo - from wikipedia
 quint64 AbstractProtocol::gcd(quint64 u, quint64 v)
 {
@@ -1130,21 +1267,21 @@ quint64 AbstractProtocol::lcm(quint64 u, quint64 v)
  * clean
  */
 template <typename T>
-bool varyCounter(QString protocolName, QByteArray &buf, int frameIndex, 
-                 const OstProto::VariableField &varField)
+bool varyCounter(const AbstractProtocol *proto, uchar *buf, int bufSize,
+                 int frameIndex, const OstProto::VariableField &varField)
 {
     int x = (frameIndex % varField.count()) * varField.step();
 
     T oldfv, newfv;
 
-    if ((varField.offset() + sizeof(T)) > uint(buf.size()))
+    if ((varField.offset() + sizeof(T)) > uint(bufSize))
     {
         qWarning("%s varField ofs %d beyond protocol frame %d - skipping", 
-                qPrintable(protocolName), varField.offset(), buf.size());
+                qPrintable(proto->shortName()), varField.offset(), bufSize);
         return false;
     }
 
-    oldfv = *((T*)((uchar*)buf.constData() + varField.offset()));
+    memcpy(&oldfv, buf + varField.offset(), sizeof(T));
     if (sizeof(T) > sizeof(quint8))
         oldfv = qFromBigEndian(oldfv);
 
@@ -1160,37 +1297,45 @@ bool varyCounter(QString protocolName, QByteArray &buf, int frameIndex,
             break;
         case OstProto::VariableField::kRandom:
             newfv = (oldfv & ~varField.mask()) 
-                | ((varField.value() + qrand()) & varField.mask());
+                | ((varField.value() + proto->protocolRandomGenerator(
+                        AbstractProtocol::kVariableFieldRandomKey
+                            | varField.offset()).value32(frameIndex))
+                    & varField.mask());
             break;
         default:
             qWarning("%s Unsupported varField mode %d", 
-                    qPrintable(protocolName), varField.mode());
+                    qPrintable(proto->shortName()), varField.mode());
             return false;
     }
 
     if (sizeof(T) == sizeof(quint8))
-        *((uchar*)buf.constData() + varField.offset()) = newfv;
+        *(buf + varField.offset()) = newfv;
     else
-        qToBigEndian(newfv, (uchar*)buf.constData() + varField.offset());
+        qToBigEndian(newfv, buf + varField.offset());
 
-    qDebug("%s varField ofs %d oldfv %x newfv %x", 
-            qPrintable(protocolName), varField.offset(), oldfv, newfv);
     return true;
 }
 
 void AbstractProtocol::varyProtocolFrameValue(QByteArray &buf, int frameIndex,
         const OstProto::VariableField &varField) const
 {
+    varyProtocolFrameValue((uchar*) buf.data(), buf.size(), frameIndex,
+                           varField);
+}
+
+void AbstractProtocol::varyProtocolFrameValue(uchar *buf, int bufSize,
+        int frameIndex, const OstProto::VariableField &varField) const
+{
 
     switch (varField.type()) {
     case OstProto::VariableField::kCounter8:
-        varyCounter<quint8>(shortName(), buf, frameIndex, varField);
+        varyCounter<quint8>(this, buf, bufSize, frameIndex, varField);
         break;
     case OstProto::VariableField::kCounter16:
-        varyCounter<quint16>(shortName(), buf, frameIndex, varField);
+        varyCounter<quint16>(this, buf, bufSize, frameIndex, varField);
         break;
     case OstProto::VariableField::kCounter32:
-        varyCounter<quint32>(shortName(), buf, frameIndex, varField);
+        varyCounter<quint32>(this, buf, bufSize, frameIndex, varField);
         break;
     default:
         break;
@@ -24,11 +24,13 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include <QFlags>
 #include <QHash>
 #include <QLinkedList>
+#include <QList>
 #include <QString>
 #include <QVariant>
 #include <qendian.h>
 
 //#include "../rpc/pbhelper.h"
+#include "counterrng.h"
 #include "protocol.pb.h"
 
 #define BASE_BIN (2)
@@ -119,6 +121,9 @@ public:
         CksumScopeAllProtocols,       //!< Cksum over all the protocols
     };
 
+    //! Random generator sub key of a variable field is this + field offset
+    static const quint64 kVariableFieldRandomKey = Q_UINT64_C(1) << 32;
+
     AbstractProtocol(StreamBase *stream, AbstractProtocol *parent = 0);
     virtual ~AbstractProtocol();
 
@@ -157,13 +162,18 @@ public:
 
     virtual QByteArray protocolFrameValue(int streamIndex = 0,
         bool forCksum = false, FrameValueAttrib *attrib = nullptr) const;
+    virtual int writeFrameValue(uchar *buf, int bufSize, int streamIndex = 0,
+        FrameValueAttrib *attrib = nullptr) const;
     virtual int protocolFrameSize(int streamIndex = 0) const;
     int protocolFrameOffset(int streamIndex = 0) const;
     int protocolFramePayloadSize(int streamIndex = 0) const;
 
     virtual bool isProtocolFrameValueVariable() const;
     virtual bool isProtocolFrameSizeVariable() const;
+    virtual bool isProtocolFrameValueThreadSafe() const;
     virtual int protocolFrameVariableCount() const;
+    virtual bool protocolFrameVariableFields(
+        QList<OstProto::VariableField> &varFields) const;
     bool isProtocolFramePayloadValueVariable() const;
     bool isProtocolFramePayloadSizeVariable() const;
     int protocolFramePayloadVariableCount() const;
@@ -181,12 +191,22 @@ public:
 
     virtual bool hasErrors(QStringList *errors = nullptr) const;
 
+    CounterRng protocolRandomGenerator(quint64 subKey = 0) const;
+
     static quint64 lcm(quint64 u, quint64 v);
     static quint64 gcd(quint64 u, quint64 v);
 
+protected:
+    void applyProtocolFrameVariableFields(uchar *buf, int bufSize,
+        int streamIndex) const;
+    quint32 protocolFrameBufferCksum(const uchar *buf, int size,
+        int streamIndex, CksumType cksumType) const;
+
 private:
     void varyProtocolFrameValue(QByteArray &buf, int frameIndex,
                                 const OstProto::VariableField &varField) const;
+    void varyProtocolFrameValue(uchar *buf, int bufSize, int frameIndex,
+                                const OstProto::VariableField &varField) const;
 };
 Q_DECLARE_OPERATORS_FOR_FLAGS(AbstractProtocol::FieldFlags);
 #endif
@@ -348,7 +348,9 @@ QVariant ArpProtocol::fieldData(int index, FieldAttrib attrib,
                 case OstProto::Arp::kRandomHost:
                     subnet = data.sender_proto_addr() 
                             & data.sender_proto_addr_mask();
-                    host = (qrand() & ~data.sender_proto_addr_mask());
+                    host = (protocolRandomGenerator(arp_senderProtoAddr)
+                                .value32(streamIndex)
+                            & ~data.sender_proto_addr_mask());
                     protoAddr = subnet | host;
                     break;
                 default:
@@ -456,7 +458,9 @@ QVariant ArpProtocol::fieldData(int index, FieldAttrib attrib,
                 case OstProto::Arp::kRandomHost:
                     subnet = data.target_proto_addr() 
                             & data.target_proto_addr_mask();
-                    host = (qrand() & ~data.target_proto_addr_mask());
+                    host = (protocolRandomGenerator(arp_targetProtoAddr)
+                                .value32(streamIndex)
+                            & ~data.target_proto_addr_mask());
                     protoAddr = subnet | host;
                     break;
                 default:
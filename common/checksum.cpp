@@ -0,0 +1,216 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "checksum.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CKSUM_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define CKSUM_NEON
+#include <arm_neon.h>
+#endif
+
+/*
+ * The kernels sum the buffer as 32-bit words into a 64-bit accumulator -
+ * since 2^16 = 1 (mod 0xFFFF), this folds to the same value as summing
+ * 16-bit words; an odd trailing byte is summed as if zero padded
+ */
+typedef quint64 (*SumFn)(const uchar *p, uint len);
+
+static quint64 sumScalar(const uchar *p, uint len)
+{
+    quint64 sum = 0;
+    quint32 w32;
+    quint16 w16;
+
+    while (len >= 4) {
+        memcpy(&w32, p, 4);
+        sum += w32;
+        p += 4;
+        len -= 4;
+    }
+
+    if (len >= 2) {
+        memcpy(&w16, p, 2);
+        sum += w16;
+        p += 2;
+        len -= 2;
+    }
+
+    if (len) {
+        uchar tail[2] = { *p, 0 };
+        memcpy(&w16, tail, 2);
+        sum += w16;
+    }
+
+    return sum;
+}
+
+#ifdef CKSUM_X86
+__attribute__((target("sse2")))
+static quint64 sumSse2(const uchar *p, uint len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc1 = zero, acc2 = zero;
+    quint64 lanes[2];
+
+    while (len >= 32) {
+        __m128i v1 = _mm_loadu_si128((const __m128i*) p);
+        __m128i v2 = _mm_loadu_si128((const __m128i*) (p + 16));
+
+        // zero extend 32-bit words to 64-bits and accumulate
+        acc1 = _mm_add_epi64(acc1, _mm_unpacklo_epi32(v1, zero));
+        acc2 = _mm_add_epi64(acc2, _mm_unpackhi_epi32(v1, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpacklo_epi32(v2, zero));
+        acc2 = _mm_add_epi64(acc2, _mm_unpackhi_epi32(v2, zero));
+        p += 32;
+        len -= 32;
+    }
+
+    _mm_storeu_si128((__m128i*) lanes, _mm_add_epi64(acc1, acc2));
+    return lanes[0] + lanes[1] + sumScalar(p, len);
+}
+
+__attribute__((target("avx2")))
+static quint64 sumAvx2(const uchar *p, uint len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc1 = zero, acc2 = zero;
+    quint64 lanes[4];
+
+    while (len >= 64) {
+        __m256i v1 = _mm256_loadu_si256((const __m256i*) p);
+        __m256i v2 = _mm256_loadu_si256((const __m256i*) (p + 32));
+
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpacklo_epi32(v1, zero));
+        acc2 = _mm256_add_epi64(acc2, _mm256_unpackhi_epi32(v1, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpacklo_epi32(v2, zero));
+        acc2 = _mm256_add_epi64(acc2, _mm256_unpackhi_epi32(v2, zero));
+        p += 64;
+        len -= 64;
+    }
+
+    _mm256_storeu_si256((__m256i*) lanes, _mm256_add_epi64(acc1, acc2));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sumSse2(p, len);
+}
+#endif
+
+#ifdef CKSUM_NEON
+static quint64 sumNeon(const uchar *p, uint len)
+{
+    uint64x2_t acc1 = vdupq_n_u64(0), acc2 = vdupq_n_u64(0);
+
+    while (len >= 32) {
+        // pairwise add 32-bit words into 64-bit lanes and accumulate
+        acc1 = vpadalq_u32(acc1, vreinterpretq_u32_u8(vld1q_u8(p)));
+        acc2 = vpadalq_u32(acc2, vreinterpretq_u32_u8(vld1q_u8(p + 16)));
+        p += 32;
+        len -= 32;
+    }
+
+    acc1 = vaddq_u64(acc1, acc2);
+    return vgetq_lane_u64(acc1, 0) + vgetq_lane_u64(acc1, 1)
+            + sumScalar(p, len);
+}
+#endif
+
+static const char *sumFnName = "scalar";
+
+static SumFn selectSumFn()
+{
+#if defined(CKSUM_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        sumFnName = "avx2";
+        return sumAvx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        sumFnName = "sse2";
+        return sumSse2;
+    }
+#elif defined(CKSUM_NEON)
+    sumFnName = "neon";
+    return sumNeon;
+#endif
+    return sumScalar;
+}
+
+// Selected on first use - not at static init, so that it is usable from
+// other static initializers too
+static inline SumFn sumFn()
+{
+    static const SumFn fn = selectSumFn();
+    return fn;
+}
+
+static inline quint16 fold(quint64 sum)
+{
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    return quint16(sum);
+}
+
+/*!
+  Returns the ones' complement sum (folded to 16 bits, NOT complemented)
+  of 'length' bytes of 'buffer' added to 'sum'
+
+  The checksum is the ones' complement of the returned value
+*/
+quint16 checksumOnesSum(const void *buffer, uint length, quint32 sum)
+{
+    return fold((*sumFn())((const uchar*) buffer, length) + sum);
+}
+
+/*!
+  Returns the checksum 'cksum' updated for a 16-bit word of the
+  checksummed data changing from 'oldValue' to 'newValue'
+
+  Uses RFC 1624 eqn. 3 - HC' = ~(~HC + ~m + m')
+*/
+quint16 checksumUpdate(quint16 cksum, quint16 oldValue, quint16 newValue)
+{
+    return ~fold(quint32(quint16(~cksum)) + quint16(~oldValue) + newValue);
+}
+
+/*!
+  Same as above for 'length' bytes of the checksummed data changing from
+  'oldData' to 'newData'
+
+  The changed bytes MUST start at a 16-bit boundary relative to the start
+  of the checksummed data
+*/
+quint16 checksumUpdate(quint16 cksum, const void *oldData,
+                       const void *newData, uint length)
+{
+    return checksumUpdate(cksum, checksumOnesSum(oldData, length),
+                          checksumOnesSum(newData, length));
+}
+
+/*!
+  Returns the name of the checksum kernel selected for this CPU
+*/
+const char* checksumKernelName()
+{
+    sumFn();
+    return sumFnName;
+}
@@ -0,0 +1,39 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _CHECKSUM_H
+#define _CHECKSUM_H
+
+#include <QtGlobal>
+
+/*
+ * Internet (ones' complement) checksum - RFC 1071
+ *
+ * All values are in host byte order i.e. the 16-bit words of the buffer
+ * are summed as read from memory; since the ones' complement sum is byte
+ * order independent, convert only the final checksum (if required)
+ */
+
+quint16 checksumOnesSum(const void *buffer, uint length, quint32 sum = 0);
+quint16 checksumUpdate(quint16 cksum, quint16 oldValue, quint16 newValue);
+quint16 checksumUpdate(quint16 cksum, const void *oldData,
+                       const void *newData, uint length);
+const char* checksumKernelName();
+
+#endif
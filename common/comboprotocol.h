@@ -186,6 +186,27 @@ public:
                         protoB->protocolFrameVariableCount());
         return count;
     }
+    virtual bool protocolFrameVariableFields(
+        QList<OstProto::VariableField> &varFields) const
+    {
+        int first;
+
+        if (!protoA->protocolFrameVariableFields(varFields))
+            return false;
+
+        // protoB follows protoA, so its offsets need to be adjusted
+        first = varFields.size();
+        if (!protoB->protocolFrameVariableFields(varFields))
+            return false;
+        for (int i = first; i < varFields.size(); i++)
+            varFields[i].set_offset(varFields.at(i).offset()
+                                        + protoA->protocolFrameSize());
+
+        for (int i = 0; i < variableFieldCount(); i++)
+            varFields.append(variableField(i));
+
+        return true;
+    }
 
     virtual quint32 protocolFrameCksum(int streamIndex = 0,
         CksumType cksumType = CksumIp, CksumFlags cksumFlags = 0) const
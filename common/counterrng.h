@@ -0,0 +1,60 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _COUNTER_RNG_H
+#define _COUNTER_RNG_H
+
+#include <QtGlobal>
+
+/*
+ * Counter based pseudo random number generator (SplitMix64)
+ *
+ * The random value for a counter (typically the frame index) is computed
+ * directly from the key and the counter - there is no state that needs to
+ * be advanced, so the value for frame 'i' costs the same for any 'i', is
+ * the same every time it is asked for and can be computed from any thread
+ *
+ * Generators with different keys produce independent sequences
+ */
+class CounterRng
+{
+public:
+    CounterRng(quint64 key = 0, quint64 subKey = 0)
+        : key_(mix(mix(key) + subKey*kGamma)) {}
+
+    quint64 value(quint64 counter) const {
+        return mix(key_ + (counter + 1)*kGamma);
+    }
+    quint32 value32(quint64 counter) const {
+        return quint32(value(counter) >> 32);
+    }
+
+private:
+    static quint64 mix(quint64 z) {
+        z = (z ^ (z >> 30)) * Q_UINT64_C(0xBF58476D1CE4E5B9);
+        z = (z ^ (z >> 27)) * Q_UINT64_C(0x94D049BB133111EB);
+        return z ^ (z >> 31);
+    }
+
+    static const quint64 kGamma = Q_UINT64_C(0x9E3779B97F4A7C15);
+
+    quint64 key_;
+};
+
+#endif
@@ -186,3 +186,17 @@ bool Eth2Protocol::setFieldData(int index, const QVariant &value,
     }
     return isOk;
 }
+
+int Eth2Protocol::writeFrameValue(uchar *buf, int bufSize, int streamIndex,
+        FrameValueAttrib *attrib) const
+{
+    if (bufSize < 2)
+        return AbstractProtocol::writeFrameValue(buf, bufSize, streamIndex,
+                                                 attrib);
+
+    qToBigEndian(quint16(data.is_override_type() ?
+                    data.type() : payloadProtocolId(ProtocolIdEth)), buf);
+
+    applyProtocolFrameVariableFields(buf, 2, streamIndex);
+    return 2;
+}
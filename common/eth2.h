@@ -59,6 +59,9 @@ public:
                int streamIndex = 0) const;
     virtual bool setFieldData(int index, const QVariant &value, 
             FieldAttrib attrib = FieldValue);
+
+    virtual int writeFrameValue(uchar *buf, int bufSize,
+            int streamIndex = 0, FrameValueAttrib *attrib = nullptr) const;
 private:
     OstProto::Eth2    data;
 };
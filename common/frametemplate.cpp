@@ -0,0 +1,455 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "frametemplate.h"
+
+#include "abstractprotocol.h"
+#include "checksum.h"
+#include "protocollistiterator.h"
+#include "streambase.h"
+
+#include <QtAlgorithms>
+#include <QtEndian>
+
+#include <algorithm>
+#include <string.h>
+
+// Streams with upto these many distinct frames are verified exhaustively
+static const int kMaxExhaustiveCount = 32;
+
+static inline quint32 fold(quint32 sum)
+{
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    return sum;
+}
+
+FrameTemplate::FrameTemplate(const StreamBase *stream)
+{
+    stream_ = stream;
+
+    compiled_ = compile();
+    if (!compiled_) {
+        base_.clear();
+        counters_.clear();
+        regions_.clear();
+        cksums_.clear();
+    }
+}
+
+/*!
+  Same as StreamBase::frameValue() - but much faster if the stream could
+  be compiled
+*/
+int FrameTemplate::frameValue(uchar *buf, int bufMaxSize, int frameIndex,
+        FrameValueAttrib *attrib) const
+{
+    if (!compiled_ || (bufMaxSize < base_.size()))
+        return stream_->frameValue(buf, bufMaxSize, frameIndex, attrib);
+
+    memcpy(buf, base_.constData(), base_.size());
+    patchFrame(buf, frameIndex);
+
+    if (attrib)
+        *attrib += attrib_;
+
+    return base_.size();
+}
+
+/*!
+  Turns 'frame' into the frame at 'frameIndex' by patching it in place
+
+  'frame' MUST already be a frame of this template (any index) - only the
+  variable fields and checksums are rewritten, the rest is left as is
+*/
+void FrameTemplate::patchFrame(uchar *frame, int frameIndex) const
+{
+    Q_ASSERT(compiled_);
+
+    applyCounters(frame, frameIndex);
+    for (int i = 0; i < cksums_.size(); i++)
+        applyChecksum(frame, cksums_.at(i));
+}
+
+bool FrameTemplate::compile()
+{
+    ProtocolListIterator *iter;
+    QList<int> solveIndex, verifyIndex;
+    QList<QByteArray> probes;
+    QVector<int> counterRegions, candidates;
+    int len, frameCount;
+
+    // XXX: length fields and their checksums vary with the frame length
+    // in ways that we don't describe; so compile only fixed length streams
+    if ((stream_->lenMode() != StreamBase::e_fl_fixed)
+            || stream_->isFrameSizeVariable())
+        return false;
+
+    frameCount = stream_->frameVariableCount();
+    if (frameCount <= 0) // overflow
+        return false;
+
+    len = stream_->frameLen() - kFcsSize;
+    if (len <= 0)
+        return false;
+
+    base_.resize(len);
+    if (stream_->frameValue((uchar*)base_.data(), len, 0, &attrib_) != len)
+        return false;
+
+    //
+    // Collect the variable fields and checksums of all protocols
+    //
+    iter = stream_->createProtocolListIterator();
+    while (iter->hasNext())
+    {
+        AbstractProtocol *proto = iter->next();
+        QList<OstProto::VariableField> varFields;
+        int offset = proto->protocolFrameOffset();
+        int protoSize = proto->protocolFrameSize();
+
+        if (!proto->protocolFrameVariableFields(varFields)) {
+            qDebug("%s: %s has non-describable variable fields",
+                    __FUNCTION__, qPrintable(proto->shortName()));
+            goto _fail;
+        }
+
+        foreach (const OstProto::VariableField &vf, varFields) {
+            Counter c;
+
+            switch (vf.type()) {
+            case OstProto::VariableField::kCounter8:
+                c.size = 1;
+                break;
+            case OstProto::VariableField::kCounter16:
+                c.size = 2;
+                break;
+            case OstProto::VariableField::kCounter32:
+                c.size = 4;
+                break;
+            default:
+                continue;
+            }
+
+            // Fields beyond the protocol are skipped by protocolFrameValue()
+            // and those beyond the frame are truncated anyway
+            c.offset = offset + vf.offset();
+            if (((vf.offset() + c.size) > uint(protoSize))
+                    || ((c.offset + c.size) > len))
+                continue;
+
+            c.random = vf.mode() == OstProto::VariableField::kRandom;
+            c.decrement = vf.mode() == OstProto::VariableField::kDecrement;
+            c.mask = vf.mask();
+            c.value = vf.value();
+            c.count = vf.count();
+            c.step = vf.step();
+            c.rng = proto->protocolRandomGenerator(
+                        AbstractProtocol::kVariableFieldRandomKey
+                            | vf.offset());
+
+            // Not a counter that varies
+            if (!c.random && (c.count <= 1))
+                continue;
+
+            counters_.append(c);
+        }
+
+        for (int i = 0; i < proto->fieldCount(); i++) {
+            Checksum cksum;
+            int bits, bitOffset;
+
+            if (!proto->fieldFlags(i).testFlag(AbstractProtocol::CksumField))
+                continue;
+
+            bits = proto->fieldData(i, AbstractProtocol::FieldBitSize)
+                                .toInt();
+            bitOffset = proto->fieldFrameBitOffset(i);
+            if ((bits != 16) || (bitOffset % 8)) {
+                qDebug("%s: %s unsupported cksum field %d", __FUNCTION__,
+                        qPrintable(proto->shortName()), i);
+                goto _fail;
+            }
+
+            cksum.offset = offset + bitOffset/8;
+            if ((cksum.offset + 2) > len)
+                continue;
+
+            cksum.region = -1;
+            cksum.zeroAsFfff = proto->protocolNumber()
+                                    == OstProto::Protocol::kUdpFieldNumber;
+            cksum.baseValue = qFromBigEndian<quint16>(
+                                (const uchar*)base_.constData()
+                                    + cksum.offset);
+            cksums_.append(cksum);
+        }
+    }
+    delete iter;
+    iter = NULL;
+
+    //
+    // Group the counter bytes into 16-bit aligned regions - the unit of
+    // checksum fixup; overlapping counters share a region
+    //
+    std::sort(counters_.begin(), counters_.end(),
+            [](const Counter &a, const Counter &b) {
+                return a.offset < b.offset;
+            });
+    for (int i = 0; i < counters_.size(); i++) {
+        Counter &c = counters_[i];
+        int start = c.offset & ~1;
+        int end = (c.offset + c.size + 1) & ~1;
+
+        if (!regions_.isEmpty() && (start < regions_.last().end))
+            regions_.last().end = qMax(regions_.last().end, end);
+        else {
+            regions_.append(Region());
+            regions_.last().start = start;
+            regions_.last().end = end;
+            counterRegions.append(regions_.size() - 1);
+        }
+        c.region = regions_.size() - 1;
+    }
+
+    // Checksums are fixed up innermost first, so that an outer checksum
+    // can cover an inner one
+    std::sort(cksums_.begin(), cksums_.end(),
+            [](const Checksum &a, const Checksum &b) {
+                return a.offset > b.offset;
+            });
+    for (int i = 0; i < cksums_.size(); i++) {
+        Checksum &cksum = cksums_[i];
+        int start = cksum.offset & ~1;
+        int end = (cksum.offset + 3) & ~1;
+
+        for (int j = 0; j < regions_.size(); j++) {
+            if ((start < regions_.at(j).end) && (regions_.at(j).start < end)) {
+                qDebug("%s: cksum at %d overlaps variable field at %d",
+                        __FUNCTION__, cksum.offset, regions_.at(j).start);
+                goto _fail;
+            }
+        }
+        regions_.append(Region());
+        regions_.last().start = start;
+        regions_.last().end = end;
+        cksum.region = regions_.size() - 1;
+    }
+
+    for (int i = 0; i < regions_.size(); i++)
+        regions_[i].baseSum = onesSum((const uchar*)base_.constData(),
+                                      regions_.at(i));
+
+    //
+    // Pick the frames to check against - all if there are only a few
+    //
+    if (frameCount <= kMaxExhaustiveCount) {
+        for (int i = 0; i < frameCount; i++) {
+            if (i)
+                solveIndex.append(i);
+            verifyIndex.append(i);
+        }
+    }
+    else {
+        solveIndex << 1 << 2 << 3 << 4 << 5
+                   << frameCount/3 << frameCount/2 << frameCount - 1;
+        verifyIndex << 0 << 6 << 7 << frameCount/7 + 3 << frameCount/5 + 1
+                    << frameCount/4 << (frameCount/4)*3 << frameCount - 2;
+    }
+
+    //
+    // Find out the regions covered by each checksum
+    //
+    if (!counters_.isEmpty()) {
+        foreach (int index, solveIndex) {
+            FrameValueAttrib attrib;
+            QByteArray frame(len, '\0');
+
+            stream_->frameValue((uchar*)frame.data(), len, index, &attrib);
+            attrib_ += attrib;
+            probes.append(frame);
+        }
+    }
+
+    candidates = counterRegions;
+    for (int i = 0; i < cksums_.size(); i++) {
+        if (!counters_.isEmpty()
+                && !solveChecksum(cksums_[i], candidates, probes)) {
+            qDebug("%s: unable to solve cksum at %d", __FUNCTION__,
+                    cksums_.at(i).offset);
+            goto _fail;
+        }
+        candidates.append(cksums_.at(i).region);
+    }
+
+    //
+    // Verify
+    //
+    foreach (int index, verifyIndex) {
+        FrameValueAttrib attrib;
+        QByteArray frame(len, '\0');
+        QByteArray patched(base_);
+
+        if (stream_->frameValue((uchar*)frame.data(), len, index, &attrib)
+                != len)
+            goto _fail;
+        attrib_ += attrib;
+
+        applyCounters((uchar*)patched.data(), index);
+        for (int i = 0; i < cksums_.size(); i++)
+            applyChecksum((uchar*)patched.data(), cksums_.at(i));
+
+        if (patched != frame) {
+            qDebug("%s: frame %d mismatch", __FUNCTION__, index);
+            goto _fail;
+        }
+    }
+
+    qDebug("%s: stream %u compiled - len %d, %d counters, %d cksums",
+            __FUNCTION__, stream_->id(), len, counters_.size(),
+            cksums_.size());
+    return true;
+
+_fail:
+    delete iter;
+    return false;
+}
+
+/*
+ * Finds the smallest set of candidate regions covered by the checksum that
+ * explains the checksum values in all the probe frames
+ */
+bool FrameTemplate::solveChecksum(Checksum &cksum,
+        const QVector<int> &candidates, const QList<QByteArray> &probes) const
+{
+    QVector<QVector<quint32> > delta;
+    int n = candidates.size();
+
+    if (n > kMaxCoverRegions)
+        return false;
+
+    // Ones' complement difference (~m + m') of each candidate per probe
+    for (int p = 0; p < probes.size(); p++) {
+        const uchar *frame = (const uchar*) probes.at(p).constData();
+
+        delta.append(QVector<quint32>());
+        for (int i = 0; i < n; i++) {
+            const Region &r = regions_.at(candidates.at(i));
+            delta.last().append(fold(quint16(~r.baseSum)
+                                        + onesSum(frame, r)));
+        }
+    }
+
+    for (int bits = 0; bits <= n; bits++) {
+        for (uint set = 0; set < (1U << n); set++) {
+            if (int(qPopulationCount(set)) != bits)
+                continue;
+
+            bool match = true;
+            for (int p = 0; match && (p < probes.size()); p++) {
+                quint32 sum = quint16(~cksum.baseValue);
+                quint16 value;
+
+                for (int i = 0; i < n; i++)
+                    if (set & (1U << i))
+                        sum += delta.at(p).at(i);
+                value = ~fold(sum);
+                if (!value && cksum.zeroAsFfff)
+                    value = 0xFFFF;
+
+                match = value == qFromBigEndian<quint16>(
+                                    (const uchar*)probes.at(p).constData()
+                                        + cksum.offset);
+            }
+
+            if (match) {
+                for (int i = 0; i < n; i++)
+                    if (set & (1U << i))
+                        cksum.regions.append(candidates.at(i));
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void FrameTemplate::applyCounters(uchar *buf, int frameIndex) const
+{
+    for (int i = 0; i < counters_.size(); i++) {
+        const Counter &c = counters_.at(i);
+        uchar *p = buf + c.offset;
+        quint32 oldfv, newfv, v;
+
+        switch (c.size) {
+        case 1: oldfv = *p; break;
+        case 2: oldfv = qFromBigEndian<quint16>(p); break;
+        default: oldfv = qFromBigEndian<quint32>(p); break;
+        }
+
+        // Same as varyCounter() in abstractprotocol.cpp
+        if (c.random)
+            v = c.value + c.rng.value32(frameIndex);
+        else {
+            quint32 x = (quint32(frameIndex) % c.count) * c.step;
+            v = c.decrement ? c.value - x : c.value + x;
+        }
+        newfv = (oldfv & ~c.mask) | (v & c.mask);
+
+        switch (c.size) {
+        case 1: *p = uchar(newfv); break;
+        case 2: qToBigEndian(quint16(newfv), p); break;
+        default: qToBigEndian(newfv, p); break;
+        }
+    }
+}
+
+/*
+ * Incremental checksum update as per RFC 1624 eqn. 3 -
+ *    HC' = ~(~HC + ~m + m')
+ */
+void FrameTemplate::applyChecksum(uchar *buf, const Checksum &cksum) const
+{
+    quint32 sum = quint16(~cksum.baseValue);
+    quint16 value;
+
+    for (int i = 0; i < cksum.regions.size(); i++) {
+        const Region &r = regions_.at(cksum.regions.at(i));
+        sum += quint16(~r.baseSum) + onesSum(buf, r);
+    }
+
+    value = ~fold(sum);
+    if (!value && cksum.zeroAsFfff)
+        value = 0xFFFF;
+
+    qToBigEndian(value, buf + cksum.offset);
+}
+
+quint16 FrameTemplate::onesSum(const uchar *buf, const Region &region) const
+{
+    int end = qMin(region.end, base_.size());
+
+    if (end <= region.start)
+        return 0;
+
+    // An odd length frame is zero padded for checksum purposes (as does
+    // checksumOnesSum()); the host order sum is converted to network order
+    // to match the rest of the fixup arithmetic
+    return qFromBigEndian(checksumOnesSum(buf + region.start,
+                                          end - region.start));
+}
@@ -0,0 +1,105 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _FRAME_TEMPLATE_H
+#define _FRAME_TEMPLATE_H
+
+#include "counterrng.h"
+#include "framevalueattrib.h"
+
+#include <QByteArray>
+#include <QVector>
+
+class StreamBase;
+
+/*
+ * A stream "compiled" into a template frame (the stream's first frame)
+ * and a small patch program that derives any other frame of the stream
+ * from the template -
+ *   - counter writes for all the variable fields of all protocols at
+ *     fixed offsets (see AbstractProtocol::protocolFrameVariableFields())
+ *   - checksum fixups for the checksums that cover the variable fields,
+ *     done incrementally as per RFC 1624
+ *
+ * Which checksum covers which variable fields is found out at compile
+ * time by checking against frames built by StreamBase::frameValue(); the
+ * compiled program is also verified against a few such frames before use
+ *
+ * If a stream cannot be compiled (e.g. variable frame length, or a
+ * protocol field that cannot be described as a counter), frameValue()
+ * transparently falls back to StreamBase::frameValue()
+ */
+class FrameTemplate
+{
+public:
+    FrameTemplate(const StreamBase *stream);
+
+    const StreamBase* stream() const { return stream_; }
+    bool isCompiled() const { return compiled_; }
+    int frameValue(uchar *buf, int bufMaxSize, int frameIndex,
+                   FrameValueAttrib *attrib = nullptr) const;
+    void patchFrame(uchar *frame, int frameIndex) const;
+
+private:
+    struct Counter {
+        int offset;     // in frame
+        int size;       // in bytes - 1, 2 or 4
+        int region;
+        bool random;
+        bool decrement;
+        quint32 mask;
+        quint32 value;
+        quint32 count;
+        quint32 step;
+        CounterRng rng; // random only
+    };
+    struct Region {     // 16-bit aligned frame bytes that may vary
+        int start;
+        int end;
+        quint16 baseSum; // ones' complement sum in the template
+    };
+    struct Checksum {
+        int offset;     // in frame
+        int region;
+        bool zeroAsFfff; // a computed zero is sent as 0xFFFF (UDP)
+        quint16 baseValue;
+        QVector<int> regions; // covered regions
+    };
+
+    bool compile();
+    bool solveChecksum(Checksum &cksum, const QVector<int> &candidates,
+                       const QList<QByteArray> &probes) const;
+
+    void applyCounters(uchar *buf, int frameIndex) const;
+    void applyChecksum(uchar *buf, const Checksum &cksum) const;
+    quint16 onesSum(const uchar *buf, const Region &region) const;
+
+    static const int kMaxCoverRegions = 16;
+
+    const StreamBase *stream_;
+    bool compiled_{false};
+
+    QByteArray base_;
+    FrameValueAttrib attrib_;
+    QVector<Counter> counters_;
+    QVector<Region> regions_;
+    QVector<Checksum> cksums_; // in the order of application
+};
+
+#endif
@@ -21,6 +21,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include <QStringList>
 
 QHash<int, int> GmpProtocol::frameFieldCountMap;
+QMutex GmpProtocol::frameFieldCountMapLock;
 
 GmpProtocol::GmpProtocol(StreamBase *stream, AbstractProtocol *parent)
     : AbstractProtocol(stream, parent)
@@ -48,20 +49,28 @@ int GmpProtocol::frameFieldCount() const
     int type = msgType();
 
     // frameFieldCountMap contains the frameFieldCounts for each
-    // msgType - this is built on demand and cached for subsequent use
+    // msgType - this is built on demand and cached for subsequent use;
+    // it is shared by all streams, whose frames may be built concurrently
+    // (see StreamBase::frameValueConcurrency()), hence the lock
 
     // lookup if we have already cached ...
-    if (frameFieldCountMap.contains(type))
-        return frameFieldCountMap.value(type);
+    frameFieldCountMapLock.lock();
+    QHash<int, int>::const_iterator iter = frameFieldCountMap.constFind(type);
+    bool found = (iter != frameFieldCountMap.constEnd());
+    int count = found ? iter.value() : 0;
+    frameFieldCountMapLock.unlock();
+    if (found)
+        return count;
 
     // ... otherwise calculate and cache 
-    int count = 0;
     for (int i = 0; i < FIELD_COUNT; i++)
     {
         if (fieldFlags(i).testFlag(AbstractProtocol::FrameField))
             count++;
     }
+    frameFieldCountMapLock.lock();
     frameFieldCountMap.insert(type, count);
+    frameFieldCountMapLock.unlock();
     return count;
 }
 
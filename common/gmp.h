@@ -24,6 +24,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "gmp.pb.h"
 
 #include <QHash>
+#include <QMutex>
 
 /* 
 Gmp Protocol Frame Format - TODO: for now see the respective RFCs
@@ -113,6 +114,7 @@ protected:
 
 private:
     static QHash<int, int> frameFieldCountMap;
+    static QMutex frameFieldCountMapLock;
 };
 
 inline int GmpProtocol::msgType() const 
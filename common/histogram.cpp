@@ -0,0 +1,132 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "histogram.h"
+
+#include <string.h>
+
+void Histogram::clear()
+{
+    memset(buckets_, 0, sizeof(buckets_));
+    count_ = 0;
+    min_ = ~Q_UINT64_C(0);
+    max_ = 0;
+}
+
+/*!
+  Adds 'count' values to the bucket at 'index' - used to rebuild a
+  histogram from its (non-empty) buckets
+
+  As the actual values are not known, min/max are updated using the
+  bucket's value range
+*/
+void Histogram::addBucket(int index, quint64 count)
+{
+    quint64 low;
+
+    if (index < 0 || index >= kBucketCount || !count)
+        return;
+
+    low = index ? bucketHighestValue(index - 1) + 1 : 0;
+
+    buckets_[index] += count;
+    count_ += count;
+    if (low < min_)
+        min_ = low;
+    if (bucketHighestValue(index) > max_)
+        max_ = bucketHighestValue(index);
+}
+
+void Histogram::merge(const Histogram &other)
+{
+    for (int i = 0; i < kBucketCount; i++)
+        buckets_[i] += other.buckets_[i];
+
+    count_ += other.count_;
+    if (other.min_ < min_)
+        min_ = other.min_;
+    if (other.max_ > max_)
+        max_ = other.max_;
+}
+
+/*!
+  Returns the value at or below which 'percent' of the values lie
+*/
+quint64 Histogram::percentile(double percent) const
+{
+    quint64 value;
+
+    percentiles(&percent, &value, 1);
+
+    return value;
+}
+
+/*!
+  Finds the values for the given percentiles - 'percents' MUST be in
+  ascending order - in one pass over the buckets
+
+  The value of a bucket is its highest value, capped by the actual min and
+  max of the values added
+*/
+void Histogram::percentiles(const double *percents, quint64 *values,
+        int n) const
+{
+    quint64 cumulative = 0;
+    int bucket = 0;
+
+    for (int i = 0; i < n; i++) {
+        // Count of values at or below the percentile value (at least 1)
+        quint64 rank = quint64(percents[i]*count_/100 + 0.5);
+        if (rank < 1)
+            rank = 1;
+
+        if (!count_) {
+            values[i] = 0;
+            continue;
+        }
+
+        while (bucket < kBucketCount) {
+            if (cumulative + buckets_[bucket] >= rank)
+                break;
+            cumulative += buckets_[bucket];
+            bucket++;
+        }
+
+        values[i] = qBound(min_, bucketHighestValue(bucket), max_);
+    }
+}
+
+quint64 Histogram::bucketHighestValue(int index)
+{
+    const int kSubBucketCount = 1 << kSubBucketBits;
+    const int kHalfCount = 1 << (kSubBucketBits - 1);
+    int shift;
+    quint64 top;
+
+    if (index < kSubBucketCount)
+        return quint64(index);
+
+    if (index >= kOverflowBucket)
+        return ~Q_UINT64_C(0); // open ended
+
+    shift = (index - kSubBucketCount)/kHalfCount + 1;
+    top = quint64(kHalfCount + (index - kSubBucketCount) % kHalfCount);
+
+    return ((top + 1) << shift) - 1;
+}
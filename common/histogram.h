@@ -0,0 +1,111 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _HISTOGRAM_H
+#define _HISTOGRAM_H
+
+#include <QtGlobal>
+
+/*
+ * Log-linear histogram (in the style of HDR Histogram) of values such as
+ * latency or jitter in nanosecs
+ *
+ * Values below 2^kSubBucketBits have a bucket each; larger values are
+ * bucketed by their kSubBucketBits most significant bits, so a value read
+ * back from the histogram (its bucket's highest value) is within 1/64
+ * (~1.6%) of the actual one. Values of 2^kMaxValueBits (~68s) or more are
+ * counted in a bucket of their own - kOverflowBucket, the last bucket
+ *
+ * Memory is fixed, adding a value is O(1) and histograms (e.g. of the
+ * same stream on different ports) can be merged by adding their buckets
+ */
+class Histogram
+{
+public:
+    static const int kSubBucketBits = 7;
+    static const int kMaxValueBits = 36;
+    static const int kOverflowBucket = (1 << kSubBucketBits)
+            + (kMaxValueBits - kSubBucketBits) * (1 << (kSubBucketBits - 1));
+    static const int kBucketCount = kOverflowBucket + 1;
+
+    Histogram() { clear(); }
+
+    void add(quint64 value);
+    void addBucket(int index, quint64 count);
+    void merge(const Histogram &other);
+    void clear();
+
+    quint64 count() const { return count_; }
+    quint64 min() const { return count_ ? min_ : 0; }
+    quint64 max() const { return max_; }
+    quint64 bucketCount(int index) const { return buckets_[index]; }
+
+    quint64 percentile(double percent) const;
+    void percentiles(const double *percents, quint64 *values, int n) const;
+
+    static int bucketIndex(quint64 value);
+    static quint64 bucketHighestValue(int index);
+
+private:
+    quint64 buckets_[kBucketCount];
+    quint64 count_;
+    quint64 min_;
+    quint64 max_;
+};
+
+inline int Histogram::bucketIndex(quint64 value)
+{
+    const quint64 kSubBucketCount = 1 << kSubBucketBits;
+    int msb, shift;
+
+    if (value < kSubBucketCount)
+        return int(value);
+
+    if (value >> kMaxValueBits)
+        return kOverflowBucket;
+
+    // Position of the most significant bit set
+#if defined(Q_CC_GNU)
+    msb = 63 - __builtin_clzll(value);
+#else
+    msb = 0;
+    for (int bits = 32; bits; bits >>= 1) {
+        if (value >> (msb + bits))
+            msb += bits;
+    }
+#endif
+
+    // Bucket by the kSubBucketBits msbs (the msb itself is always 1)
+    shift = msb - (kSubBucketBits - 1);
+    return int(kSubBucketCount)
+        + (shift - 1) * (1 << (kSubBucketBits - 1))
+        + int((value >> shift) & ((1 << (kSubBucketBits - 1)) - 1));
+}
+
+inline void Histogram::add(quint64 value)
+{
+    buckets_[bucketIndex(value)]++;
+    count_++;
+    if (value < min_)
+        min_ = value;
+    if (value > max_)
+        max_ = value;
+}
+
+#endif
@@ -19,8 +19,12 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "ip4.h"
 
+#include "checksum.h"
+
 #include <QHostAddress>
 
+#include <string.h>
+
 Ip4Protocol::Ip4Protocol(StreamBase *stream, AbstractProtocol *parent)
     : AbstractProtocol(stream, parent)
 {
@@ -433,7 +437,12 @@ QVariant Ip4Protocol::fieldData(int index, FieldAttrib attrib,
                     break;
                 case OstProto::Ip4::e_im_random_host:
                     subnet = data.src_ip() & data.src_ip_mask();
-                    host = (qrand() & ~data.src_ip_mask());
+                    // Keyed as the variable field describing the mode (see
+                    // protocolFrameVariableFields()) - so that FrameTemplate
+                    // derives the same values
+                    host = (protocolRandomGenerator(
+                                kSrcAddrRandomKey).value32(
+                                streamIndex) & ~data.src_ip_mask());
                     srcIp = subnet | host;
                     break;
                 default:
@@ -486,7 +495,10 @@ QVariant Ip4Protocol::fieldData(int index, FieldAttrib attrib,
                     break;
                 case OstProto::Ip4::e_im_random_host:
                     subnet = data.dst_ip() & data.dst_ip_mask();
-                    host = (qrand() & ~data.dst_ip_mask());
+                    // See src ip above
+                    host = (protocolRandomGenerator(
+                                kDstAddrRandomKey).value32(
+                                streamIndex) & ~data.dst_ip_mask());
                     dstIp = subnet | host;
                     break;
                 default:
@@ -844,6 +856,119 @@ int Ip4Protocol::protocolFrameVariableCount() const
     return count;
 }
 
+bool Ip4Protocol::protocolFrameVariableFields(
+        QList<OstProto::VariableField> &varFields) const
+{
+    // The src/dst ip modes vary the host part of the address which is
+    // a 32-bit counter masked with the host mask
+    if (data.src_ip_mode() != OstProto::Ip4::e_im_fixed) {
+        OstProto::VariableField vf;
+
+        vf.set_type(OstProto::VariableField::kCounter32);
+        vf.set_offset(kSrcAddrOffset);
+        vf.set_mask(~data.src_ip_mask());
+        vf.set_count(data.src_ip_count());
+        vf.set_step(1);
+        switch (data.src_ip_mode()) {
+        case OstProto::Ip4::e_im_inc_host:
+            vf.set_mode(OstProto::VariableField::kIncrement);
+            vf.set_value(data.src_ip() & ~data.src_ip_mask());
+            break;
+        case OstProto::Ip4::e_im_dec_host:
+            vf.set_mode(OstProto::VariableField::kDecrement);
+            vf.set_value(data.src_ip() & ~data.src_ip_mask());
+            break;
+        case OstProto::Ip4::e_im_random_host:
+            vf.set_mode(OstProto::VariableField::kRandom);
+            vf.set_value(0);
+            break;
+        default:
+            return false;
+        }
+        varFields.append(vf);
+    }
+
+    if (data.dst_ip_mode() != OstProto::Ip4::e_im_fixed) {
+        OstProto::VariableField vf;
+
+        vf.set_type(OstProto::VariableField::kCounter32);
+        vf.set_offset(kDstAddrOffset);
+        vf.set_mask(~data.dst_ip_mask());
+        vf.set_count(data.dst_ip_count());
+        vf.set_step(1);
+        switch (data.dst_ip_mode()) {
+        case OstProto::Ip4::e_im_inc_host:
+            vf.set_mode(OstProto::VariableField::kIncrement);
+            vf.set_value(data.dst_ip() & ~data.dst_ip_mask());
+            break;
+        case OstProto::Ip4::e_im_dec_host:
+            vf.set_mode(OstProto::VariableField::kDecrement);
+            vf.set_value(data.dst_ip() & ~data.dst_ip_mask());
+            break;
+        case OstProto::Ip4::e_im_random_host:
+            vf.set_mode(OstProto::VariableField::kRandom);
+            vf.set_value(0);
+            break;
+        default:
+            return false;
+        }
+        varFields.append(vf);
+    }
+
+    // variableFields are applied after the fields (see protocolFrameValue)
+    for (int i = 0; i < variableFieldCount(); i++)
+        varFields.append(variableField(i));
+
+    return true;
+}
+
+int Ip4Protocol::writeFrameValue(uchar *buf, int bufSize, int streamIndex,
+        FrameValueAttrib *attrib) const
+{
+    int optLen = data.options().length();
+    int hdrLen = 20 + optLen;
+    int ver, hlen, totLen;
+    quint8 proto;
+
+    if (bufSize < hdrLen)
+        return AbstractProtocol::writeFrameValue(buf, bufSize, streamIndex,
+                                                 attrib);
+
+    // Same as the FieldFrameValue of the individual fields in fieldData()
+    ver = data.is_override_ver() ? (data.ver_hdrlen() >> 4) & 0x0F : 4;
+    hlen = data.is_override_hdrlen() ? data.ver_hdrlen() : 5 + optLen/4;
+    totLen = data.is_override_totlen() ? data.totlen() :
+                protocolFramePayloadSize(streamIndex) + hdrLen;
+    proto = data.is_override_proto() ?
+                data.proto() : payloadProtocolId(ProtocolIdIp);
+
+    buf[0] = ((ver & 0x0F) << 4) | (hlen & 0x0F);
+    buf[1] = data.tos();
+    qToBigEndian(quint16(totLen), buf + 2);
+    qToBigEndian(quint16(data.id()), buf + 4);
+    qToBigEndian(quint16(((data.flags() & 0x07) << 13)
+                            | (data.frag_ofs() & 0x1FFF)), buf + 6);
+    buf[8] = data.ttl();
+    buf[9] = proto;
+    qToBigEndian(quint16(data.is_override_cksum() ? data.cksum() : 0),
+                 buf + 10);
+    qToBigEndian(fieldData(ip4_srcAddr, FieldValue, streamIndex).toUInt(),
+                 buf + 12);
+    qToBigEndian(fieldData(ip4_dstAddr, FieldValue, streamIndex).toUInt(),
+                 buf + 16);
+    memcpy(buf + 20, data.options().c_str(), optLen);
+
+    applyProtocolFrameVariableFields(buf, hdrLen, streamIndex);
+
+    // The checksum is over the header with the cksum field zeroed
+    if (!data.is_override_cksum()) {
+        quint16 cksum = ~checksumOnesSum(buf, hdrLen);
+        memcpy(buf + 10, &cksum, sizeof(cksum));
+    }
+
+    return hdrLen;
+}
+
 quint32 Ip4Protocol::protocolFrameCksum(int streamIndex,
     CksumType cksumType, CksumFlags cksumFlags) const
 {
@@ -852,8 +977,12 @@ quint32 Ip4Protocol::protocolFrameCksum(int streamIndex,
         case CksumIpPseudo:
         {
             quint32 sum = 0;
-            QByteArray fv = protocolFrameValue(streamIndex);
-            const quint8 *p = (quint8*) fv.constData();
+            uchar hdr[kMaxHdrLen];
+            const quint8 *p = hdr;
+
+            // A longer header (bogus options) is truncated, but we need
+            // only the first 20 bytes anyway
+            writeFrameValue(hdr, sizeof(hdr), streamIndex);
 
             sum += *((quint16*)(p + 12)); // src-ip hi
             sum += *((quint16*)(p + 14)); // src-ip lo
@@ -64,6 +64,16 @@ public:
         ip4_fieldCount
     };
 
+    // Offsets of the variable fields that describe the src/dst addr modes
+    // (see protocolFrameVariableFields()) and the keys of the random
+    // generators for the random host modes - the same as FrameTemplate uses
+    static const int kSrcAddrOffset = 12;
+    static const int kDstAddrOffset = 16;
+    static const quint64 kSrcAddrRandomKey =
+                            kVariableFieldRandomKey | kSrcAddrOffset;
+    static const quint64 kDstAddrRandomKey =
+                            kVariableFieldRandomKey | kDstAddrOffset;
+
     Ip4Protocol(StreamBase *stream, AbstractProtocol *parent = 0);
     virtual ~Ip4Protocol();
 
@@ -87,12 +97,19 @@ public:
             FieldAttrib attrib = FieldValue);
 
     virtual int protocolFrameVariableCount() const;
+    virtual bool protocolFrameVariableFields(
+        QList<OstProto::VariableField> &varFields) const;
+
+    virtual int writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex = 0, FrameValueAttrib *attrib = nullptr) const;
 
     virtual quint32 protocolFrameCksum(int streamIndex = 0,
         CksumType cksumType = CksumIp, CksumFlags cksumFlags = 0) const;
 
     virtual bool hasErrors(QStringList *errors = nullptr) const;
 private:
+    static const int kMaxHdrLen = 60;
+
     OstProto::Ip4    data;
 };
 
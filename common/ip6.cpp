@@ -315,39 +315,7 @@ QVariant Ip6Protocol::fieldData(int index, FieldAttrib attrib,
 
         case ip6_srcAddress:
         {
-            int u;
-            UInt128 mask = 0;
-            UInt128 prefix = 0;
-            UInt128 host = 0;
-            UInt128 src(data.src_addr_hi(), data.src_addr_lo());
-
-            switch(data.src_addr_mode())
-            {
-                case OstProto::Ip6::kFixed:
-                    break;
-                case OstProto::Ip6::kIncHost:
-                case OstProto::Ip6::kDecHost:
-                case OstProto::Ip6::kRandomHost:
-                    u = streamIndex % data.src_addr_count();
-                    mask = ~UInt128(0, 0) << (128 - data.src_addr_prefix());
-                    prefix = src & mask;
-                    if (data.src_addr_mode() == OstProto::Ip6::kIncHost) {
-                        host = ((src & ~mask) + u) & ~mask;
-                    } 
-                    else if (data.src_addr_mode() == OstProto::Ip6::kDecHost) {
-                        host = ((src & ~mask) - u) & ~mask;
-                    } 
-                    else if (data.src_addr_mode()==OstProto::Ip6::kRandomHost) {
-                        // XXX: qrand is int (32bit) not 64bit, some stdlib
-                        // implementations have RAND_MAX as low as 0x7FFF
-                        host = UInt128(qrand(), qrand()) & ~mask;
-                    }
-                    src = prefix | host;
-                    break;
-                default:
-                    qWarning("Unhandled src_addr_mode = %d", 
-                            data.src_addr_mode());
-            }
+            UInt128 src = srcAddress(streamIndex);
 
             switch(attrib)
             {
@@ -378,39 +346,7 @@ QVariant Ip6Protocol::fieldData(int index, FieldAttrib attrib,
 
         case ip6_dstAddress:
         {
-            int u;
-            UInt128 mask = 0;
-            UInt128 prefix = 0;
-            UInt128 host = 0;
-            UInt128 dst(data.dst_addr_hi(), data.dst_addr_lo());
-
-            switch(data.dst_addr_mode())
-            {
-                case OstProto::Ip6::kFixed:
-                    break;
-                case OstProto::Ip6::kIncHost:
-                case OstProto::Ip6::kDecHost:
-                case OstProto::Ip6::kRandomHost:
-                    u = streamIndex % data.dst_addr_count();
-                    mask = ~UInt128(0, 0) << (128 - data.dst_addr_prefix());
-                    prefix = dst & mask;
-                    if (data.dst_addr_mode() == OstProto::Ip6::kIncHost) {
-                        host = ((dst & ~mask) + u) & ~mask;
-                    } 
-                    else if (data.dst_addr_mode() == OstProto::Ip6::kDecHost) {
-                        host = ((dst & ~mask) - u) & ~mask;
-                    } 
-                    else if (data.dst_addr_mode()==OstProto::Ip6::kRandomHost) {
-                        // XXX: qrand is int (32bit) not 64bit, some stdlib
-                        // implementations have RAND_MAX as low as 0x7FFF
-                        host = UInt128(qrand(), qrand()) & ~mask;
-                    }
-                    dst = prefix | host;
-                    break;
-                default:
-                    qWarning("Unhandled dst_addr_mode = %d", 
-                            data.dst_addr_mode());
-            }
+            UInt128 dst = dstAddress(streamIndex);
 
             switch(attrib)
             {
@@ -767,17 +703,221 @@ int Ip6Protocol::protocolFrameVariableCount() const
     return count;
 }
 
+/*
+ * Describes the ip6 address mode as a 32-bit counter - possible only if the
+ * host part of the address fits in the lowest 32 bits (prefix >= 96);
+ * 'offset' is the offset of those lowest 32 bits
+ */
+static bool addrVariableField(OstProto::Ip6::AddrMode mode, quint64 addrLo,
+        uint prefix, uint count, uint offset, OstProto::VariableField &vf)
+{
+    quint32 hostMask;
+
+    if (prefix < 96)
+        return false;
+
+    hostMask = (prefix >= 128) ? 0 : (0xFFFFFFFF >> (prefix - 96));
+
+    vf.set_type(OstProto::VariableField::kCounter32);
+    vf.set_offset(offset);
+    vf.set_mask(hostMask);
+    vf.set_count(count);
+    vf.set_step(1);
+    switch (mode) {
+    case OstProto::Ip6::kIncHost:
+        vf.set_mode(OstProto::VariableField::kIncrement);
+        vf.set_value(quint32(addrLo) & hostMask);
+        break;
+    case OstProto::Ip6::kDecHost:
+        vf.set_mode(OstProto::VariableField::kDecrement);
+        vf.set_value(quint32(addrLo) & hostMask);
+        break;
+    case OstProto::Ip6::kRandomHost:
+        vf.set_mode(OstProto::VariableField::kRandom);
+        vf.set_value(0);
+        break;
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+bool Ip6Protocol::protocolFrameVariableFields(
+        QList<OstProto::VariableField> &varFields) const
+{
+    if (data.src_addr_mode() != OstProto::Ip6::kFixed) {
+        OstProto::VariableField vf;
+
+        if (!addrVariableField(data.src_addr_mode(), data.src_addr_lo(),
+                    data.src_addr_prefix(), data.src_addr_count(),
+                    kSrcAddrHostOffset, vf))
+            return false;
+        varFields.append(vf);
+    }
+
+    if (data.dst_addr_mode() != OstProto::Ip6::kFixed) {
+        OstProto::VariableField vf;
+
+        if (!addrVariableField(data.dst_addr_mode(), data.dst_addr_lo(),
+                    data.dst_addr_prefix(), data.dst_addr_count(),
+                    kDstAddrHostOffset, vf))
+            return false;
+        varFields.append(vf);
+    }
+
+    for (int i = 0; i < variableFieldCount(); i++)
+        varFields.append(variableField(i));
+
+    return true;
+}
+
+UInt128 Ip6Protocol::srcAddress(int streamIndex) const
+{
+    int u;
+    UInt128 mask = 0;
+    UInt128 prefix = 0;
+    UInt128 host = 0;
+    UInt128 src(data.src_addr_hi(), data.src_addr_lo());
+
+    switch(data.src_addr_mode())
+    {
+        case OstProto::Ip6::kFixed:
+            break;
+        case OstProto::Ip6::kIncHost:
+        case OstProto::Ip6::kDecHost:
+        case OstProto::Ip6::kRandomHost:
+            u = streamIndex % data.src_addr_count();
+            mask = ~UInt128(0, 0) << (128 - data.src_addr_prefix());
+            prefix = src & mask;
+            if (data.src_addr_mode() == OstProto::Ip6::kIncHost) {
+                host = ((src & ~mask) + u) & ~mask;
+            } 
+            else if (data.src_addr_mode() == OstProto::Ip6::kDecHost) {
+                host = ((src & ~mask) - u) & ~mask;
+            } 
+            else if (data.src_addr_mode()==OstProto::Ip6::kRandomHost) {
+                CounterRng rng = protocolRandomGenerator(ip6_srcAddress);
+                // The lowest 32 bits are keyed as the variable field that
+                // describes the mode (see addrVariableField()) - so that
+                // FrameTemplate derives the same values
+                quint64 lo = (rng.value(2*quint64(streamIndex) + 1)
+                                    & ~Q_UINT64_C(0xFFFFFFFF))
+                        | protocolRandomGenerator(
+                                kSrcAddrHostRandomKey).value32(
+                                    streamIndex);
+
+                host = UInt128(rng.value(2*quint64(streamIndex)), lo)
+                            & ~mask;
+            }
+            src = prefix | host;
+            break;
+        default:
+            qWarning("Unhandled src_addr_mode = %d", 
+                    data.src_addr_mode());
+    }
+
+    return src;
+}
+
+UInt128 Ip6Protocol::dstAddress(int streamIndex) const
+{
+    int u;
+    UInt128 mask = 0;
+    UInt128 prefix = 0;
+    UInt128 host = 0;
+    UInt128 dst(data.dst_addr_hi(), data.dst_addr_lo());
+
+    switch(data.dst_addr_mode())
+    {
+        case OstProto::Ip6::kFixed:
+            break;
+        case OstProto::Ip6::kIncHost:
+        case OstProto::Ip6::kDecHost:
+        case OstProto::Ip6::kRandomHost:
+            u = streamIndex % data.dst_addr_count();
+            mask = ~UInt128(0, 0) << (128 - data.dst_addr_prefix());
+            prefix = dst & mask;
+            if (data.dst_addr_mode() == OstProto::Ip6::kIncHost) {
+                host = ((dst & ~mask) + u) & ~mask;
+            } 
+            else if (data.dst_addr_mode() == OstProto::Ip6::kDecHost) {
+                host = ((dst & ~mask) - u) & ~mask;
+            } 
+            else if (data.dst_addr_mode()==OstProto::Ip6::kRandomHost) {
+                CounterRng rng = protocolRandomGenerator(ip6_dstAddress);
+                // See srcAddress()
+                quint64 lo = (rng.value(2*quint64(streamIndex) + 1)
+                                    & ~Q_UINT64_C(0xFFFFFFFF))
+                        | protocolRandomGenerator(
+                                kDstAddrHostRandomKey).value32(
+                                    streamIndex);
+
+                host = UInt128(rng.value(2*quint64(streamIndex)), lo)
+                            & ~mask;
+            }
+            dst = prefix | host;
+            break;
+        default:
+            qWarning("Unhandled dst_addr_mode = %d", 
+                    data.dst_addr_mode());
+    }
+
+    return dst;
+}
+
+int Ip6Protocol::writeFrameValue(uchar *buf, int bufSize, int streamIndex,
+        FrameValueAttrib *attrib) const
+{
+    quint8 ver, nextHdr;
+    quint16 payloadLen;
+
+    if (bufSize < 40)
+        return AbstractProtocol::writeFrameValue(buf, bufSize, streamIndex,
+                                                 attrib);
+
+    // Same as the FieldFrameValue of the individual fields in fieldData()
+    ver = data.is_override_version() ? data.version() & 0xF : 0x6;
+    payloadLen = data.is_override_payload_length() ?
+        data.payload_length() : protocolFramePayloadSize(streamIndex);
+    if (data.is_override_next_header()) {
+        nextHdr = data.next_header();
+    }
+    else {
+        nextHdr = payloadProtocolId(ProtocolIdIp);
+        if ((nextHdr == 0)
+                && next
+                && (next->protocolIdType() == ProtocolIdNone)) {
+            nextHdr = 0x3b; // IPv6 No-Next-Header
+        }
+    }
+
+    qToBigEndian(quint32((quint32(ver) << 28)
+                            | ((data.traffic_class() & 0xFF) << 20)
+                            | (data.flow_label() & 0xFFFFF)), buf);
+    qToBigEndian(payloadLen, buf + 4);
+    buf[6] = nextHdr;
+    buf[7] = data.hop_limit() & 0xFF;
+    qToBigEndian(srcAddress(streamIndex), buf + 8);
+    qToBigEndian(dstAddress(streamIndex), buf + 24);
+
+    applyProtocolFrameVariableFields(buf, 40, streamIndex);
+    return 40;
+}
+
 quint32 Ip6Protocol::protocolFrameCksum(int streamIndex, 
         CksumType cksumType, CksumFlags cksumFlags) const
 {
     if (cksumType == CksumIpPseudo)
     {
         quint32 sum = 0;
-        QByteArray fv = protocolFrameValue(streamIndex);
-        const quint8 *p = (quint8*) fv.constData();
+        uchar fv[40];
+        const quint8 *p = fv;
+
+        writeFrameValue(fv, sizeof(fv), streamIndex);
 
         // src-ip, dst-ip
-        for (int i = 8; i < fv.size(); i+=2)
+        for (uint i = 8; i < sizeof(fv); i+=2)
             sum += *((quint16*)(p + i));
 
         // XXX: payload length and protocol are also part of the
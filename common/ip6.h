@@ -22,6 +22,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "abstractprotocol.h"
 #include "ip6.pb.h"
+#include "uint128.h"
 
 /* 
 IPv6 Protocol Frame Format -
@@ -76,6 +77,17 @@ public:
         ip6_fieldCount
     };
 
+    // Offsets of the variable fields that describe the src/dst addr modes
+    // - the lowest 32 bits of the address (see addrVariableField()) - and
+    // the keys of the random generators for those bits in the random host
+    // modes - the same as FrameTemplate uses
+    static const int kSrcAddrHostOffset = 20;
+    static const int kDstAddrHostOffset = 36;
+    static const quint64 kSrcAddrHostRandomKey =
+                            kVariableFieldRandomKey | kSrcAddrHostOffset;
+    static const quint64 kDstAddrHostRandomKey =
+                            kVariableFieldRandomKey | kDstAddrHostOffset;
+
     Ip6Protocol(StreamBase *stream, AbstractProtocol *parent = 0);
     virtual ~Ip6Protocol();
 
@@ -101,12 +113,20 @@ public:
             FieldAttrib attrib = FieldValue);
 
     virtual int protocolFrameVariableCount() const;
+    virtual bool protocolFrameVariableFields(
+        QList<OstProto::VariableField> &varFields) const;
+
+    virtual int writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex = 0, FrameValueAttrib *attrib = nullptr) const;
 
     virtual quint32 protocolFrameCksum(int streamIndex = 0,
             CksumType cksumType = CksumIp, CksumFlags cksumFlags = 0) const;
 
     virtual bool hasErrors(QStringList *errors = nullptr) const;
 private:
+    UInt128 srcAddress(int streamIndex) const;
+    UInt128 dstAddress(int streamIndex) const;
+
     OstProto::Ip6 data;
 };
 
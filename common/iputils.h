@@ -20,6 +20,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #ifndef _IP_UTILS_H
 #define _IP_UTILS_H
 
+#include "counterrng.h"
 #include "uint128.h"
 
 #include <QHostAddress>
@@ -32,8 +33,9 @@ enum AddrMode {
     kRandom = 3
 };
 
+// For kRandom, 'rng' generates the random host for 'index'
 quint32 inline ipAddress(quint32 baseIp, int prefix, AddrMode mode, int count, 
-                    int index)
+                    int index, const CounterRng &rng = CounterRng())
 {
     int u;
     quint32 mask = ((1<<prefix) - 1) << (32 - prefix);
@@ -60,7 +62,7 @@ quint32 inline ipAddress(quint32 baseIp, int prefix, AddrMode mode, int count,
         break;
     case kRandom:
         subnet = baseIp & mask;
-        host = (qrand() & ~mask);
+        host = (rng.value32(index) & ~mask);
         ip = subnet | host;
         break;
     default:
@@ -72,7 +74,8 @@ quint32 inline ipAddress(quint32 baseIp, int prefix, AddrMode mode, int count,
 }
 
 void inline ipAddress(quint64 baseIpHi, quint64 baseIpLo, int prefix, 
-        AddrMode mode, int count, int index, quint64 &ipHi, quint64 &ipLo)
+        AddrMode mode, int count, int index, quint64 &ipHi, quint64 &ipLo,
+        const CounterRng &rng = CounterRng())
 {
     int u, p, q;
     quint64 maskHi = 0, maskLo = 0;
@@ -111,8 +114,8 @@ void inline ipAddress(quint64 baseIpHi, quint64 baseIpLo, int prefix,
                 hostLo = ((baseIpLo & ~maskLo) - u) & ~maskLo;
             } 
             else if (mode==kRandom) {
-                hostHi = qrand() & ~maskHi;
-                hostLo = qrand() & ~maskLo;
+                hostHi = rng.value(2*quint64(index)) & ~maskHi;
+                hostLo = rng.value(2*quint64(index) + 1) & ~maskLo;
             }
             ipHi = prefixHi | hostHi;
             ipLo = prefixLo | hostLo;
@@ -24,14 +24,21 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include <QRegExp>
 
+#include <limits.h>
+#include <string.h>
+
 #define uintToMacStr(num)    \
     QString("%1").arg(num, 6*2, BASE_HEX, QChar('0')) \
         .replace(QRegExp("([0-9a-fA-F]{2}\\B)"), "\\1:").toUpper()
 
+// Set while a frame is built to resolve a mac address - the resolving
+// frame has the mac address as 0; per thread, since frames of a stream
+// may be built by many threads at once
+static thread_local bool forResolve = false;
+
 MacProtocol::MacProtocol(StreamBase *stream, AbstractProtocol *parent)
     : AbstractProtocol(stream, parent)
 {
-    forResolve_ = false;
 }
 
 MacProtocol::~MacProtocol()
@@ -129,12 +136,12 @@ QVariant MacProtocol::fieldData(int index, FieldAttrib attrib,
                     dstMac = data.dst_mac() - u;
                     break;
                 case OstProto::Mac::e_mm_resolve:
-                    if (forResolve_)
+                    if (forResolve)
                         dstMac = 0;
                     else {
-                        forResolve_ = true;
+                        forResolve = true;
                         dstMac = mpStream->neighborMacAddress(streamIndex);
-                        forResolve_ = false;
+                        forResolve = false;
                     }
                     break;
                 default:
@@ -183,12 +190,12 @@ QVariant MacProtocol::fieldData(int index, FieldAttrib attrib,
                     srcMac = data.src_mac() - u;
                     break;
                 case OstProto::Mac::e_mm_resolve:
-                    if (forResolve_)
+                    if (forResolve)
                         srcMac = 0;
                     else {
-                        forResolve_ = true;
+                        forResolve = true;
                         srcMac = mpStream->deviceMacAddress(streamIndex);
-                        forResolve_ = false;
+                        forResolve = false;
                     }
                     break;
                 default:
@@ -349,6 +356,14 @@ _exit:
     return isOk;
 }
 
+bool MacProtocol::isProtocolFrameValueThreadSafe() const
+{
+    // Resolving an address needs the port lock - which is held by the
+    // thread building the packet list, not by any helper threads
+    return (data.dst_mac_mode() != OstProto::Mac::e_mm_resolve)
+        && (data.src_mac_mode() != OstProto::Mac::e_mm_resolve);
+}
+
 int MacProtocol::protocolFrameVariableCount() const
 {
     int count = AbstractProtocol::protocolFrameVariableCount();
@@ -374,20 +389,104 @@ int MacProtocol::protocolFrameVariableCount() const
     return count;
 }
 
+/*
+ * Describes the mac address mode as a 32-bit counter on the lower 32 bits
+ * of the address - possible only if the count*step never carries/borrows
+ * into the upper 16 bits
+ */
+static bool macVariableField(OstProto::Mac::MacAddrMode mode, quint64 mac,
+        uint count, uint step, uint offset, OstProto::VariableField &vf)
+{
+    quint64 range = quint64(count ? count - 1 : 0) * step;
+    quint32 low = quint32(mac);
+
+    if (range > INT_MAX)
+        return false;
+
+    switch (mode) {
+    case OstProto::Mac::e_mm_inc:
+        if ((quint64(low) + range) > 0xFFFFFFFFULL)
+            return false;
+        vf.set_mode(OstProto::VariableField::kIncrement);
+        break;
+    case OstProto::Mac::e_mm_dec:
+        if (quint64(low) < range)
+            return false;
+        vf.set_mode(OstProto::VariableField::kDecrement);
+        break;
+    default:
+        return false;
+    }
+
+    vf.set_type(OstProto::VariableField::kCounter32);
+    vf.set_offset(offset + 2);
+    vf.set_mask(0xFFFFFFFF);
+    vf.set_value(low);
+    vf.set_count(count);
+    vf.set_step(step);
+
+    return true;
+}
+
+bool MacProtocol::protocolFrameVariableFields(
+        QList<OstProto::VariableField> &varFields) const
+{
+    // XXX: protocolFrameValue() is reimplemented and does not apply
+    // variableFields, so we don't describe those either
+
+    // Resolved addresses may vary with the other variable fields
+    // (e.g. the dst ip) in ways we cannot describe
+    if (((data.dst_mac_mode() == OstProto::Mac::e_mm_resolve)
+                || (data.src_mac_mode() == OstProto::Mac::e_mm_resolve))
+            && (mpStream->frameVariableCount() > 1))
+        return false;
+
+    if ((data.dst_mac_mode() == OstProto::Mac::e_mm_inc)
+            || (data.dst_mac_mode() == OstProto::Mac::e_mm_dec)) {
+        OstProto::VariableField vf;
+
+        if (!macVariableField(data.dst_mac_mode(), data.dst_mac(),
+                    data.dst_mac_count(), data.dst_mac_step(), 0, vf))
+            return false;
+        varFields.append(vf);
+    }
+
+    if ((data.src_mac_mode() == OstProto::Mac::e_mm_inc)
+            || (data.src_mac_mode() == OstProto::Mac::e_mm_dec)) {
+        OstProto::VariableField vf;
+
+        if (!macVariableField(data.src_mac_mode(), data.src_mac(),
+                    data.src_mac_count(), data.src_mac_step(), 6, vf))
+            return false;
+        varFields.append(vf);
+    }
+
+    return true;
+}
+
 QByteArray MacProtocol::protocolFrameValue(int streamIndex, bool /*forCksum*/,
         FrameValueAttrib *attrib) const
 {
     QByteArray ba;
     ba.resize(12);
+    writeFrameValue((uchar*) ba.data(), ba.size(), streamIndex, attrib);
+    return ba;
+}
+
+int MacProtocol::writeFrameValue(uchar *buf, int bufSize, int streamIndex,
+        FrameValueAttrib *attrib) const
+{
+    uchar fv[12];
+    uchar *p = (bufSize < int(sizeof(fv))) ? fv : buf;
     quint64 dstMac = fieldData(mac_dstAddr, FieldValue, streamIndex)
                         .toULongLong();
     quint64 srcMac = fieldData(mac_srcAddr, FieldValue, streamIndex)
                         .toULongLong();
-    char *p = ba.data();
-    *(quint32*)(p     ) =  qToBigEndian(quint32(dstMac >> 16));
-    *(quint16*)(p +  4) =  qToBigEndian(quint16(dstMac & 0xffff));
-    *(quint32*)(p +  6) =  qToBigEndian(quint32(srcMac >> 16));
-    *(quint16*)(p + 10) =  qToBigEndian(quint16(srcMac & 0xffff));
+
+    qToBigEndian(quint32(dstMac >> 16), p);
+    qToBigEndian(quint16(dstMac & 0xffff), p + 4);
+    qToBigEndian(quint32(srcMac >> 16), p + 6);
+    qToBigEndian(quint16(srcMac & 0xffff), p + 10);
 
     if (attrib) {
         if (!dstMac && data.dst_mac_mode() == OstProto::Mac::e_mm_resolve)
@@ -396,7 +495,11 @@ QByteArray MacProtocol::protocolFrameValue(int streamIndex, bool /*forCksum*/,
             attrib->errorFlags |= FrameValueAttrib::UnresolvedSrcMacError;
     }
 
-    return ba;
+    if (p != buf) {
+        memcpy(buf, fv, bufSize);
+        return bufSize;
+    }
+    return sizeof(fv);
 }
 
 bool MacProtocol::hasErrors(QStringList *errors) const
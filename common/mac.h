@@ -63,15 +63,19 @@ public:
     virtual bool setFieldData(int index, const QVariant &value, 
             FieldAttrib attrib = FieldValue);
 
+    virtual bool isProtocolFrameValueThreadSafe() const;
     virtual int protocolFrameVariableCount() const;
+    virtual bool protocolFrameVariableFields(
+        QList<OstProto::VariableField> &varFields) const;
 
     virtual QByteArray protocolFrameValue(int streamIndex = 0,
         bool forCksum = false, FrameValueAttrib *attrib = nullptr) const;
+    virtual int writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex = 0, FrameValueAttrib *attrib = nullptr) const;
 
     virtual bool hasErrors(QStringList *errors = nullptr) const;
 private:
     OstProto::Mac    data;
-    mutable bool forResolve_;
 };
 
 #endif
@@ -45,6 +45,11 @@ PROTOS += \
 HEADERS = \
     abstractprotocol.h    \
     comboprotocol.h    \
+    checksum.h \
+    counterrng.h \
+    frametemplate.h \
+    histogram.h \
+    parallelframebuilder.h \
     protocolmanager.h \
     protocollist.h \
     protocollistiterator.h \
@@ -85,7 +90,11 @@ HEADERS += \
 
 SOURCES = \
     abstractprotocol.cpp \
+    checksum.cpp \
     crc32c.cpp \
+    frametemplate.cpp \
+    histogram.cpp \
+    parallelframebuilder.cpp \
     protocolmanager.cpp \
     protocollist.cpp \
     protocollistiterator.cpp \
@@ -0,0 +1,236 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "parallelframebuilder.h"
+
+#include "frametemplate.h"
+#include "streambase.h"
+
+#include <QRunnable>
+#include <QThread>
+
+class ParallelFrameBuilder::Task : public QRunnable
+{
+public:
+    Task(const Job &job, int frameIndex, int count, uchar *arena, Slot *slot)
+        : job_(job), frameIndex_(frameIndex), count_(count),
+          arena_(arena), slot_(slot)
+    {
+    }
+    virtual void run()
+    {
+        ParallelFrameBuilder::buildFrames(job_, frameIndex_, count_,
+                                          arena_, slot_);
+    }
+
+private:
+    Job job_;
+    int frameIndex_;
+    int count_;
+    uchar *arena_;
+    Slot *slot_;
+};
+
+/*!
+  Creates a frame builder that builds frames of upto 'bufMaxSize' bytes
+  (longer frames are truncated, same as StreamBase::frameValue()) using
+  upto 'maxThreads' threads; if 'maxThreads' is 0, as many threads as
+  there are CPU cores are used
+*/
+ParallelFrameBuilder::ParallelFrameBuilder(int bufMaxSize, int maxThreads)
+    : bufMaxSize_(bufMaxSize)
+{
+    if (maxThreads <= 0)
+        maxThreads = QThread::idealThreadCount();
+    pool_.setMaxThreadCount(qMax(maxThreads, 1));
+}
+
+/*!
+  Appends frames 0 to 'count'-1 of the stream compiled into
+  'frameTemplate' to the frames to be built
+
+  The first frame of the stream MUST have been built already by the
+  calling thread - this fills any lazily built caches of the stream and
+  its protocols, which are not safe to fill concurrently. The template
+  (and its stream) MUST not be changed or destroyed until all its frames
+  have been handed out by nextFrame()
+*/
+void ParallelFrameBuilder::addFrames(const FrameTemplate *frameTemplate,
+                                     int count)
+{
+    const StreamBase *stream = frameTemplate->stream();
+    Job job;
+    int size;
+
+    if (count <= 0)
+        return;
+
+    // Slot size is the largest frame that the stream can have
+    switch (stream->lenMode()) {
+    case StreamBase::e_fl_fixed:
+        size = stream->frameLen();
+        break;
+    case StreamBase::e_fl_inc:
+    case StreamBase::e_fl_dec:
+    case StreamBase::e_fl_random:
+        if (stream->frameLenMin() <= stream->frameLenMax()) {
+            size = stream->frameLenMax();
+            break;
+        }
+        // fall-through
+    default:
+        size = bufMaxSize_;
+        break;
+    }
+
+    job.frameTemplate = frameTemplate;
+    job.count = count;
+    job.slotSize = qMin(size, bufMaxSize_);
+
+    // A compiled template derives all frames from its template frame
+    // without calling into the stream - which is always safe
+    if (frameTemplate->isCompiled())
+        job.concurrency = StreamBase::e_fvc_frame;
+    else
+        job.concurrency = stream->frameValueConcurrency();
+    jobs_.append(job);
+}
+
+/*!
+  Returns the next frame (in the order added) and its length - the frame
+  contents are valid until the next call of this function
+
+  Any frame attributes are added to 'attrib', if given
+*/
+int ParallelFrameBuilder::nextFrame(const uchar **frame,
+                                    FrameValueAttrib *attrib)
+{
+    if (nextSlot_ >= slots_.size())
+        buildWindow();
+
+    if (nextSlot_ >= slots_.size()) {
+        qWarning("%s: no more frames to build", __FUNCTION__);
+        *frame = nullptr;
+        return 0;
+    }
+
+    const Slot &slot = slots_.at(nextSlot_++);
+
+    *frame = (const uchar*) arena_.constData() + slot.offset;
+    if (attrib)
+        *attrib += slot.attrib;
+    return slot.len;
+}
+
+/*
+ * Builds the next window of frames - slots for as many frames as fit are
+ * reserved and the frames are then built as independent tasks, each
+ * writing only into its own slots
+ */
+void ParallelFrameBuilder::buildWindow()
+{
+    struct Range {
+        int job;
+        int frameIndex;
+        int count;
+        int slot;
+    };
+    QVector<Range> poolRanges;
+    QVector<Range> callerRanges; // must be built by the calling thread
+    int threads = pool_.maxThreadCount();
+    int bytes = 0;
+
+    slots_.clear();
+    nextSlot_ = 0;
+
+    while (job_ < jobs_.size()) {
+        const Job &job = jobs_.at(job_);
+        Range range = { job_, jobFrame_, 0, slots_.size() };
+
+        while ((jobFrame_ < job.count)
+                && (slots_.isEmpty()
+                    || ((slots_.size() < kWindowFrames)
+                        && (bytes + job.slotSize <= kWindowBytes)))) {
+            Slot slot;
+
+            slot.offset = bytes;
+            slot.len = 0;
+            slots_.append(slot);
+            bytes += job.slotSize;
+            jobFrame_++;
+            range.count++;
+        }
+
+        switch (job.concurrency) {
+        case StreamBase::e_fvc_frame: {
+            // Split into frame index ranges - enough for all threads
+            int chunk = qMax((range.count + threads - 1)/threads,
+                             int(kTaskFrames));
+
+            for (int i = 0; i < range.count; i += chunk) {
+                Range r = { range.job, range.frameIndex + i,
+                            qMin(chunk, range.count - i), range.slot + i };
+                poolRanges.append(r);
+            }
+            break;
+        }
+        case StreamBase::e_fvc_stream:
+            poolRanges.append(range);
+            break;
+        default:
+            callerRanges.append(range);
+            break;
+        }
+
+        if (jobFrame_ < job.count)
+            break; // window is full
+
+        job_++;
+        jobFrame_ = 0;
+    }
+
+    if (arena_.size() < bytes)
+        arena_.resize(bytes);
+
+    // Not worth handing off to the pool if there's nothing to parallelize
+    if ((threads <= 1) || (poolRanges.size() + callerRanges.size() <= 1)) {
+        callerRanges += poolRanges;
+        poolRanges.clear();
+    }
+
+    uchar *arena = (uchar*) arena_.data();
+    Slot *slots = slots_.data();
+
+    foreach (const Range &r, poolRanges)
+        pool_.start(new Task(jobs_.at(r.job), r.frameIndex, r.count,
+                             arena, slots + r.slot));
+    foreach (const Range &r, callerRanges)
+        buildFrames(jobs_.at(r.job), r.frameIndex, r.count,
+                    arena, slots + r.slot);
+
+    pool_.waitForDone();
+}
+
+void ParallelFrameBuilder::buildFrames(const Job &job, int frameIndex,
+                                       int count, uchar *arena, Slot *slot)
+{
+    for (int i = 0; i < count; i++, slot++)
+        slot->len = job.frameTemplate->frameValue(arena + slot->offset,
+                job.slotSize, frameIndex + i, &slot->attrib);
+}
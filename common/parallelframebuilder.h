@@ -0,0 +1,86 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _PARALLEL_FRAME_BUILDER_H
+#define _PARALLEL_FRAME_BUILDER_H
+
+#include "framevalueattrib.h"
+
+#include <QByteArray>
+#include <QThreadPool>
+#include <QVector>
+
+class FrameTemplate;
+
+/*
+ * Builds the frames of a sequence of streams on a pool of worker threads
+ * while handing them out in order - so that the caller can append them to
+ * the packet list one by one, same as if it had built them itself
+ *
+ * Frames are built a window at a time into pre-reserved slots; a window
+ * spans as many streams as required, and is split into tasks by stream
+ * and, for streams that can build their frames concurrently (see
+ * StreamBase::frameValueConcurrency()), by frame index ranges
+ *
+ * Every frame is built by the same FrameTemplate::frameValue() call as a
+ * serial build, so the frames are byte for byte the same
+ */
+class ParallelFrameBuilder
+{
+public:
+    ParallelFrameBuilder(int bufMaxSize, int maxThreads = 0);
+
+    void addFrames(const FrameTemplate *frameTemplate, int count);
+    int nextFrame(const uchar **frame, FrameValueAttrib *attrib = nullptr);
+
+private:
+    struct Job {
+        const FrameTemplate *frameTemplate;
+        int count;
+        int slotSize;
+        int concurrency; // StreamBase::FrameValueConcurrency
+    };
+    struct Slot {
+        int offset;     // in arena
+        int len;
+        FrameValueAttrib attrib;
+    };
+    class Task;
+
+    void buildWindow();
+    static void buildFrames(const Job &job, int frameIndex, int count,
+                            uchar *arena, Slot *slot);
+
+    static const int kWindowFrames = 8192;
+    static const int kWindowBytes = 32*1024*1024;
+    static const int kTaskFrames = 64; // min frames per task
+
+    int bufMaxSize_;
+    QThreadPool pool_;
+
+    QVector<Job> jobs_;
+    int job_{0};        // next frame to build - job
+    int jobFrame_{0};   // next frame to build - frame index in job
+
+    QByteArray arena_;
+    QVector<Slot> slots_;
+    int nextSlot_{0};   // next frame to hand out
+};
+
+#endif
@@ -20,6 +20,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "payload.h"
 #include "streambase.h"
 
+#include <string.h>
+
 PayloadProtocol::PayloadProtocol(StreamBase *stream, AbstractProtocol *parent)
     : AbstractProtocol(stream, parent)
 {
@@ -73,8 +75,6 @@ int PayloadProtocol::protocolFrameSize(int streamIndex) const
     if (len < 0)
         len = 0;
 
-    qDebug("%s: this = %p, streamIndex = %d, len = %d", __FUNCTION__, this,
-            streamIndex, len);
     return len;
 }
 
@@ -147,10 +147,20 @@ QVariant PayloadProtocol::fieldData(int index, FieldAttrib attrib,
                                 fv[i] = 0xFF - (i % (0xFF + 1));
                             break;
                         case OstProto::Payload::e_dp_random:
-                            //! \todo (HIGH) cksum is incorrect for random pattern
-                            for (int i = 0; i < dataLen; i++)
-                                fv[i] =  qrand() % (0xFF + 1);
+                        {
+                            // The random bytes of a frame are the same
+                            // every time, so cksums over them are correct
+                            CounterRng rng = protocolRandomGenerator(
+                                                    streamIndex);
+                            quint64 r = 0;
+
+                            for (int i = 0; i < dataLen; i++) {
+                                if ((i % 8) == 0)
+                                    r = rng.value(i/8);
+                                fv[i] = char(r >> ((i % 8)*8));
+                            }
                             break;
+                        }
                         default:
                             qWarning("Unhandled data pattern %d", 
                                 data.pattern_mode());
@@ -213,6 +223,56 @@ bool PayloadProtocol::setFieldData(int index, const QVariant &value,
     return isOk;
 }
 
+int PayloadProtocol::writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex, FrameValueAttrib */*attrib*/) const
+{
+    int dataLen = qMin(protocolFrameSize(streamIndex), bufSize);
+    int i = 0;
+
+    // Same as the FieldFrameValue in fieldData()
+    switch(data.pattern_mode())
+    {
+        case OstProto::Payload::e_dp_fixed_word:
+        {
+            uchar word[4];
+
+            qToBigEndian((quint32) data.pattern(), word);
+            for (; (i + 4) <= dataLen; i += 4)
+                memcpy(buf + i, word, 4);
+            for (; i < dataLen; i++)
+                buf[i] = word[i % 4];
+            break;
+        }
+        case OstProto::Payload::e_dp_inc_byte:
+            for (; i < dataLen; i++)
+                buf[i] = i % (0xFF + 1);
+            break;
+        case OstProto::Payload::e_dp_dec_byte:
+            for (; i < dataLen; i++)
+                buf[i] = 0xFF - (i % (0xFF + 1));
+            break;
+        case OstProto::Payload::e_dp_random:
+        {
+            CounterRng rng = protocolRandomGenerator(streamIndex);
+            quint64 r = 0;
+
+            for (; i < dataLen; i++) {
+                if ((i % 8) == 0)
+                    r = rng.value(i/8);
+                buf[i] = uchar(r >> ((i % 8)*8));
+            }
+            break;
+        }
+        default:
+            qWarning("Unhandled data pattern %d", data.pattern_mode());
+            memset(buf, 0, dataLen);
+            break;
+    }
+
+    applyProtocolFrameVariableFields(buf, dataLen, streamIndex);
+    return dataLen;
+}
+
 bool PayloadProtocol::isProtocolFrameValueVariable() const
 {
     return (AbstractProtocol::isProtocolFrameValueVariable()
@@ -20,6 +20,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "protocollistiterator.h"
 #include "protocollist.h"
 #include "abstractprotocol.h"
+#include "streambase.h"
 
 ProtocolListIterator::ProtocolListIterator(ProtocolList &list)
 {
@@ -70,6 +71,9 @@ void ProtocolListIterator::insert(AbstractProtocol* value)
         value->next = NULL;
 
     _iter->insert(const_cast<AbstractProtocol*>(value));
+
+    if (value->mpStream)
+        value->mpStream->invalidateFrameLayout();
 }
 
 AbstractProtocol* ProtocolListIterator::next()
@@ -94,6 +98,8 @@ AbstractProtocol* ProtocolListIterator::previous()
 
 void ProtocolListIterator::remove()
 {
+    if (_iter->value()->mpStream)
+        _iter->value()->mpStream->invalidateFrameLayout();
     if (_iter->value()->prev)
         _iter->value()->prev->next = _iter->value()->next;
     if (_iter->value()->next)
@@ -110,6 +116,9 @@ void ProtocolListIterator::setValue(AbstractProtocol* value) const
     value->prev = _iter->value()->prev;
     value->next = _iter->value()->next;
     _iter->setValue(const_cast<AbstractProtocol*>(value));
+
+    if (value->mpStream)
+        value->mpStream->invalidateFrameLayout();
 }
 
 void ProtocolListIterator::toBack()
@@ -69,6 +69,11 @@ int SignProtocol::fieldCount() const
     return sign_fieldCount;
 }
 
+int SignProtocol::protocolFrameSize(int /*streamIndex*/) const
+{
+    return data.is_tx_timestamp() ? 13 + kTxTimestampSize : 13;
+}
+
 AbstractProtocol::FieldFlags SignProtocol::fieldFlags(int index) const
 {
     AbstractProtocol::FieldFlags flags;
@@ -80,10 +85,17 @@ AbstractProtocol::FieldFlags SignProtocol::fieldFlags(int index) const
         case sign_magic:
         case sign_tlv_tx_port:
         case sign_tlv_guid:
+        case sign_tlv_tx_timestamp:
         case sign_tlv_ttag:
         case sign_tlv_end:
             break;
 
+        case sign_is_tx_timestamp:
+        case sign_tx_timestamp_interval:
+            flags &= ~FrameField;
+            flags |= MetaField;
+            break;
+
         default:
             qFatal("%s: unimplemented case %d in switch", __PRETTY_FUNCTION__,
                 index);
@@ -143,6 +155,36 @@ QVariant SignProtocol::fieldData(int index, FieldAttrib attrib,
             }
             break;
         }
+        case sign_tlv_tx_timestamp:
+        {
+            switch(attrib)
+            {
+                case FieldName:
+                    return QString("Tx Timestamp");
+                case FieldValue:
+                    return 0;
+                case FieldTextValue:
+                    return data.is_tx_timestamp() ?
+                        QString("every %1 usec")
+                            .arg(data.tx_timestamp_interval()) :
+                        QString("NA");
+                case FieldFrameValue:
+                {
+                    QByteArray fv;
+                    if (!data.is_tx_timestamp())
+                        return fv; // not present
+
+                    fv.fill(0, kTxTimestampSize);
+                    qToBigEndian(quint32(data.tx_timestamp_interval()),
+                                 (uchar*) fv.data() + 3);
+                    fv[7] = kTypeLenTxTimestampPlaceholder;
+                    return fv;
+                }
+                default:
+                    break;
+            }
+            break;
+        }
         case sign_tlv_tx_port:
         {
             switch(attrib)
@@ -209,6 +251,34 @@ QVariant SignProtocol::fieldData(int index, FieldAttrib attrib,
             }
             break;
         }
+
+        // Meta fields
+        case sign_is_tx_timestamp:
+        {
+            switch(attrib)
+            {
+                case FieldName:
+                    return QString("Tx Timestamp");
+                case FieldValue:
+                    return data.is_tx_timestamp();
+                default:
+                    break;
+            }
+            break;
+        }
+        case sign_tx_timestamp_interval:
+        {
+            switch(attrib)
+            {
+                case FieldName:
+                    return QString("Tx Timestamp Interval");
+                case FieldValue:
+                    return data.tx_timestamp_interval();
+                default:
+                    break;
+            }
+            break;
+        }
         default:
             qFatal("%s: unimplemented case %d in switch", __PRETTY_FUNCTION__,
                 index);
@@ -235,6 +305,19 @@ bool SignProtocol::setFieldData(int index, const QVariant &value,
                 data.set_stream_guid(guid & 0xFFFFFF);
             break;
         }
+        case sign_is_tx_timestamp:
+        {
+            data.set_is_tx_timestamp(value.toBool());
+            isOk = true;
+            break;
+        }
+        case sign_tx_timestamp_interval:
+        {
+            uint interval = value.toUInt(&isOk);
+            if (isOk)
+                data.set_tx_timestamp_interval(interval);
+            break;
+        }
         default:
             qFatal("%s: unimplemented case %d in switch", __PRETTY_FUNCTION__,
                 index);
@@ -293,3 +376,67 @@ bool SignProtocol::packetTtagId(const uchar *pkt, int pktLen, uint *ttagId, uint
     }
     return ret;
 }
+
+/*!
+  Returns the tx timestamp (56 LSBs, see kTxTimestampMask), guid and tx
+  port of the packet, if it has a Tx Timestamp TLV (not a placeholder)
+*/
+bool SignProtocol::packetTxTimestamp(const uchar *pkt, int pktLen,
+        quint64 *txNsec, uint *guid, uint *txPort)
+{
+    bool ret = false;
+    const uchar *p = pkt + pktLen - sizeof(kSignMagic);
+    quint32 magic = qFromBigEndian<quint32>(p);
+    if (magic != kSignMagic)
+        return ret;
+
+    *guid = kInvalidGuid;
+    p--;
+    while (*p != kTypeLenEnd) {
+        if (*p == kTypeLenTxTimestamp) {
+            *txNsec = qFromBigEndian<quint64>(p - 8) & kTxTimestampMask;
+            ret = true;
+        } else if (*p == kTypeLenGuid) {
+            *guid = qFromBigEndian<quint32>(p - 3) >> 8;
+        } else if (*p == kTypeLenTxPort) {
+            *txPort = *(p - 1);
+        }
+        p -= 1 + (*p >> 5); // move to next TLV
+    }
+    return ret;
+}
+
+int SignProtocol::writeFrameValue(uchar *buf, int bufSize, int streamIndex,
+        FrameValueAttrib *attrib) const
+{
+    quint32 guid = data.stream_guid() & 0xFFFFFF;
+    int size = protocolFrameSize(streamIndex);
+    uchar *p = buf;
+
+    if (bufSize < size)
+        return AbstractProtocol::writeFrameValue(buf, bufSize, streamIndex,
+                                                 attrib);
+
+    // Same as the FieldFrameValue of the individual fields in fieldData()
+    *p++ = kTypeLenEnd;
+    *p++ = mpStream->portId() & 0xFF;
+    *p++ = kTypeLenTxPort;
+    *p++ = (guid >> 16) & 0xff;
+    *p++ = (guid >>  8) & 0xff;
+    *p++ = (guid >>  0) & 0xff;
+    *p++ = kTypeLenGuid;
+    if (data.is_tx_timestamp()) {
+        *p++ = 0;
+        *p++ = 0;
+        *p++ = 0;
+        qToBigEndian(quint32(data.tx_timestamp_interval()), p);
+        p += 4;
+        *p++ = kTypeLenTxTimestampPlaceholder;
+    }
+    *p++ = 0;
+    *p++ = kTypeLenTtagPlaceholder;
+    qToBigEndian(quint32(kSignMagic), p);
+
+    applyProtocolFrameVariableFields(buf, size, streamIndex);
+    return size;
+}
@@ -47,6 +47,10 @@ Defined TLVs
  Type = 2, Len = 1 (0x22): T-Tag Placeholder (0 value)
  Type = 3, Len = 1 (0x23): T-Tag with actual value
  Type = 4, Len = 1 (0x24): Tx Port Id
+ Type = 5, Len = 7 (0xE5): Tx Timestamp Placeholder (value is the stream's
+                           tx timestamp interval in usecs - 32 LSBs)
+ Type = 6, Len = 7 (0xE6): Tx Timestamp - 56 LSBs of the tx time in nsecs
+                           since the epoch (wraps around every ~2.28 years)
 
 Order of TLVs from end of packet towards beginning [Offset, Size]
  [ -4, 4 bytes] Magic
@@ -54,6 +58,14 @@ Order of TLVs from end of packet towards beginning [Offset, Size]
  [-10, 4 bytes] Stream Guid
  [-12, 2 bytes] Tx Port Id
  [-13, 1 byte ] End
+
+If tx timestamp is enabled, the Tx Timestamp TLV is inserted after TTag
+ [ -4, 4 bytes] Magic
+ [ -6, 2 bytes] TTag (Placeholder or actual)
+ [-14, 8 bytes] Tx Timestamp (Placeholder or actual)
+ [-18, 4 bytes] Stream Guid
+ [-20, 2 bytes] Tx Port Id
+ [-21, 1 byte ] End
 */
 
 class SignProtocol : public AbstractProtocol
@@ -65,11 +77,13 @@ public:
         sign_tlv_end = 0,
         sign_tlv_tx_port,
         sign_tlv_guid,
+        sign_tlv_tx_timestamp,
         sign_tlv_ttag,
         sign_magic,
 
         // Meta Fields
-        // - None
+        sign_is_tx_timestamp,
+        sign_tx_timestamp_interval,
 
         sign_fieldCount
     };
@@ -88,6 +102,7 @@ public:
     virtual QString shortName() const;
 
     virtual int fieldCount() const;
+    virtual int protocolFrameSize(int streamIndex = 0) const;
 
     virtual AbstractProtocol::FieldFlags fieldFlags(int index) const;
     virtual QVariant fieldData(int index, FieldAttrib attrib,
@@ -95,9 +110,21 @@ public:
     virtual bool setFieldData(int index, const QVariant &value,
             FieldAttrib attrib = FieldValue);
 
+    virtual int writeFrameValue(uchar *buf, int bufSize,
+            int streamIndex = 0, FrameValueAttrib *attrib = nullptr) const;
+
     static quint32 magic();
     static bool packetGuid(const uchar *pkt, int pktLen, uint *guid);
     static bool packetTtagId(const uchar *pkt, int pktLen, uint *ttagId, uint *guid);
+    static bool packetTxTimestamp(const uchar *pkt, int pktLen,
+                                  quint64 *txNsec, uint *guid, uint *txPort);
+
+    // Tx Timestamp stamping by the transmit loop (for the fixed layout)
+    static bool isTxTimestampPlaceholder(const uchar *pkt, int pktLen);
+    static uint placeholderGuid(const uchar *pkt, int pktLen);
+    static quint32 placeholderTxTimestampInterval(const uchar *pkt,
+                                                  int pktLen);
+    static void setTxTimestamp(uchar *pkt, int pktLen, quint64 nsec);
 
     // XXX: Any change in kTypeLenXXX or magic value should also be done in
     // TxThread/Ttag code as well where hardcoded values are used
@@ -105,6 +132,10 @@ public:
     static const quint32 kInvalidGuid = UINT_MAX;
     static const quint8 kTypeLenTtagPlaceholder = 0x22;
     static const quint8 kTypeLenTtag = 0x23;
+    static const quint8 kTypeLenTxTimestampPlaceholder = 0xE5;
+    static const quint8 kTypeLenTxTimestamp = 0xE6;
+    static const int kTxTimestampSize = 8; // including TypeLen
+    static const quint64 kTxTimestampMask = Q_UINT64_C(0x00ffffffffffffff);
 private:
     static const quint32 kSignMagic = 0x1d10c0da; // coda! (unicode - 0x1d10c)
     static const quint8 kTypeLenEnd = 0x00;
@@ -113,4 +144,38 @@ private:
     OstProto::Sign data;
 };
 
+inline bool SignProtocol::isTxTimestampPlaceholder(const uchar *pkt,
+        int pktLen)
+{
+    return (pktLen >= 21)
+        && (pkt[pktLen-7] == kTypeLenTxTimestampPlaceholder)
+        && (qFromBigEndian<quint32>(pkt + pktLen - 4) == kSignMagic);
+}
+
+// Valid only if isTxTimestampPlaceholder()
+inline uint SignProtocol::placeholderGuid(const uchar *pkt, int pktLen)
+{
+    return qFromBigEndian<quint32>(pkt + pktLen - 18) >> 8;
+}
+
+// Valid only if isTxTimestampPlaceholder()
+inline quint32 SignProtocol::placeholderTxTimestampInterval(const uchar *pkt,
+        int pktLen)
+{
+    return qFromBigEndian<quint32>(pkt + pktLen - 11);
+}
+
+// Valid only if isTxTimestampPlaceholder(); the placeholder (8 bytes at
+// pktLen - 14) needs to be saved by the caller to revert the stamping
+inline void SignProtocol::setTxTimestamp(uchar *pkt, int pktLen, quint64 nsec)
+{
+    uchar *p = pkt + pktLen - 14;
+
+    for (int i = 6; i >= 0; i--) {
+        p[i] = uchar(nsec);
+        nsec >>= 8;
+    }
+    p[7] = kTypeLenTxTimestamp;
+}
+
 #endif
@@ -42,6 +42,16 @@ void SignConfigForm::loadWidget(AbstractProtocol *proto)
                 SignProtocol::sign_tlv_guid,
                 AbstractProtocol::FieldValue
             ).toString());
+    txTimestamp->setChecked(
+            proto->fieldData(
+                SignProtocol::sign_is_tx_timestamp,
+                AbstractProtocol::FieldValue
+            ).toBool());
+    txTimestampInterval->setText(
+            proto->fieldData(
+                SignProtocol::sign_tx_timestamp_interval,
+                AbstractProtocol::FieldValue
+            ).toString());
 }
 
 void SignConfigForm::storeWidget(AbstractProtocol *proto)
@@ -49,5 +59,11 @@ void SignConfigForm::storeWidget(AbstractProtocol *proto)
     proto->setFieldData(
             SignProtocol::sign_tlv_guid,
             guid->text());
+    proto->setFieldData(
+            SignProtocol::sign_is_tx_timestamp,
+            txTimestamp->isChecked());
+    proto->setFieldData(
+            SignProtocol::sign_tx_timestamp_interval,
+            txTimestampInterval->text());
 }
 
@@ -20,6 +20,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "streambase.h"
 
 #include "abstractprotocol.h"
+#include "counterrng.h"
 #include "framevalueattrib.h"
 #include "protocollist.h"
 #include "protocollistiterator.h"
@@ -27,11 +28,54 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "uint128.h"
 
 #include <QDebug>
+#include <QHash>
+#include <QVector>
 
 extern ProtocolManager *OstProtocolManager;
 extern quint64 getDeviceMacAddress(int portId, int streamId, int frameIndex);
 extern quint64 getNeighborMacAddress(int portId, int streamId, int frameIndex);
 
+/*
+ * Layout of a frame - offset and size of each (top-level) protocol in the
+ * order of the stream's protocol list and the sum of all protocol sizes
+ */
+struct FrameLayout
+{
+    FrameLayout() : size(0) {}
+
+    int size;
+    QVector<int> offsets;
+    QVector<int> sizes;
+};
+
+/*
+ * Frame layouts of a stream keyed by frame length class - all frames of a
+ * stream have the same layout except for protocols like Payload and
+ * HexDump (pad until end) which fill up the frame, in which case the class
+ * is the frame length itself; streams with any other protocol that varies
+ * its size are not cached
+ */
+struct FrameLayoutCache
+{
+    enum State {
+        Unknown,    // not yet checked if stream layout can be cached
+        Disabled,   // stream layout can't be cached
+        Enabled,
+        Building    // a layout is being built
+    };
+
+    FrameLayoutCache() : state(Unknown), lengthDependent(false) {}
+
+    State state;
+    bool lengthDependent;
+    QHash<const AbstractProtocol*, int> index; // protocol to layout index
+    QHash<int, FrameLayout> layouts;
+};
+
+// XXX: a stream with random frame lengths can have many length classes -
+// we don't want the cache to grow without bounds
+static const int kMaxFrameLayouts = 2048;
+
 StreamBase::StreamBase(int portId) :
     portId_(portId),
     mStreamId(new OstProto::StreamId),
@@ -43,6 +87,8 @@ StreamBase::StreamBase(int portId) :
 
     mStreamId->set_id(0xFFFFFFFF);
 
+    layoutCache_ = new FrameLayoutCache;
+    frameRevision_ = 0;
     currentFrameProtocols = new ProtocolList;
 
     iter = createProtocolListIterator();
@@ -81,6 +127,7 @@ StreamBase::~StreamBase()
 {
     currentFrameProtocols->destroy();
     delete currentFrameProtocols;
+    delete layoutCache_;
     delete mControl;
     delete mCore;
     delete mStreamId;
@@ -90,12 +137,30 @@ void StreamBase::protoDataCopyFrom(const OstProto::Stream &stream)
 {
     AbstractProtocol        *proto;
     ProtocolListIterator    *iter;
+    bool                    isSameFrame;
+
+    // Is there any change that may change the stream's frames?
+    isSameFrame = (stream.core().len_mode() == mCore->len_mode())
+                    && (stream.core().frame_len() == mCore->frame_len())
+                    && (stream.core().frame_len_min() == mCore->frame_len_min())
+                    && (stream.core().frame_len_max() == mCore->frame_len_max())
+                    && (stream.core().has_random_seed()
+                            == mCore->has_random_seed())
+                    && (stream.core().random_seed() == mCore->random_seed())
+                    && (stream.stream_id().id() == mStreamId->id())
+                    && hasSameProtocols(stream);
 
     mStreamId->CopyFrom(stream.stream_id());
     mCore->CopyFrom(stream.core());
     mControl->CopyFrom(stream.control());
 
+    // Keep the protocols as is, if unchanged - so that changing only, say,
+    // the stream rate doesn't change the stream's frames or frameRevision()
+    if (isSameFrame)
+        return;
+
     currentFrameProtocols->destroy();
+    invalidateFrameLayout();
     iter = createProtocolListIterator();
     for (int i=0; i < stream.protocol_size(); i++)
     {
@@ -115,6 +180,29 @@ void StreamBase::protoDataCopyFrom(const OstProto::Stream &stream)
     delete iter;
 }
 
+/*
+ * Returns true if the stream's protocols are the same as those in 'stream'
+ */
+bool StreamBase::hasSameProtocols(const OstProto::Stream &stream) const
+{
+    int i = 0;
+
+    if (stream.protocol_size() != currentFrameProtocols->size())
+        return false;
+
+    foreach (const AbstractProtocol* proto, *currentFrameProtocols)
+    {
+        OstProto::Protocol p;
+
+        proto->commonProtoDataCopyInto(p);
+        proto->protoDataCopyInto(p);
+        if (p.SerializeAsString() != stream.protocol(i++).SerializeAsString())
+            return false;
+    }
+
+    return true;
+}
+
 void StreamBase::protoDataCopyInto(OstProto::Stream &stream) const
 {
     stream.mutable_stream_id()->CopyFrom(*mStreamId);
@@ -211,6 +299,7 @@ StreamBase::FrameLengthMode    StreamBase::lenMode() const
 bool StreamBase::setLenMode(FrameLengthMode    lenMode)
 {
     mCore->set_len_mode((OstProto::StreamCore::FrameLengthMode) lenMode); 
+    invalidateFrameLayout();
     return true;
 }
 
@@ -233,13 +322,8 @@ quint16    StreamBase::frameLen(int streamIndex) const
                 (frameLenMax() - frameLenMin() + 1));
             break;
         case e_fl_random:
-            //! \todo (MED) This 'random' sequence is same across iterations
-            pktLen = 64; // to avoid the 'maybe used uninitialized' warning
-            qsrand(reinterpret_cast<ulong>(this));
-            for (int i = 0; i <= streamIndex; i++)
-                pktLen = qrand();
-            pktLen = frameLenMin() + (pktLen %
-                (frameLenMax() - frameLenMin() + 1));
+            pktLen = frameLenMin() + (CounterRng(randomSeed()).value32(
+                    streamIndex) % (frameLenMax() - frameLenMin() + 1));
             break;
         case e_fl_imix: {
             // 64, 594, 1518 in 7:4:1 ratio
@@ -262,6 +346,7 @@ quint16    StreamBase::frameLen(int streamIndex) const
 bool StreamBase::setFrameLen(quint16 frameLen)
 {
     mCore->set_frame_len(frameLen);  
+    invalidateFrameLayout();
     return true;
 }
 
@@ -273,6 +358,7 @@ quint16    StreamBase::frameLenMin() const
 bool StreamBase::setFrameLenMin(quint16 frameLenMin)
 {
     mCore->set_frame_len_min(frameLenMin);  
+    invalidateFrameLayout();
     return true;
 }
 
@@ -284,6 +370,48 @@ quint16    StreamBase::frameLenMax() const
 bool StreamBase::setFrameLenMax(quint16 frameLenMax)
 {
     mCore->set_frame_len_max(frameLenMax);  
+    invalidateFrameLayout();
+    return true;
+}
+
+/*!
+  Returns the seed for all the random values of the stream's frames -
+  frame length and protocol fields (see CounterRng)
+
+  The random values of a frame are a function of the seed and the frame
+  index, so they are the same every time the frame is built - across runs
+  too. If no seed is set, the stream id is used as the seed
+*/
+quint64 StreamBase::randomSeed() const
+{
+    if (mCore->has_random_seed())
+        return mCore->random_seed();
+
+    return mStreamId->id();
+}
+
+bool StreamBase::setRandomSeed(quint64 seed)
+{
+    mCore->set_random_seed(seed);
+    invalidateFrameLayout();
+    return true;
+}
+
+/*!
+  Returns true if the random values of the stream's frames should differ in
+  every loop of the stream instead of repeating (see FrameGenerator)
+
+  Frames stored in a packet list are replayed unchanged in every loop, so
+  this applies only to frames generated at transmit time
+*/
+bool StreamBase::isRandomReseedPerLoop() const
+{
+    return mCore->random_reseed_per_loop();
+}
+
+bool StreamBase::setRandomReseedPerLoop(bool reseed)
+{
+    mCore->set_random_reseed_per_loop(reseed);
     return true;
 }
 
@@ -558,6 +686,9 @@ int StreamBase::frameValue(uchar *buf, int bufMaxSize, int frameIndex,
         FrameValueAttrib *attrib) const
 {
     int maxSize, size, pktLen, len = 0;
+    const FrameLayout *layout;
+    ProtocolList::const_iterator iter;
+    int i;
 
     pktLen = frameLen(frameIndex);
 
@@ -569,37 +700,192 @@ int StreamBase::frameValue(uchar *buf, int bufMaxSize, int frameIndex,
 
     maxSize = qMin(pktLen, bufMaxSize);
 
-    ProtocolListIterator    *iter;
+    // XXX: we iterate the protocol list directly instead of using a
+    // ProtocolListIterator to avoid a heap allocation per frame
+    layout = frameLayout(frameIndex);
+    if (layout)
+        len = layout->size;
+    else {
+        for (iter = currentFrameProtocols->constBegin();
+                iter != currentFrameProtocols->constEnd(); iter++)
+            len += (*iter)->protocolFrameSize(frameIndex);
+    }
 
-    iter = createProtocolListIterator();
-    while (iter->hasNext())
+    // Pad with zero, if required and if we have space
+    if (len < maxSize)
+        memset(buf+len, 0, maxSize-len);
+
+    // Write the protocols last to first, so that a protocol that checksums
+    // its payload finds it already in place (see writeFrameValue())
+    iter = currentFrameProtocols->constEnd();
+    i = currentFrameProtocols->size();
+    while (iter != currentFrameProtocols->constBegin())
     {
         AbstractProtocol    *proto;
-        QByteArray          ba;
         FrameValueAttrib    protoAttrib;
+        int                 written;
+
+        proto = *(--iter);
+        i--;
+        size = layout ? layout->sizes.at(i)
+                      : proto->protocolFrameSize(frameIndex);
+        len -= size;
+        if (len >= maxSize)
+            continue;
 
-        proto = iter->next();
-        ba = proto->protocolFrameValue(frameIndex, false, &protoAttrib);
+        written = proto->writeFrameValue(buf+len, maxSize-len, frameIndex,
+                                         &protoAttrib);
         if (attrib)
             *attrib += protoAttrib;
 
-        size = qMin(ba.size(), maxSize-len);
-        memcpy(buf+len, ba.constData(), size);
-        len += size;
+        // Zero out whatever the protocol did not write
+        size = qMin(size, maxSize-len);
+        if (written < size)
+            memset(buf+len+written, 0, size-written);
+    }
 
-        if (len == maxSize)
-            break;
+    return maxSize;
+}
+
+/*!
+  Returns if and how frameValue() may be called concurrently from multiple
+  threads
+
+  Stream and protocol caches (e.g. frame layouts, protocol sizes) are
+  filled on demand - the first frame MUST be built by the calling thread
+  before building frames concurrently, so that only frames of other
+  length classes (if any) need to add to them
+*/
+StreamBase::FrameValueConcurrency StreamBase::frameValueConcurrency() const
+{
+    foreach (const AbstractProtocol *proto, *currentFrameProtocols)
+        if (!proto->isProtocolFrameValueThreadSafe())
+            return e_fvc_none;
+
+    // Frames of a new length class add a frame layout to the cache
+    if (lenMode() != e_fl_fixed)
+        return e_fvc_stream;
+
+    return e_fvc_frame;
+}
+
+/*!
+  Returns the cached layout of frame 'streamIndex', building it if required
+
+  Returns nullptr if the stream's layout can't be cached or a layout is
+  being built currently (protocols like Payload query their offset and
+  payload size while they are being sized)
+
+  The returned layout is valid only until the next call of this function
+  or invalidateFrameLayout()
+*/
+const FrameLayout* StreamBase::frameLayout(int streamIndex) const
+{
+    FrameLayoutCache *cache = layoutCache_;
+    QHash<int, FrameLayout>::const_iterator layoutIter;
+    FrameLayout layout;
+    int key = 0;
+    int i = 0;
+
+    if (cache->state == FrameLayoutCache::Unknown) {
+        cache->state = FrameLayoutCache::Disabled;
+        cache->lengthDependent = false;
+        foreach (const AbstractProtocol *proto, *currentFrameProtocols) {
+            switch (proto->protocolNumber()) {
+            case OstProto::Protocol::kPayloadFieldNumber:
+            case OstProto::Protocol::kHexDumpFieldNumber:
+                cache->lengthDependent = true;
+                break;
+            default:
+                if (proto->isProtocolFrameSizeVariable()) {
+                    cache->index.clear();
+                    return nullptr;
+                }
+                break;
+            }
+            cache->index.insert(proto, i++);
+        }
+        cache->state = FrameLayoutCache::Enabled;
     }
-    delete iter;
 
-    // Pad with zero, if required and if we have space
-    if (len < maxSize) {
-        size = maxSize-len;
-        memset(buf+len, 0, size);
-        len += size;
+    if (cache->state != FrameLayoutCache::Enabled)
+        return nullptr;
+
+    if (cache->lengthDependent)
+        key = frameLen(streamIndex);
+
+    layoutIter = cache->layouts.constFind(key);
+    if (layoutIter != cache->layouts.constEnd())
+        return &layoutIter.value();
+
+    if (cache->layouts.size() >= kMaxFrameLayouts)
+        cache->layouts.clear();
+
+    cache->state = FrameLayoutCache::Building;
+    foreach (const AbstractProtocol *proto, *currentFrameProtocols) {
+        int size = proto->protocolFrameSize(streamIndex);
+
+        layout.offsets.append(layout.size);
+        layout.sizes.append(size);
+        layout.size += size;
     }
+    cache->state = FrameLayoutCache::Enabled;
 
-    return len;
+    return &cache->layouts.insert(key, layout).value();
+}
+
+/*!
+  Looks up the offset and payload size of the (top-level) protocol 'proto'
+  in frame 'streamIndex' from the stream's frame layout cache
+
+  Returns false if not available from the cache, in which case the caller
+  needs to compute them itself
+*/
+bool StreamBase::protocolFrameLayout(const AbstractProtocol *proto,
+        int streamIndex, int &offset, int &payloadSize) const
+{
+    const FrameLayout *layout = frameLayout(streamIndex);
+    int i;
+
+    if (!layout)
+        return false;
+
+    i = layoutCache_->index.value(proto, -1);
+    if (i < 0)
+        return false;
+
+    offset = layout->offsets.at(i);
+    payloadSize = layout->size - offset - layout->sizes.at(i);
+    return true;
+}
+
+/*!
+  Discards the stream's cached frame layouts and bumps frameRevision()
+
+  MUST be called after any change that may change the size of a protocol
+  of the stream - StreamBase does this itself for changes made through it
+  or through a ProtocolListIterator; callers that change protocol fields
+  directly via AbstractProtocol::setFieldData() need to call this
+*/
+void StreamBase::invalidateFrameLayout()
+{
+    layoutCache_->state = FrameLayoutCache::Unknown;
+    layoutCache_->index.clear();
+    layoutCache_->layouts.clear();
+    frameRevision_++;
+}
+
+/*!
+  Returns the revision of the stream's frames - this changes whenever the
+  stream is changed in a way that may change its frames, so frames built
+  earlier may be reused as long as this hasn't changed
+
+  Frames that depend on state outside the stream (e.g. resolved mac
+  addresses) are not covered
+*/
+quint64 StreamBase::frameRevision() const
+{
+    return frameRevision_;
 }
 
 template <typename T>
@@ -640,6 +926,9 @@ int StreamBase::findReplace(quint32 protocolNumber, int fieldIndex,
     }
     delete iter;
 
+    if (replaceCount)
+        invalidateFrameLayout();
+
     return replaceCount;
 }
 
@@ -29,6 +29,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 const int kFcsSize = 4;
 
 class AbstractProtocol;
+struct FrameLayout;
+struct FrameLayoutCache;
 struct FrameValueAttrib;
 class ProtocolList;
 class ProtocolListIterator;
@@ -72,6 +74,12 @@ public:
         e_nw_goto_id
     };
 
+    enum FrameValueConcurrency {
+        e_fvc_none,     // only the stream's own thread may build frames
+        e_fvc_stream,   // any one thread at a time may build frames
+        e_fvc_frame     // any number of threads may build frames
+    };
+
     quint32    id() const;
     bool setId(quint32 id);
 
@@ -140,6 +148,17 @@ public:
     int frameCount() const;
     int frameValue(uchar *buf, int bufMaxSize, int frameIndex,
                    FrameValueAttrib *attrib = nullptr) const;
+    FrameValueConcurrency frameValueConcurrency() const;
+
+    quint64 randomSeed() const;
+    bool setRandomSeed(quint64 seed);
+    bool isRandomReseedPerLoop() const;
+    bool setRandomReseedPerLoop(bool reseed);
+
+    bool protocolFrameLayout(const AbstractProtocol *proto, int streamIndex,
+                             int &offset, int &payloadSize) const;
+    void invalidateFrameLayout();
+    quint64 frameRevision() const;
 
     int protocolFieldReplace(quint32 protocolNumber,
                              int fieldIndex, int fieldBitSize,
@@ -158,6 +177,9 @@ private:
     int findReplace(quint32 protocolNumber, int fieldIndex,
                      QVariant findValue, QVariant findMask,
                      QVariant replaceValue, QVariant replaceMask);
+    const FrameLayout* frameLayout(int streamIndex) const;
+    bool hasSameProtocols(const OstProto::Stream &stream) const;
+
     int portId_;
 
     OstProto::StreamId      *mStreamId;
@@ -165,6 +187,8 @@ private:
     OstProto::StreamControl *mControl;
 
     ProtocolList *currentFrameProtocols;
+    FrameLayoutCache *layoutCache_;
+    quint64 frameRevision_;
 };
 
 #endif
@@ -598,3 +598,59 @@ int TcpProtocol::protocolFrameVariableCount() const
     return count;
 }
 
+bool TcpProtocol::protocolFrameVariableFields(
+        QList<OstProto::VariableField> &varFields) const
+{
+    // Besides the variableFields, we vary only the checksum (and length,
+    // if the frame length varies) which need not be described
+    for (int i = 0; i < variableFieldCount(); i++)
+        varFields.append(variableField(i));
+
+    return !isProtocolFramePayloadSizeVariable();
+}
+
+int TcpProtocol::writeFrameValue(uchar *buf, int bufSize, int streamIndex,
+        FrameValueAttrib *attrib) const
+{
+    int payloadSize;
+    quint16 cksum;
+    quint8 hdrLen;
+
+    if (bufSize < 20)
+        return AbstractProtocol::writeFrameValue(buf, bufSize, streamIndex,
+                                                 attrib);
+
+    // Same as the FieldFrameValue of the individual fields in fieldData()
+    hdrLen = data.is_override_hdrlen() ?
+                (data.hdrlen_rsvd() >> 4) & 0x0F : 0x05;
+    qToBigEndian(quint16(data.is_override_src_port() ?
+                    data.src_port() : payloadProtocolId(ProtocolIdTcpUdp)),
+                 buf);
+    qToBigEndian(quint16(data.is_override_dst_port() ?
+                    data.dst_port() : payloadProtocolId(ProtocolIdTcpUdp)),
+                 buf + 2);
+    qToBigEndian(quint32(data.seq_num()), buf + 4);
+    qToBigEndian(quint32(data.ack_num()), buf + 8);
+    buf[12] = (hdrLen << 4) | (data.hdrlen_rsvd() & 0x0F);
+    buf[13] = data.flags() & 0x3F;
+    qToBigEndian(quint16(data.window()), buf + 14);
+    qToBigEndian(quint16(data.is_override_cksum() ? data.cksum() : 0),
+                 buf + 16);
+    qToBigEndian(quint16(data.urg_ptr()), buf + 18);
+
+    applyProtocolFrameVariableFields(buf, 20, streamIndex);
+
+    if (data.is_override_cksum())
+        return 20;
+
+    // Checksum the payload in place, if we have all of it
+    payloadSize = protocolFramePayloadSize(streamIndex);
+    if (bufSize >= (20 + payloadSize))
+        cksum = protocolFrameBufferCksum(buf, 20 + payloadSize, streamIndex,
+                                         CksumTcpUdp);
+    else
+        cksum = protocolFrameCksum(streamIndex, CksumTcpUdp);
+    qToBigEndian(cksum, buf + 16);
+
+    return 20;
+}
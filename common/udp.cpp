@@ -431,3 +431,55 @@ int UdpProtocol::protocolFrameVariableCount() const
 
     return count;
 }
+
+bool UdpProtocol::protocolFrameVariableFields(
+        QList<OstProto::VariableField> &varFields) const
+{
+    // Besides the variableFields, we vary only the checksum (and length,
+    // if the frame length varies) which need not be described
+    for (int i = 0; i < variableFieldCount(); i++)
+        varFields.append(variableField(i));
+
+    return !isProtocolFramePayloadSizeVariable();
+}
+
+int UdpProtocol::writeFrameValue(uchar *buf, int bufSize, int streamIndex,
+        FrameValueAttrib *attrib) const
+{
+    int payloadSize;
+    quint16 cksum;
+
+    if (bufSize < 8)
+        return AbstractProtocol::writeFrameValue(buf, bufSize, streamIndex,
+                                                 attrib);
+
+    // Same as the FieldFrameValue of the individual fields in fieldData()
+    payloadSize = protocolFramePayloadSize(streamIndex);
+    qToBigEndian(quint16(data.is_override_src_port() ?
+                    data.src_port() : payloadProtocolId(ProtocolIdTcpUdp)),
+                 buf);
+    qToBigEndian(quint16(data.is_override_dst_port() ?
+                    data.dst_port() : payloadProtocolId(ProtocolIdTcpUdp)),
+                 buf + 2);
+    qToBigEndian(quint16(data.is_override_totlen() ?
+                    data.totlen() : payloadSize + 8), buf + 4);
+    qToBigEndian(quint16(data.is_override_cksum() ? data.cksum() : 0),
+                 buf + 6);
+
+    applyProtocolFrameVariableFields(buf, 8, streamIndex);
+
+    if (data.is_override_cksum())
+        return 8;
+
+    // Checksum the payload in place, if we have all of it
+    if (bufSize >= (8 + payloadSize))
+        cksum = protocolFrameBufferCksum(buf, 8 + payloadSize, streamIndex,
+                                         CksumTcpUdp);
+    else
+        cksum = protocolFrameCksum(streamIndex, CksumTcpUdp);
+    if (cksum == 0)
+        cksum = 0xFFFF;
+    qToBigEndian(cksum, buf + 6);
+
+    return 8;
+}
@@ -66,6 +66,11 @@ public:
             FieldAttrib attrib = FieldValue);
 
     virtual int protocolFrameVariableCount() const;
+    virtual bool protocolFrameVariableFields(
+        QList<OstProto::VariableField> &varFields) const;
+
+    virtual int writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex = 0, FrameValueAttrib *attrib = nullptr) const;
 
 private:
     OstProto::Udp    data;
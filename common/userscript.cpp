@@ -217,6 +217,12 @@ bool UserScriptProtocol::isProtocolFrameSizeVariable() const
     return userProtocol_.isProtocolFrameSizeVariable();
 }
 
+bool UserScriptProtocol::isProtocolFrameValueThreadSafe() const
+{
+    // The script can be run only by the thread owning the script engine
+    return false;
+}
+
 int UserScriptProtocol::protocolFrameVariableCount() const
 {
     return AbstractProtocol::lcm(
@@ -135,6 +135,7 @@ public:
     virtual int protocolFrameSize(int streamIndex = 0) const;
 
     virtual bool isProtocolFrameSizeVariable() const;
+    virtual bool isProtocolFrameValueThreadSafe() const;
     virtual int protocolFrameVariableCount() const;
 
     virtual quint32 protocolFrameCksum(int streamIndex = 0,
@@ -268,3 +268,18 @@ bool VlanProtocol::setFieldData(int index, const QVariant &value,
 _exit:
     return isOk;
 }
+
+int VlanProtocol::writeFrameValue(uchar *buf, int bufSize, int streamIndex,
+        FrameValueAttrib *attrib) const
+{
+    if (bufSize < 4)
+        return AbstractProtocol::writeFrameValue(buf, bufSize, streamIndex,
+                                                 attrib);
+
+    // TCI = Prio (3) | CFI/DEI (1) | VLAN Id (12)
+    qToBigEndian(quint16(data.is_override_tpid() ? data.tpid() : 0x8100), buf);
+    qToBigEndian(quint16(data.vlan_tag()), buf + 2);
+
+    applyProtocolFrameVariableFields(buf, 4, streamIndex);
+    return 4;
+}
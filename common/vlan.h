@@ -60,6 +60,9 @@ public:
     virtual bool setFieldData(int index, const QVariant &value, 
             FieldAttrib attrib = FieldValue);
 
+    virtual int writeFrameValue(uchar *buf, int bufSize,
+            int streamIndex = 0, FrameValueAttrib *attrib = nullptr) const;
+
 protected:
     OstProto::Vlan    data;
 };
@@ -20,13 +20,19 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "abstractport.h"
 
 #include "../common/abstractprotocol.h"
+#include "../common/frametemplate.h"
 #include "../common/framevalueattrib.h"
+#include "../common/histogram.h"
 #include "../common/packet.h"
+#include "../common/parallelframebuilder.h"
 #include "../common/streambase.h"
 #include "devicemanager.h"
 #include "interfaceinfo.h"
 #include "packetbuffer.h"
+#include "packetgaps.h"
+#include "packetlistbuilder.h"
 
+#include <QCryptographicHash>
 #include <QString>
 #include <QIODevice>
 
@@ -170,6 +176,7 @@ bool AbstractPort::deleteStream(int streamId)
         if ((uint)streamId == streamList_.at(i)->id())
         {
             stream = streamList_.takeAt(i);
+            removeFrameSegment(stream);
             delete stream;
             
             isSendQueueDirty_ = true;
@@ -201,12 +208,12 @@ void AbstractPort::addNote(QString note)
 bool AbstractPort::setTrackStreamStats(bool enable)
 {
     // XXX: This function is called by modify() in context of the RPC
-    // thread (1 thread per connected client), but the StreamTiming
-    // singleton resides in the main thread and its' start/stop methods
-    // start/stop timers which cannot be done across Qt Threads. Hence
-    // this slightly hacky way of invoking those methods
-    QMetaObject::invokeMethod(streamTiming_, enable ? "start" : "stop",
-        Qt::QueuedConnection, Q_ARG(uint, id()));
+    // thread (1 thread per connected client) - StreamTiming start/stop
+    // are thread-safe
+    if (enable)
+        streamTiming_->start(id());
+    else
+        streamTiming_->stop(id());
     data_.set_is_tracking_stream_stats(enable);
 
     return true;
@@ -223,103 +230,239 @@ bool AbstractPort::setRateAccuracy(Accuracy accuracy)
     return true;
 }
 
-int AbstractPort::updatePacketList()
+/*!
+  Builds the packet list from the streams
+
+  If 'builder' is given, the build is a background one which may be
+  cancelled midway (see PacketListBuilder::isCancelled()), in which case
+  the packet list is left empty and the port dirty
+
+  The caller MUST hold the port lock for write
+*/
+int AbstractPort::updatePacketList(PacketListBuilder *builder)
 {
+    QByteArray key = packetListKey();
+    int ret = 0;
+
+    // Ports with the same streams and config build the same packet list -
+    // use the one built already by another port, if any
+    if (!key.isEmpty() && useCachedPacketList(key)) {
+        qDebug("port %d: using cached packet list", id());
+        isSendQueueDirty_ = false;
+        goto _exit;
+    }
+
     switch(data_.transmit_mode())
     {
     case OstProto::kSequentialTransmit:
-        return updatePacketListSequential();
+        ret = updatePacketListSequential(builder);
         break;
     case OstProto::kInterleavedTransmit:
-        return updatePacketListInterleaved();
+        ret = updatePacketListInterleaved(builder);
         break;
     default:
         Q_ASSERT(false); // Unreachable!!!
         break;
     }
-    return 0;
+
+    // Only a complete and error free list can be used by others
+    if (!key.isEmpty() && !ret && !isSendQueueDirty_)
+        cachePacketList(key);
+
+_exit:
+    // Report the packet list footprint as part of the port config
+    data_.set_packet_list_memory(packetListMemory());
+
+    return ret;
+}
+
+/*!
+  Returns the key to find this port's packet list in the packet list cache
+  (see PacketListCache) - a hash of everything that goes into building it
+
+  Returns an empty key if the packet list is specific to this port and so
+  can't be shared with other ports
+*/
+QByteArray AbstractPort::packetListKey() const
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    OstProto::Port port;
+    std::string data;
+
+    port.set_transmit_mode(data_.transmit_mode());
+    port.set_is_tracking_stream_stats(data_.is_tracking_stream_stats());
+    port.set_speed(data_.speed());
+    data = port.SerializePartialAsString(); // port_id not set
+    hash.addData(data.data(), int(data.size()));
+    hash.addData((const char*) &minPacketSetSize_, sizeof(minPacketSetSize_));
+
+    for (int i = 0; i < streamList_.size(); i++) {
+        const StreamBase *stream = streamList_.at(i);
+        OstProto::Stream s;
+
+        // Frames with the Sign protocol carry the tx port id; and those of
+        // streams that can't build frames on any thread (e.g. with mac
+        // resolution) depend on the port's devices
+        if (stream->hasProtocol(OstProto::Protocol::kSignFieldNumber)
+                || (stream->frameValueConcurrency()
+                        == StreamBase::e_fvc_none))
+            return QByteArray();
+
+        stream->protoDataCopyInto(s);
+        data = s.SerializeAsString();
+        hash.addData(data.data(), int(data.size()));
+    }
+
+    return hash.result();
 }
 
-int AbstractPort::updatePacketListSequential()
+int AbstractPort::updatePacketListSequential(PacketListBuilder *builder)
 {
     quint64 duration = 0;  // in nanosec
     quint64 totalPkts = 0;
     QList<uint> ttagMarkers;
     uint ttagRepeatInterval;
+    uint continuousTtagInterval = 0;
     FrameValueAttrib packetListAttrib;
     long    sec = 0; 
     long    nsec = 0;
+    QList<StreamBase*> streamList(streamList_);
+    QVector<FrameTemplate*> frameTemplates(streamList.size());
+    QVector<bool> wantGenerated(streamList.size());
+    QVector<bool> reuseSegment(streamList.size());
+    ParallelFrameBuilder frameBuilder(sizeof(pktBuf_));
+    quint64 builtFrames = 0, totalFrames = 0;
 
     qDebug("In %s", __FUNCTION__);
 
-    // First sort the streams by ordinalValue
-    std::sort(streamList_.begin(), streamList_.end(), StreamBase::StreamLessThan);
+    // First sort the streams by ordinalValue - a copy of the list, since
+    // the list itself may be concurrently read by others (see
+    // updatePacketList())
+    std::sort(streamList.begin(), streamList.end(), StreamBase::StreamLessThan);
 
     clearPacketList();
 
-    for (int i = 0; i < streamList_.size(); i++)
+    // Queue up the frames to be stored in the packet list with the frame
+    // builder - which builds them in parallel - so that the loop further
+    // below only needs to pick them up in order. The streams are compiled
+    // and the first frame of each stream built here serially, so that all
+    // lazily filled stream and protocol caches are in place before frames
+    // are built concurrently. Streams that haven't changed since the last
+    // build reuse their frames from then (frameSegments_) instead
+    for (int i = 0; i < streamList.size(); i++)
     {
-        if (streamList_[i]->isEnabled())
+        StreamBase *s = streamList[i];
+        ulong n, x, y, burstSize;
+
+        if (!s->isEnabled())
+            continue;
+
+        if (!sequentialPacketSetSizes(s, n, x, y, burstSize))
+            continue;
+
+        ulong frameVariableCount = s->frameVariableCount();
+        ulong storedFrames = ((n >= 1) ? x : 0) + y;
+        bool continuous = s->sendMode() == StreamBase::e_sm_continuous;
+
+        if (frameSegments_.contains(s)
+                && (frameSegments_.value(s).frameRevision
+                    != s->frameRevision()))
+            removeFrameSegment(s);
+
+        // A kept segment implies that the stream's frames were neither
+        // generated nor compiled (with more than kMaxStoredTemplateFrames)
+        // last time - and the frames haven't changed since, so the same
+        // holds now as long as we need no more frames than then
+        if (!continuous && (storedFrames <= kMaxStoredFrames)
+                && !s->isRandomReseedPerLoop()
+                && frameSegments_.contains(s)
+                && (ulong(frameSegments_.value(s).offsets.size())
+                        > (frameVariableCount > 1 ? storedFrames : 1))) {
+            reuseSegment[i] = true;
+            totalFrames += storedFrames;
+            if (s->nextWhat() != StreamBase::e_nw_goto_next)
+                break;
+            continue;
+        }
+
+        // The stream compiled into a template - used to derive the
+        // frames instead of building each one from scratch
+        FrameTemplate *frameTemplate = new FrameTemplate(s);
+        frameTemplates[i] = frameTemplate;
+
+        // Materialising a large number of variable frames upfront takes
+        // too long and too much memory; for such streams (and those
+        // that need to be sent continuously), have the frames generated
+        // on the fly during transmit instead, if the port supports it.
+        // If the stream compiled, the frames are derived from the
+        // template at transmit time, which is cheap enough to do for
+        // even fewer frames - this keeps the packet list size
+        // independent of the number of flows in the stream. Frames
+        // that should differ in every loop can only be generated
+        wantGenerated[i] = continuous || (storedFrames > kMaxStoredFrames)
+                || s->isRandomReseedPerLoop()
+                || ((frameVariableCount > 1) && frameTemplate->isCompiled()
+                    && (storedFrames > kMaxStoredTemplateFrames));
+
+        if (!wantGenerated.at(i) && storedFrames) {
+            removeFrameSegment(s);
+            totalFrames += storedFrames;
+            frameTemplate->frameValue(pktBuf_, sizeof(pktBuf_), 0);
+            frameBuilder.addFrames(frameTemplate,
+                    frameVariableCount > 1 ? int(storedFrames) : 1);
+        }
+
+        if (s->nextWhat() != StreamBase::e_nw_goto_next)
+            break;
+    }
+
+    for (int i = 0; i < streamList.size(); i++)
+    {
+        if (streamList[i]->isEnabled())
         {
             int len = 0;
+            const uchar *frame = pktBuf_;
             ulong n, x, y;
             ulong burstSize;
             double ibg = 0;
-            quint64 ibg1 = 0, ibg2 = 0;
-            quint64 nb1 = 0, nb2 = 0;
+            PacketGaps burstGaps;
             double ipg = 0;
-            quint64 ipg1 = 0, ipg2 = 0;
-            quint64 npx1 = 0, npx2 = 0;
-            quint64 npy1 = 0, npy2 = 0;
+            PacketGaps xGaps, yGaps;
             quint64 loopDelay;
-            ulong frameVariableCount = streamList_[i]->frameVariableCount();
-            bool hasTtag = streamList_[i]->hasProtocol(
+            ulong frameVariableCount = streamList[i]->frameVariableCount();
+            bool hasTtag = streamList[i]->hasProtocol(
                                 OstProto::Protocol::kSignFieldNumber);
 
             // We derive n, x, y such that
             // n * x + y = total number of packets to be sent
+            if (!sequentialPacketSetSizes(streamList[i], n, x, y, burstSize))
+            {
+                qWarning("Unhandled stream control unit %d",
+                    streamList[i]->sendUnit());
+                continue;
+            }
 
-            switch (streamList_[i]->sendUnit())
+            switch (streamList[i]->sendUnit())
             {
             case StreamBase::e_su_bursts:
-                burstSize = streamList_[i]->burstSize();
-                x = AbstractProtocol::lcm(frameVariableCount, burstSize);
-                n = ulong(burstSize * streamList_[i]->numBursts()) / x;
-                y = ulong(burstSize * streamList_[i]->numBursts()) % x;
-                if (streamList_[i]->burstRate() > 0)
+                if (streamList[i]->burstRate() > 0)
                 {
-                    ibg = 1e9/double(streamList_[i]->burstRate());
-                    ibg1 = quint64(ceil(ibg));
-                    ibg2 = quint64(floor(ibg));
-                    nb1  = quint64((ibg - double(ibg2)) * double(x));
-                    nb2  = x - nb1;
+                    ibg = 1e9/double(streamList[i]->burstRate());
+                    burstGaps = PacketGaps(ibg, x);
                 }
-                loopDelay = ibg2;
+                loopDelay = burstGaps.shortGap();
                 break;
             case StreamBase::e_su_packets:
-                x = frameVariableCount;
-                n = 2;
-                while (x < minPacketSetSize_) 
-                    x = frameVariableCount*n++;
-                n = streamList_[i]->numPackets() / x;
-                y = streamList_[i]->numPackets() % x;
-                burstSize = x + y;
-                if (streamList_[i]->packetRate() > 0)
+                if (streamList[i]->packetRate() > 0)
                 {
-                    ipg = 1e9/double(streamList_[i]->packetRate());
-                    ipg1 = quint64(ceil(ipg));
-                    ipg2 = quint64(floor(ipg));
-                    npx1  = quint64((ipg - double(ipg2)) * double(x));
-                    npx2  = x - npx1;
-                    npy1  = quint64((ipg - double(ipg2)) * double(y));
-                    npy2  = y - npy1;
+                    ipg = 1e9/double(streamList[i]->packetRate());
+                    xGaps = PacketGaps(ipg, x);
+                    yGaps = PacketGaps(ipg, y);
                 }
-                loopDelay = ipg2;
+                loopDelay = xGaps.shortGap();
                 break;
             default:
-                qWarning("Unhandled stream control unit %d",
-                    streamList_[i]->sendUnit());
-                continue;
+                continue; // unreachable - checked above
             }
 
             qDebug("\nframeVariableCount = %lu", frameVariableCount);
@@ -327,78 +470,149 @@ int AbstractPort::updatePacketListSequential()
                     n, x, y, burstSize);
 
             qDebug("ibg  = %g", ibg);
-            qDebug("ibg1 = %llu", ibg1);
-            qDebug("nb1  = %llu", nb1);
-            qDebug("ibg2 = %llu", ibg2);
-            qDebug("nb2  = %llu\n", nb2);
+            qDebug("ibg1 = %llu", burstGaps.longGap());
+            qDebug("nb1  = %llu", burstGaps.longCount());
+            qDebug("ibg2 = %llu\n", burstGaps.shortGap());
 
             qDebug("ipg  = %g", ipg);
-            qDebug("ipg1 = %llu", ipg1);
-            qDebug("npx1 = %llu", npx1);
-            qDebug("npy1 = %llu", npy1);
-            qDebug("ipg2 = %llu", ipg2);
-            qDebug("npx2 = %llu", npx2);
-            qDebug("npy2 = %llu\n", npy2);
-
-            if (n >= 1) {
-                loopNextPacketSet(x, n, 0, loopDelay);
-                qDebug("PacketSet: n = %lu, x = %lu, delay = %llu ns",
-                        n, x, loopDelay);
-            }
-            else if (n == 0)
-                x = 0;
+            qDebug("ipg1 = %llu", xGaps.longGap());
+            qDebug("npx1 = %llu", xGaps.longCount());
+            qDebug("npy1 = %llu", yGaps.longCount());
+            qDebug("ipg2 = %llu\n", xGaps.shortGap());
 
             quint64 pktCount = n*x + y;
-            for (uint j = 0; j < (x+y); j++)
-            {
-                
-                if (j == 0 || frameVariableCount > 1)
-                {
-                    FrameValueAttrib attrib;
-                    len = streamList_[i]->frameValue(
-                            pktBuf_, sizeof(pktBuf_), j, &attrib);
-                    packetListAttrib += attrib;
-                }
-                if (len <= 0)
-                    continue;
+            ulong storedFrames = ((n >= 1) ? x : 0) + y;
+            bool continuous = streamList[i]->sendMode()
+                                == StreamBase::e_sm_continuous;
+            bool generated = false;
+            const FrameTemplate *frameTemplate = frameTemplates.at(i);
+            FrameSegment segment;
+            FrameValueAttrib streamAttrib;
+
+            if (wantGenerated.at(i)) {
+                bool isBursts = streamList[i]->sendUnit()
+                                    == StreamBase::e_su_bursts;
+                generated = addGeneratedPacketSet(frameTemplate,
+                                continuous ? 0 : pktCount,
+                                isBursts ? burstSize : 1,
+                                isBursts ? ibg : ipg,
+                                loopDelay);
+                if (generated)
+                    qDebug("PacketSet: generated %llu pkts (0 => continuous)",
+                            continuous ? 0 : pktCount);
+                else if (streamList[i]->isRandomReseedPerLoop())
+                    qWarning("port %d stream %u: frames stored - random "
+                             "reseed per loop ignored", id(),
+                             streamList[i]->id());
+            }
 
-                // Create a packet set for 'y' with repeat = 1
-                if (j == x) {
-                    loopNextPacketSet(y, 1, 0, loopDelay);
-                    qDebug("PacketSet: n = 1, y = %lu, delay = %llu",
-                            y, loopDelay);
+            if (!generated) {
+                if (n >= 1) {
+                    loopNextPacketSet(x, n, 0, loopDelay);
+                    qDebug("PacketSet: n = %lu, x = %lu, delay = %llu ns",
+                            n, x, loopDelay);
                 }
-
-                qDebug("q(%d, %d) sec = %lu nsec = %lu",
-                        i, j, sec, nsec);
-
-                if (!appendToPacketList(sec, nsec, pktBuf_, len)) {
-                    clearPacketList(); // don't leave it half baked/inconsitent
-                    packetListAttrib.errorFlags |= FrameValueAttrib::OutOfMemoryError;
-                    goto _out_of_memory;
+                else if (n == 0)
+                    x = 0;
+
+                if (reuseSegment.at(i))
+                    segment = frameSegments_.value(streamList[i]);
+                else {
+                    segment.frameRevision = streamList[i]->frameRevision();
+                    segment.offsets.append(0);
                 }
 
-                if ((j > 0) && (((j+1) % burstSize) == 0))
+                for (uint j = 0; j < (x+y); j++)
                 {
-                    nsec += (j < nb1) ? ibg1 : ibg2;
-                    while (nsec >= long(1e9))
+                
+                    if (j == 0 || frameVariableCount > 1)
                     {
-                        sec++;
-                        nsec -= long(1e9);
+                        FrameValueAttrib attrib;
+
+                        // Frames were not queued with the frame builder if
+                        // they were to be generated by the port - but it
+                        // could not do so
+                        if (wantGenerated.at(i)) {
+                            len = frameTemplate->frameValue(
+                                    pktBuf_, sizeof(pktBuf_), j, &attrib);
+                            frame = pktBuf_;
+                        }
+                        else if (reuseSegment.at(i)) {
+                            frame = (const uchar*) segment.frames.constData()
+                                        + segment.offsets.at(j);
+                            len = segment.offsets.at(j+1)
+                                        - segment.offsets.at(j);
+                        }
+                        else {
+                            len = frameBuilder.nextFrame(&frame, &attrib);
+                            segment.frames.append((const char*) frame,
+                                                  qMax(len, 0));
+                            segment.offsets.append(segment.frames.size());
+                        }
+                        packetListAttrib += attrib;
+                        streamAttrib += attrib;
+                    }
+                    if (builder && !(++builtFrames % kBuildProgressFrames)) {
+                        if (builder->isCancelled()) {
+                            clearPacketList();
+                            isSendQueueDirty_ = true; // still to be built
+                            goto _cancelled;
+                        }
+                        builder->reportProgress(builtFrames, totalFrames);
+                    }
+
+                    if (len <= 0)
+                        continue;
+
+                    // Create a packet set for 'y' with repeat = 1
+                    if (j == x) {
+                        loopNextPacketSet(y, 1, 0, loopDelay);
+                        qDebug("PacketSet: n = 1, y = %lu, delay = %llu",
+                                y, loopDelay);
                     }
-                }
-                else
-                {
-                    if (j < x)
-                        nsec += (j < npx1) ? ipg1 : ipg2;
-                    else
-                        nsec += ((j-x) < npy1) ? ipg1 : ipg2;
 
-                    while (nsec >= long(1e9))
+                    qDebug("q(%d, %d) sec = %lu nsec = %lu",
+                            i, j, sec, nsec);
+
+                    if (!appendToPacketList(sec, nsec, frame, len)) {
+                        clearPacketList(); // don't leave it half baked/inconsitent
+                        packetListAttrib.errorFlags |= FrameValueAttrib::OutOfMemoryError;
+                        goto _out_of_memory;
+                    }
+
+                    if ((j > 0) && (((j+1) % burstSize) == 0))
                     {
-                        sec++;
-                        nsec -= long(1e9);
+                        nsec += burstGaps.at(j);
+                        while (nsec >= long(1e9))
+                        {
+                            sec++;
+                            nsec -= long(1e9);
+                        }
                     }
+                    else
+                    {
+                        if (j < x)
+                            nsec += xGaps.at(j);
+                        else
+                            nsec += yGaps.at(j-x);
+
+                        while (nsec >= long(1e9))
+                        {
+                            sec++;
+                            nsec -= long(1e9);
+                        }
+                    }
+                }
+
+                // Keep the frames for the next build - unless they have
+                // errors (e.g. unresolved mac) that a rebuild may fix
+                if (!wantGenerated.at(i) && !reuseSegment.at(i)
+                        && !streamAttrib.errorFlags
+                        && (segment.offsets.size() > 1)
+                        && (frameSegmentMemory_ + segment.frames.size()
+                                <= kMaxFrameSegmentMemory)) {
+                    frameSegments_.insert(streamList[i], segment);
+                    frameSegmentMemory_ += segment.frames.size();
                 }
             }
 
@@ -409,7 +623,7 @@ int AbstractPort::updatePacketListSequential()
             if (loopDelay == 0) {
                 double maxSpeed = data_.speed() ? data_.speed(): 1000;
                 double maxPktRate = (maxSpeed*1e6)
-                                        /(8*(streamList_[i]->frameLenAvg()
+                                        /(8*(streamList[i]->frameLenAvg()
                                                 + Packet::kEthOverhead));
                 loopDelay = 1e9/maxPktRate; // in nanosec
             }
@@ -417,20 +631,31 @@ int AbstractPort::updatePacketListSequential()
             // Add a Ttag marker after every kTtagTimeInterval_ worth of pkts
             if (hasTtag) {
                 uint ttagPktInterval = kTtagTimeInterval_*1e9/loopDelay;
-                for (uint k = 0; k < pktCount; k += ttagPktInterval)
-                    ttagMarkers.append(totalPkts + k);
+                if (generated && continuous) {
+                    ttagMarkers.append(totalPkts);
+                    continuousTtagInterval = ttagPktInterval;
+                }
+                else {
+                    for (uint k = 0; k < pktCount; k += ttagPktInterval)
+                        ttagMarkers.append(totalPkts + k);
+                }
             }
+
+            // Nothing after a continuous stream is ever sent
+            if (generated && continuous)
+                goto _stop_no_more_pkts;
+
             totalPkts += pktCount;
             duration += pktCount*loopDelay; // in nanosecs
 
-            switch(streamList_[i]->nextWhat())
+            switch(streamList[i]->nextWhat())
             {
                 case StreamBase::e_nw_stop:
                     goto _stop_no_more_pkts;
 
                 case StreamBase::e_nw_goto_id:
                     /*! \todo (MED): define and use 
-                    streamList_[i].d.control().goto_stream_id(); */
+                    streamList[i].d.control().goto_stream_id(); */
 
                     /*! \todo (MED): assumes goto Id is less than current!!!! 
                      To support goto to any id, do
@@ -452,7 +677,7 @@ int AbstractPort::updatePacketListSequential()
 
                 default:
                     qFatal("---------- %s: Unhandled case (%d) -----------",
-                            __FUNCTION__, streamList_[i]->nextWhat() );
+                            __FUNCTION__, streamList[i]->nextWhat() );
                     break;
             }
 
@@ -460,10 +685,18 @@ int AbstractPort::updatePacketListSequential()
     } // for (numStreams)
 
 _stop_no_more_pkts:
-    // See comments in updatePacketListInterleaved() for calc explanation
-    ttagRepeatInterval = ttagMarkers.isEmpty() ? 0 :
-             qMax(uint(kTtagTimeInterval_*1e9/(duration)), 1U)
-                * totalPkts;
+    // XXX: For a continuous stream, the packet list is never repeated, so
+    // the 'repeat' interval is such that the continuous stream's marker
+    // repeats every ttag interval. This works correctly only if no other
+    // stream before it has a ttag
+    if (continuousTtagInterval)
+        ttagRepeatInterval = ttagMarkers.last() - ttagMarkers.first()
+                                + continuousTtagInterval;
+    else
+        // See comments in updatePacketListInterleaved() for calc explanation
+        ttagRepeatInterval = ttagMarkers.isEmpty() ? 0 :
+                 qMax(uint(kTtagTimeInterval_*1e9/(duration)), 1U)
+                    * totalPkts;
     if (!setPacketListTtagMarkers(ttagMarkers, ttagRepeatInterval)) {
         clearPacketList(); // don't leave it half baked/inconsitent
         packetListAttrib.errorFlags |= FrameValueAttrib::OutOfMemoryError;
@@ -472,13 +705,71 @@ _stop_no_more_pkts:
 _out_of_memory:
     isSendQueueDirty_ = false;
 
+_cancelled:
+    qDeleteAll(frameTemplates);
+
     qDebug("PacketListAttrib = %x",
             static_cast<int>(packetListAttrib.errorFlags));
     return static_cast<int>(packetListAttrib.errorFlags);
 }
 
-int AbstractPort::updatePacketListInterleaved()
+void AbstractPort::removeFrameSegment(const StreamBase *stream)
 {
+    QHash<const StreamBase*, FrameSegment>::iterator iter;
+
+    iter = frameSegments_.find(stream);
+    if (iter == frameSegments_.end())
+        return;
+
+    frameSegmentMemory_ -= iter->frames.size();
+    frameSegments_.erase(iter);
+}
+
+void AbstractPort::clearFrameSegments()
+{
+    frameSegments_.clear();
+    frameSegmentMemory_ = 0;
+}
+
+/*!
+  Derives the packet sets of 'stream' for sequential transmit mode -
+  n * x + y = total number of packets to be sent, with x a multiple of
+  the number of variable frames of the stream
+
+  Returns false if the stream's send unit is not handled
+*/
+bool AbstractPort::sequentialPacketSetSizes(const StreamBase *stream,
+        ulong &n, ulong &x, ulong &y, ulong &burstSize) const
+{
+    ulong frameVariableCount = stream->frameVariableCount();
+
+    switch (stream->sendUnit())
+    {
+    case StreamBase::e_su_bursts:
+        burstSize = stream->burstSize();
+        x = AbstractProtocol::lcm(frameVariableCount, burstSize);
+        n = ulong(burstSize * stream->numBursts()) / x;
+        y = ulong(burstSize * stream->numBursts()) % x;
+        break;
+    case StreamBase::e_su_packets:
+        x = frameVariableCount;
+        n = 2;
+        while (x < minPacketSetSize_) 
+            x = frameVariableCount*n++;
+        n = stream->numPackets() / x;
+        y = stream->numPackets() % x;
+        burstSize = x + y;
+        break;
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+int AbstractPort::updatePacketListInterleaved(PacketListBuilder *builder)
+{
+    QList<StreamBase*> streamList(streamList_);
     FrameValueAttrib packetListAttrib;
     int numStreams = 0;
     quint64 minGap = ULLONG_MAX;
@@ -494,6 +785,7 @@ int AbstractPort::updatePacketListInterleaved()
     QList<ulong> pktCount, burstCount;
     QList<ulong> burstSize;
     QList<bool> isVariable;
+    QList<FrameTemplate*> frameTemplate;
     QList<bool> hasTtag;
     QList<QByteArray> pktBuf;
     QList<ulong> pktLen;
@@ -503,9 +795,9 @@ int AbstractPort::updatePacketListInterleaved()
 
     clearPacketList();
 
-    for (int i = 0; i < streamList_.size(); i++)
+    for (int i = 0; i < streamList.size(); i++)
     {
-        if (streamList_[i]->isEnabled())
+        if (streamList[i]->isEnabled())
             activeStreamCount++;
     }
 
@@ -515,15 +807,16 @@ int AbstractPort::updatePacketListInterleaved()
         return 0;
     }
 
-    // First sort the streams by ordinalValue
-    std::sort(streamList_.begin(), streamList_.end(), StreamBase::StreamLessThan);
+    // First sort the streams by ordinalValue - see comment in
+    // updatePacketListSequential()
+    std::sort(streamList.begin(), streamList.end(), StreamBase::StreamLessThan);
 
     // FIXME: we are calculating n[bp][12], i[bp]g[12] for a duration of 1sec;
     // this was fine when the actual packet list duration was also 1sec. But
     // in the current code (post Turbo changes), the latter can be different!
-    for (int i = 0; i < streamList_.size(); i++)
+    for (int i = 0; i < streamList.size(); i++)
     {
-        if (!streamList_[i]->isEnabled())
+        if (!streamList[i]->isEnabled())
             continue;
 
         streamId.append(i);
@@ -540,14 +833,14 @@ int AbstractPort::updatePacketListInterleaved()
         quint64 _np1 = 0, _np2 = 0;
 
 
-        switch (streamList_[i]->sendUnit())
+        switch (streamList[i]->sendUnit())
         {
         case StreamBase::e_su_bursts:
-            numBursts = streamList_[i]->burstRate();
-            _burstSize = streamList_[i]->burstSize();
-            if (streamList_[i]->burstRate() > 0)
+            numBursts = streamList[i]->burstRate();
+            _burstSize = streamList[i]->burstSize();
+            if (streamList[i]->burstRate() > 0)
             {
-                ibg = 1e9/double(streamList_[i]->burstRate());
+                ibg = 1e9/double(streamList[i]->burstRate());
                 _ibg1 = quint64(ceil(ibg));
                 _ibg2 = quint64(floor(ibg));
                 _nb1 = quint64((ibg - double(_ibg2)) * double(numBursts));
@@ -555,11 +848,11 @@ int AbstractPort::updatePacketListInterleaved()
             }
             break;
         case StreamBase::e_su_packets:
-            numPackets = streamList_[i]->packetRate();
+            numPackets = streamList[i]->packetRate();
             _burstSize = 1;
-            if (streamList_[i]->packetRate() > 0)
+            if (streamList[i]->packetRate() > 0)
             {
-                ipg = 1e9/double(streamList_[i]->packetRate());
+                ipg = 1e9/double(streamList[i]->packetRate());
                 _ipg1 = llrint(ceil(ipg));
                 _ipg2 = quint64(floor(ipg));
                 _np1 = quint64((ipg - double(_ipg2)) * double(numPackets));
@@ -568,7 +861,7 @@ int AbstractPort::updatePacketListInterleaved()
             break;
         default:
             qWarning("Unhandled stream control unit %d",
-                streamList_[i]->sendUnit());
+                streamList[i]->sendUnit());
             continue;
         }
         qDebug("numBursts = %g, numPackets = %g\n", numBursts, numPackets);
@@ -626,9 +919,10 @@ int AbstractPort::updatePacketListInterleaved()
         pktCount.append(0);
         burstCount.append(0);
 
-        if (streamList_[i]->isFrameVariable())
+        if (streamList[i]->isFrameVariable())
         {
             isVariable.append(true);
+            frameTemplate.append(new FrameTemplate(streamList[i]));
             pktBuf.append(QByteArray());
             pktLen.append(0);
         }
@@ -636,15 +930,16 @@ int AbstractPort::updatePacketListInterleaved()
         {
             FrameValueAttrib attrib;
             isVariable.append(false);
+            frameTemplate.append(NULL);
             pktBuf.append(QByteArray());
             pktBuf.last().resize(kMaxPktSize);
-            pktLen.append(streamList_[i]->frameValue(
+            pktLen.append(streamList[i]->frameValue(
                     (uchar*)pktBuf.last().data(), pktBuf.last().size(),
                     0, &attrib));
             packetListAttrib += attrib;
         }
 
-        hasTtag.append(streamList_[i]->hasProtocol(
+        hasTtag.append(streamList[i]->hasProtocol(
                             OstProto::Protocol::kSignFieldNumber));
         numStreams++;
     } // for i
@@ -762,6 +1057,7 @@ int AbstractPort::updatePacketListInterleaved()
     }
 
     // Now build the packet list
+    quint64 builtPkts = 0;
     do
     {
         for (int i = 0; i < numStreams; i++)
@@ -776,8 +1072,8 @@ int AbstractPort::updatePacketListInterleaved()
                 {
                     FrameValueAttrib attrib;
                     buf = pktBuf_;
-                    len = streamList_[streamId.at(i)]->frameValue(pktBuf_, sizeof(pktBuf_),
-                            pktCount[i], &attrib);
+                    len = frameTemplate.at(i)->frameValue(pktBuf_,
+                            sizeof(pktBuf_), pktCount[i], &attrib);
                     packetListAttrib += attrib;
                 }
                 else
@@ -786,6 +1082,15 @@ int AbstractPort::updatePacketListInterleaved()
                     len = pktLen.at(i);
                 }
 
+                if (builder && !(++builtPkts % kBuildProgressFrames)) {
+                    if (builder->isCancelled()) {
+                        clearPacketList();
+                        isSendQueueDirty_ = true; // still to be built
+                        goto _cancelled;
+                    }
+                    builder->reportProgress(builtPkts, totalPkts);
+                }
+
                 if (len <= 0)
                     continue;
 
@@ -846,6 +1151,9 @@ int AbstractPort::updatePacketListInterleaved()
 _out_of_memory:
     isSendQueueDirty_ = false;
 
+_cancelled:
+    qDeleteAll(frameTemplate);
+
     qDebug("PacketListAttrib = %x",
             static_cast<int>(packetListAttrib.errorFlags));
     return static_cast<int>(packetListAttrib.errorFlags);
@@ -895,6 +1203,43 @@ void AbstractPort::clearStreamTiming(uint guid)
     streamTiming_->clear(id(), guid);
 }
 
+static void setTimingDistribution(OstProto::TimingDistribution *dist,
+        const Histogram &histogram)
+{
+    static const double kPercents[] = { 50, 90, 99, 99.9 };
+    quint64 values[4];
+
+    histogram.percentiles(kPercents, values, 4);
+
+    dist->set_count(histogram.count());
+    dist->set_min(histogram.min());
+    dist->set_max(histogram.max());
+    dist->set_p50(values[0]);
+    dist->set_p90(values[1]);
+    dist->set_p99(values[2]);
+    dist->set_p99_9(values[3]);
+
+    dist->set_sub_bucket_bits(Histogram::kSubBucketBits);
+    for (int i = 0; i < Histogram::kBucketCount; i++) {
+        if (!histogram.bucketCount(i))
+            continue;
+        dist->add_bucket_index(i);
+        dist->add_bucket_count(histogram.bucketCount(i));
+    }
+}
+
+static void setTimingStats(OstProto::StreamStats *s,
+        const StreamTiming::Stats &t)
+{
+    s->set_latency(t.latency);
+    s->set_jitter(t.jitter);
+
+    if (t.latencyHist)
+        setTimingDistribution(s->mutable_latency_dist(), *t.latencyHist);
+    if (t.jitterHist)
+        setTimingDistribution(s->mutable_jitter_dist(), *t.jitterHist);
+}
+
 void AbstractPort::streamStats(uint guid, OstProto::StreamStatsList *stats)
 {
     // In case stats are being maintained elsewhere
@@ -914,8 +1259,7 @@ void AbstractPort::streamStats(uint guid, OstProto::StreamStatsList *stats)
         s->mutable_port_id()->set_id(id());
 
         s->set_tx_duration(lastTransmitDuration());
-        s->set_latency(t.latency);
-        s->set_jitter(t.jitter);
+        setTimingStats(s, t);
 
         s->set_tx_pkts(sst.tx_pkts);
         s->set_tx_bytes(sst.tx_bytes);
@@ -948,8 +1292,7 @@ void AbstractPort::streamStatsAll(OstProto::StreamStatsList *stats)
         s->mutable_port_id()->set_id(id());
 
         s->set_tx_duration(txDur);
-        s->set_latency(t.latency);
-        s->set_jitter(t.jitter);
+        setTimingStats(s, t);
 
         s->set_tx_pkts(sst.tx_pkts);
         s->set_tx_bytes(sst.tx_bytes);
@@ -975,6 +1318,7 @@ void AbstractPort::resetStreamStatsAll()
 void AbstractPort::clearDeviceNeighbors()
 {
     deviceManager_->clearDeviceNeighbors();
+    clearFrameSegments(); // resolved mac addresses may change
     isSendQueueDirty_ = true;
 }
 
@@ -1020,17 +1364,20 @@ void AbstractPort::resolveDeviceNeighbors()
             }
         }
     }
+    clearFrameSegments(); // resolved mac addresses may change
     isSendQueueDirty_ = true;
 }
 
 quint64 AbstractPort::deviceMacAddress(int streamId, int frameIndex)
 {
-    // we need the packet contents only uptil the L3 header
+    // we need the packet contents only uptil the L3 header; not in pktBuf_
+    // since frames may be built by many threads at once
+    uchar buf[kMaxL3PktSize];
     StreamBase *s = stream(streamId);
-    int pktLen = s->frameValue(pktBuf_, kMaxL3PktSize, frameIndex);
+    int pktLen = s->frameValue(buf, kMaxL3PktSize, frameIndex);
 
     if (pktLen) {
-        PacketBuffer pktBuf(pktBuf_, pktLen);
+        PacketBuffer pktBuf(buf, pktLen);
         return deviceManager_->deviceMacAddress(&pktBuf);
     }
 
@@ -1039,12 +1386,14 @@ quint64 AbstractPort::deviceMacAddress(int streamId, int frameIndex)
 
 quint64 AbstractPort::neighborMacAddress(int streamId, int frameIndex)
 {
-    // we need the packet contents only uptil the L3 header
+    // we need the packet contents only uptil the L3 header; not in pktBuf_
+    // since frames may be built by many threads at once
+    uchar buf[kMaxL3PktSize];
     StreamBase *s = stream(streamId);
-    int pktLen = s->frameValue(pktBuf_, kMaxL3PktSize, frameIndex);
+    int pktLen = s->frameValue(buf, kMaxL3PktSize, frameIndex);
 
     if (pktLen) {
-        PacketBuffer pktBuf(pktBuf_, pktLen);
+        PacketBuffer pktBuf(buf, pktLen);
         return deviceManager_->neighborMacAddress(&pktBuf);
     }
 
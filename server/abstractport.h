@@ -24,15 +24,20 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "streamstats.h"
 #include "streamtiming.h"
 
+#include <QByteArray>
+#include <QHash>
 #include <QList>
 #include <QReadWriteLock>
+#include <QVector>
 #include <QtGlobal>
 
 #include <limits.h>
 
 class DeviceManager;
+class FrameTemplate;
 struct InterfaceInfo;
 class PacketBuffer;
+class PacketListBuilder;
 class QIODevice;
 class StreamBase;
 
@@ -110,7 +115,21 @@ public:
             quint64 secDelay, quint64 nsecDelay) = 0;
     virtual bool setPacketListTtagMarkers(QList<uint> markers,
             uint repeatInterval) = 0;
-    int updatePacketList();
+    virtual bool addGeneratedPacketSet(const FrameTemplate* /*frameTemplate*/,
+            quint64 /*count*/, uint /*burstSize*/, double /*burstGap*/,
+            quint64 /*delayNsec*/) {
+        return false; // subclasses may implement - if supported
+    }
+    virtual quint64 packetListMemory() {
+        return 0; // subclasses may implement - if available
+    }
+    virtual bool useCachedPacketList(const QByteArray& /*key*/) {
+        return false; // subclasses may implement - if supported
+    }
+    virtual void cachePacketList(const QByteArray& /*key*/) {
+        // subclasses may implement - if supported
+    }
+    int updatePacketList(PacketListBuilder *builder = nullptr);
 
     virtual void startTransmit() = 0;
     virtual void stopTransmit() = 0;
@@ -152,8 +171,11 @@ protected:
 
     void addNote(QString note);
 
-    int updatePacketListSequential();
-    int updatePacketListInterleaved();
+    QByteArray packetListKey() const;
+    int updatePacketListSequential(PacketListBuilder *builder);
+    int updatePacketListInterleaved(PacketListBuilder *builder);
+    bool sequentialPacketSetSizes(const StreamBase *stream,
+            ulong &n, ulong &x, ulong &y, ulong &burstSize) const;
 
     bool isUsable_;
     OstProto::Port          data_;
@@ -178,6 +200,18 @@ private:
     static const int kMaxPktSize = 16384;
     uchar   pktBuf_[kMaxPktSize];
 
+    // Max frames of a stream that are stored in the packet list - beyond
+    // this, frames are generated during transmit (if supported by port)
+    static const ulong kMaxStoredFrames = 256*1024;
+
+    // Same as above, for streams that compile into a FrameTemplate - the
+    // frames of such streams are cheap to derive during transmit
+    static const ulong kMaxStoredTemplateFrames = 4096;
+
+    // A background build checks for cancellation and reports progress
+    // every these many frames
+    static const quint64 kBuildProgressFrames = 4096;
+
     // When finding a corresponding device for a packet, we need to inspect
     // only uptil the L3 header; in the worst case this would be -
     // mac (12) + 4 x vlan (16) + ethType (2) + ipv6 (40) = 74 bytes
@@ -187,6 +221,23 @@ private:
     /*! \note StreamBase::id() and index into streamList[] are NOT same! */
     QList<StreamBase*>  streamList_;
 
+    // Frames of a stream built for the packet list - kept, so that the next
+    // packet list build needs to build only the frames of changed streams
+    struct FrameSegment {
+        quint64 frameRevision{0}; // see StreamBase::frameRevision()
+        QByteArray frames;
+        QVector<int> offsets;     // frame i is at [offsets[i], offsets[i+1])
+    };
+    QHash<const StreamBase*, FrameSegment> frameSegments_;
+    qint64 frameSegmentMemory_{0};
+
+    // Max memory for all frame segments of a port - beyond this, frames of
+    // any more streams are not kept
+    static const qint64 kMaxFrameSegmentMemory = 256*1024*1024;
+
+    void removeFrameSegment(const StreamBase *stream);
+    void clearFrameSegments();
+
     struct PortStats    epochStats_;
 
     StreamTiming *streamTiming_{nullptr};
@@ -5,6 +5,7 @@ QT += network script xml
 QT -= gui
 linux*:system(grep -q IFLA_STATS64 /usr/include/linux/if_link.h): \
     DEFINES += HAVE_IFLA_STATS64
+linux*:exists(/usr/include/linux/if_xdp.h): DEFINES += HAVE_AF_XDP
 INCLUDEPATH += "../common"
 INCLUDEPATH += "../rpc"
 
@@ -39,6 +40,7 @@ LIBS += -lprotobuf
 HEADERS += drone.h \
     pcaptransmitter.h \
     myservice.h \
+    packetlistbuilder.h \
     streamtiming.h
 SOURCES += \
     devicemanager.cpp \
@@ -46,6 +48,7 @@ SOURCES += \
     emuldevice.cpp \
     drone_main.cpp \
     drone.cpp \
+    framegenerator.cpp \
     portmanager.cpp \
     abstractport.cpp \
     pcapport.cpp \
@@ -60,11 +63,19 @@ SOURCES += \
     linuxhostdevice.cpp \
     linuxport.cpp \
     linuxutils.cpp \
+    mmsgtxthread.cpp \
+    packetlist.cpp \
+    packetlistarena.cpp \
+    packetlistbuilder.cpp \
     params.cpp \
     streamtiming.cpp \
     turbo.cpp \
+    turboport.cpp \
+    txringthread.cpp \
+    txtimestamper.cpp \
     winhostdevice.cpp \
-    winpcapport.cpp 
+    winpcapport.cpp \
+    xdptxthread.cpp
 SOURCES += myservice.cpp 
 SOURCES += pcapextra.cpp 
 SOURCES += packetbuffer.cpp
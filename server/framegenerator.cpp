@@ -0,0 +1,242 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "framegenerator.h"
+
+#include "streambase.h"
+
+#include <QtDebug>
+
+#include <limits.h>
+#include <stdlib.h>
+
+FrameGenerator::FrameGenerator(const FrameTemplate &frameTemplate,
+                               quint64 count, uint burstSize, double burstGap)
+    : frameTemplate_(frameTemplate)
+{
+    const StreamBase *stream = frameTemplate.stream();
+
+    setObjectName(QString("FrameGen:%1").arg(stream->id()));
+
+    stream_ = stream;
+    count_ = count;
+    burstSize_ = qMax(burstSize, 1U);
+    burstGap_ = burstGap;
+
+    // Frames repeat after frameVariableCount frames; the count may have
+    // overflowed for a very large number of variable frames
+    frameVariableCount_ = stream->frameVariableCount();
+    if (frameVariableCount_ <= 0)
+        frameVariableCount_ = INT_MAX;
+
+    reseedPerLoop_ = stream->isRandomReseedPerLoop();
+    // Largest multiple of frameVariableCount that fits the stream index
+    indexRange_ = quint64(INT_MAX/frameVariableCount_) * frameVariableCount_;
+
+    maxFrameLen_ = qMax(int(stream->frameLen()), int(stream->frameLenMax()));
+    slotSize_ = PacketSequence::packetSpace(maxFrameLen_);
+}
+
+FrameGenerator::~FrameGenerator()
+{
+    stop();
+    free(ring_);
+}
+
+quint64 FrameGenerator::duration() const
+{
+    if (!count_)
+        return burstGap_ > 0 ? ULLONG_MAX : 0;
+
+    return quint64(((count_ - 1)/burstSize_) * burstGap_);
+}
+
+/*!
+  (Re)starts generating frames from the first frame
+*/
+void FrameGenerator::start()
+{
+    stop();
+
+    if (!ring_) {
+        ring_ = (uchar*) malloc(size_t(kRingSize)*slotSize_);
+        if (!ring_) {
+            qWarning("%s: unable to alloc frame generator ring",
+                    qPrintable(objectName()));
+            return;
+        }
+    }
+
+    head_.storeRelease(0);
+    tail_.storeRelease(0);
+    consumed_ = 0;
+    stop_ = false;
+
+    if (isInline()) {
+        for (int i = 0; i < kRingSize; i++) {
+            PacketSequence::PacketHeader *hdr = slot(i);
+            int len = frameTemplate_.frameValue(
+                            PacketSequence::frameData(hdr), maxFrameLen_, 0);
+            hdr->len = qMax(len, 0);
+            hdr->flags = 0;
+        }
+        frameIndex_ = 0;
+        sequence_ = 0;
+        return;
+    }
+
+    QThread::start();
+}
+
+void FrameGenerator::stop()
+{
+    if (isRunning()) {
+        stop_ = true;
+        wait();
+    }
+}
+
+/*!
+  Returns the next frame; waits if the generator has not yet caught up -
+  spinning briefly first and then blocking till the generator produces
+  the frame
+
+  Returns NULL if the generator is not running
+*/
+PacketSequence::PacketHeader* FrameGenerator::next()
+{
+    if (isInline())
+        return nextInline();
+
+    uint index = uint(tail_.loadAcquire()) + consumed_;
+
+    for (int i = 0; uint(head_.loadAcquire()) == index; i++) {
+        if (!isRunning())
+            return NULL;
+        if (i < kNextSpinCount) {
+            QThread::yieldCurrentThread();
+            continue;
+        }
+
+        // XXX: Both waiting_ and head_ are updated with full barriers, so
+        // either the generator sees waiting_ set and wakes us up (under
+        // lock_, so the wakeup is not lost) or we see its new head_ below
+        lock_.lock();
+        waiting_.fetchAndStoreOrdered(1);
+        if (uint(head_.loadAcquire()) == index)
+            notEmpty_.wait(&lock_, kNextWaitMsec);
+        waiting_.fetchAndStoreOrdered(0);
+        lock_.unlock();
+    }
+
+    consumed_++;
+    return slot(index);
+}
+
+/*
+ * Derives the next frame in place in the next ring slot - the slot holds
+ * an earlier frame of the template, so only the variable fields (and the
+ * checksums) need to be rewritten
+ *
+ * The caller releases at least every half ring (see sendQueueTransmit()),
+ * so the slot is never one that is still queued for transmit
+ */
+PacketSequence::PacketHeader* FrameGenerator::nextInline()
+{
+    PacketSequence::PacketHeader *hdr;
+
+    if (!ring_ || (consumed_ >= kRingSize))
+        return NULL;
+
+    hdr = slot(uint(tail_.loadAcquire()) + consumed_);
+    frameTemplate_.patchFrame(PacketSequence::frameData(hdr),
+                              streamIndex(frameIndex_, sequence_));
+    hdr->nsec = quint64((frameIndex_/burstSize_) * burstGap_);
+
+    if (++frameIndex_ == count_)
+        frameIndex_ = 0;
+    sequence_++;
+    consumed_++;
+
+    return hdr;
+}
+
+/*!
+  Returns all frames consumed so far to the generator
+
+  Consumed frames must not be referred to after release
+*/
+void FrameGenerator::release()
+{
+    tail_.storeRelease(int(uint(tail_.loadAcquire()) + consumed_));
+    consumed_ = 0;
+}
+
+/*
+ * Returns the stream index to build the frame with for the frame with
+ * index 'frameIndex' in the cycle and 'sequence' since start
+ */
+int FrameGenerator::streamIndex(quint64 frameIndex, quint64 sequence) const
+{
+    if (reseedPerLoop_)
+        return int(sequence % indexRange_);
+
+    return int(frameIndex % frameVariableCount_);
+}
+
+void FrameGenerator::run()
+{
+    quint64 frameIndex = 0, sequence = 0;
+    uint head = 0;
+
+    qDebug("%s: generating %llu frames (0 => unbounded)",
+            qPrintable(objectName()), count_);
+
+    while (!stop_) {
+        PacketSequence::PacketHeader *hdr;
+        int len;
+
+        // Ring full? Wait for the tx thread to release some frames
+        // XXX: we sleep instead of spin since the ring is expected to be
+        // full most of the time if the stream rate is not line rate
+        if ((head - uint(tail_.loadAcquire())) >= uint(kRingSize)) {
+            QThread::usleep(20);
+            continue;
+        }
+
+        hdr = slot(head);
+        len = frameTemplate_.frameValue(PacketSequence::frameData(hdr),
+                                        maxFrameLen_,
+                                        streamIndex(frameIndex, sequence));
+        hdr->len = qMax(len, 0);
+        hdr->flags = 0;
+        hdr->nsec = quint64((frameIndex/burstSize_) * burstGap_);
+
+        head_.fetchAndStoreOrdered(int(++head));
+        if (waiting_.loadAcquire()) {
+            lock_.lock();
+            notEmpty_.wakeOne();
+            lock_.unlock();
+        }
+
+        if (++frameIndex == count_)
+            frameIndex = 0;
+        sequence++;
+    }
+}
@@ -0,0 +1,120 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _FRAME_GENERATOR_H
+#define _FRAME_GENERATOR_H
+
+#include "packetsequence.h"
+
+#include "../common/frametemplate.h"
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+class StreamBase;
+
+/*
+ * Generates the frames of a stream on the fly (during transmit) instead
+ * of all of them being materialised in the packet list upfront
+ *
+ * The generator thread (producer) fills a bounded single-producer
+ * single-consumer ring with ready to send frames (with their timestamps)
+ * which the tx thread (consumer) drains using next(). Consumed slots are
+ * returned to the producer only on release() - this allows the consumer
+ * to queue the frames for a batched send (zero-copy) and release them
+ * after the batch is flushed
+ *
+ * If the stream compiles into a FrameTemplate, there is no generator
+ * thread - the frames are derived inline by next() instead, by patching
+ * the variable fields (and checksums) of the ring slot in place; the ring
+ * slots are filled with the template frame only once at start()
+ *
+ * Frames 0 to count-1 are generated in a cycle, so the same generator
+ * can be used for every repeat of the packet set; a count of 0 implies
+ * an unbounded (continuous) sequence of frames
+ *
+ * Random fields of a frame are a function of the frame index, so each
+ * cycle repeats the same frames; if the stream is set to reseed random
+ * values per loop (StreamBase::isRandomReseedPerLoop()), each cycle continues the stream's frame index instead - the fields that
+ * vary deterministically still repeat (every frameVariableCount frames),
+ * but the random fields of successive cycles are different
+ */
+class FrameGenerator: public QThread
+{
+public:
+    FrameGenerator(const FrameTemplate &frameTemplate, quint64 count,
+                   uint burstSize, double burstGap);
+    virtual ~FrameGenerator();
+
+    quint64 count() const { return count_; }
+    int maxFrameLength() const { return maxFrameLen_; }
+    quint64 duration() const; // in nsecs; of one cycle of 'count' frames
+    bool isInline() const { return frameTemplate_.isCompiled(); }
+
+    void start();
+    void stop();
+
+    // Consumer API - to be called only from the tx thread
+    PacketSequence::PacketHeader* next();
+    void release();
+    int releasePending() const { return consumed_; }
+    static int ringSize() { return kRingSize; }
+
+protected:
+    void run();
+
+private:
+    PacketSequence::PacketHeader* slot(uint index) const {
+        return reinterpret_cast<PacketSequence::PacketHeader*>(
+                    ring_ + (index % kRingSize)*slotSize_);
+    }
+    PacketSequence::PacketHeader* nextInline();
+    int streamIndex(quint64 frameIndex, quint64 sequence) const;
+
+    static const int kRingSize = 256; // in frames; power of 2
+    static const int kNextSpinCount = 64; // before next() blocks
+    static const int kNextWaitMsec = 10;
+
+    const StreamBase *stream_;
+    FrameTemplate frameTemplate_;
+    quint64 count_;
+    uint burstSize_;
+    double burstGap_;       // in nsecs
+    int frameVariableCount_;
+    int maxFrameLen_;
+    bool reseedPerLoop_;
+    quint64 indexRange_;    // stream index wraps at this, if reseedPerLoop
+
+    uchar *ring_{nullptr};
+    uint slotSize_{0};
+
+    QAtomicInt head_{0};    // produced upto (excl); written by producer
+    QAtomicInt tail_{0};    // released upto (excl); written by consumer
+    QAtomicInt waiting_{0}; // consumer is (about to be) blocked in next()
+    QMutex lock_;           // for notEmpty_
+    QWaitCondition notEmpty_;
+    int consumed_{0};       // consumed but not yet released
+    quint64 frameIndex_{0}; // next frame to derive; inline only
+    quint64 sequence_{0};   // frames derived since start; inline only
+    volatile bool stop_{false};
+};
+
+#endif
@@ -0,0 +1,315 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "mmsgtxthread.h"
+
+#ifdef Q_OS_LINUX
+
+#include <errno.h>
+#include <net/if.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/if_packet.h>
+#include <linux/net_tstamp.h>
+
+MmsgTxThread::MmsgTxThread(const char *device, bool qdiscBypass,
+                           int txTimeClock,
+                           StreamTiming::RecordQueue *ttagRecords,
+                           QAtomicInt *ttagState)
+    : PcapTxThread(device), txTimestamper_(ttagRecords, ttagState)
+{
+    qdiscBypass_ = qdiscBypass;
+    txTimeClock_ = txTimeClock;
+
+    // msg_name is not required since the socket is bound to the device;
+    // control msgs (if any) are setup per packet in sendPacket()
+    memset(msgs_, 0, sizeof(msgs_));
+    memset(ctrl_, 0, sizeof(ctrl_));
+    for (int i = 0; i < kTxBatchSize; i++) {
+        msgs_[i].msg_hdr.msg_iov = &iovs_[i];
+        msgs_[i].msg_hdr.msg_iovlen = 1;
+        msgs_[i].msg_hdr.msg_control = ctrl_[i].buf;
+    }
+}
+
+MmsgTxThread::~MmsgTxThread()
+{
+    closeSocket();
+}
+
+bool MmsgTxThread::txBegin()
+{
+    pending_ = 0;
+
+    if ((fd_ < 0) && !openSocket()) {
+        qWarning("%s: sendmmsg unavailable, falling back to pcap_sendpacket",
+                qPrintable(device_));
+        txTimestamper_.setUnavailable();
+        batchBackToBack_ = false;
+        return PcapTxThread::txBegin();
+    }
+
+    batchBackToBack_ = true;
+
+    if (txTimeEnabled_) {
+        clockOffset_ = 0;
+        nextClockOffsetUpdate_ = 0;
+        lastLaunchTime_ = 0;
+    }
+
+    return true;
+}
+
+/*!
+  Samples the offset of the socket's launch time clock from CLOCK_MONOTONIC
+
+  Launch times are computed on CLOCK_MONOTONIC but the socket may use a
+  different clock (e.g. CLOCK_TAI for etf). Unlike CLOCK_MONOTONIC, TAI and
+  REALTIME are stepped and slewed by NTP/PTP, so the offset doesn't stay
+  fixed during a transmit and is resampled every kClockOffsetUpdateNsec
+  (of the timeline)
+*/
+void MmsgTxThread::updateClockOffset()
+{
+    struct timespec mono, clk;
+
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(txTimeClock_, &clk);
+    clockOffset_ = (qint64(clk.tv_sec) - mono.tv_sec)*1000000000LL
+                        + (clk.tv_nsec - mono.tv_nsec);
+    nextClockOffsetUpdate_ = launchTime() + kClockOffsetUpdateNsec;
+}
+
+void MmsgTxThread::txEnd()
+{
+    // The tx loop runs ahead of the wire in launch time mode - wait for
+    // the last packet to be released so that tx duration is correct
+    if (txTimeEnabled_ && lastLaunchTime_ && !stop_) {
+        struct timespec tgt;
+
+        tgt.tv_sec = lastLaunchTime_/1000000000ULL;
+        tgt.tv_nsec = lastLaunchTime_ % 1000000000ULL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tgt, NULL)
+                == EINTR)
+            ;
+    }
+
+    // Tx timestamps are reported after the packet is sent out
+    txTimestamper_.drain(kTxTimestampWaitMsec);
+
+    PcapTxThread::txEnd();
+}
+
+int MmsgTxThread::sendPacket(const uchar *packet, int length)
+{
+    if (fd_ < 0)
+        return PcapTxThread::sendPacket(packet, length);
+
+    struct msghdr *hdr = &msgs_[pending_].msg_hdr;
+
+    iovs_[pending_].iov_base = const_cast<uchar*>(packet);
+    iovs_[pending_].iov_len = length;
+
+    hdr->msg_controllen = 0;
+    if (txTimeEnabled_) {
+        // SCM_TXTIME cmsg is always the first - see setupTxTime()
+        struct cmsghdr *cmsg = (struct cmsghdr*) hdr->msg_control;
+        quint64 txTime;
+
+        if ((txTimeClock_ != CLOCK_MONOTONIC)
+                && (launchTime() >= nextClockOffsetUpdate_))
+            updateClockOffset();
+        txTime = launchTime() + clockOffset_;
+
+        memcpy(CMSG_DATA(cmsg), &txTime, sizeof(txTime));
+        hdr->msg_controllen = CMSG_SPACE(sizeof(quint64));
+        lastLaunchTime_ = launchTime();
+    }
+
+    if (isTtagPacket() && txTimestamper_.isEnabled()) {
+        TxTimestamper::addControl(hdr);
+        txTimestamper_.requested();
+    }
+
+    if (++pending_ >= kTxBatchSize)
+        flushPackets();
+
+    return 0;
+}
+
+void MmsgTxThread::flushPackets()
+{
+    int sent = 0;
+    quint64 droppedPkts = 0;
+    quint64 droppedBytes = 0;
+
+    while (sent < pending_) {
+        int ret = sendmmsg(fd_, &msgs_[sent], pending_ - sent, 0);
+        if (ret < 0) {
+            if ((errno == EAGAIN) || (errno == ENOBUFS)) {
+                struct pollfd pfd;
+
+                // If we are asked to stop, the remaining packets are
+                // dropped
+                if (stop_) {
+                    for (; sent < pending_; sent++) {
+                        droppedPkts++;
+                        droppedBytes += iovs_[sent].iov_len;
+                    }
+                    break;
+                }
+
+                // Device queue full - wait for it to drain; a pending tx
+                // timestamp report (POLLERR) also wakes us up
+                pfd.fd = fd_;
+                pfd.events = POLLOUT;
+                pfd.revents = 0;
+                poll(&pfd, 1, 10 /* ms */);
+                if (pfd.revents & POLLERR)
+                    txTimestamper_.collect();
+                continue;
+            }
+            qDebug("%s: sendmmsg error: %s",
+                    qPrintable(device_), strerror(errno));
+            // Skip the offending packet, like pcap_sendpacket() failures
+            droppedPkts++;
+            droppedBytes += iovs_[sent].iov_len;
+            sent++;
+            continue;
+        }
+        sent += ret;
+    }
+
+    pending_ = 0;
+
+    // The tx loop counts packets as sent when they are queued
+    if (droppedPkts)
+        uncountPackets(droppedPkts, droppedBytes);
+
+    if (txTimestamper_.hasOutstanding())
+        txTimestamper_.collect();
+}
+
+bool MmsgTxThread::openSocket()
+{
+    struct sockaddr_ll addr;
+
+    fd_ = socket(AF_PACKET, SOCK_RAW, 0);
+    if (fd_ < 0) {
+        qWarning("%s: unable to open AF_PACKET socket: %s",
+                qPrintable(device_), strerror(errno));
+        return false;
+    }
+
+    // XXX: Bypassing the qdisc also bypasses the local taps, so we will
+    // not be able to capture our own tx packets (and hence timestamp
+    // T-tag packets) - which is why this is opt-in; kernel tx timestamps
+    // (if enabled) are not affected
+#ifdef PACKET_QDISC_BYPASS
+    if (qdiscBypass_) {
+        int bypass = 1;
+        if (setsockopt(fd_, SOL_PACKET, PACKET_QDISC_BYPASS,
+                    &bypass, sizeof(bypass)) < 0)
+            qWarning("%s: unable to set PACKET_QDISC_BYPASS: %s",
+                    qPrintable(device_), strerror(errno));
+    }
+#endif
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = 0; // tx only
+    addr.sll_ifindex = if_nametoindex(qPrintable(device_));
+    if (!addr.sll_ifindex
+            || bind(fd_, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        qWarning("%s: unable to bind AF_PACKET socket: %s",
+                qPrintable(device_), strerror(errno));
+        closeSocket();
+        return false;
+    }
+
+    if (txTimeClock_ >= 0)
+        txTimeEnabled_ = setupTxTime();
+    paceLead_ = txTimeEnabled_ ? kTxTimeLead : 0;
+
+    // Not fatal - the port's tx ttag capture takes over providing the
+    // T-tag tx timestamps if we can't
+    txTimestamper_.enable(fd_);
+
+    return true;
+}
+
+/*!
+  Enables SO_TXTIME on the socket and sets up a SCM_TXTIME control message
+  for every msg of the batch; only the launch time is updated per packet
+
+  Requires a qdisc that honours launch times (fq or etf) on the device
+*/
+bool MmsgTxThread::setupTxTime()
+{
+#ifdef SO_TXTIME
+    struct sock_txtime txTimeCfg;
+
+    if (qdiscBypass_)
+        qWarning("%s: launch times are ignored with qdisc bypass",
+                qPrintable(device_));
+
+    memset(&txTimeCfg, 0, sizeof(txTimeCfg));
+    txTimeCfg.clockid = txTimeClock_;
+    if (setsockopt(fd_, SOL_SOCKET, SO_TXTIME,
+                &txTimeCfg, sizeof(txTimeCfg)) < 0) {
+        qWarning("%s: unable to set SO_TXTIME: %s - using software pacing",
+                qPrintable(device_), strerror(errno));
+        return false;
+    }
+
+    for (int i = 0; i < kTxBatchSize; i++) {
+        struct cmsghdr *cmsg;
+
+        // CMSG_FIRSTHDR() needs a non-zero msg_controllen
+        msgs_[i].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(quint64));
+
+        cmsg = CMSG_FIRSTHDR(&msgs_[i].msg_hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_TXTIME;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(quint64));
+    }
+
+    qDebug("%s: SO_TXTIME enabled (clock %d)",
+            qPrintable(device_), txTimeClock_);
+    return true;
+#else
+    qWarning("%s: SO_TXTIME not supported by this build - "
+            "using software pacing", qPrintable(device_));
+    return false;
+#endif
+}
+
+void MmsgTxThread::closeSocket()
+{
+    if (fd_ >= 0) {
+        txTimestamper_.disable();
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+#endif
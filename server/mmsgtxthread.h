@@ -0,0 +1,104 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _MMSG_TX_THREAD_H
+#define _MMSG_TX_THREAD_H
+
+#include <QtGlobal>
+
+#ifdef Q_OS_LINUX
+
+#include "pcaptxthread.h"
+#include "txtimestamper.h"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/*
+ * Tx thread that sends back-to-back packets (i.e. packets without any
+ * inter-packet delay between them) using a single sendmmsg() call on a
+ * raw AF_PACKET socket instead of one pcap_sendpacket() per packet.
+ *
+ * Packets are not copied - we queue references to the packets in the
+ * packet list and send them out when the batch is full or when the
+ * tx loop needs to wait before the next packet (see flushPackets())
+ *
+ * If a txTimeClock is given, every packet carries its scheduled tx time
+ * as a SCM_TXTIME launch time (SO_TXTIME) and it is the kernel (fq/etf
+ * qdisc) or NIC that releases the packet at that time; the tx loop runs
+ * upto kTxTimeLead ahead of the timeline instead of waiting for each
+ * packet's turn
+ *
+ * If ttagRecords is given, the kernel tx timestamps of T-tag packets are
+ * added to it and their availability is tracked in ttagState (see
+ * TxTimestamper)
+ *
+ * If the socket cannot be setup, we fallback to PcapTxThread behaviour
+ */
+class MmsgTxThread: public PcapTxThread
+{
+public:
+    MmsgTxThread(const char *device, bool qdiscBypass = false,
+                 int txTimeClock = -1,
+                 StreamTiming::RecordQueue *ttagRecords = nullptr,
+                 QAtomicInt *ttagState = nullptr);
+    virtual ~MmsgTxThread();
+
+protected:
+    virtual bool txBegin();
+    virtual void txEnd();
+    virtual int sendPacket(const uchar *packet, int length);
+    virtual void flushPackets();
+
+private:
+    bool openSocket();
+    bool setupTxTime();
+    void updateClockOffset();
+    void closeSocket();
+
+    static const int kTxBatchSize = 64; // in pkts
+    static const qint64 kTxTimeLead = 2000000; // in nsecs
+    static const int kTxTimestampWaitMsec = 100;
+    static const quint64 kClockOffsetUpdateNsec = 1000000;
+
+    bool qdiscBypass_;
+    int fd_{-1};
+
+    struct mmsghdr msgs_[kTxBatchSize];
+    struct iovec iovs_[kTxBatchSize];
+    int pending_{0}; // pkts queued but not yet sent
+
+    // SO_TXTIME related
+    int txTimeClock_;        // -1 => launch time not used
+    bool txTimeEnabled_{false};
+    qint64 clockOffset_{0};  // txTimeClock_ - CLOCK_MONOTONIC (nsecs)
+    quint64 nextClockOffsetUpdate_{0}; // launch time to resample offset
+    quint64 lastLaunchTime_{0};
+    union {
+        char buf[CMSG_SPACE(sizeof(quint64))
+                    + TxTimestamper::kControlSize];
+        struct cmsghdr align;
+    } ctrl_[kTxBatchSize];
+
+    TxTimestamper txTimestamper_;
+};
+
+#endif
+
+#endif
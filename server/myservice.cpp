@@ -36,6 +36,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "../rpc/pbrpccontroller.h"
 #include "device.h"
 #include "devicemanager.h"
+#include "packetlistbuilder.h"
 #include "portmanager.h"
 
 #include <QStringList>
@@ -57,11 +58,19 @@ MyService::MyService()
 #else
         portLock.append(new QReadWriteLock());
 #endif
+        portBuilder.append(new PacketListBuilder(portInfo.last(),
+                                                 portLock.last()));
+        connect(portBuilder.last(),
+                SIGNAL(notification(int, SharedProtobufMessage)),
+                this, SIGNAL(notification(int, SharedProtobufMessage)));
+        portBuilder.last()->start();
     }
 }
 
 MyService::~MyService()
 {
+    while (!portBuilder.isEmpty())
+        delete portBuilder.takeFirst();
     while (!portLock.isEmpty())
         delete portLock.takeFirst();
     //! \todo Use a singleton destroyer instead 
@@ -149,6 +158,8 @@ void MyService::modifyPort(::google::protobuf::RpcController* /*controller*/,
                 continue;
             }
 
+            if (dirty)
+                portBuilder[id]->schedule();
             portLock[id]->lockForWrite();
             portInfo[id]->modify(port);
             portLock[id]->unlock();
@@ -265,6 +276,7 @@ void MyService::addStream(::google::protobuf::RpcController* controller,
     if (portInfo[portId]->isTransmitOn())
         goto _port_busy;
 
+    portBuilder[portId]->schedule();
     portLock[portId]->lockForWrite();
     for (int i = 0; i < request->stream_id_size(); i++)
     {
@@ -329,6 +341,7 @@ void MyService::deleteStream(::google::protobuf::RpcController* controller,
     if (portInfo[portId]->isTransmitOn())
         goto _port_busy;
 
+    portBuilder[portId]->schedule();
     portLock[portId]->lockForWrite();
     for (int i = 0; i < request->stream_id_size(); i++) {
         if (!portInfo[portId]->deleteStream(request->stream_id(i).id())) {
@@ -378,6 +391,7 @@ void MyService::modifyStream(::google::protobuf::RpcController* controller,
     if (portInfo[portId]->isTransmitOn())
         goto _port_busy;
 
+    portBuilder[portId]->schedule();
     portLock[portId]->lockForWrite();
     for (int i = 0; i < request->stream_size(); i++)
     {
@@ -456,6 +470,9 @@ void MyService::startTransmit(::google::protobuf::RpcController* /*controller*/,
             continue;
         }
 
+        // Use the packet list built in the background, if available
+        frameError = portBuilder[portId]->finish();
+
         portLock[portId]->lockForWrite();
         if (portInfo[portId]->isDirty())
             frameError = portInfo[portId]->updatePacketList();
@@ -837,6 +854,8 @@ void MyService::build(::google::protobuf::RpcController* controller,
     if (portInfo[portId]->isTransmitOn())
         goto _port_busy;
 
+    frameError = portBuilder[portId]->finish();
+
     portLock[portId]->lockForWrite();
     if (portInfo[portId]->isDirty())
         frameError = portInfo[portId]->updatePacketList();
@@ -1314,7 +1333,8 @@ quint64 getDeviceMacAddress(int portId, int streamId, int frameIndex)
      * FIXME: We don't need lockForWrite, only lockForRead here.
      * However, this function is called in the following sequence
      * modifyPort() --> updatePacketList() --> frameValue()
-     * where modifyPort has already taken a write lock. Qt allows
+     * where modifyPort (or the background packet list builder) has
+     * already taken a write lock. Qt allows
      * recursive locks, but not of a different type, so we are
      * forced to use lockForWrite here - till we find a different
      * solution.
@@ -31,6 +31,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #define MAX_STREAM_NAME_SIZE        64
 
 class AbstractPort;
+class PacketListBuilder;
 
 class MyService: public QObject, public OstProto::OstService
 {
@@ -182,8 +183,8 @@ private:
     /* 
      * NOTES:
      * - AbstractPort::id() and index into portInfo[] are same!
-     * - portLock[] size and order should be same as portInfo[] as the
-     *   same index is used for both.
+     * - portLock[] and portBuilder[] size and order should be same as
+     *   portInfo[] as the same index is used for all.
      * - we assume that once populated by the constructor, the list(s) 
      *   never change (objects in the list can change, but not the list itself)
      * - locking is at port granularity, not at stream granularity - for now
@@ -191,6 +192,7 @@ private:
      */
     QList<AbstractPort*>    portInfo;
     QList<QReadWriteLock*>  portLock;
+    QList<PacketListBuilder*> portBuilder;
 
 };
 
@@ -0,0 +1,62 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _PACKET_GAPS_H
+#define _PACKET_GAPS_H
+
+#include <QtGlobal>
+
+#include <math.h>
+
+/*
+ * Splits a fractional gap (in nsecs) between 'count' packets (or bursts)
+ * of a packet set into whole nsec gaps - the first few gaps are a nsec
+ * longer than the rest so that the fractions are not lost altogether
+ *
+ * Header only, so that the rate benchmark of the test driver can build
+ * the same timeline as the packet list build
+ */
+class PacketGaps
+{
+public:
+    PacketGaps() {
+        longGap_ = shortGap_ = longCount_ = 0;
+    }
+    PacketGaps(double gap, quint64 count) {
+        longGap_ = quint64(ceil(gap));
+        shortGap_ = quint64(floor(gap));
+        longCount_ = quint64((gap - double(shortGap_)) * double(count));
+    }
+
+    // Gap after the packet at 'index'
+    quint64 at(quint64 index) const {
+        return index < longCount_ ? longGap_ : shortGap_;
+    }
+
+    quint64 longGap() const { return longGap_; }
+    quint64 shortGap() const { return shortGap_; }
+    quint64 longCount() const { return longCount_; }
+
+private:
+    quint64 longGap_;
+    quint64 shortGap_;
+    quint64 longCount_;
+};
+
+#endif
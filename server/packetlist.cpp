@@ -0,0 +1,233 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "packetlist.h"
+
+#include "framegenerator.h"
+#include "../common/streambase.h"
+
+#include <QtDebug>
+
+QMutex PacketListCache::lock_;
+QHash<QByteArray, QWeakPointer<PacketList> > PacketListCache::lists_;
+
+PacketList::PacketList(bool trackGuidStats)
+{
+    trackGuidStats_ = trackGuidStats;
+}
+
+PacketList::~PacketList()
+{
+    while (sequences_.size())
+        delete sequences_.takeFirst();
+    while (generators_.size())
+        delete generators_.takeFirst();
+}
+
+void PacketList::loopNextPacketSet(qint64 size, qint64 repeats,
+        long repeatDelaySec, long repeatDelayNsec)
+{
+    currentPacketSequence_ = new PacketSequence(&arena_, &frameTable_,
+                                                trackGuidStats_);
+    currentPacketSequence_->repeatCount_ = repeats;
+    currentPacketSequence_->nsecDelay_ = quint64(repeatDelaySec)*1000000000ULL
+                                            + repeatDelayNsec;
+
+    repeatSequenceStart_ = sequences_.size();
+    repeatSize_ = size;
+    packetCount_ = 0;
+
+    sequences_.append(currentPacketSequence_);
+}
+
+bool PacketList::append(long sec, long nsec, const uchar *packet, int length)
+{
+    bool op = true;
+    quint64 ts = quint64(sec)*1000000000ULL + nsec;
+    uint hash = qHash(QByteArray::fromRawData((const char*)packet, length));
+    PacketSequence::PacketHeader *frame = frameCache_.value(hash, NULL);
+
+    // loopNextPacketSet should have created a seq
+    Q_ASSERT(currentPacketSequence_ != NULL);
+
+    // If we already have this frame, store only a ref to it; if it's a
+    // hash collision, we just store the frame again
+    if (frame && ((int(frame->len) != length)
+                || memcmp(PacketSequence::frameData(frame), packet, length)))
+        frame = NULL;
+
+    // If not enough space, update nsecDelay and alloc a new seq
+    if (frame ? !currentPacketSequence_->hasFreeSpaceForRef()
+              : !currentPacketSequence_->hasFreeSpace(length))
+    {
+        currentPacketSequence_->nsecDelay_ =
+                ts - currentPacketSequence_->lastPacket_->nsec;
+
+        //! \todo (LOW): calculate sendqueue size
+        currentPacketSequence_ = new PacketSequence(&arena_, &frameTable_,
+                                                    trackGuidStats_);
+        sequences_.append(currentPacketSequence_);
+
+        // Validate that the pkt will fit inside the new currentSendQueue_
+        Q_ASSERT(currentPacketSequence_->hasFreeSpace(length));
+    }
+
+    if (frame) {
+        if (currentPacketSequence_->appendPacketRef(ts, frame) < 0)
+            op = false;
+    }
+    else if (currentPacketSequence_->appendPacket(ts, packet, length) < 0)
+        op = false;
+    else if (!frameCache_.contains(hash))
+        frameCache_.insert(hash, currentPacketSequence_->lastPacket_);
+
+    if (length > maxPacketLength_)
+        maxPacketLength_ = length;
+
+    if (SignProtocol::isTxTimestampPlaceholder(packet, length))
+        hasTxTimestamps_ = true;
+
+    packetCount_++;
+    size_ += repeatSize_ ? currentPacketSequence_->repeatCount_ : 1;
+
+    // Last packet of packet-set?
+    if (repeatSize_ > 0 && packetCount_ == repeatSize_)
+    {
+        qDebug("repeatSequenceStart_=%d, repeatSize_ = %llu",
+                repeatSequenceStart_, repeatSize_);
+
+        // Set the packetSequence repeatSize
+        Q_ASSERT(repeatSequenceStart_ >= 0);
+        Q_ASSERT(repeatSequenceStart_ < sequences_.size());
+
+        if (currentPacketSequence_ != sequences_[repeatSequenceStart_])
+        {
+            PacketSequence *start = sequences_[repeatSequenceStart_];
+
+            currentPacketSequence_->nsecDelay_ = start->nsecDelay_;
+            start->nsecDelay_ = 0;
+            start->repeatSize_ = sequences_.size() - repeatSequenceStart_;
+        }
+
+        repeatSize_ = 0;
+
+        // End current pktSeq
+        currentPacketSequence_ = NULL;
+    }
+
+    return op;
+}
+
+/*!
+  Adds a packet set with 'count' frames of the given stream that are
+  generated during transmit instead of being stored in the packet list;
+  a count of 0 implies the frames are sent continuously (till stopped)
+
+  Packets within a burst are sent back-to-back with 'burstGap' (nsecs)
+  between the start of bursts; 'delayNsec' is the delay after the set
+*/
+bool PacketList::addGeneratedPacketSet(const FrameTemplate *frameTemplate,
+        quint64 count, uint burstSize, double burstGap, quint64 delayNsec)
+{
+    const StreamBase *stream = frameTemplate->stream();
+    FrameGenerator *generator = new FrameGenerator(*frameTemplate, count,
+                                                   burstSize, burstGap);
+    PacketSequence *seq = new PacketSequence(&arena_, &frameTable_, false);
+
+    seq->generator_ = generator;
+    seq->packets_ = count;
+    seq->nsecDuration_ = generator->duration();
+    seq->nsecDelay_ = delayNsec;
+
+    generators_.append(generator);
+    sequences_.append(seq);
+
+    // Packets can't be appended to a generated sequence
+    currentPacketSequence_ = NULL;
+
+    size_ += count;
+    if (!count)
+        unbounded_ = true;
+
+    if (generator->maxFrameLength() > maxPacketLength_)
+        maxPacketLength_ = generator->maxFrameLength();
+
+    // Whether the generated frames actually have a Tx Timestamp is checked
+    // per packet during transmit
+    if (stream->hasProtocol(OstProto::Protocol::kSignFieldNumber))
+        hasTxTimestamps_ = true;
+
+    return true;
+}
+
+void PacketList::setLoopMode(bool loop, quint64 secDelay, quint64 nsecDelay)
+{
+    returnToQIdx_ = loop ? 0 : -1;
+    loopDelay_ = secDelay*1000000000ULL + nsecDelay;
+}
+
+bool PacketList::setTtagMarkers(QList<uint> markers, uint repeatInterval)
+{
+    // XXX: Empty markers => no streams have Ttag
+    firstTtagPkt_ = markers.isEmpty() ? -1 : int(markers.first());
+
+    // Calculate delta markers
+    ttagDeltaMarkers_.clear();
+    for (int i = 1; i < markers.size(); i++)
+        ttagDeltaMarkers_.append(markers.at(i) - markers.at(i-1));
+    if (!markers.isEmpty()) {
+        ttagDeltaMarkers_.append(repeatInterval - markers.last()
+                                    + markers.first());
+        qDebug() << "TtagRepeatInterval:" << repeatInterval;
+        qDebug() << "FirstTtagPkt:" << firstTtagPkt_;
+        qDebug() << "TtagMarkers:" << ttagDeltaMarkers_;
+    }
+    return true;
+}
+
+/*!
+  Returns the cached packet list for 'key', if any
+*/
+QSharedPointer<PacketList> PacketListCache::find(const QByteArray &key)
+{
+    QMutexLocker locker(&lock_);
+
+    return lists_.value(key).toStrongRef();
+}
+
+/*!
+  Adds a built packet list to the cache - the list MUST NOT be modified
+  thereafter
+*/
+void PacketListCache::insert(const QByteArray &key,
+        QSharedPointer<PacketList> packetList)
+{
+    QMutexLocker locker(&lock_);
+    QMutableHashIterator<QByteArray, QWeakPointer<PacketList> > iter(lists_);
+
+    Q_ASSERT(packetList->isShareable());
+
+    // Drop entries whose lists are no longer in use
+    while (iter.hasNext()) {
+        if (iter.next().value().isNull())
+            iter.remove();
+    }
+
+    lists_.insert(key, packetList.toWeakRef());
+}
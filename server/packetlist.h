@@ -0,0 +1,118 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _PACKET_LIST_H
+#define _PACKET_LIST_H
+
+#include "packetlistarena.h"
+#include "packetsequence.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QVector>
+#include <QWeakPointer>
+
+class FrameGenerator;
+class FrameTemplate;
+
+/*
+ * Packet list of a tx thread - the packet sequences (with their packet
+ * buffers) and the list level transmit config
+ *
+ * The list is built once via the build functions below and is read only
+ * thereafter, so that a built list can be used by the tx threads of more
+ * than one port at the same time (see PacketListCache) - except if it has
+ * generated sequences, whose generators have per tx run state
+ */
+class PacketList
+{
+public:
+    PacketList(bool trackGuidStats);
+    ~PacketList();
+
+    void loopNextPacketSet(qint64 size, qint64 repeats,
+                           long repeatDelaySec, long repeatDelayNsec);
+    bool append(long sec, long nsec, const uchar *packet, int length);
+    bool addGeneratedPacketSet(const FrameTemplate *frameTemplate,
+                               quint64 count, uint burstSize,
+                               double burstGap, quint64 delayNsec);
+    void setLoopMode(bool loop, quint64 secDelay, quint64 nsecDelay);
+    bool setTtagMarkers(QList<uint> markers, uint repeatInterval);
+
+    quint64 memory() const {
+        return arena_.size() + frameTable_.capacity()*sizeof(uchar*);
+    }
+    quint32 frameCount() const { return frameTable_.size(); }
+    bool isShareable() const { return generators_.isEmpty(); }
+
+    QList<PacketSequence*> sequences_;
+    QList<FrameGenerator*> generators_; // for generated sequences
+    bool unbounded_{false}; // has a continuous generated seq
+    quint64 size_{0}; // count of pkts in packet List including repeats
+    int maxPacketLength_{0};
+    bool hasTxTimestamps_{false}; // has pkts with a Sign Tx Timestamp
+
+    int returnToQIdx_{-1};
+    quint64 loopDelay_{0}; // in nanosecs
+
+    // XXX: Ttag Marker config derived; not updated during Tx
+    int firstTtagPkt_{-1};
+    QList<uint> ttagDeltaMarkers_;
+
+private:
+    bool trackGuidStats_;
+    PacketListArena arena_; // packet buffers of all sequences
+    QVector<uchar*> frameTable_; // frame number => frame (in arena_)
+
+    // Intermediate state variables used while building the packet list
+    PacketSequence *currentPacketSequence_{nullptr};
+    int repeatSequenceStart_{-1};
+    quint64 repeatSize_{0};
+    quint64 packetCount_{0};
+
+    // Unique frames in the packet list (frame hash => frame) - repeats of
+    // these are stored as refs
+    QHash<uint, PacketSequence::PacketHeader*> frameCache_;
+};
+
+/*
+ * Built packet lists indexed by a key that identifies everything that
+ * goes into building the list (see AbstractPort::packetListKey()), so
+ * that ports with the same streams and config can share the same list
+ * instead of building their own
+ *
+ * The cache doesn't own the lists - an entry goes away when the last tx
+ * thread using its list drops it
+ */
+class PacketListCache
+{
+public:
+    static QSharedPointer<PacketList> find(const QByteArray &key);
+    static void insert(const QByteArray &key,
+                       QSharedPointer<PacketList> packetList);
+
+private:
+    static QMutex lock_;
+    static QHash<QByteArray, QWeakPointer<PacketList> > lists_;
+};
+
+#endif
@@ -0,0 +1,163 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "packetlistarena.h"
+
+#include <QtDebug>
+
+#include <stdlib.h>
+
+#ifdef Q_OS_LINUX
+#include <sys/mman.h>
+#endif
+
+// Chunks of at least this size are mmap'd and marked for (transparent)
+// hugepages on Linux
+static const size_t kHugePageSize = 2*1024*1024;
+
+PacketListArena::PacketListArena()
+{
+}
+
+PacketListArena::~PacketListArena()
+{
+    foreach (const Chunk &chunk, chunks_)
+        freeChunk(chunk);
+}
+
+/*!
+  Returns a buffer of 'size' bytes or NULL if memory is not available
+*/
+uchar* PacketListArena::alloc(size_t size)
+{
+    uchar *p;
+
+    if ((size_t(limit_ - top_) < size) && !newChunk(size))
+        return NULL;
+
+    p = top_;
+    top_ += size;
+    return p;
+}
+
+/*!
+  Returns true if the allocation ending at 'end' can be grown in place
+  by 'size' bytes
+*/
+bool PacketListArena::canExtend(const uchar *end, size_t size) const
+{
+    return end && (end == top_) && (size_t(limit_ - top_) >= size);
+}
+
+/*!
+  Grows the allocation ending at 'end' by 'size' bytes - only the latest
+  allocation can be grown
+*/
+bool PacketListArena::extend(const uchar *end, size_t size)
+{
+    if (!canExtend(end, size))
+        return false;
+
+    top_ += size;
+    return true;
+}
+
+/*!
+  Releases all allocations
+
+  The first chunk is retained for reuse; all others are freed
+*/
+void PacketListArena::clear()
+{
+    while (chunks_.size() > 1)
+        freeChunk(chunks_.takeLast());
+
+    if (chunks_.isEmpty()) {
+        top_ = limit_ = NULL;
+        size_ = 0;
+    }
+    else {
+        top_ = chunks_.first().base;
+        limit_ = top_ + chunks_.first().size;
+        size_ = chunks_.first().size;
+    }
+}
+
+quint64 PacketListArena::used() const
+{
+    if (chunks_.isEmpty())
+        return 0;
+
+    // All chunks except the last are considered fully used
+    return size_ - (limit_ - top_);
+}
+
+bool PacketListArena::newChunk(size_t minSize)
+{
+    Chunk chunk;
+
+    if (chunks_.isEmpty())
+        chunk.size = kMinChunkSize;
+    else
+        chunk.size = qMin(chunks_.last().size*2, size_t(kMaxChunkSize));
+    while (chunk.size < minSize)
+        chunk.size *= 2;
+
+    chunk.base = allocChunk(chunk.size);
+    if (!chunk.base) {
+        qWarning("%s: unable to alloc %zu bytes for packet list",
+                __FUNCTION__, chunk.size);
+        return false;
+    }
+
+    chunks_.append(chunk);
+    top_ = chunk.base;
+    limit_ = chunk.base + chunk.size;
+    size_ += chunk.size;
+
+    return true;
+}
+
+uchar* PacketListArena::allocChunk(size_t size)
+{
+#ifdef Q_OS_LINUX
+    if (size >= kHugePageSize) {
+        void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return NULL;
+#ifdef MADV_HUGEPAGE
+        madvise(p, size, MADV_HUGEPAGE); // XXX: best effort
+#endif
+        return (uchar*) p;
+    }
+#endif
+    return (uchar*) malloc(size);
+}
+
+void PacketListArena::freeChunk(const Chunk &chunk)
+{
+#ifdef Q_OS_LINUX
+    if (chunk.size >= kHugePageSize) {
+        munmap(chunk.base, chunk.size);
+        return;
+    }
+#endif
+    free(chunk.base);
+}
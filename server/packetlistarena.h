@@ -0,0 +1,76 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _PACKET_LIST_ARENA_H
+#define _PACKET_LIST_ARENA_H
+
+#include <QList>
+#include <QtGlobal>
+
+#include <stddef.h>
+
+/*
+ * Bump allocator for the packet buffers of all PacketSequences of a
+ * packet list
+ *
+ * Memory is reserved in chunks that start small and double in size upto
+ * kMaxChunkSize, so that small packet lists take little memory and big
+ * ones are spread across few large (hugepage friendly) chunks. Sequences
+ * are packed contiguously one after the other - only the latest
+ * allocation can be grown (see extend()), which matches how the packet
+ * list is built i.e. one sequence at a time
+ *
+ * There is no per-allocation free - everything is released together
+ * by clear()
+ */
+class PacketListArena
+{
+public:
+    PacketListArena();
+    ~PacketListArena();
+
+    uchar* alloc(size_t size);
+    bool canExtend(const uchar *end, size_t size) const;
+    bool extend(const uchar *end, size_t size);
+    void clear();
+
+    quint64 size() const { return size_; } // memory reserved (footprint)
+    quint64 used() const;
+
+private:
+    struct Chunk
+    {
+        uchar *base;
+        size_t size;
+    };
+
+    static const size_t kMinChunkSize = 64*1024;
+    static const size_t kMaxChunkSize = 4*1024*1024;
+
+    bool newChunk(size_t minSize);
+    static uchar* allocChunk(size_t size);
+    static void freeChunk(const Chunk &chunk);
+
+    QList<Chunk> chunks_;
+    uchar *top_{nullptr};   // next free byte in the last chunk
+    uchar *limit_{nullptr}; // end of the last chunk
+    quint64 size_{0};
+};
+
+#endif
@@ -0,0 +1,189 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "packetlistbuilder.h"
+
+#include "abstractport.h"
+
+#include "../common/protocol.pb.h"
+
+#include <QReadWriteLock>
+
+PacketListBuilder::PacketListBuilder(AbstractPort *port,
+        QReadWriteLock *portLock)
+{
+    port_ = port;
+    portLock_ = portLock;
+}
+
+PacketListBuilder::~PacketListBuilder()
+{
+    lock_.lock();
+    stop_ = true;
+    cancel_.storeRelease(1);
+    wakeup_.wakeAll();
+    lock_.unlock();
+
+    wait();
+}
+
+/*!
+  Schedules a (re)build of the packet list - to be called whenever the
+  port's streams are changed, BEFORE locking the port for the change
+
+  Cancels any build in progress, so that the caller doesn't have to wait
+  for it to finish to get the port lock
+*/
+void PacketListBuilder::schedule()
+{
+    QMutexLocker locker(&lock_);
+
+    pending_ = true;
+    sinceSchedule_.start();
+    frameError_ = 0; // for a build that is now stale
+    cancel_.storeRelease(1);
+    wakeup_.wakeOne();
+}
+
+/*!
+  Waits for a scheduled or in progress build to complete - a scheduled
+  build is started right away, without waiting for the changes to settle
+
+  Returns the frame errors (FrameValueAttrib::ErrorFlags) of the build;
+  these are returned only once
+
+  The caller MUST NOT hold the port lock; if the port is still dirty after
+  this (the build was skipped), it needs to build the packet list itself
+*/
+int PacketListBuilder::finish()
+{
+    QMutexLocker locker(&lock_);
+    int frameError;
+
+    if (pending_) {
+        urgent_ = true;
+        wakeup_.wakeOne();
+    }
+
+    while (pending_ || building_)
+        finished_.wait(&lock_);
+
+    frameError = frameError_;
+    frameError_ = 0;
+
+    return frameError;
+}
+
+void PacketListBuilder::run()
+{
+    lock_.lock();
+    while (!stop_)
+    {
+        if (!pending_) {
+            wakeup_.wait(&lock_);
+            continue;
+        }
+
+        // Wait for the changes to settle, unless asked to hurry up
+        if (!urgent_) {
+            qint64 msecs = kDebounceMsec - sinceSchedule_.elapsed();
+            if (msecs > 0) {
+                wakeup_.wait(&lock_, ulong(msecs));
+                continue;
+            }
+        }
+
+        pending_ = urgent_ = false;
+        building_ = true;
+        cancel_.storeRelease(0);
+        lock_.unlock();
+
+        int frameError = build();
+
+        lock_.lock();
+        building_ = false;
+        frameError_ |= frameError;
+        finished_.wakeAll();
+    }
+    lock_.unlock();
+}
+
+int PacketListBuilder::build()
+{
+    int frameError = 0;
+    bool built = false;
+
+    // The build modifies the port (packet list, frame segments, dirty
+    // state) and the streams' cached frame layouts, so it needs the port
+    // locked for write - like any other packet list build
+    portLock_->lockForWrite();
+    if (port_->isDirty() && !port_->isTransmitOn()) {
+        sinceProgress_.start();
+        lastPercent_ = -1;
+
+        frameError = port_->updatePacketList(this);
+        built = !port_->isDirty(); // not cancelled
+    }
+    portLock_->unlock();
+
+    // Close out the progress reported, if any
+    if (lastPercent_ >= 0)
+        notifyProgress(built ? 100 : lastPercent_, !built);
+
+    return frameError;
+}
+
+/*!
+  Reports that 'done' out of 'total' frames of the packet list are built
+
+  Progress is notified to the clients at most every kProgressIntervalMsec,
+  so builds that complete before that are not notified at all
+*/
+void PacketListBuilder::reportProgress(quint64 done, quint64 total)
+{
+    int percent;
+
+    if (sinceProgress_.elapsed() < kProgressIntervalMsec)
+        return;
+
+    // 100% is notified only once the build is complete
+    percent = total ? int(qMin(done*100/total, Q_UINT64_C(99))) : 0;
+    if (percent == lastPercent_)
+        return;
+
+    sinceProgress_.restart();
+    lastPercent_ = percent;
+    notifyProgress(percent);
+}
+
+void PacketListBuilder::notifyProgress(int percent, bool cancelled)
+{
+    // notification needs to be on heap because signal/slot is across threads!
+    OstProto::Notification *notif = new OstProto::Notification;
+    OstProto::PacketListBuildProgress *progress;
+
+    notif->set_notif_type(OstProto::packetListBuildProgress);
+    progress = notif->mutable_build_progress();
+    progress->mutable_port_id()->set_id(port_->id());
+    progress->set_percent(percent);
+    if (cancelled)
+        progress->set_is_cancelled(true);
+
+    emit notification(notif->notif_type(), SharedProtobufMessage(notif));
+}
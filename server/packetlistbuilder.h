@@ -0,0 +1,92 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _PACKET_LIST_BUILDER_H
+#define _PACKET_LIST_BUILDER_H
+
+#include "../rpc/sharedprotobufmessage.h"
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+class AbstractPort;
+class QReadWriteLock;
+
+/*
+ * Builds the packet list of a port in the background after its streams
+ * are changed, so that it is (mostly) ready by the time transmit is
+ * started
+ *
+ * A build is started once the changes settle (kDebounceMsec after the
+ * last one) and is cancelled if another change arrives while it is in
+ * progress. The build holds the port lock for write; writers cancel it by
+ * calling schedule() before locking the port, so that they don't have to
+ * wait for it to complete
+ */
+class PacketListBuilder: public QThread
+{
+    Q_OBJECT
+public:
+    PacketListBuilder(AbstractPort *port, QReadWriteLock *portLock);
+    virtual ~PacketListBuilder();
+
+    void schedule();
+    int finish();
+
+    // Called by AbstractPort::updatePacketList() during the build
+    bool isCancelled() const { return cancel_.loadAcquire(); }
+    void reportProgress(quint64 done, quint64 total);
+
+signals:
+    void notification(int notifType, SharedProtobufMessage notifData);
+
+protected:
+    void run();
+
+private:
+    int build();
+    void notifyProgress(int percent, bool cancelled = false);
+
+    static const int kDebounceMsec = 500;
+    static const int kProgressIntervalMsec = 250;
+
+    AbstractPort *port_;
+    QReadWriteLock *portLock_;
+
+    QMutex lock_; // protects all below except cancel_ and progress
+    QWaitCondition wakeup_;     // builder thread waits on this
+    QWaitCondition finished_;   // finish() waits on this
+    bool stop_{false};
+    bool pending_{false};       // build scheduled
+    bool urgent_{false};        // skip debounce for pending build
+    bool building_{false};
+    QElapsedTimer sinceSchedule_;
+    int frameError_{0};
+
+    QAtomicInt cancel_{0};
+
+    // Progress of the ongoing build - accessed only by the builder thread
+    QElapsedTimer sinceProgress_;
+    int lastPercent_{-1};
+};
+
+#endif
@@ -22,53 +22,209 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "../common/packet.h"
 #include "../common/sign.h"
+#include "packetlistarena.h"
 #include "pcapextra.h"
 #include "streamstats.h"
 
+#include <QVector>
+
+#include <string.h>
+
+class FrameGenerator;
+
 class PacketSequence
 {
 public:
-    PacketSequence(bool trackGuidStats) {
+    // Compact per-packet header that precedes every packet in the buffer
+    // (instead of a pcap_pkthdr) so that we have nsec resolution timestamps
+    //
+    // The header is followed by the frame itself - unless the same frame
+    // is already present elsewhere in the packet list, in which case the
+    // header alone is the entry (kFrameRef) and refers to that frame
+    //
+    // Unique frames are numbered in the order they are added to the packet
+    // list (see the frame table); a ref has the number of the frame it
+    // refers to. A ref still needs its own timestamp, so a ref entry is
+    // 16 bytes - a fifth of the entry of a 64 byte frame
+    struct PacketHeader
+    {
+        quint64 nsec;       // timestamp - relative to the packet list start
+        quint32 frame;      // frame number within the packet list
+        quint16 len;        // upto AbstractPort::kMaxPktSize
+        quint16 flags;
+    };
+    enum PacketFlag
+    {
+        kFrameRef = 0x1,
+    };
+
+    // Packet buffer is allocated from the arena on first append and grown
+    // in place thereafter; it is freed along with the arena. The frame
+    // table (frame number => frame) is shared by all sequences of the
+    // packet list
+    PacketSequence(PacketListArena *arena, QVector<uchar*> *frameTable,
+                   bool trackGuidStats) {
+        arena_ = arena;
+        frameTable_ = frameTable;
         trackGuidStats_ = trackGuidStats;
-        sendQueue_ = pcap_sendqueue_alloc(1*1024*1024);
+        buffer_ = NULL;
+        len_ = 0;
         lastPacket_ = NULL;
         packets_ = 0;
+        frames_ = 0;
         bytes_ = 0;
-        usecDuration_ = 0;
+        nsecDuration_ = 0;
         repeatCount_ = 1;
         repeatSize_ = 1;
-        usecDelay_ = 0;
+        nsecDelay_ = 0;
         ttagL4CksumOffset_ = 0;
+        generator_ = NULL;
+#ifdef Q_OS_WIN32
+        sendQueue_ = NULL;
+#endif
     }
     ~PacketSequence() {
-        pcap_sendqueue_destroy(sendQueue_);
+#ifdef Q_OS_WIN32
+        if (sendQueue_)
+            pcap_sendqueue_destroy(sendQueue_);
+#endif
     }
-    bool hasFreeSpace(int size) {
-        if ((sendQueue_->len + size) <= sendQueue_->maxlen)
-            return true;
-        else
-            return false;
+
+    // Space (including header and padding) required in the buffer for
+    // a packet of given length; headers are kept 8-byte aligned
+    static quint32 packetSpace(quint32 length) {
+        return (sizeof(PacketHeader) + length + 7) & ~7;
     }
-    int appendPacket(const struct pcap_pkthdr *pktHeader,
-            const uchar *pktData) {
-        int ret;
-        if (lastPacket_)
-        {
-            usecDuration_ += (pktHeader->ts.tv_sec
-                                - lastPacket_->ts.tv_sec) * long(1e6);
-            usecDuration_ += (pktHeader->ts.tv_usec
-                                - lastPacket_->ts.tv_usec);
+    static quint32 refSpace() {
+        return sizeof(PacketHeader);
+    }
+    static bool isFrameRef(const PacketHeader *hdr) {
+        return hdr->flags & kFrameRef;
+    }
+    // Frame of an entry that is not a ref
+    static uchar* frameData(PacketHeader *hdr) {
+        return reinterpret_cast<uchar*>(hdr + 1);
+    }
+    uchar* packetData(PacketHeader *hdr) const {
+        if (isFrameRef(hdr))
+            return frameTable_->at(hdr->frame);
+        return frameData(hdr);
+    }
+
+    // Packet iteration - for (h = first(); h < end(); h = next(h))
+    PacketHeader* first() {
+        return reinterpret_cast<PacketHeader*>(buffer_);
+    }
+    PacketHeader* end() {
+        return reinterpret_cast<PacketHeader*>(buffer_ + len_);
+    }
+    static PacketHeader* next(PacketHeader *hdr) {
+        return reinterpret_cast<PacketHeader*>(reinterpret_cast<uchar*>(hdr)
+                + (isFrameRef(hdr) ? refSpace() : packetSpace(hdr->len)));
+    }
+
+    // An empty sequence can always accommodate a packet (in a new arena
+    // chunk if required); else we can grow only if no other sequence has
+    // been allocated after us and the arena chunk has space
+    bool hasFreeSpace(int length) {
+        return !buffer_
+                || arena_->canExtend(buffer_ + len_, packetSpace(length));
+    }
+    bool hasFreeSpaceForRef() {
+        return !buffer_ || arena_->canExtend(buffer_ + len_, refSpace());
+    }
+
+    int appendPacket(quint64 nsec, const uchar *pktData, int length) {
+        PacketHeader *hdr = appendEntry(nsec, packetSpace(length));
+        if (!hdr)
+            return -1;
+
+        hdr->frame = frameTable_->size();
+        hdr->len = length;
+        memcpy(frameData(hdr), pktData, length);
+        frameTable_->append(frameData(hdr));
+        frames_++;
+        packetAppended(hdr);
+        return 0;
+    }
+    // Appends a packet that is a repeat of an existing frame (which must
+    // not itself be a ref) in the same arena
+    int appendPacketRef(quint64 nsec, PacketHeader *frame) {
+        Q_ASSERT(!isFrameRef(frame));
+        PacketHeader *hdr = appendEntry(nsec, refSpace());
+        if (!hdr)
+            return -1;
+
+        hdr->frame = frame->frame;
+        hdr->len = frame->len;
+        hdr->flags = kFrameRef;
+        packetAppended(hdr);
+        return 0;
+    }
+#ifdef Q_OS_WIN32
+    // pcap format copy of the sequence for pcap_sendqueue_transmit()
+    // created on first use
+    pcap_send_queue* pcapSendQueue() {
+        if (sendQueue_)
+            return sendQueue_;
+        sendQueue_ = pcap_sendqueue_alloc(
+                        bytes_ + packets_*sizeof(struct pcap_pkthdr));
+        for (PacketHeader *hdr = first(); hdr < end(); hdr = next(hdr)) {
+            struct pcap_pkthdr pktHdr;
+            pktHdr.caplen = pktHdr.len = hdr->len;
+            pktHdr.ts.tv_sec = hdr->nsec/1000000000ULL;
+            pktHdr.ts.tv_usec = (hdr->nsec % 1000000000ULL)/1000;
+            pcap_sendqueue_queue(sendQueue_, &pktHdr, packetData(hdr));
         }
+        return sendQueue_;
+    }
+#endif
+
+    PacketHeader *lastPacket_;
+    long packets_;
+    long frames_;   // packets with their own frame data i.e. not refs
+    long bytes_;
+    quint64 nsecDuration_;
+    int repeatCount_;
+    int repeatSize_;
+    quint64 nsecDelay_;
+    quint16 ttagL4CksumOffset_;  // For ttag packets
+    StreamStats streamStatsMeta_;
+    // If set, packets are not stored in the sequence but generated on
+    // the fly during transmit (not owned)
+    FrameGenerator *generator_;
+
+private:
+    PacketHeader* appendEntry(quint64 nsec, quint32 space) {
+        if (!buffer_) {
+            buffer_ = arena_->alloc(space);
+            if (!buffer_)
+                return NULL;
+        }
+        else if (!arena_->extend(buffer_ + len_, space))
+            return NULL;
+
+        PacketHeader *hdr = end();
+        if (lastPacket_)
+            nsecDuration_ += nsec - lastPacket_->nsec;
+        hdr->nsec = nsec;
+        hdr->flags = 0;
+        len_ += space;
+        return hdr;
+    }
+    void packetAppended(PacketHeader *hdr) {
+        uchar *pktData = packetData(hdr);
+        int length = hdr->len;
+
         packets_++;
-        bytes_ += pktHeader->caplen;
-        lastPacket_ = (struct pcap_pkthdr *)
-                            (sendQueue_->buffer + sendQueue_->len);
-        ret = pcap_sendqueue_queue(sendQueue_, pktHeader, pktData);
-        if (trackGuidStats_ && (ret >= 0)) {
+        bytes_ += length;
+        lastPacket_ = hdr;
+
+        if (trackGuidStats_) {
             uint guid;
-            if (SignProtocol::packetGuid(pktData, pktHeader->caplen, &guid)) {
+            if (SignProtocol::packetGuid(pktData, length, &guid)) {
                 streamStatsMeta_[guid].tx_pkts++;
-                streamStatsMeta_[guid].tx_bytes += pktHeader->caplen;
+                streamStatsMeta_[guid].tx_bytes += length;
             }
         }
         // TODO: A PacketSequence belongs to a unique stream only in case of
@@ -79,23 +235,18 @@ public:
         // Till the above is fixed, Ttag packets will have wrong checksum
 #if 0
         if (trackGuidStats_ && (packets_ == 1)) // first packet of seq
-            ttagL4CksumOffset_ = Packet::l4ChecksumOffset(pktData, pktHeader->caplen);
+            ttagL4CksumOffset_ = Packet::l4ChecksumOffset(pktData, length);
 #endif
-        return ret;
     }
-    pcap_send_queue *sendQueue_;
-    struct pcap_pkthdr *lastPacket_;
-    long packets_;
-    long bytes_;
-    ulong usecDuration_;
-    int repeatCount_;
-    int repeatSize_;
-    long usecDelay_;
-    quint16 ttagL4CksumOffset_;  // For ttag packets
-    StreamStats streamStatsMeta_;
 
-private:
+    PacketListArena *arena_;
+    QVector<uchar*> *frameTable_;
     bool trackGuidStats_;
+    uchar *buffer_;
+    quint32 len_;
+#ifdef Q_OS_WIN32
+    pcap_send_queue *sendQueue_;
+#endif
 };
 
 #endif
@@ -60,7 +60,11 @@ int Params::parseCommandLine(int argc, char* argv[])
                 if (processTurboOption(optopt))
                     continue;
             }
+#ifdef Q_OS_LINUX
+            printf("usage: %s [-dhtv] [-p <port-number>]\n", argv[0]);
+#else
             printf("usage: %s [-dhv] [-p <port-number>]\n", argv[0]);
+#endif
             exit(1);
         }
         n++;
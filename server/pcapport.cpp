@@ -86,7 +86,8 @@ PcapPort::~PcapPort()
     if (monitorTx_)
         monitorTx_->stop();
 
-    txTtagStatsPoller_->stop();
+    if (isTxTtagCaptureOn_)
+        txTtagStatsPoller_->stop();
     delete txTtagStatsPoller_;
 
     rxStatsPoller_->stop();
@@ -127,6 +128,24 @@ void PcapPort::updateNotes()
             arg(notes).toStdString());
 }
 
+/*!
+  Starts or stops the tx ttag capture as per isTxTtagCaptureNeeded(), if
+  stream stats are being tracked
+*/
+void PcapPort::updateTxTtagCapture()
+{
+    bool needed = isTxTtagCaptureNeeded();
+
+    if (!data_.is_tracking_stream_stats() || (needed == isTxTtagCaptureOn_))
+        return;
+
+    if (needed)
+        txTtagStatsPoller_->start();
+    else
+        txTtagStatsPoller_->stop();
+    isTxTtagCaptureOn_ = needed;
+}
+
 bool PcapPort::setTrackStreamStats(bool enable)
 {
     bool val = enable ? startStreamStatsTracking() : stopStreamStatsTracking();
@@ -181,8 +200,11 @@ bool PcapPort::startStreamStatsTracking()
 {
     if (!transmitter_->setStreamStatsTracking(true))
         goto _tx_fail;
-    if (!txTtagStatsPoller_->start())
-        goto _tx_ttag_fail;
+    if (isTxTtagCaptureNeeded()) {
+        if (!txTtagStatsPoller_->start())
+            goto _tx_ttag_fail;
+        isTxTtagCaptureOn_ = true;
+    }
     if (!rxStatsPoller_->start())
         goto _rx_fail;
     /*
@@ -196,7 +218,9 @@ bool PcapPort::startStreamStatsTracking()
     return true;
 
 _rx_fail:
-    txTtagStatsPoller_->stop();
+    if (isTxTtagCaptureOn_)
+        txTtagStatsPoller_->stop();
+    isTxTtagCaptureOn_ = false;
 _tx_ttag_fail:
     transmitter_->setStreamStatsTracking(false);
 _tx_fail:
@@ -212,10 +236,11 @@ bool PcapPort::stopStreamStatsTracking()
         qWarning("failed to stop Transmitter stream stats tracking");
         ret = false;
     }
-    if (!txTtagStatsPoller_->stop()) {
+    if (isTxTtagCaptureOn_ && !txTtagStatsPoller_->stop()) {
         qWarning("failed to stop TxTtag stream stats thread");
         ret = false;
     }
+    isTxTtagCaptureOn_ = false;
     if (!rxStatsPoller_->stop()) {
         qWarning("failed to stop Rx stream stats thread");
         ret = false;
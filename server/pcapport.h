@@ -68,6 +68,21 @@ public:
     {
         return transmitter_->setPacketListTtagMarkers(markers, repeatInterval);
     }
+    virtual bool addGeneratedPacketSet(const FrameTemplate *frameTemplate,
+            quint64 count, uint burstSize, double burstGap,
+            quint64 delayNsec) {
+        return transmitter_->addGeneratedPacketSet(frameTemplate, count,
+                burstSize, burstGap, delayNsec);
+    }
+    virtual quint64 packetListMemory() {
+        return transmitter_->packetListMemory();
+    }
+    virtual bool useCachedPacketList(const QByteArray &key) {
+        return transmitter_->useCachedPacketList(key);
+    }
+    virtual void cachePacketList(const QByteArray &key) {
+        transmitter_->cachePacketList(key);
+    }
 
     virtual void startTransmit() { 
         Q_ASSERT(!isDirty());
@@ -174,17 +189,24 @@ protected:
     PortMonitor     *monitorTx_;
 
     PcapRxStats *rxStatsPoller_;
+    PcapTransmitter *transmitter_;
 
     void updateNotes();
 
+    // Subclasses whose transmitter gets the T-tag tx timestamps by itself
+    // may not need the tx ttag capture - call updateTxTtagCapture() if
+    // that changes
+    virtual bool isTxTtagCaptureNeeded() { return true; }
+    void updateTxTtagCapture();
+
 private:
     bool startStreamStatsTracking();
     bool stopStreamStatsTracking();
 
-    PcapTransmitter *transmitter_;
     PortCapturer    *capturer_;
     EmulationTransceiver *emulXcvr_;
     PcapTxTtagStats *txTtagStatsPoller_;
+    bool isTxTtagCaptureOn_{false};
 
     static pcap_if_t *deviceList_;
 };
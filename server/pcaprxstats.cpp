@@ -25,6 +25,20 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "settings.h"
 #include "streamtiming.h"
 
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <net/if.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#endif
+
 #define Xnotify qWarning // FIXME
 
 PcapRxStats::PcapRxStats(const char *device, int id)
@@ -39,7 +53,7 @@ PcapRxStats::PcapRxStats(const char *device, int id)
 
     portId_ = id;
 
-    timing_ = StreamTiming::instance();
+    ttagRecords_ = StreamTiming::instance()->rxRecordQueue(portId_);
 }
 
 pcap_t* PcapRxStats::handle()
@@ -89,6 +103,22 @@ void PcapRxStats::run()
     qDebug("In %s", __PRETTY_FUNCTION__);
     qDebug("RxStats Filter: %s", qPrintable(capture_filter));
 
+#ifdef Q_OS_LINUX
+    if (openRing(capture_filter)) {
+        isDirectional_ = true;
+        clearDebugStats();
+        PcapSession::preRun();
+        state_ = kRunning;
+        runRing();
+        PcapSession::postRun();
+        closeRing();
+        stop_ = false;
+        goto _exit;
+    }
+    qWarning("%s: TPACKET_V3 ring unavailable for rx stream stats, "
+            "falling back to pcap", qPrintable(device_));
+#endif
+
     handle_ = pcap_open_live(qPrintable(device_), 65535,
                     flags, 100 /* ms */, errbuf);
     if (handle_ == NULL) {
@@ -143,24 +173,12 @@ _skip_filter:
         ret = pcap_next_ex(handle_, &hdr, &data);
         switch (ret) {
             case 1: {
-                uint ttagId, guid;
-#ifdef Q_OS_WIN32
-                // Npcap (Windows) doesn't support direction, so packets
-                // Tx by PcapTxThread are received back by us here - use
-                // TxPort to filter out. TxPort is returned as byte 1 of
-                // ttagId (byte 0 is ttagId).
-                // If TxPort is us ==> Tx Packet, so skip
-                // FIXME: remove once npcap supports pcap direction
-                if (SignProtocol::packetTtagId(data, hdr->caplen, &ttagId, &guid)
-                        && (ttagId >> 8 != uint(portId_))) {
-                    ttagId &= 0xFF;
-                    timing_->recordRxTime(portId_, guid, ttagId, hdr->ts);
-                }
-#else
-                if (SignProtocol::packetTtagId(data, hdr->caplen, &ttagId, &guid)) {
-                    timing_->recordRxTime(portId_, guid, ttagId, hdr->ts);
-                }
-#endif
+                struct timespec ts;
+                uint guid;
+
+                ts.tv_sec = hdr->ts.tv_sec;
+                ts.tv_nsec = hdr->ts.tv_usec*1000;
+                guid = processPacket(data, hdr->caplen, ts);
                 if (guid != SignProtocol::kInvalidGuid) {
                     streamStats_[guid].rx_pkts++;
                     streamStats_[guid].rx_bytes += hdr->caplen;
@@ -197,6 +215,58 @@ _exit:
     state_ = kFinished;
 }
 
+/*!
+  Records the T-tag and tx timestamp (if any) of a received packet for
+  stream timing and returns its guid (kInvalidGuid if none)
+
+  Only the Sign trailer at the end of the packet is looked at
+*/
+uint PcapRxStats::processPacket(const uchar *data, int length,
+        const struct timespec &timestamp)
+{
+    uint ttagId, guid = SignProtocol::kInvalidGuid, txPort;
+    quint64 txNsec;
+
+#ifdef Q_OS_WIN32
+    // Npcap (Windows) doesn't support direction, so packets
+    // Tx by PcapTxThread are received back by us here - use
+    // TxPort to filter out. TxPort is returned as byte 1 of
+    // ttagId (byte 0 is ttagId).
+    // If TxPort is us ==> Tx Packet, so skip
+    // FIXME: remove once npcap supports pcap direction
+    if (SignProtocol::packetTtagId(data, length, &ttagId, &guid)
+            && (ttagId >> 8 != uint(portId_))) {
+        ttagId &= 0xFF;
+        ttagRecords_->record(guid, ttagId, timestamp);
+    }
+#else
+    if (SignProtocol::packetTtagId(data, length, &ttagId, &guid)) {
+        ttagRecords_->record(guid, ttagId, timestamp);
+    }
+#endif
+
+    // XXX: Tx Timestamp TLV is always at the same place in the trailer (see
+    // SignProtocol) - check that before walking the trailer again
+    if ((length > 7) && (data[length-7] == SignProtocol::kTypeLenTxTimestamp)
+            && SignProtocol::packetTxTimestamp(data, length,
+                                               &txNsec, &guid, &txPort)
+#ifdef Q_OS_WIN32
+            && (txPort != uint(portId_)) // see above
+#endif
+            ) {
+        // Tx timestamp has only the 56 LSBs of the tx time -
+        // so compute latency modulo 2^56 and sign extend
+        quint64 rxNsec = quint64(timestamp.tv_sec)*1000000000ULL
+                            + timestamp.tv_nsec;
+        quint64 diff = (rxNsec - txNsec) & SignProtocol::kTxTimestampMask;
+        if (diff & ~(SignProtocol::kTxTimestampMask >> 1))
+            diff |= ~SignProtocol::kTxTimestampMask;
+        ttagRecords_->recordLatency(guid, qint64(diff));
+    }
+
+    return guid;
+}
+
 bool PcapRxStats::start()
 {
     if (state_ == kRunning) {
@@ -237,6 +307,33 @@ bool PcapRxStats::isDirectional()
     return isDirectional_;
 }
 
+// XXX: Implemented as reset on read (like PcapSession::debugStats())
+QString PcapRxStats::debugStats()
+{
+#ifdef Q_OS_LINUX
+    int fd = ringFd_;
+
+    if (fd >= 0) {
+        struct tpacket_stats_v3 stats;
+        socklen_t len = sizeof(stats);
+
+        // Kernel resets the counters on read
+        if (getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len) < 0)
+            return QString("error reading ring stats: %1")
+                        .arg(strerror(errno));
+
+        // tp_drops are packets that matched but found the ring full - if
+        // non-zero, the rx stream stats are under-counted
+        return QString("recv: %1 drop: %2 freeze: %3 (ring)")
+                    .arg(stats.tp_packets)
+                    .arg(stats.tp_drops)
+                    .arg(stats.tp_freeze_q_cnt);
+    }
+#endif
+
+    return PcapSession::debugStats();
+}
+
 // XXX: Stats are reset on read
 void PcapRxStats::updateRxStreamStats(StreamStats &streamStats)
 {
@@ -254,3 +351,254 @@ void PcapRxStats::updateRxStreamStats(StreamStats &streamStats)
     }
     streamStats_.clear();
 }
+
+#ifdef Q_OS_LINUX
+/*!
+  Opens an AF_PACKET socket with a TPACKET_V3 rx ring on our device with
+  the given capture filter - returns false if any of it fails
+
+  The filter is compiled by libpcap and attached to the socket as is
+*/
+bool PcapRxStats::openRing(const QString &filter)
+{
+    int ver = TPACKET_V3;
+    struct tpacket_req3 req;
+    struct packet_mreq mreq;
+    struct sockaddr_ll addr;
+    struct bpf_program bpf;
+    pcap_t *dead;
+    int ifIndex = if_nametoindex(qPrintable(device_));
+
+    if (!ifIndex)
+        return false;
+
+    // Socket doesn't receive any packets till we bind it with a protocol
+    // below - after the filter and ring are setup
+    ringFd_ = socket(AF_PACKET, SOCK_RAW, 0);
+    if (ringFd_ < 0) {
+        qWarning("%s: unable to open AF_PACKET socket: %s",
+                qPrintable(device_), strerror(errno));
+        return false;
+    }
+
+    if (setsockopt(ringFd_, SOL_PACKET, PACKET_VERSION,
+                &ver, sizeof(ver)) < 0) {
+        qWarning("%s: unable to set TPACKET_V3: %s",
+                qPrintable(device_), strerror(errno));
+        goto _error;
+    }
+
+    // XXX: Without this, tx packets are dropped in processBlock()
+#ifdef PACKET_IGNORE_OUTGOING
+    {
+        int ignore = 1;
+        ignoresOutgoing_ = (setsockopt(ringFd_, SOL_PACKET,
+                    PACKET_IGNORE_OUTGOING, &ignore, sizeof(ignore)) == 0);
+    }
+#endif
+
+    // XXX: We use a dead handle instead of our device, so that libpcap
+    // doesn't use the Linux specific vlan checks (see run()); vlan tags
+    // are stripped by the kernel before the filter is run anyway
+    dead = pcap_open_dead(DLT_EN10MB, 65535);
+    if (!dead)
+        goto _error;
+    if (pcap_compile(dead, &bpf, qPrintable(filter), 1, 0) < 0) {
+        qWarning("%s: error compiling filter: %s", qPrintable(device_),
+                pcap_geterr(dead));
+    }
+    else {
+        struct sock_fprog prog;
+
+        prog.len = bpf.bf_len;
+        prog.filter = reinterpret_cast<struct sock_filter*>(bpf.bf_insns);
+        if (setsockopt(ringFd_, SOL_SOCKET, SO_ATTACH_FILTER,
+                    &prog, sizeof(prog)) < 0)
+            qWarning("%s: error setting filter: %s", qPrintable(device_),
+                    strerror(errno));
+        pcap_freecode(&bpf);
+    }
+    pcap_close(dead);
+
+    // Packets are captured in full (for the Sign trailer at the end), but
+    // V3 packs them back-to-back in a block - so small packets don't use
+    // up a frame's worth of ring
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = kRingBlockSize;
+    req.tp_block_nr = kRingBlockCount;
+    req.tp_frame_size = kRingFrameSize;
+    req.tp_frame_nr = (kRingBlockSize/kRingFrameSize)*kRingBlockCount;
+    req.tp_retire_blk_tov = kRingBlockTimeoutMsec;
+    if (setsockopt(ringFd_, SOL_PACKET, PACKET_RX_RING,
+                &req, sizeof(req)) < 0) {
+        qWarning("%s: unable to setup RX_RING: %s",
+                qPrintable(device_), strerror(errno));
+        goto _error;
+    }
+
+    ring_ = (uchar*) mmap(NULL, size_t(kRingBlockSize)*kRingBlockCount,
+                          PROT_READ | PROT_WRITE, MAP_SHARED, ringFd_, 0);
+    if (ring_ == MAP_FAILED) {
+        qWarning("%s: unable to mmap RX_RING: %s",
+                qPrintable(device_), strerror(errno));
+        ring_ = nullptr;
+        goto _error;
+    }
+
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.mr_ifindex = ifIndex;
+    mreq.mr_type = PACKET_MR_PROMISC;
+    if (setsockopt(ringFd_, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
+                &mreq, sizeof(mreq)) < 0) {
+        Xnotify("Unable to set promiscuous mode on <%s> - "
+                "stream stats rx will not work", qPrintable(device_));
+        goto _error;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = ifIndex;
+    if (bind(ringFd_, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        qWarning("%s: unable to bind AF_PACKET socket: %s",
+                qPrintable(device_), strerror(errno));
+        goto _error;
+    }
+
+    qDebug("%s: rx stats TPACKET_V3 ring blockSize %u blockCount %u "
+            "(ignore outgoing %s)", qPrintable(device_), kRingBlockSize,
+            kRingBlockCount, ignoresOutgoing_ ? "yes" : "no");
+    return true;
+
+_error:
+    closeRing();
+    return false;
+}
+
+void PcapRxStats::closeRing()
+{
+    int fd = ringFd_;
+
+    if (ring_) {
+        munmap(ring_, size_t(kRingBlockSize)*kRingBlockCount);
+        ring_ = nullptr;
+    }
+
+    if (fd >= 0) {
+        ringFd_ = -1; // before close, for debugStats()
+        close(fd);
+    }
+}
+
+/*!
+  Processes the ring blocks as and when the kernel hands them over to
+  us till we are stopped
+*/
+void PcapRxStats::runRing()
+{
+    uint block = 0;
+
+    for (int i = 0; i < kGuidCountSize; i++)
+        guidCounts_[i].guid = SignProtocol::kInvalidGuid;
+
+    while (!stop_) {
+        struct tpacket_block_desc *desc = (struct tpacket_block_desc*)
+                                            (ring_ + block*kRingBlockSize);
+
+        if (!(__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE)
+                    & TP_STATUS_USER)) {
+            struct pollfd pfd;
+
+            // A partially filled block is handed over to us after
+            // kRingBlockTimeoutMsec; stop() interrupts the poll
+            pfd.fd = ringFd_;
+            pfd.events = POLLIN | POLLERR;
+            pfd.revents = 0;
+            poll(&pfd, 1, 100 /* ms */);
+            continue;
+        }
+
+        processBlock((const uchar*)desc);
+
+        __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL,
+                __ATOMIC_RELEASE);
+        if (++block >= kRingBlockCount)
+            block = 0;
+    }
+
+    qDebug("user requested rxstats stop");
+}
+
+void PcapRxStats::processBlock(const uchar *block)
+{
+    const struct tpacket_block_desc *desc =
+        (const struct tpacket_block_desc*) block;
+    const uchar *p = block + desc->hdr.bh1.offset_to_first_pkt;
+    uint count = desc->hdr.bh1.num_pkts;
+
+    for (uint i = 0; i < count; i++) {
+        const struct tpacket3_hdr *hdr = (const struct tpacket3_hdr*) p;
+        const struct sockaddr_ll *sll = (const struct sockaddr_ll*)
+                                (p + TPACKET_ALIGN(sizeof(*hdr)));
+        p += hdr->tp_next_offset;
+
+        // Skip our own tx packets (if the kernel didn't) and packets
+        // whose trailer was not captured
+        if ((!ignoresOutgoing_ && (sll->sll_pkttype == PACKET_OUTGOING))
+                || (hdr->tp_snaplen != hdr->tp_len))
+            continue;
+
+        struct timespec ts;
+        ts.tv_sec = hdr->tp_sec;
+        ts.tv_nsec = hdr->tp_nsec;
+
+        uint guid = processPacket((const uchar*)hdr + hdr->tp_mac,
+                                  hdr->tp_snaplen, ts);
+        if (guid == SignProtocol::kInvalidGuid)
+            continue;
+
+        GuidCount *gc = &guidCounts_[guid & (kGuidCountSize - 1)];
+        if (gc->guid != guid) {
+            if (gc->guid != SignProtocol::kInvalidGuid) {
+                QMutexLocker lock(&streamStatsLock_);
+                streamStats_[gc->guid].rx_pkts += gc->pkts;
+                streamStats_[gc->guid].rx_bytes += gc->bytes;
+            }
+            gc->guid = guid;
+            gc->pkts = 0;
+            gc->bytes = 0;
+        }
+        gc->pkts++;
+        gc->bytes += hdr->tp_len;
+
+        // XXX: The kernel strips the (outermost) vlan tag and reports it
+        // in hv1 instead (the TPID too if TP_STATUS_VLAN_TPID_VALID), so
+        // tp_len is short by the tag; libpcap puts the tag back in the
+        // packet, so add it here too to match the pcap path's rx bytes
+        if (hdr->tp_status & TP_STATUS_VLAN_VALID)
+            gc->bytes += 4;
+    }
+
+    flushGuidCounts();
+}
+
+/*!
+  Adds the accumulated per guid rx counts to streamStats_
+*/
+void PcapRxStats::flushGuidCounts()
+{
+    QMutexLocker lock(&streamStatsLock_);
+
+    for (int i = 0; i < kGuidCountSize; i++) {
+        GuidCount &gc = guidCounts_[i];
+
+        if (gc.guid == SignProtocol::kInvalidGuid)
+            continue;
+
+        StreamStatsTuple &sst = streamStats_[gc.guid];
+        sst.rx_pkts += gc.pkts;
+        sst.rx_bytes += gc.bytes;
+        gc.guid = SignProtocol::kInvalidGuid;
+    }
+}
+#endif
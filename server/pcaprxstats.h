@@ -23,11 +23,18 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "streamstats.h"
 
 #include "pcapsession.h"
+#include "streamtiming.h"
 
 #include <QMutex>
 
-class StreamTiming;
-
+/*
+ * Rx stream stats poller - counts the rx packets of each stream (guid) and
+ * records the T-tag/tx timestamp of the packets for stream timing
+ *
+ * On Linux, packets are read in blocks from an AF_PACKET TPACKET_V3 mmap
+ * ring instead of one at a time using pcap_next_ex(); if the ring cannot
+ * be setup, we fallback to pcap
+ */
 class PcapRxStats: public PcapSession
 {
 public:
@@ -38,6 +45,7 @@ public:
     bool stop();
     bool isRunning();
     bool isDirectional();
+    virtual QString debugStats();
 
     void updateRxStreamStats(StreamStats &streamStats); // Reset on read
 private:
@@ -47,6 +55,38 @@ private:
         kFinished
     };
 
+    uint processPacket(const uchar *data, int length,
+                       const struct timespec &timestamp);
+
+#ifdef Q_OS_LINUX
+    bool openRing(const QString &filter);
+    void closeRing();
+    void runRing();
+    void processBlock(const uchar *block);
+    void flushGuidCounts();
+
+    static const uint kRingBlockSize = 1024*1024; // in bytes
+    static const uint kRingBlockCount = 32;
+    static const uint kRingFrameSize = 2048;      // nominal; V3 frames
+                                                  // are variable sized
+    static const uint kRingBlockTimeoutMsec = 10;
+
+    int ringFd_{-1};
+    uchar *ring_{nullptr};
+    bool ignoresOutgoing_{false}; // kernel doesn't give us tx packets
+
+    // Rx counts of a ring block are accumulated here by guid (direct
+    // mapped) and added to streamStats_ once per block, instead of a
+    // streamStats_ update per packet
+    struct GuidCount {
+        uint guid;
+        quint64 pkts;
+        quint64 bytes;
+    };
+    static const int kGuidCountSize = 256; // MUST be a power of 2
+    GuidCount guidCounts_[kGuidCountSize];
+#endif
+
     QString device_;
     StreamStats streamStats_;
     QMutex streamStatsLock_;
@@ -56,7 +96,7 @@ private:
 
     int portId_;
 
-    StreamTiming *timing_{nullptr};
+    StreamTiming::RecordQueue *ttagRecords_{nullptr};
 };
 
 #endif
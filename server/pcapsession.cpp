@@ -137,7 +137,9 @@ void PcapSession::stop()
     // we use a signal for the latter
     // TODO: If the signal mechanism doesn't work, we could try
     // pthread_cancel(thread_);
-    pcap_breakloop(handle_);
+    // Subclasses may not use a pcap handle (e.g. PcapRxStats ring mode)
+    if (handle_)
+        pcap_breakloop(handle_);
     pthread_kill(thread_.nativeId(), MY_BREAK_SIGNAL);
 }
 
@@ -56,7 +56,7 @@ inline uint qHash(const ThreadId &key)
 class PcapSession: public QThread
 {
 public:
-    QString debugStats();
+    virtual QString debugStats();
 
 protected:
     bool clearDebugStats();
@@ -79,7 +79,7 @@ private:
 class PcapSession: public QThread
 {
 public:
-    QString debugStats();
+    virtual QString debugStats();
 
 protected:
     bool clearDebugStats();
@@ -19,31 +19,83 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "pcaptransmitter.h"
 
+#include "../common/frametemplate.h"
+#include "../common/streambase.h"
+
+#include <QSet>
+
+/*!
+  Constructs a transmitter for the given device
+
+  If txThread is NULL, a default pcap based tx thread is used; otherwise
+  the transmitter takes ownership of the passed in txThread
+*/
 PcapTransmitter::PcapTransmitter(
-        const char *device)
-    : txThread_(device)
+        const char *device,
+        PcapTxThread *txThread)
 {
     adjustRxStreamStats_ = false;
     txStats_.setObjectName(QString("TxStats:%1").arg(device));
-    memset(&stats_, 0, sizeof(stats_));
-    txStats_.setTxThreadStats(&stats_);
 
-    txThread_.setStats(&stats_);
-    connect(&txThread_, SIGNAL(finished()), SLOT(updateTxThreadStreamStats()));
+    addTxThread(txThread ? txThread : new PcapTxThread(device));
+
+    // Only the primary tx thread tracks stream stats
+    connect(txThreads_.first(), SIGNAL(finished()),
+            SLOT(updateTxThreadStreamStats()));
 }
 
 PcapTransmitter::~PcapTransmitter()
 {
-    if (txThread_.isRunning())
-        txThread_.stop();
+    if (isRunning())
+        stop();
     if (txStats_.isRunning())
         txStats_.stop();
+    foreach (PcapTxThread *txThread, txThreads_) {
+        txThread->wait();
+        delete txThread;
+    }
+    qDeleteAll(txThreadStats_);
+}
+
+/*!
+  Adds an additional tx thread (shard) - the transmitter takes ownership
+  of the passed in txThread
+
+  The packet list is split across all tx threads, each thread sending
+  every Nth packet while following the complete packet list timeline, so
+  that the aggregate rate is same as that of a single tx thread
+
+  Must be called before the packet list is built
+*/
+bool PcapTransmitter::addTxThread(PcapTxThread *txThread)
+{
+    if (isRunning()) {
+        qWarning("Can't add tx thread while transmit is on");
+        return false;
+    }
+
+    StatsTuple *stats = new StatsTuple;
+    memset(stats, 0, sizeof(*stats));
+    txThread->setStats(stats);
+    txStats_.addTxThreadStats(stats);
+
+    txThreads_.append(txThread);
+    txThreadStats_.append(stats);
+
+    for (int i = 0; i < txThreads_.size(); i++)
+        txThreads_.at(i)->setShard(i, txThreads_.size());
+
+    return true;
 }
 
 bool PcapTransmitter::setRateAccuracy(
         AbstractPort::Accuracy accuracy)
 {
-    return txThread_.setRateAccuracy(accuracy);
+    foreach (PcapTxThread *txThread, txThreads_) {
+        if (!txThread->setRateAccuracy(accuracy))
+            return false;
+    }
+    return true;
 }
 
 void PcapTransmitter::adjustRxStreamStats(bool enable)
@@ -53,7 +105,9 @@ void PcapTransmitter::adjustRxStreamStats(bool enable)
 
 bool PcapTransmitter::setStreamStatsTracking(bool enable)
 {
-    return txThread_.setStreamStatsTracking(enable);
+    // Only the primary tx thread tracks stream stats - it traverses the
+    // whole packet list even if it doesn't send all the packets
+    return txThreads_.first()->setStreamStatsTracking(enable);
 }
 
 // XXX: Stats are reset on read
@@ -83,7 +137,58 @@ void PcapTransmitter::updateTxRxStreamStats(StreamStats &streamStats)
 
 void PcapTransmitter::clearPacketList()
 {
-    txThread_.clearPacketList();
+    foreach (PcapTxThread *txThread, txThreads_)
+        txThread->clearPacketList();
+}
+
+// Each tx thread has its own copy of the packet list - unless shared
+quint64 PcapTransmitter::packetListMemory()
+{
+    QSet<const PacketList*> packetLists;
+    quint64 size = 0;
+
+    foreach (PcapTxThread *txThread, txThreads_) {
+        const PacketList *packetList = txThread->packetList().data();
+        if (packetLists.contains(packetList))
+            continue;
+        packetLists.insert(packetList);
+        size += txThread->packetListMemory();
+    }
+
+    return size;
+}
+
+/*!
+  Uses the packet list with the given key from the packet list cache
+  instead of building one - returns false if there's no such list
+*/
+bool PcapTransmitter::useCachedPacketList(const QByteArray &key)
+{
+    QSharedPointer<PacketList> packetList = PacketListCache::find(key);
+
+    if (packetList.isNull())
+        return false;
+
+    foreach (PcapTxThread *txThread, txThreads_)
+        txThread->setPacketList(packetList);
+    return true;
+}
+
+/*!
+  Adds the just built packet list to the packet list cache with the given
+  key, so that other ports can use it too - as do our other tx threads,
+  instead of their own copy
+*/
+void PcapTransmitter::cachePacketList(const QByteArray &key)
+{
+    QSharedPointer<PacketList> packetList = txThreads_.first()->packetList();
+
+    if (!packetList->isShareable())
+        return;
+
+    PacketListCache::insert(key, packetList);
+    for (int i = 1; i < txThreads_.size(); i++)
+        txThreads_.at(i)->setPacketList(packetList);
 }
 
 void PcapTransmitter::loopNextPacketSet(
@@ -92,18 +197,56 @@ void PcapTransmitter::loopNextPacketSet(
         long repeatDelaySec,
         long repeatDelayNsec)
 {
-    txThread_.loopNextPacketSet(size, repeats, repeatDelaySec, repeatDelayNsec);
+    foreach (PcapTxThread *txThread, txThreads_)
+        txThread->loopNextPacketSet(size, repeats,
+                repeatDelaySec, repeatDelayNsec);
 }
 
 bool PcapTransmitter::appendToPacketList(long sec, long nsec,
         const uchar *packet, int length)
 {
-    return txThread_.appendToPacketList(sec, nsec, packet, length);
+    bool ret = true;
+
+    // XXX: every tx thread has a copy of the complete packet list
+    foreach (PcapTxThread *txThread, txThreads_) {
+        if (!txThread->appendToPacketList(sec, nsec, packet, length))
+            ret = false;
+    }
+    return ret;
+}
+
+bool PcapTransmitter::addGeneratedPacketSet(
+        const FrameTemplate *frameTemplate, quint64 count, uint burstSize,
+        double burstGap, quint64 delayNsec)
+{
+    const StreamBase *stream = frameTemplate->stream();
+    bool ret = true;
+
+    // Frames of a stream that didn't compile are built by calling into
+    // the stream from the generator thread - which is not safe for some
+    // streams at all and for others not from more than one generator (one
+    // per tx thread) at a time (see StreamBase::frameValueConcurrency());
+    // have such streams' frames stored in the packet list instead
+    if (((txThreads_.size() > 1)
+                || (stream->frameValueConcurrency()
+                        == StreamBase::e_fvc_none))
+            && !frameTemplate->isCompiled())
+        return false;
+
+    // XXX: every tx thread generates all packets for itself
+    foreach (PcapTxThread *txThread, txThreads_) {
+        if (!txThread->addGeneratedPacketSet(frameTemplate, count,
+                    burstSize, burstGap, delayNsec))
+            ret = false;
+    }
+    return ret;
 }
 
 void PcapTransmitter::setHandle(pcap_t *handle)
 {
-    txThread_.setHandle(handle);
+    // Only the primary tx thread transmits on the passed in handle, other
+    // tx threads use their own
+    txThreads_.first()->setHandle(handle);
 }
 
 void PcapTransmitter::setPacketListLoopMode(
@@ -111,14 +254,19 @@ void PcapTransmitter::setPacketListLoopMode(
         quint64 secDelay,
         quint64 nsecDelay)
 {
-    txThread_.setPacketListLoopMode(loop, secDelay, nsecDelay);
+    foreach (PcapTxThread *txThread, txThreads_)
+        txThread->setPacketListLoopMode(loop, secDelay, nsecDelay);
 }
 
 bool PcapTransmitter::setPacketListTtagMarkers(
         QList<uint> markers,
         uint repeatInterval)
 {
-    return txThread_.setPacketListTtagMarkers(markers, repeatInterval);
+    foreach (PcapTxThread *txThread, txThreads_) {
+        if (!txThread->setPacketListTtagMarkers(markers, repeatInterval))
+            return false;
+    }
+    return true;
 }
 
 void PcapTransmitter::useExternalStats(AbstractPort::PortStats *stats)
@@ -132,26 +280,38 @@ void PcapTransmitter::start()
     // is missed
     txStats_.start();
     Q_ASSERT(txStats_.isRunning());
-    txThread_.start();
+    foreach (PcapTxThread *txThread, txThreads_)
+        txThread->start();
 }
 
 void PcapTransmitter::stop()
 {
     // XXX: Stop the tx thread before the stats thread, so no tx stats
     // is missed
-    txThread_.stop();
-    Q_ASSERT(!txThread_.isRunning());
+    foreach (PcapTxThread *txThread, txThreads_) {
+        if (txThread->isRunning())
+            txThread->stop();
+        Q_ASSERT(!txThread->isRunning());
+    }
     txStats_.stop();
 }
 
 bool PcapTransmitter::isRunning()
 {
-    return txThread_.isRunning();
+    foreach (PcapTxThread *txThread, txThreads_) {
+        if (txThread->isRunning())
+            return true;
+    }
+    return false;
 }
 
 double PcapTransmitter::lastTxDuration()
 {
-    return txThread_.lastTxDuration();
+    double duration = 0.0;
+
+    foreach (PcapTxThread *txThread, txThreads_)
+        duration = qMax(duration, txThread->lastTxDuration());
+    return duration;
 }
 
 void PcapTransmitter::updateTxThreadStreamStats()
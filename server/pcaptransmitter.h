@@ -29,9 +29,11 @@ class PcapTransmitter : QObject
 {
     Q_OBJECT
 public:
-    PcapTransmitter(const char *device);
+    PcapTransmitter(const char *device, PcapTxThread *txThread = NULL);
     ~PcapTransmitter();
 
+    bool addTxThread(PcapTxThread *txThread);
+
     bool setRateAccuracy(AbstractPort::Accuracy accuracy);
     bool setStreamStatsTracking(bool enable);
     void adjustRxStreamStats(bool enable);
@@ -40,10 +42,16 @@ public:
     void clearPacketList();
     void loopNextPacketSet(qint64 size, qint64 repeats,
                            long repeatDelaySec, long repeatDelayNsec);
-    bool appendToPacketList(long sec, long usec, const uchar *packet,
+    bool appendToPacketList(long sec, long nsec, const uchar *packet,
                             int length);
+    bool addGeneratedPacketSet(const FrameTemplate *frameTemplate,
+                               quint64 count, uint burstSize,
+                               double burstGap, quint64 delayNsec);
     void setPacketListLoopMode(bool loop, quint64 secDelay, quint64 nsecDelay);
     bool setPacketListTtagMarkers(QList<uint> markers, uint repeatInterval);
+    quint64 packetListMemory();
+    bool useCachedPacketList(const QByteArray &key);
+    void cachePacketList(const QByteArray &key);
 
     void setHandle(pcap_t *handle);
     void useExternalStats(AbstractPort::PortStats *stats);
@@ -57,9 +65,9 @@ private slots:
 private:
     StreamStats streamStats_;
     QMutex streamStatsLock_;
-    PcapTxThread txThread_;
+    QList<PcapTxThread*> txThreads_; // 1st thread is the primary
+    QList<StatsTuple*> txThreadStats_;
     PcapTxStats txStats_;
-    StatsTuple stats_;
     bool adjustRxStreamStats_;
 };
 
@@ -24,8 +24,6 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 PcapTxStats::PcapTxStats()
 {
-    txThreadStats_ = NULL;
-
     stats_ = new AbstractPort::PortStats;
     usingInternalStats_ = true;
 
@@ -38,9 +36,9 @@ PcapTxStats::~PcapTxStats()
         delete stats_;
 }
 
-void PcapTxStats::setTxThreadStats(StatsTuple *stats)
+void PcapTxStats::addTxThreadStats(StatsTuple *stats)
 {
-    txThreadStats_ = stats;
+    txThreadStats_.append(stats);
 }
 
 void PcapTxStats::useExternalStats(AbstractPort::PortStats *stats)
@@ -69,13 +67,19 @@ void PcapTxStats::stop()
 
 void PcapTxStats::run()
 {
-    Q_ASSERT(txThreadStats_);
+    Q_ASSERT(!txThreadStats_.isEmpty());
 
     qDebug("txStats: collection start");
 
     while (1) {
-        stats_->txPkts = txThreadStats_->pkts;
-        stats_->txBytes = txThreadStats_->bytes;
+        quint64 pkts = 0, bytes = 0;
+
+        foreach (StatsTuple *txThreadStats, txThreadStats_) {
+            pkts += txThreadStats->pkts;
+            bytes += txThreadStats->bytes;
+        }
+        stats_->txPkts = pkts;
+        stats_->txBytes = bytes;
 
         if (stop_)
             break;
@@ -22,6 +22,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "abstractport.h"
 
+#include <QList>
 #include <QThread>
 
 struct StatsTuple;
@@ -32,7 +33,7 @@ public:
     PcapTxStats();
     ~PcapTxStats();
 
-    void setTxThreadStats(StatsTuple *stats);
+    void addTxThreadStats(StatsTuple *stats);
 
     void useExternalStats(AbstractPort::PortStats *stats);
 
@@ -41,7 +42,7 @@ public:
 private:
     void run();
 
-    StatsTuple *txThreadStats_;
+    QList<StatsTuple*> txThreadStats_; // summed up for port stats
 
     bool usingInternalStats_;
     AbstractPort::PortStats *stats_;
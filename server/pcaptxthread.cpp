@@ -19,17 +19,31 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "pcaptxthread.h"
 
+#include "checksum.h"
 #include "sign.h"
 #include "statstuple.h"
 #include "timestamp.h"
 
 #include <QtDebug>
 
+#include <string.h>
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#ifdef Q_OS_WIN32
+static QMutex sendQueueLock; // see PacketSequence::pcapSendQueue()
+#endif
+
 PcapTxThread::PcapTxThread(const char *device)
 {
     char errbuf[PCAP_ERRBUF_SIZE] = "";
 
     setObjectName(QString("Tx:%1").arg(device));
+    device_ = QString::fromLatin1(device);
 
 #ifdef Q_OS_WIN32
     LARGE_INTEGER   freq;
@@ -70,11 +84,18 @@ bool PcapTxThread::setRateAccuracy(
 {
     switch (accuracy) {
     case AbstractPort::kHighAccuracy:
-        udelayFn_ = udelay;
+        delayFn_ = ndelay;
         qWarning("%s: rate accuracy set to High - busy wait", __FUNCTION__);
         break;
+#ifdef Q_OS_LINUX
+    case AbstractPort::kMediumAccuracy:
+        calibrateHybridDelay();
+        delayFn_ = hybridDelay;
+        qWarning("%s: rate accuracy set to Medium - sleep + spin", __FUNCTION__);
+        break;
+#endif
     case AbstractPort::kLowAccuracy:
-        udelayFn_ = QThread::usleep;
+        delayFn_ = sleepDelay;
         qWarning("%s: rate accuracy set to Low - usleep", __FUNCTION__);
         break;
     default:
@@ -95,102 +116,29 @@ void PcapTxThread::clearPacketList()
 {
     Q_ASSERT(!isRunning());
     // \todo lock for packetSequenceList
-    while(packetSequenceList_.size())
-        delete packetSequenceList_.takeFirst();
-
-    currentPacketSequence_ = NULL;
-    repeatSequenceStart_ = -1;
-    repeatSize_ = 0;
-    packetCount_ = 0;
-
-    packetListSize_ = 0;
-    returnToQIdx_ = -1;
-
-    setPacketListLoopMode(false, 0, 0);
+    packetList_ = QSharedPointer<PacketList>(
+                        new PacketList(trackStreamStats_));
+    packetListVersion_++;
 }
 
 void PcapTxThread::loopNextPacketSet(qint64 size, qint64 repeats,
         long repeatDelaySec, long repeatDelayNsec)
 {
-    currentPacketSequence_ = new PacketSequence(trackStreamStats_);
-    currentPacketSequence_->repeatCount_ = repeats;
-    currentPacketSequence_->usecDelay_ = repeatDelaySec * long(1e6)
-                                            + repeatDelayNsec/1000;
-
-    repeatSequenceStart_ = packetSequenceList_.size();
-    repeatSize_ = size;
-    packetCount_ = 0;
-
-    packetSequenceList_.append(currentPacketSequence_);
+    packetList_->loopNextPacketSet(size, repeats,
+                                   repeatDelaySec, repeatDelayNsec);
 }
 
 bool PcapTxThread::appendToPacketList(long sec, long nsec,
         const uchar *packet, int length)
 {
-    bool op = true;
-    pcap_pkthdr pktHdr;
-
-    pktHdr.caplen = pktHdr.len = length;
-    pktHdr.ts.tv_sec = sec;
-    pktHdr.ts.tv_usec = nsec/1000;
-
-    // loopNextPacketSet should have created a seq
-    Q_ASSERT(currentPacketSequence_ != NULL);
-
-    // If not enough space, update usecDelay and alloc a new seq
-    if (!currentPacketSequence_->hasFreeSpace(2*sizeof(pcap_pkthdr)+length))
-    {
-        struct timeval diff;
-        timersub(&pktHdr.ts, &currentPacketSequence_->lastPacket_->ts, &diff);
-        currentPacketSequence_->usecDelay_ = diff.tv_usec;
-        if (diff.tv_sec)
-            currentPacketSequence_->usecDelay_ += diff.tv_sec*1e6;
-
-        //! \todo (LOW): calculate sendqueue size
-        currentPacketSequence_ = new PacketSequence(trackStreamStats_);
-        packetSequenceList_.append(currentPacketSequence_);
-
-        // Validate that the pkt will fit inside the new currentSendQueue_
-        Q_ASSERT(currentPacketSequence_->hasFreeSpace(
-                    sizeof(pcap_pkthdr) + length));
-    }
-
-    if (currentPacketSequence_->appendPacket(&pktHdr, (u_char*) packet) < 0)
-    {
-        op = false;
-    }
-
-    packetCount_++;
-    packetListSize_ += repeatSize_ ?
-                                currentPacketSequence_->repeatCount_ : 1;
-
-    // Last packet of packet-set?
-    if (repeatSize_ > 0 && packetCount_ == repeatSize_)
-    {
-        qDebug("repeatSequenceStart_=%d, repeatSize_ = %llu",
-                repeatSequenceStart_, repeatSize_);
-
-        // Set the packetSequence repeatSize
-        Q_ASSERT(repeatSequenceStart_ >= 0);
-        Q_ASSERT(repeatSequenceStart_ < packetSequenceList_.size());
-
-        if (currentPacketSequence_ != packetSequenceList_[repeatSequenceStart_])
-        {
-            PacketSequence *start = packetSequenceList_[repeatSequenceStart_];
-
-            currentPacketSequence_->usecDelay_ = start->usecDelay_;
-            start->usecDelay_ = 0;
-            start->repeatSize_ =
-                    packetSequenceList_.size() - repeatSequenceStart_;
-        }
-
-        repeatSize_ = 0;
-
-        // End current pktSeq
-        currentPacketSequence_ = NULL;
-    }
+    return packetList_->append(sec, nsec, packet, length);
+}
 
-    return op;
+bool PcapTxThread::addGeneratedPacketSet(const FrameTemplate *frameTemplate,
+        quint64 count, uint burstSize, double burstGap, quint64 delayNsec)
+{
+    return packetList_->addGeneratedPacketSet(frameTemplate, count,
+                                              burstSize, burstGap, delayNsec);
 }
 
 void PcapTxThread::setPacketListLoopMode(
@@ -198,29 +146,25 @@ void PcapTxThread::setPacketListLoopMode(
         quint64 secDelay,
         quint64 nsecDelay)
 {
-    returnToQIdx_ = loop ? 0 : -1;
-    loopDelay_ = secDelay*long(1e6) + nsecDelay/1000;
+    packetList_->setLoopMode(loop, secDelay, nsecDelay);
 }
 
 bool PcapTxThread::setPacketListTtagMarkers(
     QList<uint> markers,
     uint repeatInterval)
 {
-    // XXX: Empty markers => no streams have Ttag
-    firstTtagPkt_ = markers.isEmpty() ? -1 : int(markers.first());
-
-    // Calculate delta markers
-    ttagDeltaMarkers_.clear();
-    for (int i = 1; i < markers.size(); i++)
-        ttagDeltaMarkers_.append(markers.at(i) - markers.at(i-1));
-    if (!markers.isEmpty()) {
-        ttagDeltaMarkers_.append(repeatInterval - markers.last()
-                                    + markers.first());
-        qDebug() << "TtagRepeatInterval:" << repeatInterval;
-        qDebug() << "FirstTtagPkt:" << firstTtagPkt_;
-        qDebug() << "TtagMarkers:" << ttagDeltaMarkers_;
-    }
-    return true;
+    return packetList_->setTtagMarkers(markers, repeatInterval);
+}
+
+/*!
+  Uses the given (built) packet list instead of our own - the list may be
+  in use by other tx threads too, so MUST NOT be modified
+*/
+void PcapTxThread::setPacketList(QSharedPointer<PacketList> packetList)
+{
+    Q_ASSERT(!isRunning());
+    packetList_ = packetList;
+    packetListVersion_++;
 }
 
 void PcapTxThread::setHandle(pcap_t *handle)
@@ -231,6 +175,26 @@ void PcapTxThread::setHandle(pcap_t *handle)
     usingInternalHandle_ = false;
 }
 
+/*!
+  Configure this tx thread as shard 'index' of 'count' shards
+
+  All shards have the complete packet list and traverse it as per its
+  timeline, but a shard sends only the packets at positions that belong to
+  it (round-robin). All Ttag packets are sent by shard 0.
+*/
+void PcapTxThread::setShard(int index, int count)
+{
+    Q_ASSERT(!isRunning());
+    Q_ASSERT((index >= 0) && (index < count));
+    shardIndex_ = index;
+    shardCount_ = count;
+}
+
+void PcapTxThread::setCpuAffinity(int cpu)
+{
+    cpu_ = cpu;
+}
+
 void PcapTxThread::setStats(StatsTuple *stats)
 {
     stats_ = stats;
@@ -254,8 +218,6 @@ StreamStats PcapTxThread::streamStats()
 
 void PcapTxThread::run()
 {
-    //! \todo (MED) Stream Mode - continuous: define before implement
-
     // NOTE1: We can't use pcap_sendqueue_transmit() directly even on Win32
     // 'coz of 2 reasons - there's no way of stopping it before all packets
     // in the sendQueue are sent out and secondly, stats are available only
@@ -270,90 +232,118 @@ void PcapTxThread::run()
 
     const int kSyncTransmit = 1;
     int i;
-    long overHead = 0; // overHead should be negative or zero
+    qint64 overHead = 0; // pacing balance in nsecs - see pace()
     TimeStamp startTime, endTime;
 
-    qDebug("packetSequenceList_.size = %d", packetSequenceList_.size());
-    if (packetSequenceList_.size() <= 0) {
+    qDebug("packetSequenceList.size = %d", packetList_->sequences_.size());
+    if (packetList_->sequences_.size() <= 0) {
         lastTxDuration_ = 0.0;
         goto _exit2;
     }
 
-    for(i = 0; i < packetSequenceList_.size(); i++) {
-        qDebug("sendQ[%d]: rptCnt = %d, rptSz = %d, usecDelay = %ld", i,
-                packetSequenceList_.at(i)->repeatCount_,
-                packetSequenceList_.at(i)->repeatSize_,
-                packetSequenceList_.at(i)->usecDelay_);
-        qDebug("sendQ[%d]: pkts = %ld, usecDuration = %ld, ttagL4CksumOfs = %hu", i,
-                packetSequenceList_.at(i)->packets_,
-                packetSequenceList_.at(i)->usecDuration_,
-                packetSequenceList_.at(i)->ttagL4CksumOffset_);
+    for(i = 0; i < packetList_->sequences_.size(); i++) {
+        qDebug("sendQ[%d]: rptCnt = %d, rptSz = %d, nsecDelay = %llu", i,
+                packetList_->sequences_.at(i)->repeatCount_,
+                packetList_->sequences_.at(i)->repeatSize_,
+                packetList_->sequences_.at(i)->nsecDelay_);
+        qDebug("sendQ[%d]: pkts = %ld, nsecDuration = %llu, ttagL4CksumOfs = %hu", i,
+                packetList_->sequences_.at(i)->packets_,
+                packetList_->sequences_.at(i)->nsecDuration_,
+                packetList_->sequences_.at(i)->ttagL4CksumOffset_);
+    }
+
+    qDebug() << "Loop:" << (packetList_->returnToQIdx_ >= 0)
+             << "LoopDelay:" << packetList_->loopDelay_;
+    qDebug() << "First Ttag: " << packetList_->firstTtagPkt_
+             << "Ttag Markers:" << packetList_->ttagDeltaMarkers_;
+
+#ifdef Q_OS_LINUX
+    if (cpu_ >= 0) {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(cpu_, &cpuSet);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet))
+            qWarning("%s: unable to set tx thread affinity to cpu %d",
+                    qPrintable(device_), cpu_);
+    }
+#endif
+
+    if (!txBegin()) {
+        qWarning("%s: unable to start transmit", qPrintable(device_));
+        lastTxDuration_ = 0.0;
+        goto _exit2;
     }
 
-    qDebug() << "Loop:" << (returnToQIdx_ >= 0)
-             << "LoopDelay:" << loopDelay_;
-    qDebug() << "First Ttag: " << firstTtagPkt_
-             << "Ttag Markers:" << ttagDeltaMarkers_;
+    txPosition_ = 0; // used for stream stats and sharding
+    shardTurn_ = 0;
 
-    lastStats_ = *stats_; // used for stream stats
+    foreach (FrameGenerator *generator, packetList_->generators_)
+        generator->start();
 
     // Init Ttag related vars. If no packets need ttag, firstTtagPkt_ is -1,
     // so nextTagPkt_ is set to practically unreachable value (due to
     // 64 bit counter wraparound time!)
     ttagMarkerIndex_ = 0;
-    nextTtagPkt_ = stats_->pkts + firstTtagPkt_;
+    nextTtagPkt_ = quint64(packetList_->firstTtagPkt_);
+
+    // Every stream's first packet gets a Tx Timestamp
+    for (int k = 0; k < kTxTimestampSamplerCount; k++) {
+        txTimestampSamplers_[k].guid = SignProtocol::kInvalidGuid;
+        txTimestampSamplers_[k].nextDue = 0;
+        txTimestampSamplers_[k].l4CksumOffset = 0;
+    }
 
     getTimeStamp(&startTime);
+    lastPaceTime_ = startTime;
     state_ = kRunning;
     i = 0;
-    while (i < packetSequenceList_.size()) {
+    while (i < packetList_->sequences_.size()) {
 _restart:
-        int rptSz  = packetSequenceList_.at(i)->repeatSize_;
-        int rptCnt = packetSequenceList_.at(i)->repeatCount_;
+        int rptSz  = packetList_->sequences_.at(i)->repeatSize_;
+        int rptCnt = packetList_->sequences_.at(i)->repeatCount_;
 
         for (int j = 0; j < rptCnt; j++) {
             for (int k = 0; k < rptSz; k++) {
                 int ret;
-                PacketSequence *seq = packetSequenceList_.at(i+k);
+                PacketSequence *seq = packetList_->sequences_.at(i+k);
 #ifdef Q_OS_WIN32
-                TimeStamp ovrStart, ovrEnd;
-
                 // Use Windows-only pcap_sendqueue_transmit() if duration < 1s
-                // and no stream timing is configured
-                if (seq->usecDuration_ <= long(1e6) && firstTtagPkt_ < 0) {
-                    getTimeStamp(&ovrStart);
-                    ret = pcap_sendqueue_transmit(handle_,
-                            seq->sendQueue_, kSyncTransmit);
+                // and no stream timing or sharding is configured
+                if (seq->nsecDuration_ <= 1000000000ULL
+                        && packetList_->firstTtagPkt_ < 0
+                        && shardCount_ == 1 && !seq->generator_) {
+                    pcap_send_queue *sendQueue;
+
+                    // The send queue is created on first use - and the
+                    // sequence may be shared with other tx threads
+                    sendQueueLock.lock();
+                    sendQueue = seq->pcapSendQueue();
+                    sendQueueLock.unlock();
+
+                    pace(overHead);
+                    ret = pcap_sendqueue_transmit(handle_, sendQueue,
+                                                  kSyncTransmit);
                     if (ret >= 0) {
                         stats_->pkts += seq->packets_;
                         stats_->bytes += seq->bytes_;
-
-                        getTimeStamp(&ovrEnd);
-                        overHead += seq->usecDuration_
-                            - udiffTimeStamp(&ovrStart, &ovrEnd);
-                        Q_ASSERT(overHead <= 0);
+                        txPosition_ += seq->packets_;
+                        overHead += seq->nsecDuration_;
                     }
                     if (stop_)
                         ret = -2;
                 } else {
-                    ret = sendQueueTransmit(handle_, seq,
-                            overHead, kSyncTransmit);
+                    ret = sendQueueTransmit(seq, overHead, kSyncTransmit);
                 }
 #else
-                ret = sendQueueTransmit(handle_, seq,
-                            overHead, kSyncTransmit);
+                ret = sendQueueTransmit(seq, overHead, kSyncTransmit);
 #endif
 
                 if (ret >= 0) {
-                    long usecs = seq->usecDelay_ + overHead;
-                    if (usecs > 0) {
-                        (*udelayFn_)(usecs);
-                        overHead = 0;
-                    } else
-                        overHead = usecs;
+                    // Delay is done before the next pkt is sent
+                    overHead += seq->nsecDelay_;
                 } else {
                     qDebug("error %d in sendQueueTransmit()", ret);
-                    qDebug("overHead = %ld", overHead);
+                    qDebug("overHead = %lld", overHead);
                     stop_ = false;
                     goto _exit;
                 }
@@ -364,22 +354,26 @@ _restart:
         i += rptSz;
     }
 
-    if (returnToQIdx_ >= 0) {
-        long usecs = loopDelay_ + overHead;
-
-        if (usecs > 0) {
-            (*udelayFn_)(usecs);
-            overHead = 0;
-        } else
-            overHead = usecs;
+    if (packetList_->returnToQIdx_ >= 0) {
+        // Delay is done before the next pkt is sent
+        overHead += packetList_->loopDelay_;
 
-        i = returnToQIdx_;
+        i = packetList_->returnToQIdx_;
         goto _restart;
     }
 
+    // Complete any pending delay of the last packet set
+    pace(overHead);
+
 _exit:
+    flushPackets();
+    txEnd();
+
+    foreach (FrameGenerator *generator, packetList_->generators_)
+        generator->stop();
+
     getTimeStamp(&endTime);
-    lastTxDuration_ = udiffTimeStamp(&startTime, &endTime)/1e6;
+    lastTxDuration_ = ndiffTimeStamp(&startTime, &endTime)/1e9;
 
 _exit2:
     qDebug("Tx duration = %fs", lastTxDuration_);
@@ -430,28 +424,67 @@ double PcapTxThread::lastTxDuration()
     return lastTxDuration_;
 }
 
-int PcapTxThread::sendQueueTransmit(pcap_t *p, PacketSequence *seq,
-        long &overHead, int sync)
-{
-    TimeStamp ovrStart, ovrEnd;
-    struct timeval ts;
-    pcap_send_queue *queue = seq->sendQueue_;
-    struct pcap_pkthdr *hdr = (struct pcap_pkthdr*) queue->buffer;
-    char *end = queue->buffer + queue->len;
+/*!
+  Transmits all packets of the given sequence (as per the sequence timeline
+  if 'sync' is set)
 
-    ts = hdr->ts;
-    getTimeStamp(&ovrStart);
-    while((char*) hdr < end) {
-        uchar *pkt = (uchar*)hdr + sizeof(*hdr);
-        int pktLen = hdr->caplen;
+  'overHead' is the pacing balance carried across calls - see pace()
+*/
+int PcapTxThread::sendQueueTransmit(PacketSequence *seq,
+        qint64 &overHead, int sync)
+{
+    quint64 ts;
+    FrameGenerator *gen = seq->generator_;
+    PacketSequence::PacketHeader *hdr = gen ? gen->next() : seq->first();
+    PacketSequence::PacketHeader *end = seq->end();
+    quint64 remaining = gen ? gen->count() : 0; // of a generated seq
+
+    // Back-to-back packets (no inter-packet gap) being batched don't need
+    // a per-packet sync; we account for the time taken for the whole
+    // sequence instead
+    bool syncPkt = sync && (seq->nsecDuration_ || !batchBackToBack_);
+
+    if (!hdr)
+        return gen ? -1 : 0;
+
+    if (sync && !syncPkt)
+        pace(overHead);
+
+    ts = hdr->nsec;
+    while (gen ? (hdr != NULL) : (hdr < end)) {
+        uchar *pkt = seq->packetData(hdr);
+        int pktLen = hdr->len;
         bool ttagPkt = false;
+        bool ownPkt;
+        bool txTsPkt = false;
+        uchar txTsSave[SignProtocol::kTxTimestampSize];
+        quint16 txTsCksumOffset = 0;
+        quint16 txTsCksumSave = 0;
 #if 0
         quint16 origCksum = 0;
 #endif
 
         // Time for a T-Tag packet?
-        if (stats_->pkts == nextTtagPkt_) {
+        if (txPosition_ == nextTtagPkt_) {
             ttagPkt = true;
+            nextTtagPkt_ += packetList_->ttagDeltaMarkers_.at(
+                                                    ttagMarkerIndex_);
+            ttagMarkerIndex_++;
+            if (ttagMarkerIndex_ >= packetList_->ttagDeltaMarkers_.size())
+                ttagMarkerIndex_ = 0;
+        }
+
+        // Is this packet ours to send? (always true if not sharded)
+        ownPkt = ttagPkt ? (shardIndex_ == 0) : (shardTurn_ == shardIndex_);
+        if (++shardTurn_ >= shardCount_)
+            shardTurn_ = 0;
+
+        if (ttagPkt && ownPkt) {
+            // Frame may be shared with other packets of the packet list
+            // which may be queued but not yet sent - don't let them go
+            // out with the Ttag
+            flushPackets();
+
             // XXX: write 2xBytes instead of 1xHalf-word to avoid
             // potential alignment problem
             *(pkt+pktLen-5) = SignProtocol::kTypeLenTtag;
@@ -483,38 +516,64 @@ int PcapTxThread::sendQueueTransmit(pcap_t *p, PacketSequence *seq,
             }
 #endif
             ttagId_++;
-            nextTtagPkt_ += ttagDeltaMarkers_.at(ttagMarkerIndex_);
-            ttagMarkerIndex_++;
-            if (ttagMarkerIndex_ >= ttagDeltaMarkers_.size())
-                ttagMarkerIndex_ = 0;
         }
 
-        if (sync) {
-            long usec = (hdr->ts.tv_sec - ts.tv_sec) * 1000000 +
-                (hdr->ts.tv_usec - ts.tv_usec);
-
-            getTimeStamp(&ovrEnd);
-            overHead -= udiffTimeStamp(&ovrStart, &ovrEnd);
-            Q_ASSERT(overHead <= 0);
-            usec += overHead;
-            if (usec > 0) {
-                (*udelayFn_)(usec);
-                overHead = 0;
-            } else
-                overHead = usec;
-
-            ts = hdr->ts;
-            getTimeStamp(&ovrStart);
+        if (syncPkt) {
+            overHead += hdr->nsec - ts;
+            ts = hdr->nsec;
+
+            // Any due delay is done only before sending a packet - skipped
+            // packets just accumulate their delay
+            if (ownPkt)
+                pace(overHead);
         }
 
         Q_ASSERT(pktLen > 0);
 
-        pcap_sendpacket(p, pkt, pktLen);
-        stats_->pkts++;
-        stats_->bytes += pktLen;
+        // Time for a Tx Timestamp? Stamped as close to the send as we can
+        if (ownPkt && packetList_->hasTxTimestamps_
+                && SignProtocol::isTxTimestampPlaceholder(pkt, pktLen)) {
+            quint64 now = realTimeNsecs();
+            if (isTxTimestampDue(pkt, pktLen, now, &txTsCksumOffset)) {
+                // Same as for Ttag - don't let other queued packets with
+                // the same frame go out with our timestamp
+                flushPackets();
+                txTsPkt = true;
+                memcpy(txTsSave, pkt + pktLen - 14, sizeof(txTsSave));
+                if (txTsCksumOffset)
+                    memcpy(&txTsCksumSave, pkt + txTsCksumOffset,
+                           sizeof(txTsCksumSave));
+                setTxTimestamp(pkt, pktLen,
+                        now & SignProtocol::kTxTimestampMask,
+                        txTsCksumOffset);
+            }
+        }
+
+        if (ownPkt) {
+            ttagPacket_ = ttagPkt && trackStreamStats_;
+            frameIndex_ = hdr->frame;
+            sendPacket(pkt, pktLen);
+            ttagPacket_ = false;
+            stats_->pkts++;
+            stats_->bytes += pktLen;
+        }
+        txPosition_++;
+
+        // Generated packets are not in the packet list and so can't be
+        // attributed to streams later in updateTxStreamStats()
+        if (gen && trackStreamStats_ && (shardIndex_ == 0)) {
+            uint guid;
+            if (SignProtocol::packetGuid(pkt, pktLen, &guid)) {
+                generatedStreamStats_[guid].tx_pkts++;
+                generatedStreamStats_[guid].tx_bytes += pktLen;
+            }
+        }
 
         // Revert T-Tag packet changes
-        if (ttagPkt) {
+        if (ttagPkt && ownPkt) {
+            // Packet may only be queued - make sure it has been sent out
+            // before we modify it
+            flushPackets();
             *(pkt+pktLen-5) = SignProtocol::kTypeLenTtagPlaceholder;
             *(pkt+pktLen-6) = 0;
 #if 0
@@ -526,29 +585,223 @@ int PcapTxThread::sendQueueTransmit(pcap_t *p, PacketSequence *seq,
 #endif
         }
 
-        // Step to the next packet in the buffer
-        hdr = (struct pcap_pkthdr*) (pkt + pktLen);
-        pkt = (uchar*) ((uchar*)hdr + sizeof(*hdr)); // FIXME: superfluous?
+        // Revert Tx Timestamp - and send it out right away so that the
+        // timestamp isn't stale by the time the packet goes out
+        if (txTsPkt) {
+            flushPackets();
+            memcpy(pkt + pktLen - 14, txTsSave, sizeof(txTsSave));
+            if (txTsCksumOffset)
+                memcpy(pkt + txTsCksumOffset, &txTsCksumSave,
+                       sizeof(txTsCksumSave));
+        }
+
+        // Step to the next packet in the buffer (or from the generator)
+        if (gen) {
+            // Generated frames may be queued (zero-copy) by sendPacket(),
+            // so we return them to the generator only after a flush - in
+            // bulk, to retain the benefit of batching
+            if (gen->releasePending() >= FrameGenerator::ringSize()/2) {
+                flushPackets();
+                gen->release();
+            }
+            hdr = (remaining && !--remaining) ? NULL : gen->next();
+        }
+        else
+            hdr = PacketSequence::next(hdr);
 
         if (stop_) {
             return -2;
         }
     }
+
+    if (gen) {
+        flushPackets();
+        gen->release();
+    }
+
     return 0;
 }
 
+/*!
+  Returns true if the packet (which MUST have a Tx Timestamp placeholder)
+  is due for a Tx Timestamp at 'now' as per the stream's configured
+  interval; if so, schedules the next one and returns the offset of the
+  packet's L4 checksum (0 if none) in 'l4CksumOffset'
+
+  The L4 checksum offset is looked up once per stream - all frames of a
+  stream have the same headers
+*/
+bool PcapTxThread::isTxTimestampDue(const uchar *pkt, int pktLen,
+        quint64 now, quint16 *l4CksumOffset)
+{
+    uint guid = SignProtocol::placeholderGuid(pkt, pktLen);
+    quint32 interval = SignProtocol::placeholderTxTimestampInterval(pkt,
+                                                                    pktLen);
+    TxTimestampSampler &sampler = txTimestampSamplers_[
+                                    guid & (kTxTimestampSamplerCount - 1)];
+
+    if (sampler.guid != guid) {
+        sampler.guid = guid;
+        sampler.nextDue = 0;
+        sampler.l4CksumOffset = Packet::l4ChecksumOffset(pkt, pktLen);
+    }
+
+    // interval 0 => every packet
+    if (interval) {
+        if (now < sampler.nextDue)
+            return false;
+        sampler.nextDue = now + quint64(interval)*1000;
+    }
+
+    *l4CksumOffset = sampler.l4CksumOffset;
+    return true;
+}
+
+/*
+ * Writes the Tx Timestamp into the packet's Sign trailer - which is part
+ * of the L4 payload, so the L4 checksum at 'l4CksumOffset' (if not 0) is
+ * updated incrementally as per RFC 1624
+ */
+void PcapTxThread::setTxTimestamp(uchar *pkt, int pktLen, quint64 nsec,
+        quint16 l4CksumOffset)
+{
+    // Bytes changed by the timestamp - summed from a 16-bit boundary of
+    // the L4 header (the checksum field is at an even offset in it)
+    int start = pktLen - 14;
+    int len;
+    quint16 cksum, oldSum;
+
+    if (l4CksumOffset) {
+        memcpy(&cksum, pkt + l4CksumOffset, sizeof(cksum));
+        if (!cksum) // UDP over IPv4 without a checksum
+            l4CksumOffset = 0;
+    }
+
+    if (!l4CksumOffset) {
+        SignProtocol::setTxTimestamp(pkt, pktLen, nsec);
+        return;
+    }
+
+    if ((start - l4CksumOffset) & 1)
+        start--;
+    len = pktLen - 6 - start;
+
+    oldSum = checksumOnesSum(pkt + start, len);
+    SignProtocol::setTxTimestamp(pkt, pktLen, nsec);
+    cksum = checksumUpdate(cksum, oldSum, checksumOnesSum(pkt + start, len));
+
+    // For UDP, a 0 checksum implies no checksum - send its ones'
+    // complement equivalent instead (valid for TCP too)
+    if (!cksum)
+        cksum = 0xffff;
+    memcpy(pkt + l4CksumOffset, &cksum, sizeof(cksum));
+}
+
+/*!
+  Accounts the time elapsed since the last call against the pacing balance
+  'overHead' and waits if required
+
+  'overHead' (in nsecs) is positive if we are ahead of the packet list
+  timeline and need to wait before sending the next packet, and negative
+  if we are behind (in which case we send without waiting till we catch up)
+
+  The balance is NOT reset after a wait - the actual time spent waiting
+  (including any oversleep) is accounted in the next call, so that the
+  deadlines are effectively absolute and errors don't accumulate
+
+  If paceLead_ is set, we wait only till paceLead_ before the deadline;
+  the deadline itself is available to the subclass as launchTime()
+*/
+void PcapTxThread::pace(qint64 &overHead)
+{
+    TimeStamp now;
+
+    getTimeStamp(&now);
+    overHead -= ndiffTimeStamp(&lastPaceTime_, &now);
+    lastPaceTime_ = now;
+
+#ifdef Q_OS_LINUX
+    launchTime_ = quint64(now.tv_sec)*1000000000ULL + now.tv_nsec
+                    + qMax(overHead, qint64(0));
+#endif
+
+    if (overHead > paceLead_) {
+        flushPackets();
+        (*delayFn_)(overHead - paceLead_);
+    }
+}
+
+/*!
+  Called in the transmit thread context before the first packet is sent
+
+  Subclasses may override to setup any resources they need for transmit.
+  Returning false aborts the transmit
+*/
+bool PcapTxThread::txBegin()
+{
+    return (handle_ != NULL);
+}
+
+/*!
+  Called in the transmit thread context after the last packet is sent
+*/
+void PcapTxThread::txEnd()
+{
+}
+
+/*!
+  Takes out packets from the tx stats that were counted as sent but were
+  not - for subclasses that queue packets in sendPacket() and drop them
+  later (e.g. on stop)
+*/
+void PcapTxThread::uncountPackets(quint64 pkts, quint64 bytes)
+{
+    stats_->pkts -= pkts;
+    stats_->bytes -= bytes;
+}
+
+/*!
+  Sends the packet out - subclasses MAY queue the packet instead of sending
+  it out immediately, but MUST send out all queued packets when
+  flushPackets() is called
+
+  A queued packet's contents are guaranteed to be unchanged only until the
+  next flushPackets() call, so subclasses may queue a reference to the
+  packet instead of a copy
+*/
+int PcapTxThread::sendPacket(const uchar *packet, int length)
+{
+    return pcap_sendpacket(handle_, packet, length);
+}
+
+/*!
+  Called before every inter-packet delay, so that any packets queued by
+  sendPacket() are not delayed
+*/
+void PcapTxThread::flushPackets()
+{
+}
+
 void PcapTxThread::updateTxStreamStats()
 {
     QMutexLocker lock(&streamStatsLock_);
 
+    // Generated packets have already been counted
+    StreamStatsIterator genIter(generatedStreamStats_);
+    while (genIter.hasNext()) {
+        genIter.next();
+        streamStats_[genIter.key()].tx_pkts += genIter.value().tx_pkts;
+        streamStats_[genIter.key()].tx_bytes += genIter.value().tx_bytes;
+    }
+    generatedStreamStats_.clear();
+
     // If no packets in list, nothing to be done
-    if (!packetListSize_)
+    if (!packetList_->size_)
         return;
 
-    // Get number of tx packets sent during last transmit
-    quint64 pkts = stats_->pkts > lastStats_.pkts ?
-        stats_->pkts - lastStats_.pkts :
-        stats_->pkts + (ULLONG_MAX - lastStats_.pkts);
+    // Get number of tx packets sent during last transmit - if sharded,
+    // the packets traversed by us were sent by one shard or the other
+    quint64 pkts = txPosition_;
 
     // Calculate -
     //   number of complete repeats of packetList_
@@ -557,12 +810,15 @@ void PcapTxThread::updateTxStreamStats()
     //      - This encompasses 0 or more potentially partial PacketSets
     // XXX: Note for the above, we consider a PacketSet to include its
     // own repeats within itself
-    int c = pkts/packetListSize_;
-    int d = pkts%packetListSize_;
+    // If the list ends in a continuous (unbounded) set, the list is never
+    // repeated and size_ is the count of pkts before that set
+    int c = packetList_->unbounded_ ? 0 : pkts/packetList_->size_;
+    int d = packetList_->unbounded_ ? qMin(pkts, packetList_->size_)
+                                 : pkts%packetList_->size_;
 
     qDebug("%s:", __FUNCTION__);
     qDebug("txPkts = %llu", pkts);
-    qDebug("packetListSize_ = %llu", packetListSize_);
+    qDebug("packetListSize = %llu", packetList_->size_);
     qDebug("c = %d, d = %d\n", c, d);
 
     int i;
@@ -571,13 +827,13 @@ void PcapTxThread::updateTxStreamStats()
         goto _last_repeat;
 
     i = 0;
-    while (i < packetSequenceList_.size()) {
-        PacketSequence *seq = packetSequenceList_.at(i);
+    while (i < packetList_->sequences_.size()) {
+        PacketSequence *seq = packetList_->sequences_.at(i);
         int rptSz = seq->repeatSize_;
         int rptCnt = seq->repeatCount_;
 
         for (int k = 0; k < rptSz; k++) {
-            seq = packetSequenceList_.at(i+k);
+            seq = packetList_->sequences_.at(i+k);
             StreamStatsIterator iter(seq->streamStatsMeta_);
             while (iter.hasNext()) {
                 iter.next();
@@ -596,14 +852,18 @@ _last_repeat:
         goto _done;
 
     i = 0;
-    while (i < packetSequenceList_.size()) {
-        PacketSequence *seq = packetSequenceList_.at(i);
+    while (i < packetList_->sequences_.size()) {
+        PacketSequence *seq = packetList_->sequences_.at(i);
         int rptSz = seq->repeatSize_;
         int rptCnt = seq->repeatCount_;
 
         for (int j = 0; j < rptCnt; j++) {
             for (int k = 0; k < rptSz; k++) {
-                seq = packetSequenceList_.at(i+k);
+                seq = packetList_->sequences_.at(i+k);
+                // Generated packets have already been counted and a
+                // partially sent generated seq can't be traversed
+                if (seq->generator_ && (d < seq->packets_ || !seq->packets_))
+                    goto _done;
                 Q_ASSERT(seq->packets_);
                 if (d >= seq->packets_) {
                     // All packets of this seq were sent
@@ -621,21 +881,20 @@ _last_repeat:
                     // not all packets of this seq were sent, so we need to
                     // traverse this seq upto 'd' pkts, parse guid from the
                     // packet and update streamStats
-                    struct pcap_pkthdr *hdr =
-                        (struct pcap_pkthdr*) seq->sendQueue_->buffer;
-                    char *end = seq->sendQueue_->buffer + seq->sendQueue_->len;
+                    PacketSequence::PacketHeader *hdr = seq->first();
+                    PacketSequence::PacketHeader *end = seq->end();
 
-                    while(d && ((char*) hdr < end)) {
-                        uchar *pkt = (uchar*)hdr + sizeof(*hdr);
+                    while(d && (hdr < end)) {
+                        uchar *pkt = seq->packetData(hdr);
                         uint guid;
 
-                        if (SignProtocol::packetGuid(pkt, hdr->caplen, &guid)) {
+                        if (SignProtocol::packetGuid(pkt, hdr->len, &guid)) {
                             streamStats_[guid].tx_pkts++;
-                            streamStats_[guid].tx_bytes += hdr->caplen;
+                            streamStats_[guid].tx_bytes += hdr->len;
                         }
 
                         // Step to the next packet in the buffer
-                        hdr = (struct pcap_pkthdr*) (pkt + hdr->caplen);
+                        hdr = PacketSequence::next(hdr);
                         d--;
                     }
                     Q_ASSERT(d == 0);
@@ -651,38 +910,118 @@ _done:
     return;
 }
 
-void PcapTxThread::udelay(unsigned long usec)
+void PcapTxThread::ndelay(quint64 nsec)
 {
 #if defined(Q_OS_WIN32)
     LARGE_INTEGER tgtTicks;
     LARGE_INTEGER curTicks;
 
     QueryPerformanceCounter(&curTicks);
-    tgtTicks.QuadPart = curTicks.QuadPart + (usec*gTicksFreq)/1000000;
+    tgtTicks.QuadPart = curTicks.QuadPart + (nsec/1000000000ULL)*gTicksFreq
+                            + ((nsec % 1000000000ULL)*gTicksFreq)/1000000000ULL;
 
     while (curTicks.QuadPart < tgtTicks.QuadPart)
         QueryPerformanceCounter(&curTicks);
 #elif defined(Q_OS_LINUX)
-    struct timeval delay, target, now;
-
-    //qDebug("usec delay = %ld", usec);
+    struct timespec delay, target, now;
 
-    delay.tv_sec = 0;
-    delay.tv_usec = usec;
+    //qDebug("nsec delay = %llu", nsec);
 
-    while (delay.tv_usec >= 1000000)
-    {
-        delay.tv_sec++;
-        delay.tv_usec -= 1000000;
-    }
+    delay.tv_sec = nsec/1000000000ULL;
+    delay.tv_nsec = nsec % 1000000000ULL;
 
-    gettimeofday(&now, NULL);
-    timeradd(&now, &delay, &target);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    timespecadd(&now, &delay, &target);
 
     do {
-        gettimeofday(&now, NULL);
-    } while (timercmp(&now, &target, <));
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (timespeccmp(&now, &target, <));
 #else
-    QThread::usleep(usec);
+    QThread::usleep(nsec/1000);
 #endif
 }
+
+void PcapTxThread::sleepDelay(quint64 nsec)
+{
+    QThread::usleep(nsec/1000);
+}
+
+#ifdef Q_OS_LINUX
+// Typical wakeup latency of clock_nanosleep() - the last part of a
+// hybridDelay() is a spin of this duration
+static long gSleepSlackNsec = 50000;
+
+/*!
+  Delay using a clock_nanosleep() for the bulk of the delay followed by a
+  short spin for the tail
+
+  The sleep is upto an absolute CLOCK_MONOTONIC deadline; the spin is on
+  CLOCK_MONOTONIC_RAW which is not subject to NTP slewing
+*/
+void PcapTxThread::hybridDelay(quint64 nsec)
+{
+    struct timespec now, target, wakeup, delay, raw;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    delay.tv_sec = nsec/1000000000ULL;
+    delay.tv_nsec = nsec % 1000000000ULL;
+    timespecadd(&now, &delay, &target);
+
+    if (nsec > quint64(gSleepSlackNsec)) {
+        delay.tv_sec = 0;
+        delay.tv_nsec = gSleepSlackNsec;
+        timespecsub(&target, &delay, &wakeup);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL)
+                == EINTR)
+            ;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    }
+
+    if (!timespeccmp(&now, &target, <))
+        return; // overslept!
+
+    // Convert remaining time to a raw clock deadline and spin
+    timespecsub(&target, &now, &delay);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &raw);
+    timespecadd(&raw, &delay, &target);
+    do {
+        clock_gettime(CLOCK_MONOTONIC_RAW, &raw);
+    } while (timespeccmp(&raw, &target, <));
+}
+
+/*!
+  Measure the wakeup latency of clock_nanosleep() on this system to decide
+  how long hybridDelay() should spin; done only once
+*/
+void PcapTxThread::calibrateHybridDelay()
+{
+    static bool calibrated = false;
+    const int kSamples = 16;
+    const long kSleepNsec = 100000;
+    long maxSlack = 0;
+
+    if (calibrated)
+        return;
+
+    for (int i = 0; i < kSamples; i++) {
+        struct timespec start, target, end, delay, diff;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        delay.tv_sec = 0;
+        delay.tv_nsec = kSleepNsec;
+        timespecadd(&start, &delay, &target);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &target, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        timespecsub(&end, &target, &diff);
+        long slack = diff.tv_sec*1000000000L + diff.tv_nsec;
+        maxSlack = qMax(maxSlack, slack);
+    }
+
+    // Spin a little more than the worst observed latency, within limits
+    gSleepSlackNsec = qBound(10000L, maxSlack + maxSlack/4, 1000000L);
+    calibrated = true;
+
+    qDebug("hybrid delay: sleep slack %ld nsec", gSleepSlackNsec);
+}
+#endif
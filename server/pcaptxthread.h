@@ -21,10 +21,13 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #define _PCAP_TX_THREAD_H
 
 #include "abstractport.h"
-#include "packetsequence.h"
+#include "framegenerator.h"
+#include "packetlist.h"
 #include "statstuple.h"
+#include "timestamp.h"
 
 #include <QMutex>
+#include <QSharedPointer>
 #include <QThread>
 #include <pcap.h>
 
@@ -32,20 +35,29 @@ class PcapTxThread: public QThread
 {
 public:
     PcapTxThread(const char *device);
-    ~PcapTxThread();
+    virtual ~PcapTxThread();
 
     bool setRateAccuracy(AbstractPort::Accuracy accuracy);
     bool setStreamStatsTracking(bool enable);
 
     void clearPacketList();
+    quint64 packetListMemory() { return packetList_->memory(); }
     void loopNextPacketSet(qint64 size, qint64 repeats,
                            long repeatDelaySec, long repeatDelayNsec);
-    bool appendToPacketList(long sec, long usec, const uchar *packet,
+    bool appendToPacketList(long sec, long nsec, const uchar *packet,
                             int length);
+    bool addGeneratedPacketSet(const FrameTemplate *frameTemplate,
+                               quint64 count, uint burstSize,
+                               double burstGap, quint64 delayNsec);
     void setPacketListLoopMode(bool loop, quint64 secDelay, quint64 nsecDelay);
     bool setPacketListTtagMarkers(QList<uint> markers, uint repeatInterval);
 
+    QSharedPointer<PacketList> packetList() { return packetList_; }
+    void setPacketList(QSharedPointer<PacketList> packetList);
+
     void setHandle(pcap_t *handle);
+    void setShard(int index, int count);
+    void setCpuAffinity(int cpu);
 
     void setStats(StatsTuple *stats);
 
@@ -58,6 +70,50 @@ public:
     bool isRunning();
     double lastTxDuration();
 
+protected:
+    // Transmit primitives - subclasses may override these to use a
+    // different (faster) send mechanism than pcap_sendpacket()
+    virtual bool txBegin();
+    virtual void txEnd();
+    virtual int sendPacket(const uchar *packet, int length);
+    virtual void flushPackets();
+
+    void uncountPackets(quint64 pkts, quint64 bytes);
+
+    int maxPacketLength() { return packetList_->maxPacketLength_; }
+    quint32 frameCount() { return packetList_->frameCount(); }
+    const QList<PacketSequence*>& packetSequenceList() {
+        return packetList_->sequences_;
+    }
+    // Changes every time the packet list is cleared (and rebuilt)
+    quint32 packetListVersion() { return packetListVersion_; }
+
+    // Scheduled tx time (CLOCK_MONOTONIC nsecs) of the packet being sent;
+    // valid only on Linux
+    quint64 launchTime() { return launchTime_; }
+
+    // Whether the packet being sent is a T-tag packet whose tx timestamp
+    // is needed for stream timing; valid only within sendPacket()
+    bool isTtagPacket() { return ttagPacket_; }
+
+    // Frame number (see PacketSequence::PacketHeader) of the packet being
+    // sent; valid only within sendPacket() and not for generated packets
+    quint32 frameIndex() { return frameIndex_; }
+
+    QString device_;
+    pcap_t *handle_;
+    volatile bool stop_;
+
+    // How far (in nsecs) the tx loop may run ahead of the packet list
+    // timeline - non-zero only for subclasses that hand over the packet
+    // launch time to the kernel/NIC (see launchTime())
+    qint64 paceLead_{0};
+
+    // Whether back-to-back packets (i.e. sequences without any gap) are
+    // paced once per sequence instead of per packet - only for subclasses
+    // that batch such packets (see MmsgTxThread)
+    bool batchBackToBack_{false};
+
 private:
     enum State
     {
@@ -66,46 +122,65 @@ private:
         kFinished
     };
 
-    static void udelay(unsigned long usec);
-    int sendQueueTransmit(pcap_t *p, PacketSequence *seq,
-            long &overHead, int sync);
+    // Delay functions - all delays are in nanosecs
+    static void ndelay(quint64 nsec);
+    static void sleepDelay(quint64 nsec);
+#ifdef Q_OS_LINUX
+    static void hybridDelay(quint64 nsec);
+    static void calibrateHybridDelay();
+#endif
+    void pace(qint64 &overHead);
+    int sendQueueTransmit(PacketSequence *seq, qint64 &overHead, int sync);
     void updateTxStreamStats();
 
-    // Intermediate state variables used while building the packet list
-    PacketSequence *currentPacketSequence_;
-    int repeatSequenceStart_;
-    quint64 repeatSize_;
-    quint64 packetCount_;
+    // May be shared with the tx threads of other ports - see PacketList
+    QSharedPointer<PacketList> packetList_;
+    quint32 packetListVersion_{0};
 
-    QList<PacketSequence*> packetSequenceList_;
-    quint64 packetListSize_; // count of pkts in packet List including repeats
-
-    int returnToQIdx_;
-    quint64 loopDelay_; // in nanosecs
-
-    void (*udelayFn_)(unsigned long);
+    void (*delayFn_)(quint64);
+    TimeStamp lastPaceTime_; // time upto which pacing has been accounted
+    quint64 launchTime_{0};
+    bool ttagPacket_{false};
+    quint32 frameIndex_{0};
 
     bool usingInternalHandle_;
-    pcap_t *handle_;
-    volatile bool stop_;
     volatile State state_;
 
     bool trackStreamStats_;
     StatsTuple *stats_;
-    StatsTuple lastStats_;
+    quint64 txPosition_{0}; // pkts traversed (sent or skipped) in this run
     StreamStats streamStats_;
+    StreamStats generatedStreamStats_; // counted live during tx
     QMutex streamStatsLock_;
     quint8 ttagId_{0};
 
     double lastTxDuration_{0.0}; // in secs
 
-    // XXX: Ttag Marker config derived; not updated during Tx
-    int firstTtagPkt_;
-    QList<uint> ttagDeltaMarkers_;
+    // Shard config - we send only the packets at positions belonging to
+    // our shard, but follow the timeline of the complete packet list
+    int shardIndex_{0};
+    int shardCount_{1};
+    int shardTurn_{0}; // shard index of pkt at current position
+    int cpu_{-1};      // cpu affinity; -1 => none
 
     // XXX: Ttag related; updated during Tx
     int ttagMarkerIndex_;
     quint64 nextTtagPkt_{0};
+
+    // Tx Timestamp sampling state per stream - direct mapped by guid; on
+    // a collision the other stream's state is overwritten (and it gets
+    // stamped early once)
+    struct TxTimestampSampler {
+        uint guid;
+        quint64 nextDue; // realTimeNsecs()
+        quint16 l4CksumOffset; // 0 => no L4 checksum to fixup
+    };
+    static const int kTxTimestampSamplerCount = 1024;
+    TxTimestampSampler txTimestampSamplers_[kTxTimestampSamplerCount];
+    bool isTxTimestampDue(const uchar *pkt, int pktLen, quint64 now,
+                          quint16 *l4CksumOffset);
+    static void setTxTimestamp(uchar *pkt, int pktLen, quint64 nsec,
+                               quint16 l4CksumOffset);
 };
 
 #endif
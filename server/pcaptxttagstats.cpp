@@ -32,7 +32,7 @@ PcapTxTtagStats::PcapTxTtagStats(const char *device, int id)
     setObjectName(QString("TxT$:%1").arg(device));
     device_ = QString::fromLatin1(device);
 
-    timing_ = StreamTiming::instance();
+    ttagRecords_ = StreamTiming::instance()->txRecordQueue(portId_);
 }
 
 void PcapTxTtagStats::run()
@@ -114,7 +114,7 @@ _skip_filter:
                         break;
                     ttagId &= 0xFF;
 #endif
-                    timing_->recordTxTime(portId_, guid, ttagId, hdr->ts);
+                    ttagRecords_->record(guid, ttagId, hdr->ts);
                 }
                 break;
             }
@@ -21,8 +21,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #define _PCAP_TX_TTAG_H
 
 #include "pcapsession.h"
-
-class StreamTiming;
+#include "streamtiming.h"
 
 class PcapTxTtagStats: public PcapSession
 {
@@ -49,7 +48,7 @@ private:
 
     int portId_;
 
-    StreamTiming *timing_{nullptr};
+    StreamTiming::RecordQueue *ttagRecords_{nullptr};
 };
 
 #endif
@@ -231,6 +231,8 @@ AbstractPort::Accuracy PortManager::rateAccuracy()
                                   kRateAccuracyDefaultValue).toString();
     if (rateAccuracy == "High")
         return AbstractPort::kHighAccuracy;
+    else if (rateAccuracy == "Medium")
+        return AbstractPort::kMediumAccuracy;
     else if (rateAccuracy == "Low")
         return AbstractPort::kLowAccuracy;
     else
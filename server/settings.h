@@ -42,6 +42,21 @@ const QString kRpcServerAddress("RpcServer/Address");
 const QString kPortListIncludeKey("PortList/Include");
 const QString kPortListExcludeKey("PortList/Exclude");
 
+//
+// Turbo Section Keys (Linux only)
+//
+const QString kTurboEnableKey("Turbo/Enable");
+const QString kTurboPortListKey("Turbo/Include");
+const QString kTurboQdiscBypassKey("Turbo/QdiscBypass");
+const QString kTurboTxModeKey("Turbo/TxMode");
+const QString kTurboTxModeDefaultValue("TxRing");
+const QString kTurboXdpQueueKey("Turbo/XdpQueue");
+const QString kTurboTxTimeClockKey("Turbo/TxTimeClock");
+const QString kTurboTxTimeClockDefaultValue("Monotonic");
+const QString kTurboTxThreadsKey("Turbo/TxThreads");
+const QString kTurboTxCpusKey("Turbo/TxCpus");
+const QString kTurboKernelTxTimestampsKey("Turbo/KernelTxTimestamps");
+
 //
 // Internal Section Keys
 //
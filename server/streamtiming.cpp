@@ -19,30 +19,136 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "streamtiming.h"
 
-#include "timestamp.h"
-
 #include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QThread>
+
+class StreamTiming::Aggregator : public QThread
+{
+public:
+    Aggregator(StreamTiming *timing) : timing_(timing) {}
+
+protected:
+    void run() { timing_->aggregate(); }
+
+private:
+    StreamTiming *timing_;
+};
+
+StreamTiming::RecordQueue::RecordQueue(uint portId, bool isTx)
+    : portId_(portId), isTx_(isTx)
+{
+}
+
+// Called only by the consumer (aggregator)
+bool StreamTiming::RecordQueue::take(Record &record)
+{
+    uint tail = uint(tail_.load());
+
+    if (tail == uint(head_.loadAcquire()))
+        return false; // empty
+
+    record = records_[tail & (kSize - 1)];
+    tail_.storeRelease(int(tail + 1));
+
+    return true;
+}
 
 StreamTiming::StreamTiming(QObject *parent)
     : QObject(parent)
 {
-    // This class MUST be part of the main thread so that timers can work
-    Q_ASSERT(this->thread() == QCoreApplication::instance()->thread());
+    txWheel_.resize(kTxRecordTicks);
+    rxWheel_.resize(kRxRecordTicks);
+    snapshot_.storeRelease(new StatsSnapshot);
 
-    timer_ = new QTimer(this);
-    connect(timer_, &QTimer::timeout, this, &StreamTiming::processRecords);
-    timer_->setInterval(3000);
+    aggregator_ = new Aggregator(this);
+    aggregator_->setObjectName("StreamTiming");
+    aggregator_->start();
+}
 
-    gcTimer_ = new QTimer(this);
-    connect(gcTimer_, &QTimer::timeout, this, &StreamTiming::deleteStaleRecords);
-    gcTimer_->setInterval(30000);
+StreamTiming::~StreamTiming()
+{
+    lock_.lock();
+    quit_ = true;
+    wakeup_.wakeOne();
+    lock_.unlock();
+
+    aggregator_->wait();
+    delete aggregator_;
+
+    // XXX: the ports, and so the producers of these queues, are destroyed
+    // before us
+    qDeleteAll(txQueues_);
+    qDeleteAll(rxQueues_);
+    qDeleteAll(kernelTxQueues_);
+
+    qDeleteAll(retiredSnapshots_);
+    delete snapshot_.loadAcquire();
+}
+
+/*!
+  Returns the queue for the tx ttag records of the given port
+
+  The queue MUST be used by only one thread at a time
+*/
+StreamTiming::RecordQueue* StreamTiming::txRecordQueue(uint portId)
+{
+    QMutexLocker locker(&lock_);
+    RecordQueue *queue = txQueues_.value(portId);
+
+    if (!queue) {
+        queue = new RecordQueue(portId, true);
+        txQueues_.insert(portId, queue);
+    }
+
+    return queue;
+}
+
+/*!
+  Returns the queue for the rx ttag records of the given port
+
+  The queue MUST be used by only one thread at a time
+*/
+StreamTiming::RecordQueue* StreamTiming::rxRecordQueue(uint portId)
+{
+    QMutexLocker locker(&lock_);
+    RecordQueue *queue = rxQueues_.value(portId);
+
+    if (!queue) {
+        queue = new RecordQueue(portId, false);
+        rxQueues_.insert(portId, queue);
+    }
+
+    return queue;
+}
+
+/*!
+  Returns the queue for the kernel tx timestamps (see TxTimestamper) of the
+  ttag packets of the given port - separate from txRecordQueue(), so that
+  the tx thread and the tx ttag capture are never producers of the same
+  queue
+
+  The queue MUST be used by only one thread at a time
+*/
+StreamTiming::RecordQueue* StreamTiming::kernelTxRecordQueue(uint portId)
+{
+    QMutexLocker locker(&lock_);
+    RecordQueue *queue = kernelTxQueues_.value(portId);
+
+    if (!queue) {
+        queue = new RecordQueue(portId, true);
+        kernelTxQueues_.insert(portId, queue);
+    }
+
+    return queue;
 }
 
 void StreamTiming::start(uint portId)
 {
+    QMutexLocker locker(&lock_);
+
     if (activePortSet_.isEmpty()) { // First port?
-        timer_->start();
-        gcTimer_->start();
+        wakeup_.wakeOne();
         qDebug("Stream Latency tracking started");
     }
     activePortSet_.insert(portId);
@@ -51,38 +157,37 @@ void StreamTiming::start(uint portId)
 
 void StreamTiming::stop(uint portId)
 {
+    QMutexLocker locker(&lock_);
+
     activePortSet_.remove(portId);
     qDebug("Stream Latency tracking stopped for port %u", portId);
     if (activePortSet_.isEmpty()) { // Last port?
-        processRecords();
-        deleteStaleRecords();
-        timer_->stop();
-        gcTimer_->stop();
+        // Wakeup aggregator to process the remaining records
+        wakeup_.wakeOne();
         qDebug("Stream Latency tracking stopped");
     }
 }
 
+/*!
+  Returns the latency and jitter of the given stream as of the last run
+  of the aggregator - this doesn't wait for the aggregator
+*/
 StreamTiming::Stats StreamTiming::stats(uint portId, uint guid)
 {
     Stats stats = {0, 0};
 
     Q_ASSERT(guid <= SignProtocol::kMaxGuid);
 
-    // Process anything pending first
-    processRecords();
+    // Count ourselves as a reader so that the snapshot we use is not
+    // deleted under us, even if it is replaced meanwhile
+    snapshotReaders_.ref();
 
-    QMutexLocker locker(&timingLock_);
+    const StatsSnapshot *snapshot = snapshot_.loadAcquire();
+    StatsSnapshot::const_iterator port = snapshot->constFind(portId);
+    if (port != snapshot->constEnd())
+        stats = port->value(guid, stats);
 
-    if (!timing_.contains(portId))
-        return stats;
-
-    Timing t = timing_.value(portId)->value(guid);
-    if (t.countDelays == 0)
-        return stats;
-
-    stats.latency = timespecToNsecs(t.sumDelays)/t.countDelays;
-    if (t.countDelays > 1)
-        stats.jitter = t.sumJitter/(t.countDelays-1);
+    snapshotReaders_.deref();
 
     return stats;
 }
@@ -92,113 +197,307 @@ void StreamTiming::clear(uint portId, uint guid)
     // XXX: We need to clear only the final timing hash; rx/tx hashes
     // are cleared by StreamTiming itself as part of processRecords and
     // deleteStaleRecords respectively
-    QMutexLocker locker(&timingLock_);
+    //
+    // Timing is owned by the aggregator, so we ask it to do the clear and
+    // wait till it's done, so that subsequent stats() don't return the
+    // cleared stats
+    QMutexLocker locker(&lock_);
+    quint64 request = ++clearRequestCount_;
+
+    clearRequests_.append(qMakePair(portId, guid));
+    wakeup_.wakeOne();
+
+    while (clearDoneCount_ < request && !quit_)
+        clearDone_.wait(&lock_);
+}
+
+void StreamTiming::aggregate()
+{
+    QElapsedTimer timer;
+    QList<QPair<uint, uint> > clearRequests;
+    QList<RecordQueue*> txQueues;
+    QList<RecordQueue*> rxQueues;
+    quint64 clearCount;
+    bool active;
+
+    timer.start();
+
+    lock_.lock();
+    while (!quit_)
+    {
+        clearRequests = clearRequests_;
+        clearRequests_.clear();
+        clearCount = clearRequestCount_;
+        // Kernel tx records after the captured ones, so that the former
+        // win if a ttag packet has both
+        txQueues = txQueues_.values() + kernelTxQueues_.values();
+        rxQueues = rxQueues_.values();
+        active = !activePortSet_.isEmpty();
+        lock_.unlock();
+
+        deleteRetiredStats();
+
+        for (int i = 0; i < clearRequests.size(); i++)
+            clearTiming(clearRequests.at(i).first, clearRequests.at(i).second);
+
+        processRecords(txQueues, rxQueues);
+        deleteStaleRecords(quint32(timer.elapsed()/kTickMsec));
+        // Publish right away if we won't run again till started/cleared
+        publishStats(!clearRequests.isEmpty() || !active);
+
+        lock_.lock();
+        if (clearCount > clearDoneCount_) {
+            clearDoneCount_ = clearCount;
+            clearDone_.wakeAll();
+        }
+
+        if (quit_ || !clearRequests_.isEmpty())
+            continue;
+
+        if (activePortSet_.isEmpty())
+            wakeup_.wait(&lock_); // nothing to do till started
+        else
+            wakeup_.wait(&lock_, kProcessIntervalMsec);
+    }
+    lock_.unlock();
+}
 
+void StreamTiming::clearTiming(uint portId, uint guid)
+{
     if (!timing_.contains(portId))
         return;
 
-    PortTiming *portTiming = timing_.value(portId);
-    if (!portTiming)
-        return;
+    PortTiming &portTiming = timing_[portId];
 
-    if (guid >= SignProtocol::kInvalidGuid)
-        portTiming->clear();      // remove ALL guids
-    else
-        portTiming->remove(guid);
+    if (guid >= SignProtocol::kInvalidGuid) {
+        portTiming.clear();      // remove ALL guids
+        changedGuids_.remove(portId);
+        stats_.remove(portId);
+    }
+    else {
+        portTiming.remove(guid);
+        if (changedGuids_.contains(portId))
+            changedGuids_[portId].remove(guid);
+        if (stats_.contains(portId))
+            stats_[portId].remove(guid);
+    }
+
+    statsCleared_ = true;
 }
 
-int StreamTiming::processRecords()
+int StreamTiming::processRecords(const QList<RecordQueue*> &txQueues,
+        const QList<RecordQueue*> &rxQueues)
 {
-    // TODO: yield after a certain count of records or time when called in
-    // timer context; when called from delay(), process ALL
-
+    // XXX: we take at most a queue's worth of records from a queue in one
+    // go, so that a busy port doesn't hold up the others
     int count = 0;
-    QMutexLocker txLocker(&txHashLock_);
-    QMutexLocker rxLocker(&rxHashLock_);
-    QMutexLocker timingLocker(&timingLock_);
-
-    auto i = rxHash_.begin();
-    while (i != rxHash_.end()) {
-        if (txHash_.contains(i.key())) {
-            struct timespec txTime = txHash_.take(i.key()).timeStamp;
-            struct timespec rxTime = i.value().timeStamp;
-            struct timespec diff;
-            timespecsub(&rxTime, &txTime, &diff);
-
-            uint guid = guidFromKey(i.key());
-            uint portId = i.value().portId;
-
-            if (!timing_.contains(portId))
-                timing_.insert(portId, new PortTiming);
-            PortTiming *portTiming = timing_.value(portId);
-            Timing &guidTiming = (*portTiming)[guid];
-            timespecadd(&guidTiming.sumDelays, &diff, &guidTiming.sumDelays);
-            if (guidTiming.countDelays)
-                guidTiming.sumJitter += abs(
-                        diff.tv_sec*long(1e9) + diff.tv_nsec
-                        - guidTiming.lastDelay.tv_sec*long(1e9)
-                        - guidTiming.lastDelay.tv_nsec);
-            guidTiming.lastDelay = diff;
-            guidTiming.countDelays++;
-
-            count++;
-
-            timingDebug("[%u/%u/%u] diff %ld.%09ld (%ld.%09ld - %ld.%09ld)",
-                i.value().portId, guid, ttagIdFromKey(i.key()),
-                diff.tv_sec, diff.tv_nsec,
-                rxTime.tv_sec, rxTime.tv_nsec,
-                txTime.tv_sec, txTime.tv_nsec);
-            timingDebug("[%u/%u](%d) total %ld.%09ld count %u jittersum %09llu",
-                i.value().portId, guid, count,
-                guidTiming.sumDelays.tv_sec, guidTiming.sumDelays.tv_nsec,
-                guidTiming.countDelays, guidTiming.sumJitter);
+    RecordQueue::Record record;
+
+    // Tx records first, so that the rx records find their tx records
+    foreach (RecordQueue *queue, txQueues) {
+        for (uint i = 0; i < RecordQueue::kSize && queue->take(record); i++) {
+            // Rx record processed before its tx record?
+            QHash<TxRxKey, TtagData>::iterator rx = rxHash_.find(record.key);
+            if (rx != rxHash_.end()) {
+                matchRecords(rx->portId, record.key,
+                             record.timestamp, rx->timeStamp);
+                rxHash_.erase(rx);
+                count++;
+                continue;
+            }
+
+            TtagData &tx = txHash_[record.key];
+            tx.timeStamp = record.timestamp;
+            tx.tick = tick_;
+            tx.portId = queue->portId_;
+            txWheel_[tick_ % uint(txWheel_.size())].append(record.key);
         }
-        i = rxHash_.erase(i);
     }
 
-    Q_ASSERT(rxHash_.isEmpty());
+    foreach (RecordQueue *queue, rxQueues) {
+        for (uint i = 0; i < RecordQueue::kSize && queue->take(record); i++) {
+            if (record.kind == RecordQueue::kLatencyRecord) {
+                updateTiming(queue->portId_, guidFromKey(record.key),
+                             qint64(record.timestamp));
+                count++;
+                continue;
+            }
+
+            QHash<TxRxKey, TtagData>::iterator tx = txHash_.find(record.key);
+            if (tx != txHash_.end()) {
+                matchRecords(queue->portId_, record.key,
+                             tx->timeStamp, record.timestamp);
+                txHash_.erase(tx);
+                count++;
+                continue;
+            }
+
+            // Tx record may not have been recorded yet - keep the rx record
+            // around for a while for it
+            TtagData &rx = rxHash_[record.key];
+            rx.timeStamp = record.timestamp;
+            rx.tick = tick_;
+            rx.portId = queue->portId_;
+            rxWheel_[tick_ % uint(rxWheel_.size())].append(record.key);
+        }
+    }
+
+    foreach (RecordQueue *queue, txQueues + rxQueues) {
+        int dropCount = queue->dropCount_.fetchAndStoreRelaxed(0);
+        if (dropCount)
+            qWarning("port %u: dropped %d %s ttag records (queue full)",
+                    queue->portId_, dropCount, queue->isTx_ ? "tx" : "rx");
+    }
 
     return count;
 }
 
-int StreamTiming::deleteStaleRecords()
+void StreamTiming::matchRecords(uint rxPortId, quint32 key,
+        quint64 txTime, quint64 rxTime)
 {
-    // TODO: yield after a certain count of records or time unless we are
-    // idle when we process all; how do we determine we are "idle"?
+    qint64 diff = qint64(rxTime - txTime);
 
-    // XXX: We assume the Tx packet timestamps are based on CLOCK_REALTIME
-    // (or a similar and comparable source). Since garbage collection timer
-    // is not a short interval, it need not be the exact same source as long
-    // as the values are comparable
-    int count = 0;
-    struct timespec now;
-    clock_gettime(CLOCK_REALTIME, &now);
-
-    // XXX: processRecords() iterates and deletes all rx records irrespective
-    // of whether it found a matching tx record. So for garbage collection we
-    // only need to look at (and delete) tx records
-    QMutexLocker locker(&txHashLock_);
-
-    auto i = txHash_.begin();
-    while (i != txHash_.end()) {
-        struct timespec txTime = i.value().timeStamp;
-        struct timespec diff;
-        timespecsub(&now, &txTime, &diff);
-        timingDebug("gc diff %ld", diff.tv_sec);
-        if (diff.tv_sec > 30) {
-            i = txHash_.erase(i);
-            count++;
-        } else {
-            i++;
-        }
+    timingDebug("[%u/%u/%u] diff %lld (%llu - %llu)",
+        rxPortId, guidFromKey(key), ttagIdFromKey(key), diff, rxTime, txTime);
 
+    updateTiming(rxPortId, guidFromKey(key), diff);
+}
+
+void StreamTiming::updateTiming(uint rxPortId, uint guid, qint64 diff)
+{
+    Timing &guidTiming = timing_[rxPortId][guid];
+    guidTiming.sumDelays += diff;
+    // XXX: -ve latency is possible if the tx and rx timestamps are from
+    // different clocks; histogram has only +ve values
+    guidTiming.latencyHist.add(diff > 0 ? quint64(diff) : 0);
+    if (guidTiming.countDelays) {
+        quint64 jitter = qAbs(diff - guidTiming.lastDelay);
+        guidTiming.sumJitter += jitter;
+        guidTiming.jitterHist.add(jitter);
     }
+    guidTiming.lastDelay = diff;
+    guidTiming.countDelays++;
+
+    changedGuids_[rxPortId].insert(guid);
+
+    timingDebug("[%u/%u] total %lld count %u jittersum %09llu",
+        rxPortId, guid, guidTiming.sumDelays, guidTiming.countDelays,
+        guidTiming.sumJitter);
+}
+
+int StreamTiming::deleteStaleRecords(quint32 tick)
+{
+    // XXX: Records expire based on when we processed them, not on their
+    // packet timestamps, so there are no assumptions on the clock source
+    // of the latter
 
+    // Tx records with no rx records - e.g. dropped packets
+    int count = expireRecords(txHash_, txWheel_, tick);
     if (count)
         qDebug("Latency garbage collected %d stale tx timing records", count);
+
+    // Rx records with no tx records - e.g. tx port not tracking
+    expireRecords(rxHash_, rxWheel_, tick);
+
+    tick_ = tick;
+
     return count;
 }
 
+/*!
+  Deletes the records that were added wheel-size or more ticks before
+  the given tick by going over the wheel slots of the ticks since the
+  last time we were called
+*/
+int StreamTiming::expireRecords(QHash<TxRxKey, TtagData> &hash,
+        TimerWheel &wheel, quint32 tick)
+{
+    quint32 size = quint32(wheel.size());
+    quint32 ticks = tick - tick_;
+    int count = 0;
+
+    if (ticks > size)
+        ticks = size; // all slots
+
+    for (quint32 t = tick - ticks + 1; t != tick + 1; t++) {
+        QVector<TxRxKey> &slot = wheel[t % size];
+
+        for (int i = 0; i < slot.size(); i++) {
+            QHash<TxRxKey, TtagData>::iterator iter = hash.find(slot.at(i));
+
+            // Skip if recorded again since (ttagIds wrap around)
+            if ((iter != hash.end()) && ((tick - iter->tick) >= size)) {
+                hash.erase(iter);
+                count++;
+            }
+        }
+        slot.clear();
+    }
+
+    return count;
+}
+
+/*!
+  Publishes a new stats snapshot with the stats of the streams that have
+  changed since the last snapshot
+
+  As the histograms are copied, this is done only every
+  kPublishIntervalMsec, unless 'force' is set
+*/
+void StreamTiming::publishStats(bool force)
+{
+    if (changedGuids_.isEmpty() && !statsCleared_)
+        return;
+
+    if (!force && sincePublish_.isValid()
+            && (sincePublish_.elapsed() < kPublishIntervalMsec))
+        return;
+
+    QHashIterator<PortIdKey, QSet<GuidKey> > iter(changedGuids_);
+    while (iter.hasNext()) {
+        iter.next();
+        const PortTiming &portTiming = timing_[iter.key()];
+        PortStats &portStats = stats_[iter.key()];
+
+        foreach (GuidKey guid, iter.value()) {
+            PortTiming::const_iterator timing = portTiming.constFind(guid);
+            if (timing == portTiming.constEnd())
+                continue;
+
+            const Timing &t = timing.value();
+            Stats &stats = portStats[guid];
+
+            stats.latency = quint64(t.sumDelays/t.countDelays);
+            stats.jitter = t.countDelays > 1 ?
+                                t.sumJitter/(t.countDelays-1) : 0;
+            stats.latencyHist = QSharedPointer<const Histogram>(
+                                    new Histogram(t.latencyHist));
+            stats.jitterHist = QSharedPointer<const Histogram>(
+                                    new Histogram(t.jitterHist));
+        }
+    }
+    changedGuids_.clear();
+    statsCleared_ = false;
+    sincePublish_.start();
+
+    // The new snapshot shares the stats of the unchanged ports with the
+    // old one (implicit sharing)
+    retiredSnapshots_.append(
+            snapshot_.fetchAndStoreOrdered(new StatsSnapshot(stats_)));
+}
+
+void StreamTiming::deleteRetiredStats()
+{
+    // A reader that started before a snapshot was retired may still be
+    // using it, but one that starts now can only get the current one - so
+    // retired snapshots are deleted only when there are no readers
+    if (retiredSnapshots_.isEmpty() || snapshotReaders_.loadAcquire())
+        return;
+
+    qDeleteAll(retiredSnapshots_);
+    retiredSnapshots_.clear();
+}
+
 StreamTiming* StreamTiming::instance()
 {
     static StreamTiming *instance{nullptr};
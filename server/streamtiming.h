@@ -21,15 +21,35 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #define _STREAM_TIMING
 
 #include "../common/debugdefs.h"
+#include "../common/histogram.h"
 #include "../common/sign.h"
 
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QElapsedTimer>
 #include <QHash>
+#include <QList>
 #include <QMutex>
+#include <QObject>
+#include <QPair>
 #include <QSet>
-#include <QTimer>
+#include <QSharedPointer>
+#include <QVector>
+#include <QWaitCondition>
 
 #include <time.h>
 
+/*
+ * Tracks the latency and jitter of streams using the tx and rx timestamps
+ * of their ttag packets - and the latencies computed by the rx port for
+ * packets carrying their tx timestamp (see SignProtocol Tx Timestamp)
+ *
+ * The port threads that capture the ttag packets add (ttag, timestamp)
+ * records to per port RecordQueues without any locking; an aggregator
+ * thread drains the queues, matches rx records with tx records and
+ * updates the stream timing. The timing is published as an immutable
+ * snapshot which stats() reads without waiting on the aggregator
+ */
 class StreamTiming : public QObject
 {
     Q_OBJECT
@@ -38,159 +58,225 @@ public:
     {
         quint64 latency;
         quint64 jitter;
+        QSharedPointer<const Histogram> latencyHist;
+        QSharedPointer<const Histogram> jitterHist;
     };
 
-    bool recordTxTime(uint portId, uint guid, uint ttagId,
-                      const struct timespec &timestamp);
-    bool recordRxTime(uint portId, uint guid, uint ttagId,
-                      const struct timespec &timestamp);
+    /*
+     * Queue of the tx or rx ttag records of a port
+     *
+     * A queue has a single producer - the port thread that captures the
+     * ttag packets - and a single consumer - the aggregator. If the queue
+     * is full, the record is dropped
+     */
+    class RecordQueue
+    {
+    public:
+        RecordQueue(uint portId, bool isTx);
 
-    bool recordTxTime(uint portId, uint guid, uint ttagId,
-                      const struct timeval &timestamp);
-    bool recordRxTime(uint portId, uint guid, uint ttagId,
-                      const struct timeval &timestamp);
+        bool record(uint guid, uint ttagId, const struct timespec &timestamp);
+        bool record(uint guid, uint ttagId, const struct timeval &timestamp);
+        bool recordLatency(uint guid, qint64 latency); // rx queue only
 
-    bool recordTxTime(uint portId, uint *ttagList, int count,
-                      const struct timespec &timestamp);
+        uint portId() const { return portId_; }
 
-    Stats stats(uint portId, uint guid);
-    void clear(uint portId, uint guid = SignProtocol::kInvalidGuid);
+    private:
+        friend class StreamTiming;
 
-    static StreamTiming* instance();
+        enum RecordKind {
+            kTtagRecord,
+            kLatencyRecord
+        };
+        struct Record {
+            quint64 timestamp; // nanosecs; latency for kLatencyRecord
+            quint32 key;
+            quint8 kind;
+        };
 
-public slots:
-    void start(uint portId);
-    void stop(uint portId);
+        bool add(quint32 key, quint64 value, RecordKind kind);
 
-private:
-    StreamTiming(QObject *parent=nullptr);
+        bool take(Record &record);
 
-    int processRecords();
-    int deleteStaleRecords();
+        static const uint kSize = 4096; // MUST be a power of 2
 
-    // XXX: use only time intervals, not absolute time
-    quint64 timespecToNsecs(const struct timespec &interval) {
-        return interval.tv_nsec + interval.tv_sec*1e9;
-    }
-
-    struct TtagData {
-        struct timespec timeStamp; // nanosec resolution
-        uint portId;
+        uint portId_;
+        bool isTx_;
+        Record records_[kSize];
+        QAtomicInt head_{0}; // next record to add - updated by producer
+        QAtomicInt tail_{0}; // next record to take - updated by consumer
+        QAtomicInt dropCount_{0};
     };
 
-    // XXX: used only as a Qt Container value, so members will get init to 0
-    // when this struct is retrieved from the container due to Qt's default-
-    // cosntructed value semantics
-    struct Timing {
-        struct timespec sumDelays; // nanosec resolution
-        struct timespec lastDelay;
-        quint64 sumJitter; // nanosec resolution
-        uint countDelays;
-    };
+    RecordQueue* txRecordQueue(uint portId);
+    RecordQueue* rxRecordQueue(uint portId);
+    RecordQueue* kernelTxRecordQueue(uint portId);
 
-    QSet<uint> activePortSet_;
+    void start(uint portId);
+    void stop(uint portId);
+
+    Stats stats(uint portId, uint guid);
+    void clear(uint portId, uint guid = SignProtocol::kInvalidGuid);
+
+    static StreamTiming* instance();
+
+private:
+    class Aggregator;
+
+    StreamTiming(QObject *parent=nullptr);
+    ~StreamTiming();
+
+    void aggregate();
+    void clearTiming(uint portId, uint guid);
+    int processRecords(const QList<RecordQueue*> &txQueues,
+                       const QList<RecordQueue*> &rxQueues);
+    void matchRecords(uint rxPortId, quint32 key,
+                      quint64 txTime, quint64 rxTime);
+    void updateTiming(uint rxPortId, uint guid, qint64 latency);
+    int deleteStaleRecords(quint32 tick);
+    void publishStats(bool force);
+    void deleteRetiredStats();
 
     // XXX: TxRxKey = ttagid (8 bit MSB) + guid (24 bit LSB)
     // TODO: encode tx port in packet and use as part of key
     typedef quint32 TxRxKey;
-    TxRxKey makeKey(uint guid, uint ttagId) {
+    static TxRxKey makeKey(uint guid, uint ttagId) {
         return (ttagId << 24 ) | (guid & 0x00FFFFFF);
     }
-    uint guidFromKey(TxRxKey key) {
+    static uint guidFromKey(TxRxKey key) {
         return uint(key) & 0x00FFFFFF;
     }
-    uint ttagIdFromKey(TxRxKey key) {
+    static uint ttagIdFromKey(TxRxKey key) {
         return uint(key) >> 24;
     }
 
+    // Aggregator runs every kProcessIntervalMsec when tracking is active
+    // and publishes the stats every kPublishIntervalMsec; record expiry is
+    // tracked in units of kTickMsec
+    static const int kProcessIntervalMsec = 10;
+    static const int kPublishIntervalMsec = 100;
+    static const int kTickMsec = 100;
+    static const int kTxRecordTicks = 300;  // 30s
+    static const int kRxRecordTicks = 20;   // 2s
+
+    // Shared between the aggregator and other threads - protected by lock_
+    QMutex lock_;
+    QWaitCondition wakeup_;         // aggregator waits on this
+    QWaitCondition clearDone_;      // clear() waits on this
+    bool quit_{false};
+    QSet<uint> activePortSet_;
+    QHash<uint, RecordQueue*> txQueues_;
+    QHash<uint, RecordQueue*> rxQueues_;
+    QHash<uint, RecordQueue*> kernelTxQueues_;
+    QList<QPair<uint, uint> > clearRequests_; // (portId, guid)
+    quint64 clearRequestCount_{0};
+    quint64 clearDoneCount_{0};
+
+    Aggregator *aggregator_;
+
+    // Everything below is accessed only by the aggregator
+
+    // XXX: used only as a Qt Container value, so members will get init to 0
+    // when this struct is retrieved from the container due to Qt's default-
+    // cosntructed value semantics
+    struct Timing {
+        qint64 sumDelays; // nanosec resolution
+        qint64 lastDelay;
+        quint64 sumJitter; // nanosec resolution
+        uint countDelays;
+        Histogram latencyHist;
+        Histogram jitterHist;
+    };
+
+    // Records yet to be matched; expired using timer wheels - a wheel slot
+    // has the keys of the records added in a tick (modulo wheel size)
+    struct TtagData {
+        quint64 timeStamp; // nanosecs
+        quint32 tick;
+        uint portId;
+    };
     QHash<TxRxKey, TtagData> txHash_;
     QHash<TxRxKey, TtagData> rxHash_;
-    QMutex txHashLock_;
-    QMutex rxHashLock_;
+    typedef QVector<QVector<TxRxKey> > TimerWheel;
+    TimerWheel txWheel_;
+    TimerWheel rxWheel_;
+    quint32 tick_{0};
+    int expireRecords(QHash<TxRxKey, TtagData> &hash, TimerWheel &wheel,
+                      quint32 tick);
 
     typedef uint PortIdKey;
     typedef uint GuidKey; // guid only, no ttagid
     typedef QHash<GuidKey, Timing> PortTiming;
-    QHash<PortIdKey, PortTiming*> timing_;
-    QMutex timingLock_;
-
-    QTimer *timer_;     // Periodic timer to process tx/rx records
-    QTimer *gcTimer_;   // Garbage collection for stale tx records
+    QHash<PortIdKey, PortTiming> timing_;
+    QHash<PortIdKey, QSet<GuidKey> > changedGuids_; // since last publish
+
+    // Published stats - readers use the current snapshot; replaced ones
+    // are deleted once there are no readers
+    typedef QHash<GuidKey, Stats> PortStats;
+    typedef QHash<PortIdKey, PortStats> StatsSnapshot;
+    StatsSnapshot stats_;
+    QElapsedTimer sincePublish_;
+    bool statsCleared_{false}; // since last publish
+    QAtomicPointer<const StatsSnapshot> snapshot_;
+    QAtomicInt snapshotReaders_{0};
+    QList<const StatsSnapshot*> retiredSnapshots_;
 };
 
 inline
-bool StreamTiming::recordTxTime(uint portId, uint guid, uint ttagId,
-        const struct timespec &timestamp)
+bool StreamTiming::RecordQueue::add(quint32 key, quint64 value,
+        RecordKind kind)
 {
-    TxRxKey key = makeKey(guid, ttagId);
-    TtagData value = { .timeStamp = timestamp, .portId = portId};
+    uint head = uint(head_.load());
 
-    timingDebug("[%d TX] %ld:%ld ttag %u guid %u", portId,
-            timestamp.tv_sec, long(timestamp.tv_nsec), ttagId, guid);
+    if (head - uint(tail_.loadAcquire()) >= kSize) {
+        dropCount_.ref();
+        return false;
+    }
 
-    QMutexLocker locker(&txHashLock_);
-    txHash_.insert(key, value);
+    Record &record = records_[head & (kSize - 1)];
+    record.timestamp = value;
+    record.key = key;
+    record.kind = quint8(kind);
+    head_.storeRelease(int(head + 1));
 
     return true;
 }
 
 inline
-bool StreamTiming::recordRxTime(uint portId, uint guid, uint ttagId,
+bool StreamTiming::RecordQueue::record(uint guid, uint ttagId,
         const struct timespec &timestamp)
 {
-    TxRxKey key = makeKey(guid, ttagId);
-    TtagData value = { .timeStamp = timestamp, .portId = portId};
-
-    timingDebug("[%d RX] %ld:%ld ttag %u guid %u", portId,
-            timestamp.tv_sec, long(timestamp.tv_nsec), ttagId, guid);
-
-    QMutexLocker locker(&rxHashLock_);
-    rxHash_.insert(key, value);
-
-    return true;
-}
-
-inline
-bool StreamTiming::recordTxTime(uint portId, uint guid, uint ttagId,
-        const struct timeval &timestamp)
-{
-    struct timespec ts;
-    ts.tv_sec = timestamp.tv_sec;
-    ts.tv_nsec = timestamp.tv_usec*1000;
+    timingDebug("[%d %s] %ld:%ld ttag %u guid %u", portId_,
+            isTx_ ? "TX" : "RX", timestamp.tv_sec, long(timestamp.tv_nsec),
+            ttagId, guid);
 
-    return recordTxTime(portId, guid, ttagId, ts);
+    return add(makeKey(guid, ttagId),
+               quint64(timestamp.tv_sec)*1000000000ULL + timestamp.tv_nsec,
+               kTtagRecord);
 }
 
 inline
-bool StreamTiming::recordRxTime(uint portId, uint guid, uint ttagId,
+bool StreamTiming::RecordQueue::record(uint guid, uint ttagId,
         const struct timeval &timestamp)
 {
     struct timespec ts;
     ts.tv_sec = timestamp.tv_sec;
     ts.tv_nsec = timestamp.tv_usec*1000;
 
-    return recordRxTime(portId, guid, ttagId, ts);
+    return record(guid, ttagId, ts);
 }
 
-// TTagList contains 32-bit ttags formatted as ttagId (8msb) + guid (24lsb)
+/*!
+  Records a latency (nanosecs) already computed by the rx port - it is
+  used as is, without matching with any tx record
+*/
 inline
-bool StreamTiming::recordTxTime(uint portId, uint *ttagList, int count,
-        const struct timespec &timestamp)
+bool StreamTiming::RecordQueue::recordLatency(uint guid, qint64 latency)
 {
-    TtagData value = { .timeStamp = timestamp, .portId = portId};
-    QMutexLocker locker(&txHashLock_);
+    Q_ASSERT(!isTx_);
 
-    for (int i = 0; i < count; i++) {
-        TxRxKey key = TxRxKey(ttagList[i]);
+    timingDebug("[%d RX] latency %lld guid %u", portId_, latency, guid);
 
-        timingDebug("[%d TX] %ld:%ld ttag %u guid %u", portId,
-                timestamp.tv_sec, long(timestamp.tv_nsec),
-                ttagIdFromKey(key), guidFromKey(key));
-
-        txHash_.insert(key, value);
-    }
-
-    return true;
+    return add(makeKey(guid, 0), quint64(latency), kLatencyRecord);
 }
 
 #endif
@@ -27,47 +27,22 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #if defined(Q_OS_LINUX)
 #include <sys/time.h>
-#ifdef USE_NSEC_TIMESTAMP
+#include <time.h>
 typedef struct timespec TimeStamp;
 static void inline getTimeStamp(TimeStamp *stamp)
 {
+    // Use a monotonic clock (not wall-clock) that doesn't step
     clock_gettime(CLOCK_MONOTONIC, stamp);
 }
 
 // Returns time diff in nsecs between end and start
-static long inline ndiffTimeStamp(const TimeStamp *start, const TimeStamp *end)
+static qint64 inline ndiffTimeStamp(const TimeStamp *start, const TimeStamp *end)
 {
     struct timespec diff;
     timespecsub(end, start, &diff);
 
-    long nsecs = diff.tv_nsec;
-    if (diff.tv_sec)
-        nsecs += diff.tv_sec*1e9;
-
-    return nsecs;
+    return qint64(diff.tv_sec)*1000000000LL + diff.tv_nsec;
 }
-#else
-typedef struct timeval TimeStamp;
-static void inline getTimeStamp(TimeStamp *stamp)
-{
-    gettimeofday(stamp, NULL);
-}
-
-// Returns time diff in usecs between end and start
-static long inline udiffTimeStamp(const TimeStamp *start, const TimeStamp *end)
-{
-    struct timeval diff;
-    long usecs;
-
-    timersub(end, start, &diff);
-
-    usecs = diff.tv_usec;
-    if (diff.tv_sec)
-        usecs += diff.tv_sec*1e6;
-
-    return usecs;
-}
-#endif
 
 #elif defined(Q_OS_WIN32)
 #include <windows.h>
@@ -78,21 +53,54 @@ static void inline getTimeStamp(TimeStamp* stamp)
     QueryPerformanceCounter(stamp);
 }
 
-static long inline udiffTimeStamp(const TimeStamp *start, const TimeStamp *end)
+// Returns time diff in nsecs between end and start
+static qint64 inline ndiffTimeStamp(const TimeStamp *start, const TimeStamp *end)
 {
+    quint64 ticks;
+
     if (end->QuadPart >= start->QuadPart)
-        return (end->QuadPart - start->QuadPart)*long(1e6)/gTicksFreq;
+        ticks = end->QuadPart - start->QuadPart;
     else
     {
         // FIXME: incorrect! what's the max value for this counter before
         // it rolls over?
-        return (start->QuadPart)*long(1e6)/gTicksFreq;
+        ticks = start->QuadPart;
     }
+
+    // Split to avoid overflow of ticks*1e9
+    return (ticks/gTicksFreq)*1000000000LL
+                + ((ticks % gTicksFreq)*1000000000LL)/gTicksFreq;
 }
 #else
 typedef int TimeStamp;
 static void inline getTimeStamp(TimeStamp*) {}
-static long inline udiffTimeStamp(const TimeStamp*, const TimeStamp*) { return 0; }
+static qint64 inline ndiffTimeStamp(const TimeStamp*, const TimeStamp*) { return 0; }
+#endif
+
+// Returns the wall-clock time in nsecs since the epoch - unlike TimeStamp,
+// this is comparable across hosts (if their clocks are synchronized)
+#if defined(Q_OS_WIN32)
+static quint64 inline realTimeNsecs()
+{
+    FILETIME ft;
+    ULARGE_INTEGER t;
+
+    GetSystemTimePreciseAsFileTime(&ft);
+    t.LowPart = ft.dwLowDateTime;
+    t.HighPart = ft.dwHighDateTime;
+
+    // FILETIME is in 100ns units since 1601-01-01
+    return (t.QuadPart - 116444736000000000ULL)*100;
+}
+#else
+#include <time.h>
+static quint64 inline realTimeNsecs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return quint64(ts.tv_sec)*1000000000ULL + ts.tv_nsec;
+}
 #endif
 
 #endif
@@ -19,22 +19,125 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "turbo.h"
 
+#include "settings.h"
+#include "turboport.h"
+
+#include <QRegExp>
+#include <QStringList>
+
+static bool turboEnabled = false;
+#ifdef Q_OS_LINUX
+static TurboPort::Options turboOptions;
+#endif
+static QStringList turboPortList;
+
 bool initTurbo()
 {
+#ifdef Q_OS_LINUX
+    // Turbo may be enabled either via command line (-t) or settings
+    if (appSettings->value(kTurboEnableKey, false).toBool())
+        turboEnabled = true;
+    turboPortList = appSettings->value(kTurboPortListKey).toStringList();
+    turboOptions.qdiscBypass = appSettings->value(kTurboQdiscBypassKey,
+                                                  false).toBool();
+    turboOptions.xdpQueue = appSettings->value(kTurboXdpQueueKey, 0).toInt();
+    turboOptions.kernelTxTimestamps = appSettings->value(
+            kTurboKernelTxTimestampsKey, true).toBool();
+    turboOptions.txThreads = qMax(1,
+            appSettings->value(kTurboTxThreadsKey, 1).toInt());
+    foreach (QString cpu, appSettings->value(kTurboTxCpusKey).toStringList()) {
+        bool isOk;
+        int n = cpu.toInt(&isOk);
+        if (isOk && (n >= 0))
+            turboOptions.txCpus.append(n);
+        else if (!cpu.isEmpty())
+            qWarning("Ignoring invalid Turbo TxCpus entry %s",
+                    qPrintable(cpu));
+    }
+
+    QString mode = appSettings->value(kTurboTxModeKey,
+                                      kTurboTxModeDefaultValue).toString();
+    if (mode.compare("TxRing", Qt::CaseInsensitive) == 0)
+        turboOptions.txMode = TurboPort::kTxRing;
+    else if (mode.compare("SendMmsg", Qt::CaseInsensitive) == 0)
+        turboOptions.txMode = TurboPort::kSendMmsg;
+#ifdef HAVE_AF_XDP
+    else if (mode.compare("Xdp", Qt::CaseInsensitive) == 0)
+        turboOptions.txMode = TurboPort::kXdp;
+#endif
+    else if (mode.compare("TxTime", Qt::CaseInsensitive) == 0)
+        turboOptions.txMode = TurboPort::kTxTime;
+    else {
+        qWarning("Unsupported Turbo TxMode %s - using TxRing",
+                qPrintable(mode));
+        turboOptions.txMode = TurboPort::kTxRing;
+    }
+
+    QString clock = appSettings->value(kTurboTxTimeClockKey,
+                                       kTurboTxTimeClockDefaultValue).toString();
+    if (clock.compare("Tai", Qt::CaseInsensitive) == 0)
+        turboOptions.txTimeClock = CLOCK_TAI;
+    else if (clock.compare("Monotonic", Qt::CaseInsensitive) == 0)
+        turboOptions.txTimeClock = CLOCK_MONOTONIC;
+    else
+        qWarning("Unsupported Turbo TxTimeClock %s - using Monotonic",
+                qPrintable(clock));
+
+    if (turboEnabled)
+        qDebug("Turbo enabled for ports %s (mode %s, tx threads %d, "
+                "qdisc bypass %s)",
+                turboPortList.isEmpty() ? "*" :
+                    qPrintable(turboPortList.join(",")),
+                qPrintable(mode), turboOptions.txThreads,
+                turboOptions.qdiscBypass ? "on" : "off");
+#endif
     return true;
 }
 
-bool isTurboPort(const char* /*device*/)
+bool isTurboPort(const char* device)
 {
+    QRegExp pattern;
+
+    if (!turboEnabled)
+        return false;
+
+    // An empty (or missing) list implies all ports
+    // NOTE: A blank "Include=" is read as a stringlist with one
+    // string which is empty => treat it same as an empty stringlist
+    if (turboPortList.isEmpty()
+            || (turboPortList.size() == 1 && turboPortList.at(0).isEmpty()))
+        return true;
+
+    pattern.setPatternSyntax(QRegExp::Wildcard);
+    foreach (QString str, turboPortList) {
+        pattern.setPattern(str);
+        if (pattern.exactMatch(device))
+            return true;
+    }
+
     return false;
 }
 
-AbstractPort* createTurboPort(int /*id*/, const char* /*device*/)
+AbstractPort* createTurboPort(int id, const char* device)
 {
+#ifdef Q_OS_LINUX
+    return new TurboPort(id, device, turboOptions);
+#else
+    Q_UNUSED(id);
+    Q_UNUSED(device);
     return nullptr;
+#endif
 }
 
-bool processTurboOption(int /*opt*/)
+bool processTurboOption(int opt)
 {
+#ifdef Q_OS_LINUX
+    if (opt == 't') {
+        turboEnabled = true;
+        return true;
+    }
+#else
+    Q_UNUSED(opt);
+#endif
     return false;
 }
@@ -0,0 +1,145 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "turboport.h"
+
+#ifdef Q_OS_LINUX
+
+#include "mmsgtxthread.h"
+#include "streamtiming.h"
+#include "txringthread.h"
+#include "txtimestamper.h"
+#include "xdptxthread.h"
+
+TurboPort::TurboPort(int id, const char *device, const Options &options)
+    : LinuxPort(id, device), kernelTxState_(TxTimestamper::kUnavailable)
+{
+    options_ = options;
+
+    // Replace the default transmitter with one that uses the turbo tx
+    // thread(s). No need to stop it because it is started only on
+    // startTransmit()
+    delete transmitter_;
+    transmitter_ = new PcapTransmitter(device, createTxThread(device, 0));
+    for (int i = 1; i < options_.txThreads; i++)
+        transmitter_->addTxThread(createTxThread(device, i));
+
+    qDebug("%s: using turbo tx mode %d with %d tx thread(s) "
+            "(qdisc bypass %s)", device, options_.txMode,
+            options_.txThreads, options_.qdiscBypass ? "on" : "off");
+}
+
+TurboPort::~TurboPort()
+{
+}
+
+PcapTxThread* TurboPort::createTxThread(const char *device, int shard)
+{
+    PcapTxThread *txThread = NULL;
+    StreamTiming::RecordQueue *ttagRecords = NULL;
+    QAtomicInt *ttagState = NULL;
+
+    // Only the primary tx thread (shard 0) sends T-tag packets
+    if (hasKernelTxTimestamps() && (shard == 0)) {
+        ttagRecords = StreamTiming::instance()->kernelTxRecordQueue(id());
+        ttagState = &kernelTxState_;
+    }
+
+    switch (options_.txMode) {
+    case kSendMmsg:
+        txThread = new MmsgTxThread(device, options_.qdiscBypass, -1,
+                                    ttagRecords, ttagState);
+        break;
+    case kTxTime:
+        txThread = new MmsgTxThread(device, options_.qdiscBypass,
+                                    options_.txTimeClock, ttagRecords,
+                                    ttagState);
+        break;
+#ifdef HAVE_AF_XDP
+    case kXdp:
+        // Each shard needs its own queue
+        txThread = new XdpTxThread(device, options_.xdpQueue + shard);
+        break;
+#endif
+    case kTxRing:
+    default:
+        txThread = new TxRingThread(device, options_.qdiscBypass,
+                                    ttagRecords, ttagState);
+        break;
+    }
+
+    if (!options_.txCpus.isEmpty())
+        txThread->setCpuAffinity(
+                options_.txCpus.at(shard % options_.txCpus.size()));
+
+    return txThread;
+}
+
+/*!
+  Returns true if the tx thread(s) get the T-tag tx timestamps from the
+  kernel (SO_TIMESTAMPING) - possible only for the AF_PACKET tx modes
+*/
+bool TurboPort::hasKernelTxTimestamps()
+{
+    return options_.kernelTxTimestamps && (options_.txMode != kXdp);
+}
+
+void TurboPort::init()
+{
+    LinuxPort::init();
+
+    // Tx packets are not seen by the local capture used for timestamping
+    // Ttag packets if we bypass the qdisc or the kernel stack altogether -
+    // kernel tx timestamps, if available, don't need the capture
+    bool kernelTxTimestamps = hasKernelTxTimestamps()
+                                && TxTimestamper::isSupported(name());
+
+    if (kernelTxTimestamps)
+        kernelTxState_.storeRelease(TxTimestamper::kPending);
+    else if (hasKernelTxTimestamps())
+        addNote("Kernel tx timestamps not available");
+
+    if (options_.txMode == kXdp)
+        addNote("Stream latency not available (AF_XDP)");
+    else if (options_.qdiscBypass && !kernelTxTimestamps)
+        addNote("Stream latency not available (qdisc bypass)");
+}
+
+void TurboPort::startTransmit()
+{
+    // The kernel tx timestamps may have turned out to be unavailable
+    // during the last transmit
+    updateTxTtagCapture();
+
+    LinuxPort::startTransmit();
+}
+
+/*!
+  Returns true if the T-tag tx timestamps need to be captured - i.e. the
+  tx thread can't get them from the kernel (see TxTimestamper)
+
+  The kernel timestamps are expected to be reported till they turn out
+  not to be, so a transmit during which that happens has no tx timestamps
+*/
+bool TurboPort::isTxTtagCaptureNeeded()
+{
+    return kernelTxState_.loadAcquire() == TxTimestamper::kUnavailable;
+}
+
+#endif
@@ -0,0 +1,80 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _SERVER_TURBO_PORT_H
+#define _SERVER_TURBO_PORT_H
+
+#include <QtGlobal>
+
+#ifdef Q_OS_LINUX
+
+#include "linuxport.h"
+
+#include <QAtomicInt>
+
+#include <time.h>
+
+/*
+ * A LinuxPort that transmits using a faster mechanism than
+ * pcap_sendpacket() - see TxMode
+ */
+class TurboPort : public LinuxPort
+{
+public:
+    enum TxMode
+    {
+        kTxRing,    // AF_PACKET mmap'd TX_RING
+        kSendMmsg,  // AF_PACKET sendmmsg() for back-to-back packets
+        kXdp,       // AF_XDP with packet list resident in UMEM
+        kTxTime,    // AF_PACKET sendmmsg() with SO_TXTIME launch times
+    };
+
+    struct Options
+    {
+        TxMode txMode{kTxRing};
+        bool qdiscBypass{false}; // AF_PACKET modes only
+        bool kernelTxTimestamps{true}; // AF_PACKET modes only; T-tag tx
+                                       // timestamps via SO_TIMESTAMPING
+        int xdpQueue{0};         // AF_XDP mode only; first queue if sharded
+        int txTimeClock{CLOCK_MONOTONIC}; // TxTime mode only; fq needs
+                                          // MONOTONIC, etf needs TAI
+        int txThreads{1};        // number of tx shards
+        QList<int> txCpus;       // cpu affinity per tx shard (round-robin)
+    };
+
+    TurboPort(int id, const char *device, const Options &options);
+    virtual ~TurboPort();
+
+    void init();
+
+    virtual void startTransmit();
+
+protected:
+    virtual bool isTxTtagCaptureNeeded();
+
+private:
+    PcapTxThread* createTxThread(const char *device, int shard);
+    bool hasKernelTxTimestamps();
+
+    Options options_;
+    QAtomicInt kernelTxState_; // TxTimestamper::State; shared with shard 0
+};
+#endif
+
+#endif
@@ -0,0 +1,332 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "txringthread.h"
+
+#ifdef Q_OS_LINUX
+
+#include <errno.h>
+#include <net/if.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <linux/if_packet.h>
+
+// Offset of packet data within a TPACKET_V2 ring frame
+static const uint kTxDataOffset = TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+
+TxRingThread::TxRingThread(const char *device, bool qdiscBypass,
+                           StreamTiming::RecordQueue *ttagRecords,
+                           QAtomicInt *ttagState)
+    : PcapTxThread(device), txTimestamper_(ttagRecords, ttagState)
+{
+    qdiscBypass_ = qdiscBypass;
+}
+
+TxRingThread::~TxRingThread()
+{
+    teardownRing();
+    if (fd_ >= 0)
+        close(fd_);
+}
+
+bool TxRingThread::txBegin()
+{
+    if ((fd_ < 0) && !openSocket())
+        goto _fallback;
+
+    // Ring frame size depends on the largest packet in the packet list
+    // which may have changed since the last transmit
+    if (!ring_ || (kTxDataOffset + maxPacketLength()) > frameSize_) {
+        teardownRing();
+        if (!setupRing(maxPacketLength()))
+            goto _fallback;
+    }
+
+    frameIndex_ = 0;
+    pending_ = 0;
+    return true;
+
+_fallback:
+    qWarning("%s: TX_RING unavailable, falling back to pcap_sendpacket",
+            qPrintable(device_));
+    txTimestamper_.setUnavailable();
+    return PcapTxThread::txBegin();
+}
+
+void TxRingThread::txEnd()
+{
+    if (!ring_) {
+        PcapTxThread::txEnd();
+        return;
+    }
+
+    // Wait (bounded) for the kernel to finish sending all queued frames
+    // so that the tx duration and stats reflect reality
+    for (int i = 0; i < 100; i++) {
+        bool busy = false;
+        for (uint j = 0; j < frameCount_; j++) {
+            tpacket2_hdr *hdr = (tpacket2_hdr*)(ring_ + j*frameSize_);
+            if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE)
+                    & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING)) {
+                busy = true;
+                break;
+            }
+        }
+        if (!busy)
+            break;
+        kick();
+        QThread::msleep(10);
+    }
+
+    // Tx timestamps are reported after the packet is sent out
+    txTimestamper_.drain(kTxTimestampWaitMsec);
+}
+
+int TxRingThread::sendPacket(const uchar *packet, int length)
+{
+    if (!ring_)
+        return PcapTxThread::sendPacket(packet, length);
+
+    if (!waitForFrame(frameIndex_))
+        return -1;
+
+    tpacket2_hdr *hdr = (tpacket2_hdr*)(ring_ + frameIndex_*frameSize_);
+
+    memcpy((uchar*)hdr + kTxDataOffset, packet, length);
+    hdr->tp_len = length;
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST,
+            __ATOMIC_RELEASE);
+
+    if (++frameIndex_ >= frameCount_)
+        frameIndex_ = 0;
+
+    // XXX: the timestamp request applies to all frames sent by the kick -
+    // the tx loop flushes before and after a T-tag packet, so usually
+    // that's just the T-tag packet
+    if (isTtagPacket() && txTimestamper_.isEnabled())
+        txTimestampKick_ = true;
+
+    if (++pending_ >= kTxBatchSize)
+        kick();
+
+    return 0;
+}
+
+void TxRingThread::flushPackets()
+{
+    if (pending_)
+        kick();
+
+    if (txTimestamper_.hasOutstanding())
+        txTimestamper_.collect();
+}
+
+bool TxRingThread::openSocket()
+{
+    int ver = TPACKET_V2;
+    int discard = 1;
+
+    fd_ = socket(AF_PACKET, SOCK_RAW, 0);
+    if (fd_ < 0) {
+        qWarning("%s: unable to open AF_PACKET socket: %s",
+                qPrintable(device_), strerror(errno));
+        return false;
+    }
+
+    if (setsockopt(fd_, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver)) < 0) {
+        qWarning("%s: unable to set TPACKET_V2: %s",
+                qPrintable(device_), strerror(errno));
+        goto _error;
+    }
+
+    // Malformed frames are discarded by the kernel instead of stalling
+    // the ring with TP_STATUS_WRONG_FORMAT
+    if (setsockopt(fd_, SOL_PACKET, PACKET_LOSS,
+                &discard, sizeof(discard)) < 0) {
+        qWarning("%s: unable to set PACKET_LOSS: %s",
+                qPrintable(device_), strerror(errno));
+        goto _error;
+    }
+
+    // XXX: Bypassing the qdisc also bypasses the local taps, so we will
+    // not be able to capture our own tx packets (and hence timestamp
+    // T-tag packets) - which is why this is opt-in; kernel tx timestamps
+    // (if enabled) are not affected
+#ifdef PACKET_QDISC_BYPASS
+    if (qdiscBypass_) {
+        int bypass = 1;
+        if (setsockopt(fd_, SOL_PACKET, PACKET_QDISC_BYPASS,
+                    &bypass, sizeof(bypass)) < 0)
+            qWarning("%s: unable to set PACKET_QDISC_BYPASS: %s",
+                    qPrintable(device_), strerror(errno));
+    }
+#endif
+
+    return true;
+
+_error:
+    close(fd_);
+    fd_ = -1;
+    return false;
+}
+
+bool TxRingThread::setupRing(int maxPacketLength)
+{
+    struct tpacket_req req;
+    struct sockaddr_ll addr;
+
+    // Frame size must be a multiple of TPACKET_ALIGNMENT; we round it up
+    // to a power of 2 so that a whole number of frames fit in a block
+    frameSize_ = TPACKET_ALIGN(kTxDataOffset + maxPacketLength);
+    uint sz = TPACKET_ALIGNMENT;
+    while (sz < frameSize_)
+        sz <<= 1;
+    frameSize_ = sz;
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = qMax(frameSize_, uint(kBlockSize));
+    req.tp_block_nr = qMax(kRingSize/req.tp_block_size, 1U);
+    req.tp_frame_size = frameSize_;
+    req.tp_frame_nr = (req.tp_block_size/frameSize_) * req.tp_block_nr;
+
+    if (setsockopt(fd_, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+        qWarning("%s: unable to setup TX_RING: %s",
+                qPrintable(device_), strerror(errno));
+        return false;
+    }
+    frameCount_ = req.tp_frame_nr;
+
+    ringSize_ = size_t(req.tp_block_size) * req.tp_block_nr;
+    ring_ = (uchar*) mmap(NULL, ringSize_, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fd_, 0);
+    if (ring_ == MAP_FAILED) {
+        qWarning("%s: unable to mmap TX_RING: %s",
+                qPrintable(device_), strerror(errno));
+        ring_ = nullptr;
+        goto _error;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = 0; // tx only
+    addr.sll_ifindex = if_nametoindex(qPrintable(device_));
+    if (!addr.sll_ifindex
+            || bind(fd_, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        qWarning("%s: unable to bind AF_PACKET socket: %s",
+                qPrintable(device_), strerror(errno));
+        goto _error;
+    }
+
+    // XXX: The packet reported with a tx timestamp refers to the ring
+    // frame, so it needs to be read before the frame is reused - we
+    // collect the timestamps on every flush, well before the ring wraps.
+    // Not fatal if we can't - the port's tx ttag capture takes over
+    // providing the T-tag tx timestamps
+    txTimestamper_.enable(fd_);
+
+    qDebug("%s: TX_RING frameSize %u frameCount %u ringSize %zu",
+            qPrintable(device_), frameSize_, frameCount_, ringSize_);
+    return true;
+
+_error:
+    teardownRing();
+    return false;
+}
+
+void TxRingThread::teardownRing()
+{
+    txTimestamper_.disable();
+
+    if (ring_) {
+        munmap(ring_, ringSize_);
+        ring_ = nullptr;
+    }
+
+    if (frameCount_) {
+        // A ring once setup can only be changed after unmapping it
+        struct tpacket_req req;
+        memset(&req, 0, sizeof(req));
+        setsockopt(fd_, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req));
+    }
+
+    ringSize_ = 0;
+    frameSize_ = 0;
+    frameCount_ = 0;
+}
+
+void TxRingThread::kick()
+{
+    int ret;
+
+    pending_ = 0;
+    if (txTimestampKick_) {
+        struct msghdr msg;
+        union {
+            char buf[TxTimestamper::kControlSize];
+            struct cmsghdr align;
+        } ctrl;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = ctrl.buf;
+        TxTimestamper::addControl(&msg);
+
+        ret = sendmsg(fd_, &msg, MSG_DONTWAIT);
+        txTimestampKick_ = false;
+        txTimestamper_.requested();
+    }
+    else
+        ret = send(fd_, NULL, 0, MSG_DONTWAIT);
+
+    if (ret < 0) {
+        if ((errno != EAGAIN) && (errno != ENOBUFS))
+            qDebug("%s: TX_RING send error: %s",
+                    qPrintable(device_), strerror(errno));
+    }
+}
+
+bool TxRingThread::waitForFrame(uint index)
+{
+    tpacket2_hdr *hdr = (tpacket2_hdr*)(ring_ + index*frameSize_);
+
+    while (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE)
+            != TP_STATUS_AVAILABLE) {
+        struct pollfd pfd;
+
+        if (stop_)
+            return false;
+
+        // Ring full - make sure the kernel is draining it and wait; a
+        // pending tx timestamp report (POLLERR) also wakes us up
+        kick();
+        pfd.fd = fd_;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        poll(&pfd, 1, 10 /* ms */);
+        if (pfd.revents & POLLERR)
+            txTimestamper_.collect();
+    }
+
+    return true;
+}
+
+#endif
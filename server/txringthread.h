@@ -0,0 +1,85 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _TX_RING_THREAD_H
+#define _TX_RING_THREAD_H
+
+#include <QtGlobal>
+
+#ifdef Q_OS_LINUX
+
+#include "pcaptxthread.h"
+#include "txtimestamper.h"
+
+/*
+ * Tx thread that uses a AF_PACKET (TPACKET_V2) mmap'd TX_RING to send
+ * packets instead of pcap_sendpacket(). Packets are copied into ring
+ * frames and the kernel is kicked to send them out once for a batch of
+ * packets (or before any inter-packet delay) instead of once per packet.
+ *
+ * If ttagRecords is given, the kernel tx timestamps of T-tag packets are
+ * added to it and their availability is tracked in ttagState (see
+ * TxTimestamper)
+ *
+ * If the ring cannot be setup, we fallback to PcapTxThread behaviour
+ */
+class TxRingThread: public PcapTxThread
+{
+public:
+    TxRingThread(const char *device, bool qdiscBypass = false,
+                 StreamTiming::RecordQueue *ttagRecords = nullptr,
+                 QAtomicInt *ttagState = nullptr);
+    virtual ~TxRingThread();
+
+protected:
+    virtual bool txBegin();
+    virtual void txEnd();
+    virtual int sendPacket(const uchar *packet, int length);
+    virtual void flushPackets();
+
+private:
+    bool openSocket();
+    bool setupRing(int maxPacketLength);
+    void teardownRing();
+    void kick();
+    bool waitForFrame(uint index);
+
+    static const uint kRingSize = 4*1024*1024;  // in bytes
+    static const uint kBlockSize = 64*1024;     // in bytes
+    static const uint kTxBatchSize = 64;        // in pkts
+    static const int kTxTimestampWaitMsec = 100;
+
+    bool qdiscBypass_;
+    int fd_{-1};
+
+    uchar *ring_{nullptr};
+    size_t ringSize_{0};
+    uint frameSize_{0};
+    uint frameCount_{0};
+
+    uint frameIndex_{0}; // next ring frame to use
+    uint pending_{0};    // frames queued but kernel not yet kicked
+
+    TxTimestamper txTimestamper_;
+    bool txTimestampKick_{false}; // request tx timestamp in next kick()
+};
+
+#endif
+
+#endif
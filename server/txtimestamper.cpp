@@ -0,0 +1,249 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "txtimestamper.h"
+
+#ifdef Q_OS_LINUX
+
+#include "../common/sign.h"
+
+#include <QThread>
+
+#include <errno.h>
+#include <string.h>
+
+#include <linux/errqueue.h>
+#include <linux/ethtool.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+TxTimestamper::TxTimestamper(StreamTiming::RecordQueue *ttagRecords,
+                             QAtomicInt *state)
+{
+    ttagRecords_ = ttagRecords;
+    state_ = state;
+}
+
+/*!
+  Returns true if software tx timestamps can be had for the packets sent
+  on the given device - i.e. the driver timestamps tx packets (as per
+  ETHTOOL_GET_TS_INFO) and the kernel supports SO_TIMESTAMPING
+*/
+bool TxTimestamper::isSupported(const char *device)
+{
+    struct ethtool_ts_info info;
+    struct ifreq ifr;
+    int flags = SOF_TIMESTAMPING_SOFTWARE;
+    bool ret = false;
+    int fd;
+
+    fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (fd < 0)
+        return false;
+
+    memset(&info, 0, sizeof(info));
+    info.cmd = ETHTOOL_GET_TS_INFO;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, device, sizeof(ifr.ifr_name) - 1);
+    ifr.ifr_data = (char*)&info;
+
+    if (ioctl(fd, SIOCETHTOOL, &ifr) < 0)
+        qDebug("%s: ETHTOOL_GET_TS_INFO failed: %s", device, strerror(errno));
+    else if (!(info.so_timestamping & SOF_TIMESTAMPING_TX_SOFTWARE))
+        qDebug("%s: driver doesn't support software tx timestamps", device);
+    else if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING,
+                &flags, sizeof(flags)) < 0)
+        qDebug("%s: SO_TIMESTAMPING not supported: %s",
+                device, strerror(errno));
+    else
+        ret = true;
+
+    close(fd);
+    return ret;
+}
+
+/*!
+  Enables reporting of software tx timestamps on the given (bound)
+  AF_PACKET socket - timestamps are still generated only for the packets
+  sent with our control message
+
+  Returns false if we have no ttag records queue, the timestamps are known
+  to be unavailable or the kernel doesn't support SO_TIMESTAMPING
+*/
+bool TxTimestamper::enable(int fd)
+{
+    int flags = SOF_TIMESTAMPING_SOFTWARE;
+
+    disable();
+    outstanding_ = 0;
+
+    if (!ttagRecords_ || (state_->loadAcquire() == kUnavailable))
+        return false;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING,
+                &flags, sizeof(flags)) < 0) {
+        qWarning("unable to set SO_TIMESTAMPING: %s - using the tx "
+                "ttag capture for tx timestamps", strerror(errno));
+        setUnavailable();
+        return false;
+    }
+
+    // Packet is reported in full; we need its Sign trailer at the end
+    packet_.resize(65536);
+    fd_ = fd;
+
+    return true;
+}
+
+void TxTimestamper::disable()
+{
+    fd_ = -1;
+}
+
+/*!
+  Stops requesting tx timestamps for good - to be called if the T-tag
+  packets are (or will be) sent some other way, e.g. pcap_sendpacket()
+
+  The port starts its tx ttag capture on seeing this (from its next
+  transmit)
+*/
+void TxTimestamper::setUnavailable()
+{
+    fd_ = -1;
+    if (state_)
+        state_->storeRelease(kUnavailable);
+}
+
+/*!
+  Appends the control message requesting a tx timestamp to the given
+  msghdr - msg_control MUST have kControlSize bytes free after
+  msg_controllen
+*/
+void TxTimestamper::addControl(struct msghdr *msg)
+{
+    struct cmsghdr *cmsg = (struct cmsghdr*)
+                            ((char*)msg->msg_control + msg->msg_controllen);
+    int flags = SOF_TIMESTAMPING_TX_SOFTWARE;
+
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SO_TIMESTAMPING;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(flags));
+    memcpy(CMSG_DATA(cmsg), &flags, sizeof(flags));
+
+    msg->msg_controllen += CMSG_SPACE(sizeof(flags));
+}
+
+/*!
+  Reads all tx timestamp reports queued on the socket's error queue and
+  records the ones for T-tag packets - doesn't wait for any
+*/
+void TxTimestamper::collect()
+{
+    union {
+        char buf[512];
+        struct cmsghdr align;
+    } ctrl;
+
+    if (fd_ < 0)
+        return;
+
+    while (1) {
+        struct msghdr msg;
+        struct iovec iov;
+        struct timespec *ts = NULL;
+        uint ttagId, guid;
+        int len;
+
+        iov.iov_base = packet_.data();
+        iov.iov_len = packet_.size();
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctrl.buf;
+        msg.msg_controllen = sizeof(ctrl.buf);
+
+        len = recvmsg(fd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+        if (len < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                qDebug("tx timestamp recvmsg error: %s", strerror(errno));
+            break;
+        }
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+                cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET
+                    && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                // ts[0] is the software timestamp
+                ts = reinterpret_cast<struct scm_timestamping*>(
+                                            CMSG_DATA(cmsg))->ts;
+            }
+        }
+
+        if (outstanding_ > 0)
+            outstanding_--;
+
+        // XXX: other packets sent with the T-tag packet in the same send
+        // call (if any) are also reported - ttag id lookup skips them
+        if (!ts || (msg.msg_flags & MSG_TRUNC)
+                || !SignProtocol::packetTtagId((const uchar*)packet_.data(),
+                                               len, &ttagId, &guid))
+            continue;
+
+        ttagRecords_->record(guid, ttagId, *ts);
+        if (!reported_) {
+            state_->testAndSetOrdered(kPending, kReporting);
+            reported_ = true;
+        }
+    }
+}
+
+/*!
+  Collects the outstanding tx timestamps, waiting upto 'msecs' for them
+  to be reported - called at the end of transmit
+*/
+void TxTimestamper::drain(int msecs)
+{
+    if (fd_ < 0)
+        return;
+
+    for (int i = 0; i < msecs && hasOutstanding(); i++) {
+        collect();
+        if (hasOutstanding())
+            QThread::msleep(1);
+    }
+
+    // No reports - likely the driver doesn't timestamp tx packets
+    if (hasOutstanding()) {
+        if (!warned_)
+            qWarning("%d tx timestamp(s) not reported - does the driver "
+                    "support software tx timestamps?", outstanding_);
+        warned_ = true;
+        outstanding_ = 0;
+
+        // If none were ever reported, none will be - stop requesting them
+        // and leave the tx timestamps to the tx ttag capture
+        if (!reported_)
+            setUnavailable();
+    }
+}
+
+#endif
@@ -0,0 +1,94 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _TX_TIMESTAMPER_H
+#define _TX_TIMESTAMPER_H
+
+#include <QtGlobal>
+
+#ifdef Q_OS_LINUX
+
+#include "streamtiming.h"
+
+#include <QAtomicInt>
+#include <QByteArray>
+
+#include <sys/socket.h>
+
+/*
+ * Collects the kernel (SO_TIMESTAMPING) tx timestamps of the T-tag packets
+ * sent on an AF_PACKET socket and adds them to the port's tx ttag records
+ * - instead of capturing our own tx packets (see PcapTxTtagStats)
+ *
+ * A software tx timestamp (taken by the driver just before handing over
+ * the packet to the NIC) is requested only for T-tag packets, by adding
+ * a SO_TIMESTAMPING control message to the send call of the packet (see
+ * addControl()). The kernel reports the timestamp on the socket's error
+ * queue along with the packet itself, from which we get the ttag id and
+ * guid - so reports for any other packets are ignored
+ *
+ * The timestamps are read asynchronously (see collect()) and are on the
+ * same clock (CLOCK_REALTIME) as the rx timestamps of the ttag packets
+ *
+ * Whether the timestamps can be had is tracked in a State shared with the
+ * port - the port runs its tx ttag capture only once they turn out to be
+ * unavailable (the socket can't be set up or the driver doesn't report
+ * them), and we stop requesting them from then on - so the two never
+ * record the same packets
+ */
+class TxTimestamper
+{
+public:
+    enum State {
+        kPending,       // requested but none reported yet
+        kReporting,     // being reported
+        kUnavailable    // can't be had; not requested any more
+    };
+
+    TxTimestamper(StreamTiming::RecordQueue *ttagRecords, QAtomicInt *state);
+
+    static bool isSupported(const char *device);
+
+    bool enable(int fd);
+    void disable();
+    void setUnavailable();
+    bool isEnabled() const { return fd_ >= 0; }
+
+    // Space needed for the control message in a msghdr's msg_control
+    static const int kControlSize = CMSG_SPACE(sizeof(int));
+    static void addControl(struct msghdr *msg);
+
+    void requested() { outstanding_++; }
+    bool hasOutstanding() const { return outstanding_ > 0; }
+    void collect();
+    void drain(int msecs);
+
+private:
+    StreamTiming::RecordQueue *ttagRecords_;
+    QAtomicInt *state_;
+    int fd_{-1};
+    int outstanding_{0}; // timestamps requested but not yet reported
+    bool warned_{false};
+    bool reported_{false}; // state_ set to kReporting
+    QByteArray packet_;  // for the packet reported with the timestamp
+};
+
+#endif
+
+#endif
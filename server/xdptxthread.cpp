@@ -0,0 +1,424 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "xdptxthread.h"
+
+#if defined(Q_OS_LINUX) && defined(HAVE_AF_XDP)
+
+#include <errno.h>
+#include <net/if.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+XdpTxThread::XdpTxThread(const char *device, int queueId)
+    : PcapTxThread(device)
+{
+    queueId_ = queueId;
+    memset(&tx_, 0, sizeof(tx_));
+    memset(&comp_, 0, sizeof(comp_));
+}
+
+XdpTxThread::~XdpTxThread()
+{
+    teardown();
+}
+
+bool XdpTxThread::txBegin()
+{
+    // (Re)load the UMEM only if the packet list has changed since
+    if (!umem_ || (umemVersion_ != packetListVersion())) {
+        teardown();
+        if (!setup()) {
+            teardown();
+            qWarning("%s: AF_XDP unavailable, falling back to "
+                    "pcap_sendpacket", qPrintable(device_));
+            return PcapTxThread::txBegin();
+        }
+    }
+
+    pending_ = 0;
+    return true;
+}
+
+void XdpTxThread::txEnd()
+{
+    if (!umem_) {
+        PcapTxThread::txEnd();
+        return;
+    }
+
+    // Wait (bounded) for the kernel to finish sending all posted descs
+    // so that the tx duration reflects reality and the UMEM is idle
+    for (int i = 0; outstanding_ && (i < 100); i++) {
+        kick();
+        reclaim();
+        if (outstanding_)
+            QThread::msleep(10);
+    }
+    if (outstanding_)
+        qWarning("%s: %u AF_XDP descs not completed", qPrintable(device_),
+                outstanding_);
+}
+
+int XdpTxThread::sendPacket(const uchar *packet, int length)
+{
+    if (!umem_)
+        return PcapTxThread::sendPacket(packet, length);
+
+    quint32 index = frameIndex();
+    uchar *frame = umem_ + quint64(index)*frameSize_;
+
+    // XXX: T-Tag and Tx Timestamp stamping modify the packet list packet
+    // but not our UMEM copy - so sync the Sign trailer bytes that may be
+    // stamped (and revert them subsequently)
+    int trailer = qMin(length, 14);
+    if (memcmp(frame + length - trailer, packet + length - trailer,
+               trailer)) {
+        if (!waitForFrameIdle(index))
+            return -1;
+        memcpy(frame + length - trailer, packet + length - trailer,
+               trailer);
+    }
+
+    if (!waitForTxSlot())
+        return -1;
+
+    struct xdp_desc *desc = static_cast<struct xdp_desc*>(tx_.descs)
+                                + (tx_.cached & tx_.mask);
+    desc->addr = quint64(index)*frameSize_;
+    desc->len = length;
+    desc->options = 0;
+    tx_.cached++;
+
+    inflight_[index]++;
+    outstanding_++;
+
+    if (++pending_ >= kTxBatchSize)
+        flushPackets();
+
+    return 0;
+}
+
+void XdpTxThread::flushPackets()
+{
+    if (!pending_)
+        return;
+
+    __atomic_store_n(tx_.producer, tx_.cached, __ATOMIC_RELEASE);
+    pending_ = 0;
+    kick();
+    reclaim();
+}
+
+bool XdpTxThread::setup()
+{
+    struct xdp_umem_reg umemReg;
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp addr;
+    socklen_t optlen;
+    quint32 txRingSize = kTxRingSize;
+    quint32 fillRingSize = kFillRingSize;
+    quint32 compRingSize = kTxRingSize;
+    quint32 frames = frameCount();
+    long pageSize = sysconf(_SC_PAGESIZE);
+
+    // XXX: in aligned chunk mode, chunk (frame) size must be a power of 2
+    // between 2K and the page size
+    frameSize_ = maxPacketLength() <= 2048 ? 2048 : pageSize;
+    if (maxPacketLength() > int(frameSize_)) {
+        qWarning("%s: max packet length %d too large for AF_XDP",
+                qPrintable(device_), maxPacketLength());
+        return false;
+    }
+
+    foreach (PacketSequence *seq, packetSequenceList()) {
+        if (seq->generator_) {
+            qWarning("%s: generated packets not supported with AF_XDP",
+                    qPrintable(device_));
+            return false;
+        }
+    }
+    if (!frames)
+        return false;
+
+    umemSize_ = quint64(frames)*frameSize_;
+    if (umemSize_ > kMaxUmemSize) {
+        qWarning("%s: packet list too large (%zu bytes) for AF_XDP UMEM",
+                qPrintable(device_), umemSize_);
+        umemSize_ = 0;
+        return false;
+    }
+    umemSize_ = (umemSize_ + pageSize - 1) & ~(pageSize - 1);
+
+    umem_ = (uchar*) mmap(NULL, umemSize_, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (umem_ == MAP_FAILED) {
+        qWarning("%s: unable to alloc AF_XDP UMEM: %s",
+                qPrintable(device_), strerror(errno));
+        umem_ = nullptr;
+        umemSize_ = 0;
+        return false;
+    }
+
+    // Copy the packet list into the UMEM - UMEM frame index is the frame
+    // number of the packet list frame, so that packets that are refs to a
+    // frame use the same UMEM frame and sendPacket() needs no lookup
+    foreach (PacketSequence *seq, packetSequenceList()) {
+        for (PacketSequence::PacketHeader *hdr = seq->first();
+                hdr < seq->end(); hdr = PacketSequence::next(hdr)) {
+            if (PacketSequence::isFrameRef(hdr))
+                continue;
+            Q_ASSERT(hdr->frame < frames);
+            memcpy(umem_ + quint64(hdr->frame)*frameSize_,
+                   PacketSequence::frameData(hdr), hdr->len);
+        }
+    }
+    inflight_.fill(0, frames);
+    outstanding_ = 0;
+
+    fd_ = socket(AF_XDP, SOCK_RAW, 0);
+    if (fd_ < 0) {
+        qWarning("%s: unable to open AF_XDP socket: %s",
+                qPrintable(device_), strerror(errno));
+        return false;
+    }
+
+    memset(&umemReg, 0, sizeof(umemReg));
+    umemReg.addr = (quint64) umem_;
+    umemReg.len = umemSize_;
+    umemReg.chunk_size = frameSize_;
+    umemReg.headroom = 0;
+    if (setsockopt(fd_, SOL_XDP, XDP_UMEM_REG,
+                &umemReg, sizeof(umemReg)) < 0) {
+        qWarning("%s: unable to register AF_XDP UMEM (%zu bytes): %s",
+                qPrintable(device_), umemSize_, strerror(errno));
+        return false;
+    }
+
+    // XXX: A fill ring is mandatory even though we don't receive
+    if ((setsockopt(fd_, SOL_XDP, XDP_UMEM_FILL_RING,
+                    &fillRingSize, sizeof(fillRingSize)) < 0)
+            || (setsockopt(fd_, SOL_XDP, XDP_UMEM_COMPLETION_RING,
+                    &compRingSize, sizeof(compRingSize)) < 0)
+            || (setsockopt(fd_, SOL_XDP, XDP_TX_RING,
+                    &txRingSize, sizeof(txRingSize)) < 0)) {
+        qWarning("%s: unable to setup AF_XDP rings: %s",
+                qPrintable(device_), strerror(errno));
+        return false;
+    }
+
+    optlen = sizeof(off);
+    if ((getsockopt(fd_, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0)
+            || (optlen != sizeof(off))) {
+        qWarning("%s: unable to get AF_XDP ring offsets", qPrintable(device_));
+        return false;
+    }
+
+    if (!mapRing(&tx_, off.tx, txRingSize, sizeof(struct xdp_desc),
+                XDP_PGOFF_TX_RING)
+            || !mapRing(&comp_, off.cr, compRingSize, sizeof(quint64),
+                XDP_UMEM_PGOFF_COMPLETION_RING))
+        return false;
+    tx_.cached = *tx_.producer;
+    comp_.cached = *comp_.consumer;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sxdp_family = AF_XDP;
+    addr.sxdp_ifindex = if_nametoindex(qPrintable(device_));
+    addr.sxdp_queue_id = queueId_;
+    if (!addr.sxdp_ifindex) {
+        qWarning("%s: unable to get ifindex", qPrintable(device_));
+        return false;
+    }
+
+    // Prefer zero-copy, fallback to copy mode if driver doesn't support it
+    // and finally to no need-wakeup support for older kernels
+    {
+        const quint16 bindFlags[] = {
+            XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP,
+            XDP_COPY | XDP_USE_NEED_WAKEUP,
+            XDP_COPY,
+        };
+        uint i;
+
+        for (i = 0; i < sizeof(bindFlags)/sizeof(bindFlags[0]); i++) {
+            addr.sxdp_flags = bindFlags[i];
+            if (bind(fd_, (struct sockaddr*)&addr, sizeof(addr)) == 0)
+                break;
+        }
+        if (i == sizeof(bindFlags)/sizeof(bindFlags[0])) {
+            qWarning("%s: unable to bind AF_XDP socket to queue %d: %s",
+                    qPrintable(device_), queueId_, strerror(errno));
+            return false;
+        }
+    }
+    needWakeup_ = addr.sxdp_flags & XDP_USE_NEED_WAKEUP;
+
+    umemVersion_ = packetListVersion();
+    qDebug("%s: AF_XDP %s mode, queue %d, %u frames x %u bytes",
+            qPrintable(device_),
+            addr.sxdp_flags & XDP_ZEROCOPY ? "zero-copy" : "copy",
+            queueId_, frames, frameSize_);
+    return true;
+}
+
+void XdpTxThread::teardown()
+{
+    unmapRing(&tx_);
+    unmapRing(&comp_);
+
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+
+    // UMEM can be freed only after the socket is closed
+    if (umem_) {
+        munmap(umem_, umemSize_);
+        umem_ = nullptr;
+    }
+    umemSize_ = 0;
+    umemVersion_ = 0;
+    inflight_.clear();
+    outstanding_ = 0;
+    pending_ = 0;
+    needWakeup_ = false;
+}
+
+bool XdpTxThread::mapRing(Ring *ring, const struct xdp_ring_offset &offsets,
+        quint32 size, size_t descSize, quint64 pgoff)
+{
+    ring->mapLen = offsets.desc + size*descSize;
+    ring->map = mmap(NULL, ring->mapLen, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd_, pgoff);
+    if (ring->map == MAP_FAILED) {
+        qWarning("%s: unable to mmap AF_XDP ring: %s",
+                qPrintable(device_), strerror(errno));
+        ring->map = nullptr;
+        return false;
+    }
+
+    uchar *base = static_cast<uchar*>(ring->map);
+    ring->producer = (quint32*)(base + offsets.producer);
+    ring->consumer = (quint32*)(base + offsets.consumer);
+    ring->flags = (quint32*)(base + offsets.flags);
+    ring->descs = base + offsets.desc;
+    ring->size = size;
+    ring->mask = size - 1;
+
+    return true;
+}
+
+void XdpTxThread::unmapRing(Ring *ring)
+{
+    if (ring->map)
+        munmap(ring->map, ring->mapLen);
+    memset(ring, 0, sizeof(*ring));
+}
+
+void XdpTxThread::kick()
+{
+    if (needWakeup_
+            && !(__atomic_load_n(tx_.flags, __ATOMIC_ACQUIRE)
+                    & XDP_RING_NEED_WAKEUP))
+        return;
+
+    if (sendto(fd_, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0) {
+        if ((errno != EAGAIN) && (errno != ENOBUFS) && (errno != EBUSY))
+            qDebug("%s: AF_XDP kick error: %s",
+                    qPrintable(device_), strerror(errno));
+    }
+}
+
+/*!
+  Reclaim UMEM frames of descs that the kernel has finished sending
+*/
+void XdpTxThread::reclaim()
+{
+    quint32 prod = __atomic_load_n(comp_.producer, __ATOMIC_ACQUIRE);
+
+    if (prod == comp_.cached)
+        return;
+
+    quint64 *addrs = static_cast<quint64*>(comp_.descs);
+    while (comp_.cached != prod) {
+        quint32 index = addrs[comp_.cached & comp_.mask]/frameSize_;
+        Q_ASSERT(inflight_[index] > 0);
+        inflight_[index]--;
+        outstanding_--;
+        comp_.cached++;
+    }
+
+    __atomic_store_n(comp_.consumer, comp_.cached, __ATOMIC_RELEASE);
+}
+
+bool XdpTxThread::waitForTxSlot()
+{
+    // XXX: We ensure the completion ring never overflows by limiting
+    // outstanding descs to the ring size (tx and completion ring sizes
+    // are same)
+    while (outstanding_ >= tx_.size) {
+        struct pollfd pfd;
+
+        if (stop_)
+            return false;
+
+        if (pending_) {
+            __atomic_store_n(tx_.producer, tx_.cached, __ATOMIC_RELEASE);
+            pending_ = 0;
+        }
+        kick();
+        reclaim();
+        if (outstanding_ < tx_.size)
+            break;
+
+        pfd.fd = fd_;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        poll(&pfd, 1, 1 /* ms */);
+        reclaim();
+    }
+
+    return true;
+}
+
+bool XdpTxThread::waitForFrameIdle(quint32 index)
+{
+    flushPackets();
+    while (inflight_[index]) {
+        if (stop_)
+            return false;
+        kick();
+        reclaim();
+    }
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,105 @@
+/*
+Copyright (C) 2024 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _XDP_TX_THREAD_H
+#define _XDP_TX_THREAD_H
+
+#include <QtGlobal>
+
+#if defined(Q_OS_LINUX) && defined(HAVE_AF_XDP)
+
+#include "pcaptxthread.h"
+
+#include <QVector>
+
+#include <linux/if_xdp.h>
+
+/*
+ * Tx thread that uses an AF_XDP socket to send packets
+ *
+ * All unique frames of the packet list are copied into the XDP UMEM once (at
+ * the start of the first transmit after the packet list is rebuilt) - each
+ * transmit loop thereafter only posts descriptors to the TX ring, without
+ * any per packet copies. Zero-copy mode is used if the driver supports it,
+ * otherwise we use copy (generic/SKB) mode.
+ *
+ * If the socket or UMEM cannot be setup, we fallback to PcapTxThread
+ * behaviour
+ */
+class XdpTxThread: public PcapTxThread
+{
+public:
+    XdpTxThread(const char *device, int queueId = 0);
+    virtual ~XdpTxThread();
+
+protected:
+    virtual bool txBegin();
+    virtual void txEnd();
+    virtual int sendPacket(const uchar *packet, int length);
+    virtual void flushPackets();
+
+private:
+    struct Ring
+    {
+        quint32 *producer;
+        quint32 *consumer;
+        quint32 *flags;
+        void *descs;
+        quint32 mask;
+        quint32 size;
+        quint32 cached; // local producer (tx) or consumer (completion)
+        void *map;
+        size_t mapLen;
+    };
+
+    bool setup();
+    void teardown();
+    bool mapRing(Ring *ring, const struct xdp_ring_offset &offsets,
+            quint32 size, size_t descSize, quint64 pgoff);
+    void unmapRing(Ring *ring);
+    void kick();
+    void reclaim();
+    bool waitForTxSlot();
+    bool waitForFrameIdle(quint32 index);
+
+    static const quint32 kTxRingSize = 2048;         // in descs
+    static const quint32 kFillRingSize = 64;         // in descs (unused)
+    static const quint32 kTxBatchSize = 64;          // in pkts
+    static const quint64 kMaxUmemSize = 256*1024*1024; // in bytes
+
+    int queueId_;
+    int fd_{-1};
+    bool needWakeup_{false};
+
+    uchar *umem_{nullptr};
+    size_t umemSize_{0};
+    quint32 frameSize_{0};
+    quint32 umemVersion_{0}; // packetListVersion() loaded in UMEM
+
+    Ring tx_;
+    Ring comp_;
+
+    QVector<quint32> inflight_; // per frame count of descs with kernel
+    quint32 outstanding_{0};    // total descs with kernel
+    quint32 pending_{0};        // descs not yet published to kernel
+};
+
+#endif
+
+#endif
@@ -1,14 +1,33 @@
 
+#include "checksum.h"
+#include "counterrng.h"
+#include "eth2.pb.h"
+#include "frametemplate.h"
+#include "histogram.h"
+#include "ip4.pb.h"
+#include "mac.pb.h"
 #include "ostprotolib.h"
+#include "parallelframebuilder.h"
+#include "payload.pb.h"
 #include "pcapfileformat.h"
 #include "protocol.pb.h"
 #include "protocolmanager.h"
 #include "settings.h"
+#include "streambase.h"
+#include "streamfileformat.h"
+#include "udp.pb.h"
+#include "../server/packetgaps.h"
+#include "../server/pcaptxthread.h"
+#include "../server/statstuple.h"
 
 #include <QCoreApplication>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QSettings>
 #include <QString>
+#include <QVector>
+
+#include <algorithm>
 
 extern ProtocolManager *OstProtocolManager;
 
@@ -46,6 +65,10 @@ int usage(int /*argc*/, char* argv[])
     printf("%s <command>\n", argv[0]);
     printf("command -\n");
     printf("  importpcap\n");
+    printf("  cksumbench\n");
+    printf("  framebuild [streamfile]\n");
+    printf("  histbench\n");
+    printf("  ratebench [high|medium|low]\n");
 
     return 255;
 }
@@ -79,6 +102,463 @@ int testImportPcap(int argc, char* argv[])
     return 0;
 }
 
+/*
+ * The checksum loop used by AbstractProtocol::protocolFrameCksum() before
+ * checksumOnesSum() - kept here as the benchmark baseline
+ */
+static quint16 legacyOnesSum(const uchar *buf, uint len)
+{
+    const quint16 *ip = (const quint16*) buf;
+    quint32 sum = 0;
+
+    while(len > 1)
+    {
+        sum += *ip;
+        if(sum & 0x80000000)
+            sum = (sum & 0xFFFF) + (sum >> 16);
+        ip++;
+        len -= 2;
+    }
+
+    if (len)
+        sum += (unsigned short) *(const unsigned char *)ip;
+
+    while(sum>>16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return sum;
+}
+
+int testChecksumBench(int /*argc*/, char* /*argv*/[])
+{
+    static const int kSizes[] = { 64, 128, 512, 1500, 4096, 9000 };
+    static const int kBytesPerSize = 256*1024*1024;
+    QByteArray buf(9000 + 1, 0);
+    volatile quint16 sink = 0;
+    int exitCode = 0;
+
+    for (int i = 0; i < buf.size(); i++)
+        buf[i] = char(qrand());
+
+    printf("checksum kernel: %s\n", checksumKernelName());
+    printf("%8s %14s %14s %8s\n", "size", "legacy ns/op", "kernel ns/op",
+            "speedup");
+
+    for (uint i = 0; i < sizeof(kSizes)/sizeof(kSizes[0]); i++) {
+        // +1 to use an odd (unaligned) start address too
+        for (int j = 0; j < 2; j++) {
+            const uchar *p = (const uchar*) buf.constData() + j;
+            int size = kSizes[i] - j;
+            int loops = kBytesPerSize/size;
+            QElapsedTimer timer;
+            qint64 legacyNsec, kernelNsec;
+
+            if (legacyOnesSum(p, size) != checksumOnesSum(p, size)) {
+                printf("%8d: MISMATCH %04x != %04x\n", size,
+                        legacyOnesSum(p, size), checksumOnesSum(p, size));
+                exitCode = 1;
+                continue;
+            }
+
+            timer.start();
+            for (int k = 0; k < loops; k++)
+                sink = sink + legacyOnesSum(p, size);
+            legacyNsec = timer.nsecsElapsed();
+
+            timer.restart();
+            for (int k = 0; k < loops; k++)
+                sink = sink + checksumOnesSum(p, size);
+            kernelNsec = timer.nsecsElapsed();
+
+            printf("%8d %14.1f %14.1f %7.1fx\n", size,
+                    double(legacyNsec)/loops, double(kernelNsec)/loops,
+                    double(legacyNsec)/qMax(kernelNsec, qint64(1)));
+        }
+    }
+
+    return exitCode;
+}
+
+/*
+ * Sample streams for testFrameBuild() - one per frame length mode, as the
+ * frame builder sizes its slots and splits its work by length mode
+ */
+static void sampleStreams(OstProto::StreamConfigList &streams)
+{
+    static const OstProto::StreamCore::FrameLengthMode kLenModes[] = {
+        OstProto::StreamCore::e_fl_fixed,
+        OstProto::StreamCore::e_fl_inc,
+        OstProto::StreamCore::e_fl_random,
+        OstProto::StreamCore::e_fl_imix,
+    };
+
+    for (uint i = 0; i < sizeof(kLenModes)/sizeof(kLenModes[0]); i++) {
+        OstProto::Stream *stream = streams.add_stream();
+        OstProto::Protocol *proto;
+
+        stream->mutable_stream_id()->set_id(i);
+        stream->mutable_core()->set_is_enabled(true);
+        stream->mutable_core()->set_len_mode(kLenModes[i]);
+        stream->mutable_core()->set_frame_len(256);
+
+        proto = stream->add_protocol();
+        proto->mutable_protocol_id()->set_id(
+                OstProto::Protocol::kMacFieldNumber);
+        OstProto::Mac *mac = proto->MutableExtension(OstProto::mac);
+        mac->set_dst_mac(0x000102030405ULL);
+        mac->set_dst_mac_mode(OstProto::Mac::e_mm_inc);
+        mac->set_dst_mac_count(50);
+        mac->set_src_mac(0x00aabbccddeeULL);
+        mac->set_src_mac_mode(OstProto::Mac::e_mm_fixed);
+
+        proto = stream->add_protocol();
+        proto->mutable_protocol_id()->set_id(
+                OstProto::Protocol::kEth2FieldNumber);
+
+        proto = stream->add_protocol();
+        proto->mutable_protocol_id()->set_id(
+                OstProto::Protocol::kIp4FieldNumber);
+        OstProto::Ip4 *ip4 = proto->MutableExtension(OstProto::ip4);
+        ip4->set_src_ip(0x0a000001);
+        ip4->set_src_ip_mode(OstProto::Ip4::e_im_inc_host);
+        ip4->set_src_ip_count(1000);
+        ip4->set_dst_ip(0x0b000001);
+        ip4->set_dst_ip_mode(OstProto::Ip4::e_im_random_host);
+        ip4->set_dst_ip_mask(0xFFFF0000);
+        ip4->set_dst_ip_count(5000);
+
+        proto = stream->add_protocol();
+        proto->mutable_protocol_id()->set_id(
+                OstProto::Protocol::kUdpFieldNumber);
+
+        proto = stream->add_protocol();
+        proto->mutable_protocol_id()->set_id(
+                OstProto::Protocol::kPayloadFieldNumber);
+        proto->MutableExtension(OstProto::payload)->set_pattern_mode(
+                OstProto::Payload::e_dp_random);
+    }
+}
+
+/*
+ * Builds the frames of the sample streams (or those in the given stream
+ * file) serially and using the parallel frame builder and checks that
+ * both are byte for byte the same
+ */
+int testFrameBuild(int argc, char* argv[])
+{
+    static const int kFrameCount = 10000;
+    static const int kThreads[] = { 1, 3, 0 }; // 0 => one per CPU core
+    OstProto::StreamConfigList streams;
+    QList<StreamBase*> streamList;
+    QList<FrameTemplate*> templates;
+    QList<QByteArray> frames;
+    uchar buf[16384];
+    QElapsedTimer timer;
+    qint64 serialNsec;
+    int exitCode = 0;
+
+    if (argc > 3)
+    {
+        printf("usage:\n");
+        printf("%s framebuild [streamfile]\n", argv[0]);
+        return 255;
+    }
+
+    if (argc == 3)
+    {
+        QString inFile(argv[2]);
+        QString error;
+        StreamFileFormat *fileFormat;
+
+        fileFormat = StreamFileFormat::fileFormatFromFile(inFile);
+        if (!fileFormat || !fileFormat->open(inFile, streams, error))
+        {
+            printf("%s: unable to open - %s\n",
+                    qPrintable(inFile), qPrintable(error));
+            return 1;
+        }
+    }
+    else
+        sampleStreams(streams);
+
+    for (int i = 0; i < streams.stream_size(); i++) {
+        StreamBase *stream = new StreamBase();
+
+        stream->protoDataCopyFrom(streams.stream(i));
+        streamList.append(stream);
+        templates.append(new FrameTemplate(stream));
+    }
+
+    // Serial build - same as what the packet list build did earlier i.e.
+    // without frame templates
+    timer.start();
+    foreach (const StreamBase *stream, streamList) {
+        for (int j = 0; j < kFrameCount; j++) {
+            int len = stream->frameValue(buf, sizeof(buf), j);
+            frames.append(QByteArray((const char*) buf, len));
+        }
+    }
+    serialNsec = timer.nsecsElapsed();
+    printf("%d streams x %d frames\n", templates.size(), kFrameCount);
+    printf("%8s %12s %10s\n", "threads", "msec", "result");
+    printf("%8s %12.1f\n", "serial", serialNsec/1e6);
+
+    for (uint i = 0; i < sizeof(kThreads)/sizeof(kThreads[0]); i++) {
+        ParallelFrameBuilder builder(sizeof(buf), kThreads[i]);
+        int mismatches = 0;
+        int k = 0;
+
+        timer.restart();
+        foreach (const FrameTemplate *frameTemplate, templates)
+            builder.addFrames(frameTemplate, kFrameCount);
+        for (int j = 0; j < frames.size(); j++) {
+            const uchar *frame;
+            int len = builder.nextFrame(&frame);
+
+            if ((len != frames.at(j).size())
+                    || memcmp(frame, frames.at(j).constData(), len)) {
+                if (!mismatches)
+                    k = j;
+                mismatches++;
+            }
+        }
+        printf("%8d %12.1f %10s\n", kThreads[i], timer.nsecsElapsed()/1e6,
+                mismatches ? "MISMATCH" : "ok");
+        if (mismatches) {
+            printf("  %d mismatches - first at stream %d frame %d\n",
+                    mismatches, k/kFrameCount, k%kFrameCount);
+            exitCode = 1;
+        }
+    }
+
+    qDeleteAll(templates);
+    qDeleteAll(streamList);
+    return exitCode;
+}
+
+/*
+ * Measures the cost of adding a value to a (latency) histogram and checks
+ * the histogram percentiles against the exact ones and that merging
+ * histograms is the same as adding all values to one
+ */
+int testHistogramBench(int /*argc*/, char* /*argv*/[])
+{
+    static const int kValueCount = 1 << 20;
+    static const int kLoops = 64;
+    static const double kPercents[] = { 50, 90, 99, 99.9 };
+    const int percentCount = sizeof(kPercents)/sizeof(kPercents[0]);
+    CounterRng rng(0x1a7e5c);
+    QVector<quint64> values(kValueCount);
+    Histogram *histogram = new Histogram;
+    Histogram *half1 = new Histogram;
+    Histogram *half2 = new Histogram;
+    quint64 percentileValues[percentCount];
+    QElapsedTimer timer;
+    qint64 nsec;
+    int exitCode = 0;
+
+    // Values spread over all magnitudes from nanosecs to secs
+    for (int i = 0; i < kValueCount; i++) {
+        quint64 r = rng.value(i);
+        values[i] = (r >> 32) & ((Q_UINT64_C(1) << (8 + r % 24)) - 1);
+    }
+
+    timer.start();
+    for (int j = 0; j < kLoops; j++) {
+        histogram->clear();
+        for (int i = 0; i < kValueCount; i++)
+            histogram->add(values.at(i));
+    }
+    nsec = timer.nsecsElapsed();
+    printf("histogram add: %.2f ns/value (%d buckets, %d bytes)\n",
+            double(nsec)/(double(kLoops)*kValueCount),
+            Histogram::kBucketCount, int(sizeof(Histogram)));
+
+    // Percentiles MUST be within a bucket's relative error (1/64)
+    histogram->percentiles(kPercents, percentileValues, percentCount);
+    std::sort(values.begin(), values.end());
+    for (int i = 0; i < percentCount; i++) {
+        quint64 exact = values.at(
+                int(kPercents[i]*kValueCount/100 + 0.5) - 1);
+        double error = (double(percentileValues[i]) - double(exact))
+                            / qMax(double(exact), 1.0);
+        bool ok = (error >= 0) && (error <= 1.0/64);
+
+        printf("p%-5g %12llu exact %12llu error %6.3f%% %s\n",
+                kPercents[i], percentileValues[i], exact, error*100,
+                ok ? "ok" : "MISMATCH");
+        if (!ok)
+            exitCode = 1;
+    }
+    if ((histogram->min() != values.first())
+            || (histogram->max() != values.last())) {
+        printf("min/max MISMATCH\n");
+        exitCode = 1;
+    }
+
+    // Merged histogram MUST be the same as the one with all values
+    for (int i = 0; i < kValueCount; i++)
+        (i & 1 ? half1 : half2)->add(values.at(i));
+    half1->merge(*half2);
+    for (int i = 0; i < Histogram::kBucketCount; i++) {
+        if (half1->bucketCount(i) != histogram->bucketCount(i)) {
+            printf("merge MISMATCH at bucket %d\n", i);
+            exitCode = 1;
+            break;
+        }
+    }
+    if ((half1->count() != histogram->count())
+            || (half1->min() != histogram->min())
+            || (half1->max() != histogram->max())) {
+        printf("merge MISMATCH of count/min/max\n");
+        exitCode = 1;
+    }
+
+    delete half2;
+    delete half1;
+    delete histogram;
+    return exitCode;
+}
+
+/*
+ * Tx thread that doesn't send packets - it only notes when each packet
+ * would have been sent, for the rate benchmark
+ */
+class NullTxThread: public PcapTxThread
+{
+public:
+    NullTxThread(int packets) : PcapTxThread("null"), packets_(packets) {}
+
+    const QVector<qint64>& sendTimes() const { return sendTimes_; }
+
+protected:
+    virtual bool txBegin() {
+        // Preallocate, so that the appends don't add to the jitter
+        sendTimes_.clear();
+        sendTimes_.reserve(packets_);
+        timer_.start();
+        return true;
+    }
+    virtual int sendPacket(const uchar* /*packet*/, int /*length*/) {
+        sendTimes_.append(timer_.nsecsElapsed());
+        return 0;
+    }
+
+private:
+    int packets_;
+    QElapsedTimer timer_;
+    QVector<qint64> sendTimes_;
+};
+
+/*
+ * Transmits a packets/sec stream - with its packet list built the same way
+ * as the port does - on a NullTxThread for a range of (fractional) rates
+ * and reports the achieved rate and its error vs the requested one along
+ * with the jitter (deviation of the inter-packet gaps from the requested
+ * gap). The achieved rate MUST be within 1% of the requested rate
+ *
+ * Rate accuracy (pacer) is High by default; "medium" or "low" may be
+ * given instead
+ */
+int testRateBench(int argc, char* argv[])
+{
+    static const double kRates[] = {
+        100.5, 1234.567, 10000, 33333.3, 99999.9, 333333.3, 1000000
+    };
+    // Min packet set size of Linux/BSD ports for a stream with fixed
+    // frame content
+    static const ulong kSetSize = 16;
+    static const double kDuration = 0.2; // secs per rate
+    static const double kMaxError = 1e-2;
+    AbstractPort::Accuracy accuracy = AbstractPort::kHighAccuracy;
+    uchar frame[64];
+    StatsTuple stats;
+    int exitCode = 0;
+
+#ifdef Q_OS_WIN32
+    // XXX: the Win32 tx loop uses pcap_sendqueue_transmit() bypassing
+    // sendPacket() for such packet lists
+    printf("ratebench not supported on Windows\n");
+    return 0;
+#endif
+
+    if (argc > 2) {
+        if (strcmp(argv[2], "medium") == 0)
+            accuracy = AbstractPort::kMediumAccuracy;
+        else if (strcmp(argv[2], "low") == 0)
+            accuracy = AbstractPort::kLowAccuracy;
+        else if (strcmp(argv[2], "high") != 0) {
+            printf("usage:\n");
+            printf("%s ratebench [high|medium|low]\n", argv[0]);
+            return 255;
+        }
+    }
+
+    memset(frame, 0, sizeof(frame));
+    memset(&stats, 0, sizeof(stats));
+
+    printf("%14s %14s %9s %14s %14s %8s\n", "requested pps",
+            "achieved pps", "error", "jitter avg ns", "jitter max ns",
+            "result");
+
+    for (uint i = 0; i < sizeof(kRates)/sizeof(kRates[0]); i++) {
+        double ipg = 1e9/kRates[i];
+        PacketGaps gaps(ipg, kSetSize);
+        ulong n = qMax(ulong(kRates[i]*kDuration/kSetSize), 2UL);
+        NullTxThread txThread(int(n*kSetSize));
+        quint64 nsec = 0;
+
+        txThread.setStats(&stats);
+        if (!txThread.setRateAccuracy(accuracy)) {
+            printf("rate accuracy not supported\n");
+            return 1;
+        }
+
+        // Set is repeated 'n' times with the short gap after each - see
+        // AbstractPort::updatePacketListSequential()
+        txThread.clearPacketList();
+        txThread.loopNextPacketSet(kSetSize, n, 0, gaps.shortGap());
+        for (ulong j = 0; j < kSetSize; j++) {
+            txThread.appendToPacketList(nsec/1000000000ULL,
+                                        nsec % 1000000000ULL,
+                                        frame, sizeof(frame));
+            nsec += gaps.at(j);
+        }
+        txThread.setPacketListLoopMode(false, 0, 0);
+
+        txThread.start();
+        txThread.wait();
+
+        const QVector<qint64> &times = txThread.sendTimes();
+        if (times.size() != int(n*kSetSize)) {
+            printf("%14.1f sent %d of %lu packets MISMATCH\n",
+                    kRates[i], times.size(), n*kSetSize);
+            exitCode = 1;
+            continue;
+        }
+
+        double achievedPps = double(times.size() - 1)*1e9
+                                / double(times.last() - times.first());
+        double error = (achievedPps - kRates[i])/kRates[i];
+        double jitterSum = 0, jitterMax = 0;
+        for (int j = 1; j < times.size(); j++) {
+            double jitter = qAbs(double(times.at(j) - times.at(j-1)) - ipg);
+            jitterSum += jitter;
+            jitterMax = qMax(jitterMax, jitter);
+        }
+        bool ok = qAbs(error) <= kMaxError;
+
+        printf("%14.1f %14.1f %8.3f%% %14.0f %14.0f %8s\n",
+                kRates[i], achievedPps, error*100,
+                jitterSum/(times.size() - 1), jitterMax,
+                ok ? "ok" : "MISMATCH");
+        if (!ok)
+            exitCode = 1;
+    }
+
+    return exitCode;
+}
+
 int main(int argc, char* argv[])
 {
     QCoreApplication app(argc, argv);
@@ -121,6 +601,14 @@ int main(int argc, char* argv[])
         exitCode = usage(argc, argv);
     else if (strcmp(argv[1],"importpcap") == 0)
         exitCode = testImportPcap(argc, argv);
+    else if (strcmp(argv[1],"cksumbench") == 0)
+        exitCode = testChecksumBench(argc, argv);
+    else if (strcmp(argv[1],"framebuild") == 0)
+        exitCode = testFrameBuild(argc, argv);
+    else if (strcmp(argv[1],"histbench") == 0)
+        exitCode = testHistogramBench(argc, argv);
+    else if (strcmp(argv[1],"ratebench") == 0)
+        exitCode = testRateBench(argc, argv);
     else
         exitCode = usage(argc, argv);
 
@@ -1,5 +1,5 @@
 TEMPLATE = app
-CONFIG += qt console
+CONFIG += qt console c++11
 QT += xml network script
 INCLUDEPATH += "../rpc/" "../common/" "../client"
 
@@ -27,6 +27,13 @@ LIBS += -L"../extra/qhexedit2/$(OBJECTS_DIR)/" -lqhexedit2
 HEADERS += 
 SOURCES += main.cpp
 
+# Drone tx thread and packet list - for ratebench
+SOURCES += \
+    ../server/framegenerator.cpp \
+    ../server/packetlist.cpp \
+    ../server/packetlistarena.cpp \
+    ../server/pcaptxthread.cpp
+
 QMAKE_DISTCLEAN += object_script.*
 
 include(../install.pri)